@@ -15,6 +15,7 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see www.gnu.org/licenses/.
 */
 
+#include <string.h>
 #include <board.h>
 #include <board_sw.h>
 #include <board_ps.h>
@@ -24,26 +25,201 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #include <drv_i2c_sfm3000.h>
 #include <drv_i2c_tca9548a.h>
 
-static const ms5525dso_qx_t common_ps_qx = MS5525DSO_QX_FOR_PP001DS();
+#if (BOARD_CIRCUITS > 2u)
+#error "At most two circuits are supported"
+#endif
 
-static sfm3000_settings_t fs_settings = {
-    .offset = SFM3000_GIVEN_OFFSET,
-    .scale_factor = SFM3000_GIVEN_SCALE_FACTOR_O2};
+// Circuits sharing a bus split its time, and the mux channels between them,
+// half of BOARD_DEV_BUDGET would not fit a pressure read
+#if (BOARD_CIRCUITS > 1u) && (HAL_I2C_CIRCUIT2_PORT == I2C_NUM_0)
+#define BOARD_CIRCUIT1_CHANNELS BOARD_SHARED_CIRCUIT1_CHANNELS
+#define BOARD_CIRCUIT2_CHANNELS BOARD_SHARED_CIRCUIT2_CHANNELS
+#define BOARD_CIRCUIT_BUDGET BOARD_SHARED_BUDGET
+#else
+#define BOARD_CIRCUIT1_CHANNELS 0xFFu
+#define BOARD_CIRCUIT2_CHANNELS 0xFFu
+#define BOARD_CIRCUIT_BUDGET BOARD_DEV_BUDGET
+#endif
+
+// Each read has to fit behind its mux select in one update, or the bus plan
+// refuses every layout that has the sensor
+#if ((BOARD_SW_COST + BOARD_PS_COST_READ) > BOARD_CIRCUIT_BUDGET) || \
+    ((BOARD_SW_COST + BOARD_FS_COST_READ_WORD) > BOARD_CIRCUIT_BUDGET)
+#error "A sensor read does not fit in BOARD_CIRCUIT_BUDGET"
+#endif
+
+static const board_config_t board_config[BOARD_CIRCUITS] = {
+    {.name = "BOARD1",
+     .ps1_name = "PS1",
+     .fs1_name = "FS1",
+     .sw_dev = HAL_I2C_DEV_SWITCH,
+     .ps1_dev = HAL_I2C_DEV_PS1,
+     .fs1_dev = HAL_I2C_DEV_FS1,
+     .reset_pin = HAL_GPIO_DRV_RSTn_PIN,
+     .channels = BOARD_CIRCUIT1_CHANNELS,
+     .layout_key = BOARD_LAYOUT_NVS_KEY,
+     .ps1_channel = BOARD_LAYOUT_DEFAULT_PS1_CHANNEL,
+     .fs1_channel = BOARD_LAYOUT_DEFAULT_FS1_CHANNEL,
+     .budget = BOARD_CIRCUIT_BUDGET},
+#if (BOARD_CIRCUITS > 1u)
+    // The one reset line belongs to circuit 1, on a shared bus it resets the
+    // switch under circuit 2 as well
+    {.name = "BOARD2",
+     .ps1_name = "PS2",
+     .fs1_name = "FS2",
+     .sw_dev = HAL_I2C_DEV_SWITCH2,
+     .ps1_dev = HAL_I2C_DEV_PS2,
+     .fs1_dev = HAL_I2C_DEV_FS2,
+     .reset_pin = BOARD_NO_RESET_PIN,
+     .channels = BOARD_CIRCUIT2_CHANNELS,
+     .layout_key = BOARD_LAYOUT_NVS_KEY2,
+     .ps1_channel = 5u,
+     .fs1_channel = 2u,
+     .budget = BOARD_CIRCUIT_BUDGET},
+#endif
+};
 
 static void update_state(board_t* board, board_state_t new_state);
+static void run_state(board_t* board);
+static void init_sensors(board_t* board);
+static board_dev_status_t update_sensors(board_t* board);
+static board_dev_status_t update_ps1(board_t* board);
+static board_dev_status_t update_fs1(board_t* board);
+static board_dev_status_t check_faults(const board_t* board);
+static void scan_bus(board_t* board);
+static board_dev_status_t plan_bus(board_t* board, uint8_t ps1, uint8_t fs1);
+static void publish(board_t* board);
+static const board_fs_backend_t* fs_backend(board_layout_type_t type);
+
+const board_config_t* board_get_config(uint32_t circuit) {
+  return (circuit < BOARD_CIRCUITS) ? &board_config[circuit] : NULL;
+}
+
+board_dev_status_t board_init(board_t* board, const board_config_t* config) {
+  board_dev_status_t retval;
 
-void board_init(board_t* board) {
   assert(board);
+  assert(config);
 
-  if (board != NULL) {
-    sw_init(&board->sw, HAL_I2C_DEV_SWITCH);
-    ps_init(&board->ps1, HAL_I2C_DEV_PS1, MS5525DSO_OSR256, &common_ps_qx);
-    fs_init(&board->fs1, HAL_I2C_DEV_FS1, &fs_settings);
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((board != NULL) && (config != NULL)) {
+    board->config = config;
+
+    // Health counters are only cleared here, they are kept across resets
+    board_dev_stats_init(&board->sw.stats, hal_get_timestamp());
+    board_dev_stats_init(&board->ps1.stats, hal_get_timestamp());
+    board_dev_stats_init(&board->fs1.stats, hal_get_timestamp());
+
+    // So are the sample histories, readers keep their place in them
+    board_hist_init(&board->ps1.hist, board->ps1.hist_buffer,
+                    BOARD_HIST_PS_LEN);
+    board_hist_init(&board->fs1.hist, board->fs1.hist_buffer,
+                    BOARD_HIST_FS_LEN);
+
+    // And the cached flow sensor, read from the flash before the bus is locked
+    fs_load_cal(&board->fs1, config->fs1_name);
+
+    // Which sensors this rig has, and how to run them, is read only once
+    if (board_layout_load(&board->layout, config->layout_key) ==
+        BOARD_DEV_READY) {
+      hal_log(HAL_LOG_INFO, config->name, "Layout from NVS");
+    } else {
+      board->layout.ps1.mux_channel = config->ps1_channel;
+      board->layout.fs1.mux_channel = config->fs1_channel;
+      hal_log(HAL_LOG_INFO, config->name, "Default layout");
+    }
+
+    // Sensors behind another circuit's channels are not this circuit's
+    if ((config->channels & (1u << board->layout.ps1.mux_channel)) == 0u) {
+      hal_log(HAL_LOG_WARN, config->ps1_name, "On a channel not owned");
+      board->layout.ps1.present = 0;
+    }
+    if ((config->channels & (1u << board->layout.fs1.mux_channel)) == 0u) {
+      hal_log(HAL_LOG_WARN, config->fs1_name, "On a channel not owned");
+      board->layout.fs1.present = 0;
+    }
+
+    // A layout the bus cannot carry even at the slowest rates is refused for
+    // the default one. If that does not fit either, no sensor is run
+    retval = plan_bus(board, board->layout.ps1.present,
+                      board->layout.fs1.present);
+    if (retval != BOARD_DEV_READY) {
+      hal_log(HAL_LOG_ERROR, config->name, "Layout overloads the bus, refused");
+      board_layout_default(&board->layout);
+      board->layout.ps1.mux_channel = config->ps1_channel;
+      board->layout.fs1.mux_channel = config->fs1_channel;
+      retval = plan_bus(board, board->layout.ps1.present,
+                        board->layout.fs1.present);
+    }
+    if (retval != BOARD_DEV_READY) {
+      hal_log(HAL_LOG_ERROR, config->name, "Default layout overloads the bus");
+      board->layout.ps1.present = 0;
+      board->layout.fs1.present = 0;
+    }
+
+    board_scan_init(&board->scan, BOARD_SCAN_SHARE);
+    board_volume_init(&board->fs1_volume);
+    init_sensors(board);
+    board->escalate_faults = BOARD_ESCALATE_FAULTS;
+    board->startup_time = 0;
+    board_dev_period_init(&board->period);
+    board_dev_budget_init(&board->budget, config->budget);
+    board->run_time = 0;
+    board->run_time_max = 0;
+    board->bus_busy = 0;
+    board->first = 0;
+    board_snapshot_init(&board->snapshot);
     update_state(board, BOARD_ST_HARD_RESET);
   }
+
+  return retval;
 }
 
 void board_update(board_t* board) {
+  hal_timestamp_t ts_start;
+
+  assert(board);
+
+  if (board != NULL) {
+    // Wake up jitter of the board task, the spread in these is the spread in
+    // sensor sample times
+    ts_start = hal_get_timestamp();
+    board_dev_period_update(&board->period, ts_start);
+
+    // Circuits on the same bus take turns a whole update at a time, they
+    // share the mux channel as well
+    if (hal_i2c_lock(hal_i2c_get_config(board->config->sw_dev)) == HAL_OK) {
+      // Time spent waiting on the other circuit is not this update's
+      ts_start = hal_get_timestamp();
+      board_dev_budget_start(&board->budget);
+      run_state(board);
+      hal_i2c_unlock(hal_i2c_get_config(board->config->sw_dev));
+
+      // Measured before publishing, so it goes out with this update
+      board->run_time = hal_get_timestamp() - ts_start;
+      if (board->run_time > board->run_time_max) {
+        board->run_time_max = board->run_time;
+      }
+    } else {
+      board->bus_busy++;
+    }
+
+    // Published in every state, so health counters stay visible while the
+    // board is recovering
+    publish(board);
+  }
+}
+
+void board_store_cal(board_t* board) {
+  assert(board);
+
+  if (board != NULL) {
+    fs_store_cal(&board->fs1);
+  }
+}
+
+static void run_state(board_t* board) {
   board_dev_status_t res;
 
   assert(board);
@@ -51,43 +227,52 @@ void board_update(board_t* board) {
   if (board != NULL) {
     switch (board->state) {
       case BOARD_ST_HARD_RESET:
-        hal_gpio_write(HAL_GPIO_DRV_RSTn_PIN, 0);
+        // A circuit without a reset line of its own just re-polls the switch
+        if (board->config->reset_pin != BOARD_NO_RESET_PIN) {
+          hal_gpio_write(board->config->reset_pin, 0);
+        }
         update_state(board, BOARD_ST_HARD_RESET_WAIT);
+        board->ts_hard_reset = board->ts_state;
         break;
 
       case BOARD_ST_HARD_RESET_WAIT:
         if (hal_get_timestamp() > (board->ts_state + BOARD_HARD_RESET_TIME)) {
-          hal_gpio_write(HAL_GPIO_DRV_RSTn_PIN, 1);
+          if (board->config->reset_pin != BOARD_NO_RESET_PIN) {
+            hal_gpio_write(board->config->reset_pin, 1);
+          }
+          sw_init(&board->sw, board->config->sw_dev);
+          update_state(board, BOARD_ST_HARD_RESET_POLL);
+        }
+        break;
+
+      case BOARD_ST_HARD_RESET_POLL:
+        // Move on as soon as the switch answers, rather than waiting out the
+        // worst case
+        if (sw_get_channel(&board->sw, &board->sw.last_channel) ==
+            BOARD_DEV_READY) {
           update_state(board, BOARD_ST_SOFT_RESET);
+        } else if (hal_get_timestamp() >
+                   (board->ts_state + BOARD_HARD_RESET_TIMEOUT)) {
+          update_state(board, BOARD_ST_HARD_RESET);
         }
         break;
 
       case BOARD_ST_SOFT_RESET:
         // (re)Initialize sensor controllers
-        sw_init(&board->sw, HAL_I2C_DEV_SWITCH);
-        ps_init(&board->ps1, HAL_I2C_DEV_PS1, MS5525DSO_OSR256, &common_ps_qx);
-        fs_init(&board->fs1, HAL_I2C_DEV_FS1, &fs_settings);
+        init_sensors(board);
         update_state(board, BOARD_ST_SOFT_RESET_WAIT);
         break;
 
       case BOARD_ST_SOFT_RESET_WAIT:
-        // Update the presssure sensor
-        res = sw_set_channel(&board->sw, HAL_I2C_SWITCH_CH_PS1);
-        if (res == BOARD_DEV_READY) {
-          res = ps_update(&board->ps1, &board->ps1_value);
-        }
-
-        // Update the flow sensor
-        if (res == BOARD_DEV_READY) {
-          res = sw_set_channel(&board->sw, HAL_I2C_SWITCH_CH_FS1);
-        }
-
-        if (res == BOARD_DEV_READY) {
-          res = fs_update(&board->fs1, &board->fs1_value);
-        }
+        // Bring up both sensors side by side, one being slow does not hold
+        // back the other
+        res = update_sensors(board);
 
         // Keep trying until both boards are ready, or we timeout and reset
         if (res == BOARD_DEV_READY) {
+          board->startup_time = hal_get_timestamp() - board->ts_hard_reset;
+          hal_log(HAL_LOG_INFO, board->config->name, "First samples after %lld us",
+                  board->startup_time);
           update_state(board, BOARD_ST_RUNNING);
         } else if (hal_get_timestamp() >
                    (board->ts_state + BOARD_SOFT_RESET_TIMEOUT)) {
@@ -98,22 +283,16 @@ void board_update(board_t* board) {
         break;
 
       case BOARD_ST_RUNNING:
-        // Update the pressure sensor
-        res = sw_set_channel(&board->sw, HAL_I2C_SWITCH_CH_PS1);
-        if (res == BOARD_DEV_READY) {
-          res = ps_update(&board->ps1, &board->ps1_value);
-        }
+        // Each sensor recovers from its own faults with a backoff, while the
+        // healthy ones keep streaming
+        update_sensors(board);
 
-        // Update the flow sensor
-        if (res == BOARD_DEV_READY) {
-          res = sw_set_channel(&board->sw, HAL_I2C_SWITCH_CH_FS1);
-        }
-        if (res == BOARD_DEV_READY) {
-          res = fs_update(&board->fs1, &board->fs1_value);
-        }
+        // Lowest priority, only runs on bus time the sensors left over
+        scan_bus(board);
 
-        // If either device errors, we are in trouble
-        if (res != BOARD_DEV_READY) {
+        // Only when a device keeps failing do we reset the whole board
+        if (check_faults(board) != BOARD_DEV_READY) {
+          hal_log(HAL_LOG_WARN, board->config->name, "Device faults, hard reset");
           update_state(board, BOARD_ST_HARD_RESET);
         }
         break;
@@ -126,6 +305,316 @@ void board_update(board_t* board) {
   }
 }
 
+static board_dev_status_t update_sensors(board_t* board) {
+  board_dev_status_t res;
+  uint32_t deferred;
+
+  assert(board);
+
+  res = BOARD_DEV_NOT_READY;
+
+  if (board != NULL) {
+    if (board->first == 0u) {
+      res = update_ps1(board);
+      deferred = board->budget.deferred;
+      if (update_fs1(board) != BOARD_DEV_READY) {
+        res = BOARD_DEV_NOT_READY;
+      }
+    } else {
+      res = update_fs1(board);
+      deferred = board->budget.deferred;
+      if (update_ps1(board) != BOARD_DEV_READY) {
+        res = BOARD_DEV_NOT_READY;
+      }
+    }
+
+    // A sensor left without budget goes first next update, so one that reads
+    // every update never starves the other. Back to the usual order after
+    if ((board->first == 0u) && (board->budget.deferred != deferred)) {
+      board->first = 1u;
+    } else {
+      board->first = 0u;
+    }
+  }
+
+  return res;
+}
+
+static board_dev_status_t update_ps1(board_t* board) {
+  board_dev_status_t res;
+
+  assert(board);
+
+  res = BOARD_DEV_NOT_READY;
+
+  if (board != NULL) {
+    // Skip the sensor entirely when the bus time is used up, it keeps its
+    // last status
+    res = board->ps1.status;
+    if (board->ps1_attached == 0u) {
+      // Not on the bus, never holds up the others
+      res = BOARD_DEV_READY;
+    } else if (board_dev_budget_select(&board->budget, BOARD_SW_COST) ==
+               BOARD_DEV_READY) {
+      res = sw_set_channel(&board->sw, 1u << board->layout.ps1.mux_channel);
+      if (res == BOARD_DEV_READY) {
+        res = ps_update(&board->ps1, &board->budget, &board->ps1_value);
+      }
+
+      // No longer answers its address, it was unplugged. Left to the scan to
+      // find again, rather than resetting the board over and over
+      if ((board->ps1.backoff.faults >= BOARD_DETACH_FAULTS) &&
+          (board->ps1.stats.last_fault == HAL_ERR_NACK)) {
+        hal_log(HAL_LOG_WARN, board->ps1.name, "Lost, dropped from schedule");
+        board->ps1_attached = 0u;
+        board_scan_forget(&board->scan, board->layout.ps1.mux_channel,
+                          hal_i2c_get_config(board->config->ps1_dev)->i2c_addr);
+        res = BOARD_DEV_READY;
+      }
+    }
+  }
+
+  return res;
+}
+
+static board_dev_status_t update_fs1(board_t* board) {
+  board_dev_status_t res;
+
+  assert(board);
+
+  res = BOARD_DEV_NOT_READY;
+
+  if (board != NULL) {
+    // Skip the sensor entirely when the bus time is used up, it keeps its
+    // last status
+    res = board->fs1.status;
+    if (board->fs1_attached == 0u) {
+      // Not on the bus, never holds up the others
+      res = BOARD_DEV_READY;
+    } else if (board_dev_budget_select(&board->budget, BOARD_SW_COST) ==
+               BOARD_DEV_READY) {
+      res = sw_set_channel(&board->sw, 1u << board->layout.fs1.mux_channel);
+      if (res == BOARD_DEV_READY) {
+        res = fs_update(&board->fs1, &board->budget, &board->fs1_value);
+      }
+      // Flow is only converted here outside raw mode
+      if ((res == BOARD_DEV_READY) && (board->fs1.raw == 0u)) {
+        board_volume_update(&board->fs1_volume, &board->fs1_value);
+      }
+
+      // No longer answers its address, it was unplugged. Left to the scan to
+      // find again, rather than resetting the board over and over
+      if ((board->fs1.backoff.faults >= BOARD_DETACH_FAULTS) &&
+          (board->fs1.stats.last_fault == HAL_ERR_NACK)) {
+        hal_log(HAL_LOG_WARN, board->fs1.name, "Lost, dropped from schedule");
+        board->fs1_attached = 0u;
+        board_scan_forget(&board->scan, board->layout.fs1.mux_channel,
+                          board->fs1.backend->i2c_addr);
+        res = BOARD_DEV_READY;
+      }
+    }
+  }
+
+  return res;
+}
+
+static board_dev_status_t check_faults(const board_t* board) {
+  board_dev_status_t retval;
+
+  assert(board);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if (board != NULL) {
+    // Sensors off the schedule keep their fault count, but no longer count
+    if ((board->sw.faults < board->escalate_faults) &&
+        ((board->ps1_attached == 0u) ||
+         (board->ps1.backoff.faults < board->escalate_faults)) &&
+        ((board->fs1_attached == 0u) ||
+         (board->fs1.backoff.faults < board->escalate_faults))) {
+      retval = BOARD_DEV_READY;
+    }
+  }
+
+  return retval;
+}
+
+static void scan_bus(board_t* board) {
+  uint8_t busy[BOARD_SCAN_CHANNELS];
+  hal_i2c_config_t cfg;
+  uint8_t ps1_addr;
+  uint8_t fs1_addr;
+  uint8_t channel;
+  uint8_t addr;
+  uint8_t replan;
+
+  assert(board);
+
+  if (board != NULL) {
+    replan = 0;
+    ps1_addr = hal_i2c_get_config(board->config->ps1_dev)->i2c_addr;
+    fs1_addr = fs_backend(board->layout.fs1.type)->i2c_addr;
+
+    // Running sensors show they are there with their own traffic, probing
+    // them too could upset a conversion in progress
+    // Nor are channels that belong to another circuit
+    for (uint8_t ch = 0; ch < BOARD_SCAN_CHANNELS; ch++) {
+      busy[ch] = ((board->config->channels & (1u << ch)) != 0u) ? 0u : 0xFFu;
+    }
+    if (board->ps1_attached != 0u) {
+      busy[board->layout.ps1.mux_channel] |= board_scan_addr_bit(ps1_addr);
+    }
+    if (board->fs1_attached != 0u) {
+      busy[board->layout.fs1.mux_channel] |= board_scan_addr_bit(fs1_addr);
+    }
+
+    if (board_scan_next(&board->scan, &board->budget, busy, &channel, &addr) ==
+        BOARD_DEV_READY) {
+      if (sw_set_channel(&board->sw, 1u << channel) == BOARD_DEV_READY) {
+        // Same port and timeout as the switch, only the address differs
+        cfg = *hal_i2c_get_config(board->sw.i2c_dev);
+        cfg.i2c_addr = addr;
+        board_scan_result(&board->scan, channel, addr, hal_i2c_probe(&cfg));
+      }
+    }
+
+    // Sensors the scan finds are brought up on whichever channel they are
+    // plugged into, the fitted channel first
+    if ((board->ps1_attached == 0u) &&
+        (board_scan_find(&board->scan, ps1_addr, board->layout.ps1.mux_channel,
+                         &channel) == BOARD_DEV_READY)) {
+      hal_log(HAL_LOG_INFO, board->config->ps1_name, "Found on channel %u",
+              channel);
+      board->layout.ps1.mux_channel = channel;
+      ps_init(&board->ps1, board->config->ps1_name, board->config->ps1_dev,
+              board->layout.ps1.osr, &board->layout.ps1.qx);
+      ps_set_raw(&board->ps1, BOARD_RAW_MODE);
+      board->ps1_attached = 1u;
+      replan = 1u;
+    }
+    if ((board->fs1_attached == 0u) &&
+        (board_scan_find(&board->scan, fs1_addr, board->layout.fs1.mux_channel,
+                         &channel) == BOARD_DEV_READY)) {
+      hal_log(HAL_LOG_INFO, board->config->fs1_name, "Found on channel %u",
+              channel);
+      board->layout.fs1.mux_channel = channel;
+      fs_init(&board->fs1, board->config->fs1_name, board->config->fs1_dev,
+              fs_backend(board->layout.fs1.type), &board->layout.fs1.settings);
+      fs_set_raw(&board->fs1, BOARD_RAW_MODE);
+      board->fs1_attached = 1u;
+      replan = 1u;
+    }
+
+    // A sensor the layout did not have adds to the load. It runs even if the
+    // bus is over budget, as slow as it goes
+    if (replan != 0u) {
+      plan_bus(board, board->ps1_attached, board->fs1_attached);
+      ps_set_rate_divisor(&board->ps1, board->bus_divisor);
+      fs_set_rate_divisor(&board->fs1, board->bus_divisor);
+    }
+  }
+}
+
+static board_dev_status_t plan_bus(board_t* board, uint8_t ps1, uint8_t fs1) {
+  board_bus_load_t load[2];
+  board_dev_status_t retval;
+  uint32_t count;
+  float used;
+
+  assert(board);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if (board != NULL) {
+    // In the order the board updates them
+    count = 0;
+    if (ps1 != 0u) {
+      board_bus_ps_load(&load[count], board->layout.ps1.osr,
+                        BOARD_PS_TEMP_DECIMATION);
+      count++;
+    }
+    if (fs1 != 0u) {
+      board_bus_fs_load(&load[count]);
+      count++;
+    }
+
+    retval = board_bus_admit(load, count, board->config->budget,
+                             BOARD_SCAN_SHARE, &board->bus_divisor);
+    used = board_bus_predict(load, count, BOARD_BUS_PERIOD,
+                             board->config->budget, board->bus_divisor,
+                             BOARD_SCAN_SHARE);
+    board->bus_load = (uint32_t)((used * 100.0f) + 0.5f);
+
+    if (board->bus_divisor > 1u) {
+      hal_log(HAL_LOG_WARN, board->config->name,
+              "Bus load %u%%, sample rates divided by %u", board->bus_load,
+              board->bus_divisor);
+    } else {
+      hal_log(HAL_LOG_INFO, board->config->name, "Bus load %u%%",
+              board->bus_load);
+    }
+  }
+
+  return retval;
+}
+
+static void publish(board_t* board) {
+  board_sample_t sample;
+
+  assert(board);
+
+  if (board != NULL) {
+    // Sensor values are only live while running
+    if (board->state == BOARD_ST_RUNNING) {
+      sample.ps1_status = board->ps1.status;
+      sample.fs1_status = board->fs1.status;
+    } else {
+      sample.ps1_status = BOARD_DEV_NOT_READY;
+      sample.fs1_status = BOARD_DEV_NOT_READY;
+    }
+    sample.ps1 = board->ps1_value;
+    sample.fs1 = board->fs1_value;
+    sample.sw_stats = board->sw.stats;
+    sample.ps1_stats = board->ps1.stats;
+    sample.fs1_stats = board->fs1.stats;
+    sample.period = board->period;
+    sample.budget = board->budget;
+    sample.run_time_max = board->run_time_max;
+    sample.scan = board->scan;
+    sample.bus_busy = board->bus_busy;
+    sample.bus_load = board->bus_load;
+    sample.bus_divisor = board->bus_divisor;
+    ps_get_info(&board->ps1, &sample.ps1_info);
+    fs_get_info(&board->fs1, &sample.fs1_info);
+    sample.fs1_settings = board->fs1.settings;
+    board_volume_get_breath(&board->fs1_volume, &sample.fs1_breath);
+    sample.fs1_volume = board_volume_get_volume(&board->fs1_volume);
+    sample.ps1_hist = &board->ps1.hist;
+    sample.fs1_hist = &board->fs1.hist;
+    board_snapshot_publish(&board->snapshot, &sample);
+  }
+}
+
+static void init_sensors(board_t* board) {
+  assert(board);
+
+  if (board != NULL) {
+    sw_init(&board->sw, board->config->sw_dev);
+    ps_init(&board->ps1, board->config->ps1_name, board->config->ps1_dev,
+            board->layout.ps1.osr, &board->layout.ps1.qx);
+    fs_init(&board->fs1, board->config->fs1_name, board->config->fs1_dev,
+            fs_backend(board->layout.fs1.type), &board->layout.fs1.settings);
+    ps_set_rate_divisor(&board->ps1, board->bus_divisor);
+    fs_set_rate_divisor(&board->fs1, board->bus_divisor);
+    ps_set_raw(&board->ps1, BOARD_RAW_MODE);
+    fs_set_raw(&board->fs1, BOARD_RAW_MODE);
+
+    // Every fitted sensor gets a chance to come up, missing ones drop out
+    board->ps1_attached = board->layout.ps1.present;
+    board->fs1_attached = board->layout.fs1.present;
+  }
+}
+
 static void update_state(board_t* board, board_state_t new_state) {
   assert(board);
 
@@ -134,3 +623,8 @@ static void update_state(board_t* board, board_state_t new_state) {
     board->ts_state = hal_get_timestamp();
   }
 }
+
+static const board_fs_backend_t* fs_backend(board_layout_type_t type) {
+  return (type == BOARD_LAYOUT_TYPE_SFM3019) ? &board_fs_sfm3019
+                                             : &board_fs_sfm3000;
+}
@@ -24,6 +24,11 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #include <board_sw.h>
 #include <board_ps.h>
 #include <board_fs.h>
+#include <board_volume.h>
+#include <board_snapshot.h>
+#include <board_layout.h>
+#include <board_scan.h>
+#include <board_bus.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,38 +40,130 @@ extern "C" {
  * @{
  */
 
-/** Wait in reset for 100ms */
-#define BOARD_HARD_RESET_TIME 500000
+/** Patient circuits run by this firmware image, each with its own sensors,
+ * board task and control loop. Override at build time for split ventilation
+ * stands */
+#ifndef BOARD_CIRCUITS
+#define BOARD_CIRCUITS 1u
+#endif
+
+/** Mux channels of each circuit when two share a bus */
+#define BOARD_SHARED_CIRCUIT1_CHANNELS 0xC3u
+#define BOARD_SHARED_CIRCUIT2_CHANNELS 0x3Cu
+
+/** Bus time of each circuit per update when two share a bus, in us. Each
+ * gets half the update period, board_bus_admit() keeps the load of either
+ * below BOARD_BUS_HEADROOM of it, which leaves the time to hand the bus over */
+#define BOARD_SHARED_BUDGET (BOARD_BUS_PERIOD / 2)
+
+/** Pressure sensor sample rate every circuit must sustain, in Hz */
+#ifndef BOARD_PS_RATE_TARGET
+#define BOARD_PS_RATE_TARGET 100.0f
+#endif
+
+/** Flow sensor sample rate every circuit must sustain, in Hz */
+#ifndef BOARD_FS_RATE_TARGET
+#define BOARD_FS_RATE_TARGET 500.0f
+#endif
+
+/** Set to leave pressure compensation and flow conversion to a host reading
+ * the raw stream, see serial_link_init() */
+#ifndef BOARD_RAW_MODE
+#define BOARD_RAW_MODE 0u
+#endif
+
+/** Circuit has no switch reset line of its own */
+#define BOARD_NO_RESET_PIN 0xFFFFFFFFu
+
+/** Hold the reset line for 1ms */
+#define BOARD_HARD_RESET_TIME 1000
+
+/** Wait for a maximum of 500ms for the i2c switch to come out of reset */
+#define BOARD_HARD_RESET_TIMEOUT 500000
 
 /** Wait for a maximum of 500ms for the i2c devices to reset */
 #define BOARD_SOFT_RESET_TIMEOUT 2000000
 
+/** Consecutive faults on a single device before the whole board is reset */
+#define BOARD_ESCALATE_FAULTS 8u
+
+/** Consecutive faults with no ACK before a sensor is taken as unplugged and
+ * dropped from the schedule, well before it would escalate */
+#define BOARD_DETACH_FAULTS 3u
+
 typedef enum board_state_t {
   BOARD_ST_HARD_RESET,
   BOARD_ST_HARD_RESET_WAIT,
+  BOARD_ST_HARD_RESET_POLL,
   BOARD_ST_SOFT_RESET,
   BOARD_ST_SOFT_RESET_WAIT,
   BOARD_ST_RUNNING,
 } board_state_t;
 
+/** @brief What sets one patient circuit apart from another
+ */
+typedef struct board_config_t {
+  const char* name;         //!< Log topic of the circuit
+  const char* ps1_name;     //!< Log topic of the pressure sensor
+  const char* fs1_name;     //!< Log topic of the flow sensor
+  hal_i2c_dev_t sw_dev;     //!< I2C switch in front of the sensors
+  hal_i2c_dev_t ps1_dev;    //!< Pressure sensor
+  hal_i2c_dev_t fs1_dev;    //!< Flow sensor
+  uint32_t reset_pin;       //!< Switch reset line, or BOARD_NO_RESET_PIN
+  uint8_t channels;         //!< Mux channels owned, one bit per channel
+  const char* layout_key;   //!< NVS key of the sensor layout
+  uint8_t ps1_channel;      //!< Pressure sensor mux channel without a layout
+  uint8_t fs1_channel;      //!< Flow sensor mux channel without a layout
+  hal_timestamp_t budget;   //!< Bus time allowed per board update, in us
+} board_config_t;
+
 typedef struct board_t {
+  const board_config_t* config;  //!< Which circuit this is
   board_state_t state;
+  board_layout_t layout;  //!< Sensors fitted on this rig
   board_dev_sw_t sw;
   board_dev_ps_t ps1;
   board_dev_fs_t fs1;
+  uint8_t ps1_attached;  //!< Pressure sensor is on the schedule
+  uint8_t fs1_attached;  //!< Flow sensor is on the schedule
+  uint8_t first;         //!< Flow sensor goes first next update if set
+  board_scan_t scan;     //!< Search for sensors plugged in or pulled out
   hal_timestamp_t ts_state;
+  hal_timestamp_t ts_hard_reset;  //!< Timestamp of the last hard reset
+  hal_timestamp_t startup_time;   //!< Time from hard reset to all sensors up
   ps_values_t ps1_value;
   fs_values_t fs1_value;
+  board_volume_t fs1_volume;  //!< Breaths seen by the flow sensor
+  uint32_t escalate_faults;  //!< Device faults tolerated before hard reset
+  board_snapshot_t snapshot;  //!< Latest samples, readable from other cores
+  board_dev_period_t period;  //!< Interval between board updates
+  board_dev_budget_t budget;  //!< Bus time allowed per board update
+  hal_timestamp_t run_time;      //!< Duration of the last board update
+  hal_timestamp_t run_time_max;  //!< Longest board update since init
+  uint32_t bus_busy;  //!< Updates skipped, another circuit held the bus
+  uint32_t bus_load;     //!< Predicted bus time in use, in percent
+  uint32_t bus_divisor;  //!< Sample rates are divided by this to fit the bus
 } board_t;
 
+/**
+ * @brief Get the configuration of a patient circuit
+ *
+ * @param circuit Index of the circuit, below BOARD_CIRCUITS
+ * @return const board_config_t* NULL if there is no such circuit
+ */
+const board_config_t* board_get_config(uint32_t circuit);
+
 /**
  * @brief Initialize board
  *
  * Attempt to initialize all the drivers, read coefficients, start timers etc.
  *
  * @param board
+ * @param config Circuit the board runs, see board_get_config()
+ * @return BOARD_DEV_NOT_READY if neither the stored layout nor the default
+ * fits on the bus, the board must not be updated
  */
-void board_init(board_t* board);
+board_dev_status_t board_init(board_t* board, const board_config_t* config);
 
 /**
  * @brief Update the board
@@ -77,6 +174,17 @@ void board_init(board_t* board);
  */
 void board_update(board_t* board);
 
+/**
+ * @brief Write the calibration of any newly found sensor to NVS
+ *
+ * From the board task after board_update(), never within it. The flash write
+ * blocks for tens of ms, with the bus free for the other circuit meanwhile.
+ * Rare, only when a different sensor has been fitted.
+ *
+ * @param board
+ */
+void board_store_cal(board_t* board);
+
 /** @} */
 
 #ifdef __cplusplus
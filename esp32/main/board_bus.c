@@ -0,0 +1,209 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <board_bus.h>
+
+static uint8_t take(hal_timestamp_t* used, uint8_t* stepped,
+                    hal_timestamp_t cost, hal_timestamp_t budget,
+                    uint8_t step);
+
+void board_bus_ps_load(board_bus_load_t* load, ms5525dso_osr_t osr,
+                       uint32_t decimation) {
+  assert(load);
+  assert(decimation > 0u);
+
+  if ((load != NULL) && (decimation > 0u)) {
+    // Each read starts the next conversion, a sample for every pressure and
+    // one temperature in between every decimation of them. Planned as if the
+    // conversion time had been learned as short as it goes
+    load->cost = BOARD_PS_COST_READ;
+    load->wait = ps_get_min_wait(osr);
+    load->reads = decimation + 1u;
+    load->samples = decimation;
+    load->rate = 0.0f;
+  }
+}
+
+void board_bus_fs_load(board_bus_load_t* load) {
+  assert(load);
+
+  if (load != NULL) {
+    load->cost = BOARD_FS_COST_READ_WORD;
+    load->wait = BOARD_FS_CONVERSION_TIME;
+    load->reads = 1;
+    load->samples = 1;
+    load->rate = 0.0f;
+  }
+}
+
+float board_bus_predict(board_bus_load_t* load, uint32_t count,
+                        hal_timestamp_t period, hal_timestamp_t budget,
+                        uint32_t divisor, uint32_t share) {
+  hal_timestamp_t ts_read[BOARD_BUS_MAX_LOADS];
+  uint32_t reads[BOARD_BUS_MAX_LOADS];
+  hal_timestamp_t ts;
+  hal_timestamp_t used;
+  hal_timestamp_t busy;
+  hal_timestamp_t span;
+  uint32_t first;
+  uint32_t next;
+  uint32_t n;
+  uint8_t deferred;
+  uint8_t stepped;
+
+  assert(load);
+  assert(count <= BOARD_BUS_MAX_LOADS);
+  assert(period > 0);
+
+  busy = 0;
+  span = (hal_timestamp_t)period * BOARD_BUS_MODEL_UPDATES;
+  first = 0;
+  deferred = 0;
+
+  if ((load != NULL) && (count <= BOARD_BUS_MAX_LOADS) && (period > 0)) {
+    for (n = 0; n < count; n++) {
+      // Every sensor reads on the first update
+      ts_read[n] = -(load[n].wait * divisor);
+      reads[n] = 0;
+    }
+
+    // Same order, waits and budget checks as the board and state machines,
+    // with the clock moving on by the bus time of each transaction
+    for (uint32_t u = 0; u < (2u * BOARD_BUS_MODEL_UPDATES); u++) {
+      ts = (hal_timestamp_t)period * u;
+      used = 0;
+      stepped = 0;
+
+      // A sensor left without budget goes first next update, then back to
+      // the usual order
+      next = 0;
+      for (uint32_t k = 0; k < count; k++) {
+        n = (first + k) % count;
+        if (take(&used, &stepped, BOARD_SW_COST, budget, 0u) == 0u) {
+          deferred = 1;
+        } else {
+          ts += BOARD_SW_COST;
+
+          if (ts >= (ts_read[n] + (load[n].wait * divisor))) {
+            if (take(&used, &stepped, load[n].cost, budget, 1u) == 0u) {
+              deferred = 1;
+            } else {
+              ts += load[n].cost;
+              ts_read[n] = ts;
+              if (u >= BOARD_BUS_MODEL_UPDATES) {
+                reads[n]++;
+              }
+            }
+          }
+        }
+
+        if ((deferred != 0u) && (next == 0u) && (k > 0u)) {
+          next = n;
+        }
+        deferred = 0;
+      }
+      first = next;
+
+      // The first half only settles the schedule
+      if (u >= BOARD_BUS_MODEL_UPDATES) {
+        busy += used;
+      }
+    }
+
+    for (n = 0; n < count; n++) {
+      load[n].rate = ((float)reads[n] * (float)load[n].samples * 1000000.0f) /
+                     ((float)span * (float)load[n].reads);
+    }
+  }
+
+  return ((float)busy / (float)span) + ((float)share / 100.0f);
+}
+
+board_dev_status_t board_bus_admit(board_bus_load_t* load, uint32_t count,
+                                   hal_timestamp_t budget, uint32_t share,
+                                   uint32_t* divisor) {
+  board_dev_status_t retval;
+  float limit;
+  float used;
+  uint8_t fit;
+
+  assert(load);
+  assert(divisor);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((load != NULL) && (divisor != NULL)) {
+    limit = ((float)budget * (float)BOARD_BUS_HEADROOM) /
+            ((float)BOARD_BUS_PERIOD * 100.0f);
+
+    // Fastest first, slower until the load fits and every sensor gets to read
+    *divisor = 0;
+    fit = 0;
+    while ((fit == 0u) && (*divisor < BOARD_BUS_MAX_DIVISOR)) {
+      (*divisor)++;
+      used = board_bus_predict(load, count, BOARD_BUS_PERIOD, budget, *divisor,
+                               share);
+      fit = (used <= limit) ? 1u : 0u;
+      for (uint32_t n = 0; n < count; n++) {
+        if (load[n].rate <= 0.0f) {
+          fit = 0;
+        }
+      }
+    }
+
+    if (fit != 0u) {
+      retval = BOARD_DEV_READY;
+    }
+
+    // Reads that do not fit together are pushed to later updates, but one
+    // that does not fit on its own would overrun every update it runs in
+    for (uint32_t n = 0; n < count; n++) {
+      if ((BOARD_SW_COST + load[n].cost) > budget) {
+        retval = BOARD_DEV_NOT_READY;
+      }
+    }
+  }
+
+  return retval;
+}
+
+static uint8_t take(hal_timestamp_t* used, uint8_t* stepped,
+                    hal_timestamp_t cost, hal_timestamp_t budget,
+                    uint8_t step) {
+  uint8_t retval;
+
+  // As board_dev_budget_select() and board_dev_budget_take(), the first
+  // device of an update always goes ahead, with its select and one step
+  retval = 0;
+  if (step == 0u) {
+    if ((*used == 0) || ((*used + cost) <= budget)) {
+      if (*used != 0) {
+        *stepped = 1u;
+      }
+      *used += cost;
+      retval = 1;
+    }
+  } else if ((*stepped == 0u) || ((*used + cost) <= budget)) {
+    *used += cost;
+    *stepped = 1u;
+    retval = 1;
+  }
+
+  return retval;
+}
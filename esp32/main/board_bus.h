@@ -0,0 +1,142 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#ifndef ESP32_MAIN_BOARD_BUS_H_
+#define ESP32_MAIN_BOARD_BUS_H_
+
+#include <stdint.h>
+#include <hal.h>
+#include <board_dev.h>
+#include <board_sw.h>
+#include <board_ps.h>
+#include <board_fs.h>
+#include <drv_i2c_ms5525dso.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup board_bus Board Bus Load
+ * @ingroup board
+ * @brief Predicted I2C bus occupancy of a sensor configuration
+ *
+ * Works out, before anything runs, how much of the bus a set of sensors will
+ * take. Each sensor is described by the bus time of one read and the wait
+ * its conversion needs before the next, taken from the same cost macros and
+ * conversion times the state machines use.
+ *
+ * The model is a dry run of the board updates. A read only happens on an
+ * update, once its wait is over and there is budget left, and every update
+ * pays to select each sensor's mux channel whether it reads or not. As on
+ * the board, a sensor left without budget goes first the next update only. So the
+ * rates that come out are the whole-update rates the board really runs at,
+ * not the conversion rates of the sensors.
+ *
+ * Configurations that would use more than BOARD_BUS_HEADROOM of the budget
+ * are slowed down, by giving each conversion a whole multiple of its
+ * conversion time, or refused when even that is not enough.
+ * @{
+ */
+
+/** Board update period the model assumes, in us, must match the board task */
+#ifndef BOARD_BUS_PERIOD
+#define BOARD_BUS_PERIOD 1000
+#endif
+
+/** Share of the update budget the sensors may use on average, in percent.
+ * The rest absorbs wake up jitter and reads pushed to the next update */
+#ifndef BOARD_BUS_HEADROOM
+#define BOARD_BUS_HEADROOM 90u
+#endif
+
+/** Slowest the sensors are run to fit a configuration on the bus */
+#define BOARD_BUS_MAX_DIVISOR 8u
+
+/** Board updates the model runs through, after as many again to settle */
+#define BOARD_BUS_MODEL_UPDATES 1000u
+
+/** Most sensors the model takes on one board */
+#define BOARD_BUS_MAX_LOADS 4u
+
+/** @brief Bus load of one sensor */
+typedef struct board_bus_load_t {
+  hal_timestamp_t cost;  //!< Bus time of one read, in us
+  hal_timestamp_t wait;  //!< Conversion time after a read, in us
+  uint32_t reads;        //!< Reads per cycle of the sensor
+  uint32_t samples;      //!< Samples per cycle of the sensor
+  float rate;            //!< Sample rate in Hz, filled in by the model
+} board_bus_load_t;
+
+/**
+ * @brief Describe a running pressure sensor
+ *
+ * @param load
+ * @param osr Oversampling ratio of its conversions
+ * @param decimation Pressure conversions per temperature conversion
+ */
+void board_bus_ps_load(board_bus_load_t* load, ms5525dso_osr_t osr,
+                       uint32_t decimation);
+
+/**
+ * @brief Describe a running flow sensor
+ *
+ * @param load
+ */
+void board_bus_fs_load(board_bus_load_t* load);
+
+/**
+ * @brief Predict the bus occupancy of sensors sharing board updates
+ *
+ * @param load Sensors, in the order they are updated. The rate of each is
+ * filled in
+ * @param count Number of sensors, at most BOARD_BUS_MAX_LOADS
+ * @param period Board update period, in us
+ * @param budget Bus time allowed per board update, in us
+ * @param divisor Each conversion is given this many times its wait
+ * @param share Bus time taken by background work, in percent
+ * @return float Share of bus time in use, from 0 to 1
+ */
+float board_bus_predict(board_bus_load_t* load, uint32_t count,
+                        hal_timestamp_t period, hal_timestamp_t budget,
+                        uint32_t divisor, uint32_t share);
+
+/**
+ * @brief Find the fastest rates sensors can run at within a budget
+ *
+ * @param load Sensors, in the order they are updated. The rate of each is
+ * filled in for the divisor found
+ * @param count Number of sensors, at most BOARD_BUS_MAX_LOADS
+ * @param budget Bus time allowed per board update, in us
+ * @param share Bus time taken by background work, in percent
+ * @param divisor Filled in with the smallest divisor that fits, or
+ * BOARD_BUS_MAX_DIVISOR if none does
+ * @return BOARD_DEV_READY if the sensors fit, BOARD_DEV_NOT_READY if the
+ * configuration must be refused, because a sensor cannot read within the
+ * budget at all or the bus is overloaded even at the slowest rates
+ */
+board_dev_status_t board_bus_admit(board_bus_load_t* load, uint32_t count,
+                                   hal_timestamp_t budget, uint32_t share,
+                                   uint32_t* divisor);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ESP32_MAIN_BOARD_BUS_H_
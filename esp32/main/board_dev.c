@@ -0,0 +1,323 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <assert.h>
+#include <hal.h>
+#include <board_dev.h>
+
+static void roll_window(board_dev_stats_t* stats, hal_timestamp_t ts);
+
+void board_dev_backoff_init(board_dev_backoff_t* backoff) {
+  assert(backoff);
+
+  if (backoff != NULL) {
+    backoff->delay = BOARD_DEV_BACKOFF_MIN;
+    backoff->ts_retry = 0;
+    backoff->faults = 0;
+  }
+}
+
+void board_dev_backoff_fault(board_dev_backoff_t* backoff) {
+  assert(backoff);
+
+  if (backoff != NULL) {
+    backoff->ts_retry = hal_get_timestamp() + backoff->delay;
+    backoff->faults++;
+
+    // Double the delay for the next fault, saturating at the maximum
+    if (backoff->delay < (BOARD_DEV_BACKOFF_MAX / 2)) {
+      backoff->delay *= 2;
+    } else {
+      backoff->delay = BOARD_DEV_BACKOFF_MAX;
+    }
+  }
+}
+
+void board_dev_backoff_ready(board_dev_backoff_t* backoff) {
+  assert(backoff);
+
+  if (backoff != NULL) {
+    backoff->delay = BOARD_DEV_BACKOFF_MIN;
+    backoff->faults = 0;
+  }
+}
+
+board_dev_status_t board_dev_backoff_expired(const board_dev_backoff_t* backoff) {
+  board_dev_status_t retval;
+
+  assert(backoff);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if (backoff != NULL) {
+    if (hal_get_timestamp() >= backoff->ts_retry) {
+      retval = BOARD_DEV_READY;
+    }
+  }
+
+  return retval;
+}
+
+void board_dev_stats_init(board_dev_stats_t* stats, hal_timestamp_t ts) {
+  assert(stats);
+
+  if (stats != NULL) {
+    stats->samples = 0;
+    stats->crc_failures = 0;
+    stats->nacks = 0;
+    stats->errors = 0;
+    stats->resets = 0;
+    stats->window_samples = 0;
+    stats->status = BOARD_DEV_NOT_READY;
+    stats->last_fault = HAL_OK;
+    stats->rate = 0.0f;
+    stats->ts_window = ts;
+    stats->ts_not_ready = ts;
+    stats->not_ready_time = 0;
+  }
+}
+
+void board_dev_stats_sample(board_dev_stats_t* stats, hal_timestamp_t ts) {
+  assert(stats);
+
+  if (stats != NULL) {
+    if (stats->status != BOARD_DEV_READY) {
+      stats->not_ready_time += ts - stats->ts_not_ready;
+      stats->status = BOARD_DEV_READY;
+    }
+    stats->samples++;
+    stats->window_samples++;
+    roll_window(stats, ts);
+  }
+}
+
+void board_dev_stats_fault(board_dev_stats_t* stats, hal_timestamp_t ts,
+                           hal_err_t res) {
+  assert(stats);
+
+  if (stats != NULL) {
+    switch (res) {
+      case HAL_ERR_CRC:
+        stats->crc_failures++;
+        break;
+      case HAL_ERR_NACK:
+        stats->nacks++;
+        break;
+      default:
+        stats->errors++;
+        break;
+    }
+    stats->last_fault = res;
+    stats->resets++;
+    board_dev_stats_not_ready(stats, ts);
+    roll_window(stats, ts);
+  }
+}
+
+void board_dev_stats_not_ready(board_dev_stats_t* stats, hal_timestamp_t ts) {
+  assert(stats);
+
+  if (stats != NULL) {
+    if (stats->status == BOARD_DEV_READY) {
+      stats->ts_not_ready = ts;
+      stats->status = BOARD_DEV_NOT_READY;
+    }
+  }
+}
+
+hal_timestamp_t board_dev_stats_not_ready_time(const board_dev_stats_t* stats,
+                                               hal_timestamp_t ts) {
+  hal_timestamp_t retval;
+
+  assert(stats);
+
+  retval = 0;
+
+  if (stats != NULL) {
+    retval = stats->not_ready_time;
+    if (stats->status != BOARD_DEV_READY) {
+      retval += ts - stats->ts_not_ready;
+    }
+  }
+
+  return retval;
+}
+
+float board_dev_stats_rate(const board_dev_stats_t* stats, hal_timestamp_t ts) {
+  float retval;
+  hal_timestamp_t elapsed;
+
+  assert(stats);
+
+  retval = 0.0f;
+
+  if (stats != NULL) {
+    elapsed = ts - stats->ts_window;
+    if (elapsed < BOARD_DEV_STATS_WINDOW) {
+      retval = stats->rate;
+    } else {
+      retval = ((float)stats->window_samples * 1000000.0f) / (float)elapsed;
+    }
+  }
+
+  return retval;
+}
+
+static void roll_window(board_dev_stats_t* stats, hal_timestamp_t ts) {
+  hal_timestamp_t elapsed;
+
+  elapsed = ts - stats->ts_window;
+  if (elapsed >= BOARD_DEV_STATS_WINDOW) {
+    stats->rate = ((float)stats->window_samples * 1000000.0f) / (float)elapsed;
+    stats->window_samples = 0;
+    stats->ts_window = ts;
+  }
+}
+
+void board_dev_period_init(board_dev_period_t* period) {
+  assert(period);
+
+  if (period != NULL) {
+    period->ts_last = 0;
+    period->ts_window = 0;
+    period->window_min = 0;
+    period->window_max = 0;
+    period->window_sum = 0;
+    period->window_count = 0;
+    period->min = 0;
+    period->max = 0;
+    period->mean = 0;
+  }
+}
+
+void board_dev_period_update(board_dev_period_t* period, hal_timestamp_t ts) {
+  hal_timestamp_t interval;
+
+  assert(period);
+
+  if (period != NULL) {
+    if (period->ts_last == 0) {
+      // First event, nothing to measure against yet
+      period->ts_window = ts;
+    } else {
+      interval = ts - period->ts_last;
+      if ((period->window_count == 0) || (interval < period->window_min)) {
+        period->window_min = interval;
+      }
+      if ((period->window_count == 0) || (interval > period->window_max)) {
+        period->window_max = interval;
+      }
+      period->window_sum += interval;
+      period->window_count++;
+
+      if ((ts - period->ts_window) >= BOARD_DEV_STATS_WINDOW) {
+        period->min = period->window_min;
+        period->max = period->window_max;
+        period->mean = period->window_sum / period->window_count;
+        period->window_sum = 0;
+        period->window_count = 0;
+        period->ts_window = ts;
+      }
+    }
+    period->ts_last = ts;
+  }
+}
+
+void board_dev_budget_init(board_dev_budget_t* budget, hal_timestamp_t limit) {
+  assert(budget);
+
+  if (budget != NULL) {
+    budget->limit = limit;
+    budget->used = 0;
+    budget->deferred = 0;
+    budget->stepped = 0;
+  }
+}
+
+void board_dev_budget_start(board_dev_budget_t* budget) {
+  assert(budget);
+
+  if (budget != NULL) {
+    budget->used = 0;
+    budget->stepped = 0;
+  }
+}
+
+board_dev_status_t board_dev_budget_take(board_dev_budget_t* budget,
+                                         hal_timestamp_t cost) {
+  board_dev_status_t retval;
+
+  assert(budget);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if (budget != NULL) {
+    if ((budget->stepped == 0u) || ((budget->used + cost) <= budget->limit)) {
+      budget->used += cost;
+      budget->stepped = 1u;
+      retval = BOARD_DEV_READY;
+    } else {
+      budget->deferred++;
+    }
+  }
+
+  return retval;
+}
+
+board_dev_status_t board_dev_budget_select(board_dev_budget_t* budget,
+                                           hal_timestamp_t cost) {
+  board_dev_status_t retval;
+
+  assert(budget);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if (budget != NULL) {
+    // Goes ahead with the step after it, it does not count as one. Only the
+    // first device of an update gets to step over the allowance, a device
+    // selected after it has to fit, step or not
+    if ((budget->used == 0) || ((budget->used + cost) <= budget->limit)) {
+      if (budget->used != 0) {
+        budget->stepped = 1u;
+      }
+      budget->used += cost;
+      retval = BOARD_DEV_READY;
+    } else {
+      budget->deferred++;
+    }
+  }
+
+  return retval;
+}
+
+board_dev_status_t board_dev_budget_spare(board_dev_budget_t* budget,
+                                          hal_timestamp_t cost) {
+  board_dev_status_t retval;
+
+  assert(budget);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if (budget != NULL) {
+    if ((budget->used + cost) <= budget->limit) {
+      budget->used += cost;
+      retval = BOARD_DEV_READY;
+    }
+  }
+
+  return retval;
+}
@@ -18,9 +18,261 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #ifndef ESP32_MAIN_BOARD_DEV_H_
 #define ESP32_MAIN_BOARD_DEV_H_
 
+#include <stdint.h>
+#include <hal.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** First retry after a device fault happens after 10ms */
+#define BOARD_DEV_BACKOFF_MIN 10000
+
+/** Retry delay doubles on every consecutive fault, up to 1s */
+#define BOARD_DEV_BACKOFF_MAX 1000000
+
+/** Default bus time each board update may use, in us */
+#ifndef BOARD_DEV_BUDGET
+#define BOARD_DEV_BUDGET 750
+#endif
+
+/** NVS namespace of the calibration each sensor caches, keyed by its name */
+#define BOARD_DEV_CAL_NVS_NAMESPACE "cal"
+
+/** Sample rate is measured over 1s windows */
+#define BOARD_DEV_STATS_WINDOW 1000000
+
 typedef enum board_dev_status_t {
   BOARD_DEV_READY,
   BOARD_DEV_NOT_READY
 } board_dev_status_t;
 
+/**
+ * @brief Per-device recovery state
+ *
+ * Each device state machine recovers from its own faults. Consecutive faults
+ * push the next recovery attempt out exponentially, so a misbehaving device
+ * does not hog the bus while the healthy ones keep streaming.
+ */
+typedef struct board_dev_backoff_t {
+  hal_timestamp_t delay;     //!< Delay to apply before the next retry
+  hal_timestamp_t ts_retry;  //!< Earliest time the next retry may start
+  uint32_t faults;           //!< Consecutive faults since last good sample
+} board_dev_backoff_t;
+
+/**
+ * @brief Per-device health counters
+ *
+ * Kept across device and board resets, so a sensor that keeps degrading shows
+ * up here well before it escalates to a hard reset. Every update is O(1).
+ */
+typedef struct board_dev_stats_t {
+  uint32_t samples;                //!< Good samples produced
+  uint32_t crc_failures;           //!< Faults caused by a bad CRC
+  uint32_t nacks;                  //!< Faults caused by a missing ACK
+  uint32_t errors;                 //!< Faults caused by other bus errors
+  uint32_t resets;                 //!< Recoveries started after a fault
+  uint32_t window_samples;         //!< Samples in the current rate window
+  board_dev_status_t status;       //!< Status as of the last update
+  hal_err_t last_fault;            //!< Error behind the most recent fault
+  float rate;                      //!< Rate over the last full window, in Hz
+  hal_timestamp_t ts_window;       //!< Start of the current rate window
+  hal_timestamp_t ts_not_ready;    //!< Start of the current not ready period
+  hal_timestamp_t not_ready_time;  //!< Completed not ready periods, in us
+} board_dev_stats_t;
+
+/**
+ * @brief Spread of the interval between periodic events
+ *
+ * Min, max and mean interval over the last full window, peak to peak jitter
+ * is max - min. Every update is O(1).
+ */
+typedef struct board_dev_period_t {
+  hal_timestamp_t ts_last;     //!< Time of the previous event
+  hal_timestamp_t ts_window;   //!< Start of the current window
+  hal_timestamp_t window_min;  //!< Shortest interval in the current window
+  hal_timestamp_t window_max;  //!< Longest interval in the current window
+  hal_timestamp_t window_sum;  //!< Sum of intervals in the current window
+  uint32_t window_count;       //!< Intervals in the current window
+  hal_timestamp_t min;         //!< Shortest interval in the last full window
+  hal_timestamp_t max;         //!< Longest interval in the last full window
+  hal_timestamp_t mean;        //!< Mean interval in the last full window
+} board_dev_period_t;
+
+/**
+ * @brief Bus time allowance for one board update
+ *
+ * Devices take the estimated cost of a transaction before starting it, and
+ * defer it to a later update when it does not fit. The first device step of
+ * an update always fits, so a step that costs more than the whole allowance
+ * still makes progress. Selecting the mux channel in front of the first device
+ * does not use that up, see board_dev_budget_select().
+ */
+typedef struct board_dev_budget_t {
+  hal_timestamp_t limit;  //!< Allowance per update, in us
+  hal_timestamp_t used;   //!< Estimated bus time taken this update
+  uint32_t deferred;      //!< Transactions deferred, since init
+  uint8_t stepped;        //!< The first device has had its step this update
+} board_dev_budget_t;
+
+/**
+ * @brief Clear the recovery state, next fault retries after the minimum delay
+ *
+ * @param backoff
+ */
+void board_dev_backoff_init(board_dev_backoff_t* backoff);
+
+/**
+ * @brief Record a device fault and schedule the next retry
+ *
+ * @param backoff
+ */
+void board_dev_backoff_fault(board_dev_backoff_t* backoff);
+
+/**
+ * @brief Record a good sample, clears the consecutive fault count
+ *
+ * @param backoff
+ */
+void board_dev_backoff_ready(board_dev_backoff_t* backoff);
+
+/**
+ * @brief Check if a retry is allowed yet
+ *
+ * @param backoff
+ * @return BOARD_DEV_READY if the backoff delay has expired
+ */
+board_dev_status_t board_dev_backoff_expired(const board_dev_backoff_t* backoff);
+
+/**
+ * @brief Clear all counters, the device starts out not ready
+ *
+ * @param stats
+ * @param ts Current time
+ */
+void board_dev_stats_init(board_dev_stats_t* stats, hal_timestamp_t ts);
+
+/**
+ * @brief Record a good sample
+ *
+ * @param stats
+ * @param ts Current time
+ */
+void board_dev_stats_sample(board_dev_stats_t* stats, hal_timestamp_t ts);
+
+/**
+ * @brief Record a fault and the recovery it starts
+ *
+ * @param stats
+ * @param ts Current time
+ * @param res Error that caused the fault
+ */
+void board_dev_stats_fault(board_dev_stats_t* stats, hal_timestamp_t ts,
+                           hal_err_t res);
+
+/**
+ * @brief Record the device going not ready without a fault, e.g. reinit
+ *
+ * @param stats
+ * @param ts Current time
+ */
+void board_dev_stats_not_ready(board_dev_stats_t* stats, hal_timestamp_t ts);
+
+/**
+ * @brief Total time spent not ready, including a period still in progress
+ *
+ * @param stats
+ * @param ts Current time
+ * @return hal_timestamp_t Time in us
+ */
+hal_timestamp_t board_dev_stats_not_ready_time(const board_dev_stats_t* stats,
+                                               hal_timestamp_t ts);
+
+/**
+ * @brief Effective sample rate
+ *
+ * Rate over the last full window. If the current window has overrun because
+ * nothing was recorded, the rate over the overrun window instead, so a device
+ * that went quiet reads as slow rather than stale.
+ *
+ * @param stats
+ * @param ts Current time
+ * @return float Rate in Hz
+ */
+float board_dev_stats_rate(const board_dev_stats_t* stats, hal_timestamp_t ts);
+
+/**
+ * @brief Initialize the allowance
+ *
+ * @param budget
+ * @param limit Bus time each update may use, in us
+ */
+void board_dev_budget_init(board_dev_budget_t* budget, hal_timestamp_t limit);
+
+/**
+ * @brief Start a new update with the full allowance
+ *
+ * @param budget
+ */
+void board_dev_budget_start(board_dev_budget_t* budget);
+
+/**
+ * @brief Take bus time for a transaction
+ *
+ * @param budget
+ * @param cost Estimated bus time of the transaction, in us
+ * @return BOARD_DEV_READY if the transaction may go ahead now, otherwise it
+ * must be deferred to a later update
+ */
+board_dev_status_t board_dev_budget_take(board_dev_budget_t* budget,
+                                         hal_timestamp_t cost);
+
+/**
+ * @brief Take bus time for selecting the mux channel of a device
+ *
+ * The first select of an update always goes ahead, and is not a device step,
+ * so the step after it still goes ahead whatever it costs. Any later select
+ * has to fit, and ends that first step whether or not the device before it
+ * stepped, so an update overruns by no more than one device.
+ *
+ * @param budget
+ * @param cost Estimated bus time of the select, in us
+ * @return BOARD_DEV_READY if the select may go ahead now, otherwise it must
+ * be deferred to a later update
+ */
+board_dev_status_t board_dev_budget_select(board_dev_budget_t* budget,
+                                           hal_timestamp_t cost);
+
+/**
+ * @brief Take bus time for background work from what is left over
+ *
+ * Unlike board_dev_budget_take() it never overruns the allowance, and work
+ * that does not fit is not counted as deferred.
+ *
+ * @param budget
+ * @param cost Estimated bus time of the transaction, in us
+ * @return BOARD_DEV_READY if the transaction may go ahead now
+ */
+board_dev_status_t board_dev_budget_spare(board_dev_budget_t* budget,
+                                          hal_timestamp_t cost);
+
+/**
+ * @brief Clear the period measurement, the next event starts it
+ *
+ * @param period
+ */
+void board_dev_period_init(board_dev_period_t* period);
+
+/**
+ * @brief Record a periodic event
+ *
+ * @param period
+ * @param ts Time of the event
+ */
+void board_dev_period_update(board_dev_period_t* period, hal_timestamp_t ts);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif  // ESP32_MAIN_BOARD_DEV_H_
@@ -21,21 +21,39 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #include <drv_i2c_sfm3000.h>
 
 static void update_state(board_dev_fs_t* fs, flow_sensor_state_t new_state);
+static void fault(board_dev_fs_t* fs, hal_err_t res);
+static void save_cal(board_dev_fs_t* fs);
+static board_dev_status_t apply_settings(board_dev_fs_t* fs);
 
-void fs_init(board_dev_fs_t* fs, hal_i2c_dev_t i2c_dev,
+void fs_init(board_dev_fs_t* fs, const char* name, hal_i2c_dev_t i2c_dev,
+             const board_fs_backend_t* backend,
              const sfm3000_settings_t* settings) {
   assert(fs);
+  assert(name);
+  assert(backend);
   assert(settings);
 
-  if ((fs != NULL) || (settings != NULL)) {
+  if ((fs != NULL) && (name != NULL) && (backend != NULL) &&
+      (settings != NULL)) {
+    fs->name = name;
     fs->status = BOARD_DEV_NOT_READY;
     fs->i2c_dev = i2c_dev;
+    fs->backend = backend;
+    fs->i2c_cfg = *hal_i2c_get_config(i2c_dev);
+    fs->i2c_cfg.i2c_addr = backend->i2c_addr;
     fs->flow_raw = 0;
     fs->flow = 0.0f;
     fs->product = 0;
     fs->serial = 0;
-    fs->settings.offset = SFM3000_GIVEN_OFFSET;
-    fs->settings.scale_factor = SFM3000_GIVEN_SCALE_FACTOR_O2;
+    fs->startup_time = 0;
+    fs->conversion_time = BOARD_FS_CONVERSION_TIME;
+    fs->raw = 0;
+    fs->given = *settings;
+    apply_settings(fs);
+    board_dev_backoff_init(&fs->backoff);
+    board_dev_stats_not_ready(&fs->stats, hal_get_timestamp());
+    // The history outlives a reset, like the health counters
+    board_hist_break(&fs->hist);
     update_state(fs, FS_SENSOR_ST_RESET);
   }
 }
@@ -49,85 +67,248 @@ board_dev_status_t fs_set_settings(board_dev_fs_t* fs, const sfm3000_settings_t*
   retval = BOARD_DEV_NOT_READY;
 
   if ((fs != NULL) && (settings != NULL)) {
-    memcpy(&fs->settings, settings, sizeof(sfm3000_settings_t));
-    retval = fs->status;
+    memcpy(&fs->given, settings, sizeof(sfm3000_settings_t));
+    retval = apply_settings(fs);
+    if (retval == BOARD_DEV_READY) {
+      retval = fs->status;
+    }
   }
 
   return retval;
 }
 
-board_dev_status_t fs_update(board_dev_fs_t* fs, fs_values_t* values) {
+void fs_set_rate_divisor(board_dev_fs_t* fs, uint32_t divisor) {
+  assert(fs);
+
+  if ((fs != NULL) && (divisor > 0u)) {
+    fs->conversion_time = BOARD_FS_CONVERSION_TIME * divisor;
+  }
+}
+
+void fs_set_raw(board_dev_fs_t* fs, uint8_t raw) {
+  assert(fs);
+
+  if (fs != NULL) {
+    fs->raw = raw;
+  }
+}
+
+void fs_load_cal(board_dev_fs_t* fs, const char* name) {
+  size_t len;
+
+  assert(fs);
+  assert(name);
+
+  if ((fs != NULL) && (name != NULL)) {
+    len = sizeof(fs->cal);
+    fs->cal_valid =
+        ((hal_nvs_read_blob(BOARD_DEV_CAL_NVS_NAMESPACE, name, &fs->cal,
+                            &len) == HAL_OK) &&
+         (len == sizeof(fs->cal)))
+            ? 1u
+            : 0u;
+    fs->cal_dirty = 0;
+  }
+}
+
+void fs_store_cal(board_dev_fs_t* fs) {
+  assert(fs);
+
+  if ((fs != NULL) && (fs->cal_dirty != 0u)) {
+    // Once only, a failed write is not retried on every update. The cache in
+    // RAM still serves until the next power cycle
+    fs->cal_dirty = 0;
+    if (hal_nvs_write_blob(BOARD_DEV_CAL_NVS_NAMESPACE, fs->name, &fs->cal,
+                           sizeof(fs->cal)) != HAL_OK) {
+      hal_log(HAL_LOG_WARN, fs->name, "Calibration not cached");
+    }
+  }
+}
+
+board_dev_status_t fs_update(board_dev_fs_t* fs, board_dev_budget_t* budget,
+                             fs_values_t* values) {
   hal_err_t res;
   board_dev_status_t retval;
 
   assert(fs);
+  assert(budget);
 
   retval = BOARD_DEV_NOT_READY;
 
-  if ((fs != NULL) && (values != NULL)) {
+  if ((fs != NULL) && (budget != NULL) && (values != NULL)) {
     switch (fs->state) {
       case FS_SENSOR_ST_RESET:
         fs->status = BOARD_DEV_NOT_READY;
-        res = sfm3000_soft_reset(hal_i2c_get_config(fs->i2c_dev));
-        if (res == HAL_OK) {
-          update_state(fs, FS_SENSOR_ST_CONFIG);
+        // Hold off retrying a faulted sensor, the others keep running
+        if ((board_dev_backoff_expired(&fs->backoff) == BOARD_DEV_READY) &&
+            (board_dev_budget_take(budget, fs->backend->cost_reset) ==
+             BOARD_DEV_READY)) {
+          res = fs->backend->reset(&fs->i2c_cfg);
+          if (res == HAL_OK) {
+            fs->ts_reset = hal_get_timestamp();
+            update_state(fs, FS_SENSOR_ST_CONFIG);
+          } else {
+            fault(fs, res);
+          }
         }
         break;
 
       case FS_SENSOR_ST_CONFIG:
-        if (hal_get_timestamp() >= (fs->ts_state + BOARD_FS_RESET_TIME)) {
-          res = sfm3000_read_product(hal_i2c_get_config(fs->i2c_dev),
-                                     &fs->product);
+        // Poll until the sensor is out of reset, a cheap address ACK first
+        if ((hal_get_timestamp() >= (fs->ts_poll + BOARD_FS_POLL_TIME)) &&
+            (board_dev_budget_take(budget, BOARD_FS_COST_PROBE) ==
+             BOARD_DEV_READY)) {
+          fs->ts_poll = hal_get_timestamp();
+          res = hal_i2c_probe(&fs->i2c_cfg);
+          if (res == HAL_OK) {
+            fs->state = FS_SENSOR_ST_READ_SERIAL;
+          } else if (hal_get_timestamp() >=
+                     (fs->ts_state + BOARD_FS_RESET_TIME)) {
+            // Never came out of reset
+            fault(fs, res);
+          }
+        }
+        break;
 
+      case FS_SENSOR_ST_READ_SERIAL:
+        // Then a serial number that passes its CRC. The product number and
+        // calibration of the sensor cached are kept if it is the same one
+        if (board_dev_budget_take(budget, fs->backend->cost_identify) ==
+            BOARD_DEV_READY) {
+          res = fs->backend->identify(&fs->i2c_cfg, &fs->serial);
           if (res == HAL_OK) {
-            res = sfm3000_read_serial(hal_i2c_get_config(fs->i2c_dev),
-                                      &fs->serial);
+            apply_settings(fs);
           }
+          if ((res == HAL_OK) && (fs->cal_valid != 0u) &&
+              (fs->serial == fs->cal.serial)) {
+            fs->product = fs->cal.product;
+            hal_log(HAL_LOG_INFO, fs->name,
+                    "%s product 0x%.08X serial 0x%.08X", fs->backend->part,
+                    fs->product, fs->serial);
+            fs->state = FS_SENSOR_ST_START_FLOW;
+          } else if (res == HAL_OK) {
+            fs->state = FS_SENSOR_ST_READ_PRODUCT;
+          } else if (hal_get_timestamp() >=
+                     (fs->ts_state + BOARD_FS_RESET_TIME)) {
+            fault(fs, res);
+          } else {
+            fs->state = FS_SENSOR_ST_CONFIG;
+          }
+        }
+        break;
 
+      case FS_SENSOR_ST_READ_PRODUCT:
+        if (board_dev_budget_take(budget, fs->backend->cost_product) ==
+            BOARD_DEV_READY) {
+          res = fs->backend->read_product(&fs->i2c_cfg, &fs->product);
           if (res == HAL_OK) {
-            res = sfm3000_start_flow(hal_i2c_get_config(fs->i2c_dev));
+            hal_log(HAL_LOG_INFO, fs->name,
+                    "%s product 0x%.08X serial 0x%.08X", fs->backend->part,
+                    fs->product, fs->serial);
+            fs->state = FS_SENSOR_ST_READ_OFFSET;
+          } else {
+            fault(fs, res);
           }
+        }
+        break;
 
+      case FS_SENSOR_ST_READ_OFFSET:
+        // Read into the cache, which only becomes this sensor's once all of
+        // it has been read
+        if (board_dev_budget_take(budget, fs->backend->cost_offset) ==
+            BOARD_DEV_READY) {
+          fs->cal_valid = 0;
+          res = fs->backend->read_offset(&fs->i2c_cfg, &fs->cal.offset);
+          if (res == HAL_OK) {
+            fs->state = FS_SENSOR_ST_READ_SCALE;
+          } else {
+            fault(fs, res);
+          }
+        }
+        break;
+
+      case FS_SENSOR_ST_READ_SCALE:
+        if (board_dev_budget_take(budget, fs->backend->cost_scale) ==
+            BOARD_DEV_READY) {
+          res = fs->backend->read_scale_factor(&fs->i2c_cfg,
+                                               &fs->cal.scale_factor);
+          if (res == HAL_OK) {
+            hal_log(HAL_LOG_INFO, fs->name, "Offset %.0f scale factor %.1f",
+                    fs->cal.offset, fs->cal.scale_factor);
+            save_cal(fs);
+            apply_settings(fs);
+            fs->state = FS_SENSOR_ST_START_FLOW;
+          } else {
+            fault(fs, res);
+          }
+        }
+        break;
+
+      case FS_SENSOR_ST_START_FLOW:
+        if (board_dev_budget_take(budget, fs->backend->cost_start) ==
+            BOARD_DEV_READY) {
+          res = fs->backend->start(&fs->i2c_cfg);
           if (res == HAL_OK) {
-            hal_log(HAL_LOG_INFO, "FS1", "Product 0x%.08X", fs->product);
-            hal_log(HAL_LOG_INFO, "FS1", "Serial 0x%.08X", fs->serial);
             update_state(fs, FS_SENSOR_ST_DISCARD_FIRST_FLOW);
           } else {
-            update_state(fs, FS_SENSOR_ST_RESET);
+            fault(fs, res);
           }
         }
         break;
 
       case FS_SENSOR_ST_DISCARD_FIRST_FLOW:
-        // Has the previous conversion finished?
         // @NOTE: This is unexpected, and not in the datasheet, we must wait
         // significant time before the first flow reading, or all readings fail
-        if (hal_get_timestamp() >= (fs->ts_state + BOARD_FS_RESET_TIME)) {
-          // Don't check the result of the first flow reading, just move on to
-          // reading real flow values
-          sfm3000_read_flow(hal_i2c_get_config(fs->i2c_dev), &fs->flow_raw);
-          update_state(fs, FS_SENSOR_ST_READ_FLOW);
+        // Nothing is read until the part's start-up time has passed. After
+        // that the first measurement is still not valid, and the sensor does
+        // not answer with a good CRC until it is running. Poll until a reading
+        // passes its CRC, discard it, then read real flow
+        if ((hal_get_timestamp() >= (fs->ts_state + BOARD_FS_START_SETTLE)) &&
+            (hal_get_timestamp() >= (fs->ts_poll + BOARD_FS_POLL_TIME)) &&
+            (board_dev_budget_take(budget, fs->backend->cost_read) ==
+             BOARD_DEV_READY)) {
+          fs->ts_poll = hal_get_timestamp();
+          res = fs->backend->read(&fs->i2c_cfg, &fs->flow_raw);
+          if (res == HAL_OK) {
+            update_state(fs, FS_SENSOR_ST_READ_FLOW);
+          } else if (hal_get_timestamp() >=
+                     (fs->ts_state + BOARD_FS_START_TIME)) {
+            fault(fs, res);
+          }
         }
         break;
 
       case FS_SENSOR_ST_READ_FLOW:
         // Has the previous conversion finished?
-        if (hal_get_timestamp() >= (fs->ts_state + BOARD_FS_CONVERSION_TIME)) {
-          res =
-              sfm3000_read_flow(hal_i2c_get_config(fs->i2c_dev), &fs->flow_raw);
-          if (res == HAL_OK) {
-            res =
-                sfm3000_convert_to_slm(fs->flow_raw, &fs->settings, &fs->flow);
+        if ((hal_get_timestamp() >=
+             (fs->ts_state + fs->conversion_time)) &&
+            (board_dev_budget_take(budget, fs->backend->cost_read) ==
+             BOARD_DEV_READY)) {
+          // The conversion is the same prepared one for every part
+          res = fs->backend->read(&fs->i2c_cfg, &fs->flow_raw);
+          if ((res == HAL_OK) && (fs->raw == 0u)) {
+            res = sfm3000_convert(fs->flow_raw, &fs->conv, &fs->flow);
           }
 
           if (res == HAL_OK) {
+            if (fs->status != BOARD_DEV_READY) {
+              fs->startup_time = hal_get_timestamp() - fs->ts_reset;
+              hal_log(HAL_LOG_INFO, fs->name, "First sample after %lld us",
+                      fs->startup_time);
+            }
+            board_hist_push(&fs->hist, fs->ts_state, fs->flow_raw,
+                            (fs->status != BOARD_DEV_READY)
+                                ? BOARD_HIST_FLAG_GAP
+                                : 0u);
             // last conversion time is identical to current ts_state
             values->ts = fs->ts_state;
             values->flow = fs->flow;
             fs->status = BOARD_DEV_READY;
+            board_dev_backoff_ready(&fs->backoff);
+            board_dev_stats_sample(&fs->stats, hal_get_timestamp());
             update_state(fs, FS_SENSOR_ST_READ_FLOW);
           } else {
-            update_state(fs, FS_SENSOR_ST_RESET);
+            fault(fs, res);
           }
         }
         break;
@@ -156,11 +337,68 @@ fs_info_t* fs_get_info(board_dev_fs_t* fs, fs_info_t* info) {
   return info;
 }
 
+static void fault(board_dev_fs_t* fs, hal_err_t res) {
+  assert(fs);
+
+  if (fs != NULL) {
+    fs->status = BOARD_DEV_NOT_READY;
+    board_dev_backoff_fault(&fs->backoff);
+    board_dev_stats_fault(&fs->stats, hal_get_timestamp(), res);
+    update_state(fs, FS_SENSOR_ST_RESET);
+  }
+}
+
+static void save_cal(board_dev_fs_t* fs) {
+  assert(fs);
+
+  if (fs != NULL) {
+    // Only a new sensor gets here, so the flash is rarely written, and not
+    // from here as the bus is locked. Kept for the next reset regardless
+    fs->cal.product = fs->product;
+    fs->cal.serial = fs->serial;
+    fs->cal_valid = 1u;
+    fs->cal_dirty = 1u;
+  }
+}
+
+static board_dev_status_t apply_settings(board_dev_fs_t* fs) {
+  board_dev_status_t retval;
+
+  assert(fs);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if (fs != NULL) {
+    // The sensor's own calibration, once it is known to be this sensor's
+    fs->settings = fs->given;
+    if ((fs->cal_valid != 0u) && (fs->cal.serial == fs->serial)) {
+      fs->settings.offset = fs->cal.offset;
+      fs->settings.scale_factor =
+          fs->cal.scale_factor *
+          (fs->given.scale_factor / fs->backend->given_scale_factor_air);
+      if (sfm3000_prepare_conv(&fs->settings, &fs->conv) == HAL_OK) {
+        retval = BOARD_DEV_READY;
+      } else {
+        hal_log(HAL_LOG_WARN, fs->name, "Sensor calibration unusable");
+        fs->settings = fs->given;
+      }
+    }
+
+    if ((retval != BOARD_DEV_READY) &&
+        (sfm3000_prepare_conv(&fs->settings, &fs->conv) == HAL_OK)) {
+      retval = BOARD_DEV_READY;
+    }
+  }
+
+  return retval;
+}
+
 static void update_state(board_dev_fs_t* fs, flow_sensor_state_t new_state) {
   assert(fs);
 
   if (fs != NULL) {
     fs->state = new_state;
     fs->ts_state = hal_get_timestamp();
+    fs->ts_poll = fs->ts_state;
   }
 }
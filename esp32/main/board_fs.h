@@ -21,6 +21,8 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #include <stdint.h>
 #include <hal.h>
 #include <board_dev.h>
+#include <board_hist.h>
+#include <board_fs_backend.h>
 #include <drv_i2c_sfm3000.h>
 
 #ifdef __cplusplus
@@ -28,21 +30,42 @@ extern "C" {
 #endif
 
 /**
- * @defgroup board_fs Board SFM3000 Control
+ * @defgroup board_fs Board Flow Sensor Control
  * @ingroup board
  * @brief
  * @{
  */
 
-/** Wait for reset to clear for 200ms */
+/** Give up on the sensor if it has not come out of reset after 200ms */
 #define BOARD_FS_RESET_TIME 200000
 
+/** Read nothing for 100ms after starting flow, the SFM3000 start-up time */
+#define BOARD_FS_START_SETTLE (SFM3000_STARTUP_TIME_MS * 1000)
+
+/** Give up on the sensor if it has no valid first flow after 300ms */
+#define BOARD_FS_START_TIME (BOARD_FS_START_SETTLE + 200000)
+
+/** Poll for the sensor to come out of reset, or start flowing, every 1ms */
+#define BOARD_FS_POLL_TIME 1000
+
 /** Wait for 2ms for conversion */
 #define BOARD_FS_CONVERSION_TIME 1000
 
+/** Estimated bus time of each step, taken from the board update budget */
+#define BOARD_FS_COST_CMD HAL_I2C_XFER_TIME_US(2u)
+#define BOARD_FS_COST_PROBE HAL_I2C_XFER_TIME_US(0u)
+#define BOARD_FS_COST_READ_WORD HAL_I2C_XFER_TIME_US(3u)
+#define BOARD_FS_COST_READ_LONG (BOARD_FS_COST_CMD + HAL_I2C_XFER_TIME_US(6u))
+#define BOARD_FS_COST_READ_REG (BOARD_FS_COST_CMD + BOARD_FS_COST_READ_WORD)
+
 typedef enum flow_sensor_state_t {
   FS_SENSOR_ST_RESET,
   FS_SENSOR_ST_CONFIG,
+  FS_SENSOR_ST_READ_SERIAL,
+  FS_SENSOR_ST_READ_PRODUCT,
+  FS_SENSOR_ST_READ_OFFSET,
+  FS_SENSOR_ST_READ_SCALE,
+  FS_SENSOR_ST_START_FLOW,
   FS_SENSOR_ST_DISCARD_FIRST_FLOW,
   FS_SENSOR_ST_READ_FLOW,
 } flow_sensor_state_t;
@@ -57,44 +80,134 @@ typedef struct fs_info_t {
   uint32_t serial;
 } fs_info_t;
 
+/** @brief Identity and calibration of a sensor, as cached in NVS
+ */
+typedef struct fs_cal_t {
+  uint32_t product;
+  uint32_t serial;
+  float offset;        //!< As read from the sensor
+  float scale_factor;  //!< As read from the sensor, for Air
+} fs_cal_t;
+
 typedef struct board_dev_fs_t {
+  const char* name;       //!< Log topic
   hal_i2c_dev_t i2c_dev;  //!< I2C device to use
+  const board_fs_backend_t* backend;  //!< The part fitted
+  hal_i2c_config_t i2c_cfg;  //!< i2c_dev's, at the part's address
   board_dev_status_t status;
   hal_timestamp_t ts_state;
+  hal_timestamp_t ts_poll;       //!< Timestamp of the last readiness poll
+  hal_timestamp_t ts_reset;      //!< Timestamp of the last soft reset
+  hal_timestamp_t startup_time;  //!< Time from soft reset to first sample
+  hal_timestamp_t conversion_time;  //!< Wait for a measurement, in us
   flow_sensor_state_t state;
   uint32_t product;
   uint32_t serial;
   uint16_t flow_raw;
   float flow;
-  sfm3000_settings_t settings;
+  sfm3000_settings_t given;     //!< Asked for, the scale factor picks the gas
+  sfm3000_settings_t settings;  //!< In use, from the sensor once it is known
+  sfm3000_conv_t conv;          //!< Prepared from settings
+  fs_cal_t cal;       //!< Cached sensor, from NVS or the last full read
+  uint8_t cal_valid;  //!< cal holds a sensor
+  uint8_t cal_dirty;  //!< cal not yet written to NVS, see fs_store_cal()
+  board_dev_backoff_t backoff;  //!< Fault recovery state
+  board_dev_stats_t stats;      //!< Health counters, survive re-init
+  uint8_t raw;                  //!< Leave conversion to the host if set
+  board_hist_t hist;            //!< Recent raw flow samples
+  board_hist_sample_t hist_buffer[BOARD_HIST_FS_LEN];
 } board_dev_fs_t;
 
 /**
  * @brief
  *
+ * The product number, offset and scale factor are cached in NVS under the
+ * name, with the serial number they belong to, see fs_load_cal() and
+ * fs_store_cal(). After a reset only the serial number is read, the rest too
+ * if the sensor is a different one.
+ *
+ * The sensor's own offset is used, and its scale factor, which is for Air,
+ * adjusted for the gas the given scale factor is for. The given settings are
+ * used as they are until then, or if the sensor's are unusable.
+ *
+ * @param fs
+ * @param name Log topic, and NVS key, e.g. "FS1"
+ * @param i2c_dev Bus and timeout to use, the address is the part's own
+ * @param backend The part fitted, e.g. &board_fs_sfm3000
+ * @param settings Datasheet offset and scale factor for the gas
+ */
+void fs_init(board_dev_fs_t* fs, const char* name, hal_i2c_dev_t i2c_dev,
+             const board_fs_backend_t* backend,
+             const sfm3000_settings_t* settings);
+
+/**
+ * @brief Load the sensor cached in NVS
+ *
+ * Once, before the first fs_init(), and not with the bus locked, as it reads
+ * the flash. The cache is kept across fs_init() like the health counters.
+ *
+ * @param fs
+ * @param name NVS key, the name later given to fs_init()
+ */
+void fs_load_cal(board_dev_fs_t* fs, const char* name);
+
+/**
+ * @brief Write a newly read sensor to the NVS cache
+ *
+ * Between updates, not with the bus locked, as the flash write blocks for
+ * tens of ms. Does nothing unless fs_update() has read a different sensor
+ * since the last call.
+ *
  * @param fs
- * @param i2c_dev
- * @param settings
  */
-void fs_init(board_dev_fs_t* fs, hal_i2c_dev_t i2c_dev, const sfm3000_settings_t* settings);
+void fs_store_cal(board_dev_fs_t* fs);
 
 /**
  * @brief Update flow sensor state machine and get current value(s)
  *
  * @param fs
+ * @param budget Bus time left in this board update, steps that do not fit
+ * are deferred to a later update
  * @param values
  * @return board_dev_status_t
  */
-board_dev_status_t fs_update(board_dev_fs_t* fs, fs_values_t* values);
+board_dev_status_t fs_update(board_dev_fs_t* fs, board_dev_budget_t* budget,
+                             fs_values_t* values);
 
 /**
  * @brief Set flow sensor settings
  *
+ * As for fs_init(). The conversion constants are worked out here, not on
+ * every sample.
+ *
  * @param fs
  * @param settings
+ * @return BOARD_DEV_NOT_READY if the settings cannot be used
  */
 board_dev_status_t fs_set_settings(board_dev_fs_t* fs, const sfm3000_settings_t* settings);
 
+/**
+ * @brief Slow the sample rate down, to keep the bus load in bounds
+ *
+ * Each measurement is given divisor times the time it needs. Cleared by
+ * fs_init().
+ *
+ * @param fs
+ * @param divisor 1 for the fastest rate
+ */
+void fs_set_rate_divisor(board_dev_fs_t* fs, uint32_t divisor);
+
+/**
+ * @brief Leave conversion to the host
+ *
+ * Raw readings are only kept in the history, for streaming, and the flow
+ * value is not updated. Cleared by fs_init().
+ *
+ * @param fs
+ * @param raw Set to skip conversion
+ */
+void fs_set_raw(board_dev_fs_t* fs, uint8_t raw);
+
 /**
  * @brief Get Flow sensor information
  *
@@ -0,0 +1,168 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <board_fs.h>
+#include <board_fs_backend.h>
+#include <drv_i2c_sfm3000.h>
+#include <drv_i2c_sfm3019.h>
+
+/** A command with an argument word, and reads of whole words */
+#define COST_CMD_ARG HAL_I2C_XFER_TIME_US(5u)
+#define COST_READ_WORDS(n) HAL_I2C_XFER_TIME_US(3u * (n))
+
+static hal_err_t sfm3019_identify(const hal_i2c_config_t* cfg,
+                                  uint32_t* serial);
+static hal_err_t sfm3019_read_product(const hal_i2c_config_t* cfg,
+                                      uint32_t* product);
+static hal_err_t sfm3019_read_offset(const hal_i2c_config_t* cfg,
+                                     float* offset);
+static hal_err_t sfm3019_read_scale_factor(const hal_i2c_config_t* cfg,
+                                           float* scale_factor);
+static hal_err_t sfm3019_start(const hal_i2c_config_t* cfg);
+
+// The driver calls are used as they are wherever they fit, so the table adds
+// nothing to them
+const board_fs_backend_t board_fs_sfm3000 = {
+    .part = "SFM3000",
+    .i2c_addr = SFM3000_I2C_ADDR,
+    .given_scale_factor_air = SFM3000_GIVEN_SCALE_FACTOR_AIR_N2,
+    .cost_reset = BOARD_FS_COST_CMD,
+    .cost_identify = BOARD_FS_COST_READ_LONG,
+    .cost_product = BOARD_FS_COST_READ_LONG,
+    .cost_offset = BOARD_FS_COST_READ_REG,
+    .cost_scale = BOARD_FS_COST_READ_REG,
+    .cost_start = BOARD_FS_COST_CMD,
+    .cost_read = BOARD_FS_COST_READ_WORD,
+    .reset = sfm3000_soft_reset,
+    .identify = sfm3000_read_serial,
+    .read_product = sfm3000_read_product,
+    .read_offset = sfm3000_read_offset,
+    .read_scale_factor = sfm3000_read_scale_factor,
+    .start = sfm3000_start_flow,
+    .read = sfm3000_read_flow,
+};
+
+// Its soft reset is an I2C general call, which would reset every device on
+// the channel, stopping measurement is enough to start over
+const board_fs_backend_t board_fs_sfm3019 = {
+    .part = "SFM3019",
+    .i2c_addr = SFM3019_I2C_ADDR,
+    .given_scale_factor_air = SFM3019_GIVEN_SCALE_FACTOR,
+    .cost_reset = BOARD_FS_COST_CMD,
+    .cost_identify = BOARD_FS_COST_CMD + COST_READ_WORDS(6u),
+    .cost_product = BOARD_FS_COST_CMD + COST_READ_WORDS(6u),
+    .cost_offset = COST_CMD_ARG + COST_READ_WORDS(3u),
+    .cost_scale = COST_CMD_ARG + COST_READ_WORDS(3u),
+    .cost_start = 2 * COST_CMD_ARG,
+    .cost_read = BOARD_FS_COST_READ_WORD,
+    .reset = sfm3019_stop_cont_meas,
+    .identify = sfm3019_identify,
+    .read_product = sfm3019_read_product,
+    .read_offset = sfm3019_read_offset,
+    .read_scale_factor = sfm3019_read_scale_factor,
+    .start = sfm3019_start,
+    .read = sfm3019_read_flow,
+};
+
+static hal_err_t sfm3019_identify(const hal_i2c_config_t* cfg,
+                                  uint32_t* serial) {
+  hal_err_t res;
+  uint32_t product;
+  uint64_t serial64;
+
+  assert(serial);
+
+  res = HAL_ERR_FAIL;
+
+  if (serial != NULL) {
+    res = sfm3019_read_product_ident(cfg, &product, &serial64);
+    if (res == HAL_OK) {
+      *serial = (uint32_t)(serial64 ^ (serial64 >> 32));
+    }
+  }
+
+  return res;
+}
+
+static hal_err_t sfm3019_read_product(const hal_i2c_config_t* cfg,
+                                      uint32_t* product) {
+  uint64_t serial64;
+
+  return sfm3019_read_product_ident(cfg, product, &serial64);
+}
+
+// Both come from the one settings read, which is repeated rather than hold
+// an update for both. Only a new sensor is read
+static hal_err_t sfm3019_read_offset(const hal_i2c_config_t* cfg,
+                                     float* offset) {
+  hal_err_t res;
+  int16_t scale_factor16;
+  int16_t offset16;
+  uint16_t flow_unit;
+
+  assert(offset);
+
+  res = HAL_ERR_FAIL;
+
+  if (offset != NULL) {
+    res = sfm3019_read_settings(cfg, SFM3019_GAS_AIR, &scale_factor16,
+                                &offset16, &flow_unit);
+    if (res == HAL_OK) {
+      // Biased like the readings
+      *offset = (float)((int32_t)offset16 + SFM3019_FLOW_BIAS);
+    }
+  }
+
+  return res;
+}
+
+static hal_err_t sfm3019_read_scale_factor(const hal_i2c_config_t* cfg,
+                                           float* scale_factor) {
+  hal_err_t res;
+  int16_t scale_factor16;
+  int16_t offset16;
+  uint16_t flow_unit;
+
+  assert(scale_factor);
+
+  res = HAL_ERR_FAIL;
+
+  if (scale_factor != NULL) {
+    res = sfm3019_read_settings(cfg, SFM3019_GAS_AIR, &scale_factor16,
+                                &offset16, &flow_unit);
+    if (res == HAL_OK) {
+      *scale_factor = (float)scale_factor16;
+    }
+  }
+
+  return res;
+}
+
+static hal_err_t sfm3019_start(const hal_i2c_config_t* cfg) {
+  hal_err_t res;
+
+  // Averaging until read gives every conversion in between to each sample,
+  // however much the rate is divided down
+  res = sfm3019_configure_avg(cfg, 0);
+  if (res == HAL_OK) {
+    res = sfm3019_start_cont_meas(cfg, SFM3019_GAS_AIR, 0);
+  }
+
+  return res;
+}
@@ -0,0 +1,90 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#ifndef ESP32_MAIN_BOARD_FS_BACKEND_H_
+#define ESP32_MAIN_BOARD_FS_BACKEND_H_
+
+#include <stdint.h>
+#include <hal.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup board_fs_backend Board Flow Sensor Parts
+ * @ingroup board_fs
+ * @brief The flow sensor parts board_fs can drive
+ *
+ * Each part is a constant table of the steps board_fs takes it through, and
+ * the bus time each of them takes. Every part gives its flow as an unsigned
+ * raw reading, with an offset and scale factor that turn it into slm, so the
+ * conversion is the same prepared one for all of them.
+ * @{
+ */
+
+/** @brief Steps to bring up and run one flow sensor part
+ */
+typedef struct board_fs_backend_t {
+  const char* part;  //!< Part number, for the log
+  uint8_t i2c_addr;  //!< Fixed I2C address of the part
+  float given_scale_factor_air;  //!< Datasheet scale factor for Air
+
+  hal_timestamp_t cost_reset;     //!< Bus time of reset
+  hal_timestamp_t cost_identify;  //!< Bus time of identify
+  hal_timestamp_t cost_product;   //!< Bus time of read_product
+  hal_timestamp_t cost_offset;    //!< Bus time of read_offset
+  hal_timestamp_t cost_scale;     //!< Bus time of read_scale_factor
+  hal_timestamp_t cost_start;     //!< Bus time of start
+  hal_timestamp_t cost_read;      //!< Bus time of read
+
+  /** Stop whatever the sensor is doing, it answers again once ready */
+  hal_err_t (*reset)(const hal_i2c_config_t* cfg);
+
+  /** Read the serial number, folded to 32 bits if it is longer */
+  hal_err_t (*identify)(const hal_i2c_config_t* cfg, uint32_t* serial);
+
+  /** Read the product number */
+  hal_err_t (*read_product)(const hal_i2c_config_t* cfg, uint32_t* product);
+
+  /** Read the sensor's own offset, each step fits one board update */
+  hal_err_t (*read_offset)(const hal_i2c_config_t* cfg, float* offset);
+
+  /** Read the sensor's own scale factor for Air */
+  hal_err_t (*read_scale_factor)(const hal_i2c_config_t* cfg,
+                                 float* scale_factor);
+
+  /** Start continuous measurement, the first reading is discarded */
+  hal_err_t (*start)(const hal_i2c_config_t* cfg);
+
+  /** Read the latest measurement */
+  hal_err_t (*read)(const hal_i2c_config_t* cfg, uint16_t* flow_raw);
+} board_fs_backend_t;
+
+/** Sensirion SFM3000 */
+extern const board_fs_backend_t board_fs_sfm3000;
+
+/** Sensirion SFM3019, measuring Air and averaging until each read */
+extern const board_fs_backend_t board_fs_sfm3019;
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ESP32_MAIN_BOARD_FS_BACKEND_H_
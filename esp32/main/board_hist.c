@@ -0,0 +1,193 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <board_hist.h>
+
+static void fill_span(const board_hist_t* hist, uint32_t start, uint32_t count,
+                      board_hist_span_t* span);
+
+board_dev_status_t board_hist_init(board_hist_t* hist,
+                                   board_hist_sample_t* buffer, uint32_t len) {
+  board_dev_status_t retval;
+
+  assert(hist);
+  assert(buffer);
+  assert((len >= 2u) && ((len & (len - 1u)) == 0u));
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((hist != NULL) && (buffer != NULL) && (len >= 2u) &&
+      ((len & (len - 1u)) == 0u)) {
+    hist->buffer = buffer;
+    hist->mask = len - 1u;
+    hist->ts_last = 0;
+    hist->gap = 1u;
+    __atomic_store_n(&hist->head, 0u, __ATOMIC_RELEASE);
+    retval = BOARD_DEV_READY;
+  }
+
+  return retval;
+}
+
+void board_hist_break(board_hist_t* hist) {
+  assert(hist);
+
+  if (hist != NULL) {
+    hist->gap = 1u;
+  }
+}
+
+void board_hist_push(board_hist_t* hist, hal_timestamp_t ts, uint32_t raw,
+                     uint16_t flags) {
+  board_hist_sample_t* sample;
+  hal_timestamp_t dt;
+  uint32_t head;
+
+  assert(hist);
+
+  if ((hist != NULL) && (hist->buffer != NULL)) {
+    head = hist->head;
+    dt = ts - hist->ts_last;
+
+    // A time step that does not fit breaks the chain of deltas
+    if ((hist->gap != 0u) || (dt < 0) || (dt > BOARD_HIST_DT_MAX)) {
+      dt = 0;
+      flags |= BOARD_HIST_FLAG_GAP;
+    }
+    hist->gap = 0;
+
+    sample = &hist->buffer[head & hist->mask];
+    sample->raw = raw;
+    sample->dt = (uint16_t)dt;
+    sample->flags = flags;
+    hist->ts_last = ts;
+
+    // Publish the sample to readers only once it is completely written
+    __atomic_store_n(&hist->head, head + 1u, __ATOMIC_RELEASE);
+  }
+}
+
+uint32_t board_hist_head(const board_hist_t* hist) {
+  uint32_t head;
+
+  assert(hist);
+
+  head = 0;
+
+  if (hist != NULL) {
+    head = __atomic_load_n(&hist->head, __ATOMIC_ACQUIRE);
+  }
+
+  return head;
+}
+
+board_dev_status_t board_hist_get_latest(const board_hist_t* hist,
+                                         uint32_t count,
+                                         board_hist_span_t* span) {
+  board_dev_status_t retval;
+  uint32_t head;
+
+  assert(hist);
+  assert(span);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((hist != NULL) && (span != NULL) && (hist->buffer != NULL)) {
+    head = __atomic_load_n(&hist->head, __ATOMIC_ACQUIRE);
+
+    // One slot always belongs to the writer, so views hold at most len - 1
+    if (count > hist->mask) {
+      count = hist->mask;
+    }
+    if (count > head) {
+      count = head;
+    }
+
+    fill_span(hist, head - count, count, span);
+    retval = BOARD_DEV_READY;
+  }
+
+  return retval;
+}
+
+board_dev_status_t board_hist_get_since(const board_hist_t* hist, uint32_t pos,
+                                        board_hist_span_t* span) {
+  board_dev_status_t retval;
+  uint32_t head;
+  uint32_t count;
+
+  assert(hist);
+  assert(span);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((hist != NULL) && (span != NULL) && (hist->buffer != NULL)) {
+    head = __atomic_load_n(&hist->head, __ATOMIC_ACQUIRE);
+
+    // Positions wrap, so a position ahead of head also shows up as too many
+    count = head - pos;
+    if (count <= hist->mask) {
+      fill_span(hist, pos, count, span);
+      retval = BOARD_DEV_READY;
+    }
+  }
+
+  return retval;
+}
+
+board_dev_status_t board_hist_check(const board_hist_t* hist,
+                                    const board_hist_span_t* span) {
+  board_dev_status_t retval;
+  uint32_t head;
+
+  assert(hist);
+  assert(span);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((hist != NULL) && (span != NULL)) {
+    // Keep the reader's sample loads ahead of the head load
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&hist->head, __ATOMIC_RELAXED);
+
+    // The writer may be part way through the slot at head, which is the
+    // oldest one once the ring is full
+    if ((head - span->start) <= hist->mask) {
+      retval = BOARD_DEV_READY;
+    }
+  }
+
+  return retval;
+}
+
+static void fill_span(const board_hist_t* hist, uint32_t start, uint32_t count,
+                      board_hist_span_t* span) {
+  uint32_t idx;
+
+  idx = start & hist->mask;
+
+  span->start = start;
+  span->first = &hist->buffer[idx];
+  span->first_len = hist->mask + 1u - idx;
+  if (span->first_len > count) {
+    span->first_len = count;
+  }
+  span->second = hist->buffer;
+  span->second_len = count - span->first_len;
+}
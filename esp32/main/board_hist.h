@@ -0,0 +1,177 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#ifndef ESP32_MAIN_BOARD_HIST_H_
+#define ESP32_MAIN_BOARD_HIST_H_
+
+#include <stdint.h>
+#include <hal.h>
+#include <board_dev.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup board_hist Board Sample History
+ * @ingroup board
+ * @brief Fixed size ring buffer of recent raw samples for each sensor
+ *
+ * The owning sensor is the only writer. Readers get views straight into the
+ * ring, split in two where it wraps, instead of copies. A reader on another
+ * core must consume a view before the writer laps it, and can confirm that
+ * with board_hist_check() afterwards.
+ * @{
+ */
+
+/** Pressure sensor history holds 2^x samples, override at build time */
+#ifndef BOARD_HIST_PS_LEN_LOG2
+#define BOARD_HIST_PS_LEN_LOG2 8u
+#endif
+
+/** Flow sensor history holds 2^x samples, override at build time */
+#ifndef BOARD_HIST_FS_LEN_LOG2
+#define BOARD_HIST_FS_LEN_LOG2 9u
+#endif
+
+#define BOARD_HIST_PS_LEN (1u << BOARD_HIST_PS_LEN_LOG2)
+#define BOARD_HIST_FS_LEN (1u << BOARD_HIST_FS_LEN_LOG2)
+
+/** Largest time step a sample can record, in us */
+#define BOARD_HIST_DT_MAX 0xFFFFu
+
+/** Sample is not continuous with the previous one (first after a reset, or
+ * the time step did not fit) */
+#define BOARD_HIST_FLAG_GAP (1u << 0)
+
+/** Raw value is a temperature reading, for sensors that interleave them with
+ * their main readings. It applies to the samples after it */
+#define BOARD_HIST_FLAG_TEMP (1u << 1)
+
+/** @brief Compact history sample, 8 bytes
+ */
+typedef struct board_hist_sample_t {
+  uint32_t raw;    //!< Raw value as read from the sensor
+  uint16_t dt;     //!< Time since the previous sample in us
+  uint16_t flags;  //!< BOARD_HIST_FLAG_* bits
+} board_hist_sample_t;
+
+typedef struct board_hist_t {
+  board_hist_sample_t* buffer;  //!< Sample storage, length is a power of 2
+  uint32_t mask;                //!< Length of buffer - 1
+  uint32_t head;                //!< Total samples ever pushed, wraps
+  hal_timestamp_t ts_last;      //!< Timestamp of the newest sample
+  uint8_t gap;                  //!< Next sample is flagged BOARD_HIST_FLAG_GAP
+} board_hist_t;
+
+/** @brief View of a run of samples, oldest first
+ *
+ * The run starts in first and continues in second when it wraps around the
+ * end of the ring.
+ */
+typedef struct board_hist_span_t {
+  const board_hist_sample_t* first;
+  uint32_t first_len;
+  const board_hist_sample_t* second;
+  uint32_t second_len;
+  uint32_t start;  //!< Position of the first sample, see board_hist_head()
+} board_hist_span_t;
+
+/**
+ * @brief Initialize history over the given storage
+ *
+ * @param hist
+ * @param buffer Sample storage
+ * @param len Number of samples in buffer, must be a power of 2
+ * @return BOARD_DEV_READY if the history is usable
+ */
+board_dev_status_t board_hist_init(board_hist_t* hist,
+                                   board_hist_sample_t* buffer, uint32_t len);
+
+/**
+ * @brief Mark the next sample as not continuous with the ones before
+ *
+ * For a sensor that was reset. Positions carry on, so readers keep their
+ * place, only the next sample is flagged BOARD_HIST_FLAG_GAP.
+ *
+ * @param hist
+ */
+void board_hist_break(board_hist_t* hist);
+
+/**
+ * @brief Add a sample, overwriting the oldest when full
+ *
+ * @param hist
+ * @param ts Timestamp of the sample
+ * @param raw Raw value
+ * @param flags BOARD_HIST_FLAG_* bits
+ */
+void board_hist_push(board_hist_t* hist, hal_timestamp_t ts, uint32_t raw,
+                     uint16_t flags);
+
+/**
+ * @brief Position one past the newest sample
+ *
+ * Positions count every sample ever pushed, readers can keep one as a cursor
+ * and pass it to board_hist_get_since() to consume new samples only.
+ *
+ * @param hist
+ * @return uint32_t
+ */
+uint32_t board_hist_head(const board_hist_t* hist);
+
+/**
+ * @brief Get a view of the newest samples
+ *
+ * @param hist
+ * @param count Number of samples wanted, clipped to what is held
+ * @param span Filled in with the view
+ * @return BOARD_DEV_READY if span is valid
+ */
+board_dev_status_t board_hist_get_latest(const board_hist_t* hist,
+                                         uint32_t count,
+                                         board_hist_span_t* span);
+
+/**
+ * @brief Get a view of every sample from a position up to the newest
+ *
+ * @param hist
+ * @param pos Position of the first sample wanted
+ * @param span Filled in with the view
+ * @return BOARD_DEV_NOT_READY if samples from pos have been overwritten, or
+ * pos is ahead of the history, the reader must resync
+ */
+board_dev_status_t board_hist_get_since(const board_hist_t* hist, uint32_t pos,
+                                        board_hist_span_t* span);
+
+/**
+ * @brief Check that a view has not been overwritten since it was taken
+ *
+ * @param hist
+ * @param span
+ * @return BOARD_DEV_READY if every sample in span is still intact
+ */
+board_dev_status_t board_hist_check(const board_hist_t* hist,
+                                    const board_hist_span_t* span);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ESP32_MAIN_BOARD_HIST_H_
@@ -0,0 +1,226 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <board_layout.h>
+#include <sensirion_codec.h>
+
+/** Number of Qx exponents in a pressure sensor record */
+#define QX_COUNT 6u
+
+static const ms5525dso_qx_t default_ps_qx = MS5525DSO_QX_FOR_PP001DS();
+
+// Smallest and largest of Q1 to Q6 over the parts in the datasheet. Anything
+// else is not a real part, and could shift past the width of the arithmetic
+static const uint8_t qx_min[QX_COUNT] = {14u, 16u, 4u, 1u, 7u, 21u};
+static const uint8_t qx_max[QX_COUNT] = {18u, 21u, 8u, 6u, 7u, 22u};
+
+static board_dev_status_t parse_ms5525dso(const uint8_t* payload, uint8_t len,
+                                          board_layout_ps_t* ps);
+static board_dev_status_t parse_sfm3000(const uint8_t* payload, uint8_t len,
+                                        board_layout_fs_t* fs);
+static board_dev_status_t parse_sfm3019(const uint8_t* payload, uint8_t len,
+                                        board_layout_fs_t* fs);
+
+void board_layout_default(board_layout_t* layout) {
+  assert(layout);
+
+  if (layout != NULL) {
+    layout->ps1.present = 1;
+    layout->ps1.mux_channel = BOARD_LAYOUT_DEFAULT_PS1_CHANNEL;
+    layout->ps1.osr = MS5525DSO_OSR256;
+    memcpy(&layout->ps1.qx, &default_ps_qx, sizeof(layout->ps1.qx));
+
+    layout->fs1.present = 1;
+    layout->fs1.mux_channel = BOARD_LAYOUT_DEFAULT_FS1_CHANNEL;
+    layout->fs1.type = BOARD_LAYOUT_TYPE_SFM3000;
+    layout->fs1.settings.offset = SFM3000_GIVEN_OFFSET;
+    layout->fs1.settings.scale_factor = SFM3000_GIVEN_SCALE_FACTOR_O2;
+  }
+}
+
+board_dev_status_t board_layout_parse(const uint8_t* blob, uint32_t len,
+                                      board_layout_t* layout) {
+  board_dev_status_t retval;
+  board_layout_t parsed;
+  uint32_t pos;
+  uint8_t count;
+  uint8_t type;
+  uint8_t slot;
+  uint8_t mux_channel;
+  uint8_t payload_len;
+
+  assert(blob);
+  assert(layout);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((blob != NULL) && (layout != NULL) &&
+      (len >= (BOARD_LAYOUT_HEADER_LEN + 1u)) && (blob[0] == 'B') &&
+      (blob[1] == 'L') && (blob[2] == BOARD_LAYOUT_VERSION) &&
+      (sensirion_crc8(blob, len - 1u, BOARD_LAYOUT_CRC_INIT) ==
+       blob[len - 1u])) {
+    // Only what the blob lists is fitted
+    board_layout_default(&parsed);
+    parsed.ps1.present = 0;
+    parsed.fs1.present = 0;
+
+    count = blob[3];
+    pos = BOARD_LAYOUT_HEADER_LEN;
+    len--;  // CRC is not part of the records
+    retval = BOARD_DEV_READY;
+
+    for (uint8_t n = 0; (n < count) && (retval == BOARD_DEV_READY); n++) {
+      retval = BOARD_DEV_NOT_READY;
+      if ((pos + BOARD_LAYOUT_RECORD_HEADER_LEN) <= len) {
+        type = blob[pos];
+        slot = blob[pos + 1u];
+        mux_channel = blob[pos + 2u];
+        payload_len = blob[pos + 3u];
+        pos += BOARD_LAYOUT_RECORD_HEADER_LEN;
+
+        if (((pos + payload_len) <= len) &&
+            (mux_channel < BOARD_LAYOUT_MUX_CHANNELS)) {
+          // Only one sensor of each type is supported, in slot 0
+          if ((type == BOARD_LAYOUT_TYPE_MS5525DSO) && (slot == 0u)) {
+            retval = parse_ms5525dso(&blob[pos], payload_len, &parsed.ps1);
+            parsed.ps1.mux_channel = mux_channel;
+          } else if ((type == BOARD_LAYOUT_TYPE_SFM3000) && (slot == 0u)) {
+            retval = parse_sfm3000(&blob[pos], payload_len, &parsed.fs1);
+            parsed.fs1.mux_channel = mux_channel;
+          } else if ((type == BOARD_LAYOUT_TYPE_SFM3019) && (slot == 0u)) {
+            retval = parse_sfm3019(&blob[pos], payload_len, &parsed.fs1);
+            parsed.fs1.mux_channel = mux_channel;
+          } else {
+            // Unknown to this firmware, skip over it
+            retval = BOARD_DEV_READY;
+          }
+          pos += payload_len;
+        }
+      }
+    }
+
+    // Trailing bytes mean the count does not match the records
+    if ((retval == BOARD_DEV_READY) && (pos == len)) {
+      memcpy(layout, &parsed, sizeof(parsed));
+    } else {
+      retval = BOARD_DEV_NOT_READY;
+    }
+  }
+
+  return retval;
+}
+
+board_dev_status_t board_layout_load(board_layout_t* layout, const char* key) {
+  board_dev_status_t retval;
+  uint8_t blob[BOARD_LAYOUT_MAX_LEN];
+  size_t len;
+
+  assert(layout);
+  assert(key);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((layout != NULL) && (key != NULL)) {
+    len = sizeof(blob);
+    if (hal_nvs_read_blob(BOARD_LAYOUT_NVS_NAMESPACE, key, blob, &len) ==
+        HAL_OK) {
+      retval = board_layout_parse(blob, len, layout);
+    }
+
+    if (retval != BOARD_DEV_READY) {
+      board_layout_default(layout);
+    }
+  }
+
+  return retval;
+}
+
+static board_dev_status_t parse_ms5525dso(const uint8_t* payload, uint8_t len,
+                                          board_layout_ps_t* ps) {
+  board_dev_status_t retval;
+  uint8_t qx_valid;
+
+  retval = BOARD_DEV_NOT_READY;
+
+  qx_valid = (len == BOARD_LAYOUT_MS5525DSO_LEN) ? 1u : 0u;
+  for (uint32_t n = 0; (qx_valid != 0u) && (n < QX_COUNT); n++) {
+    if ((payload[1u + n] < qx_min[n]) || (payload[1u + n] > qx_max[n])) {
+      qx_valid = 0;
+    }
+  }
+
+  if ((qx_valid != 0u) && (payload[0] <= (uint8_t)MS5525DSO_OSR4096)) {
+    ps->present = 1;
+    ps->osr = (ms5525dso_osr_t)payload[0];
+    ps->qx.Q1 = payload[1];
+    ps->qx.Q2 = payload[2];
+    ps->qx.Q3 = payload[3];
+    ps->qx.Q4 = payload[4];
+    ps->qx.Q5 = payload[5];
+    ps->qx.Q6 = payload[6];
+    retval = BOARD_DEV_READY;
+  }
+
+  return retval;
+}
+
+static board_dev_status_t parse_sfm3000(const uint8_t* payload, uint8_t len,
+                                        board_layout_fs_t* fs) {
+  board_dev_status_t retval;
+  uint16_t offset;
+  uint16_t scale_factor;
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if (len == BOARD_LAYOUT_SFM3000_LEN) {
+    offset = payload[0] | (payload[1] << 8);
+    scale_factor = payload[2] | (payload[3] << 8);
+    // A zero scale factor would divide by zero in the conversion
+    if (scale_factor != 0u) {
+      fs->present = 1;
+      fs->type = BOARD_LAYOUT_TYPE_SFM3000;
+      fs->settings.offset = offset;
+      fs->settings.scale_factor = scale_factor / 10.0f;
+      retval = BOARD_DEV_READY;
+    }
+  }
+
+  return retval;
+}
+
+static board_dev_status_t parse_sfm3019(const uint8_t* payload, uint8_t len,
+                                        board_layout_fs_t* fs) {
+  board_dev_status_t retval;
+
+  // Nothing to configure, the record only names the sensor
+  (void)payload;
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if (len == BOARD_LAYOUT_SFM3019_LEN) {
+    fs->present = 1;
+    fs->type = BOARD_LAYOUT_TYPE_SFM3019;
+    fs->settings.offset = SFM3019_GIVEN_OFFSET;
+    fs->settings.scale_factor = SFM3019_GIVEN_SCALE_FACTOR;
+    retval = BOARD_DEV_READY;
+  }
+
+  return retval;
+}
@@ -0,0 +1,144 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#ifndef ESP32_MAIN_BOARD_LAYOUT_H_
+#define ESP32_MAIN_BOARD_LAYOUT_H_
+
+#include <stdint.h>
+#include <hal.h>
+#include <board_dev.h>
+#include <drv_i2c_ms5525dso.h>
+#include <drv_i2c_sfm3000.h>
+#include <drv_i2c_sfm3019.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup board_layout Board Sensor Layout
+ * @ingroup board
+ * @brief Which sensors a rig has, where they sit on the mux, and how to run
+ * them
+ *
+ * Read once at board_init() from a binary blob in NVS, so one firmware image
+ * serves every rig variant. Falls back to the compiled default if the blob
+ * is missing or does not parse.
+ *
+ * Blob format, multi-byte fields little endian:
+ *
+ *     'B' 'L' version count
+ *     count records of: type slot mux_channel len payload[len]
+ *     CRC-8 of all preceding bytes (poly 0x31, init 0xFF)
+ *
+ * Record payloads:
+ *  - BOARD_LAYOUT_TYPE_MS5525DSO: osr Q1 Q2 Q3 Q4 Q5 Q6, each Qx within the
+ *    range the datasheet gives over every part
+ *  - BOARD_LAYOUT_TYPE_SFM3000: offset(u16) scale_factor_x10(u16)
+ *  - BOARD_LAYOUT_TYPE_SFM3019: none, it is run for Air with the datasheet
+ *    values
+ *
+ * Records of unknown type are skipped, so newer blobs still load.
+ * @{
+ */
+
+#define BOARD_LAYOUT_NVS_NAMESPACE "board"
+#define BOARD_LAYOUT_NVS_KEY "layout"
+#define BOARD_LAYOUT_NVS_KEY2 "layout2"
+
+#define BOARD_LAYOUT_VERSION 1u
+
+/** The blob CRC is the Sensirion one, with the SFM3019 initial value */
+#define BOARD_LAYOUT_CRC_INIT 0xFFu
+
+/** Largest blob accepted */
+#define BOARD_LAYOUT_MAX_LEN 64u
+
+#define BOARD_LAYOUT_HEADER_LEN 4u
+#define BOARD_LAYOUT_RECORD_HEADER_LEN 4u
+#define BOARD_LAYOUT_MS5525DSO_LEN 7u
+#define BOARD_LAYOUT_SFM3000_LEN 4u
+#define BOARD_LAYOUT_SFM3019_LEN 0u
+
+/** Number of channels on the I2C mux */
+#define BOARD_LAYOUT_MUX_CHANNELS 8u
+
+/** Mux channels of the compiled default layout */
+#define BOARD_LAYOUT_DEFAULT_PS1_CHANNEL 7u
+#define BOARD_LAYOUT_DEFAULT_FS1_CHANNEL 0u
+
+typedef enum board_layout_type_t {
+  BOARD_LAYOUT_TYPE_MS5525DSO = 1,
+  BOARD_LAYOUT_TYPE_SFM3000 = 2,
+  BOARD_LAYOUT_TYPE_SFM3019 = 3,
+} board_layout_type_t;
+
+typedef struct board_layout_ps_t {
+  uint8_t present;      //!< Non-zero if the rig has this sensor
+  uint8_t mux_channel;  //!< Mux channel number, 0 to 7
+  ms5525dso_osr_t osr;
+  ms5525dso_qx_t qx;
+} board_layout_ps_t;
+
+typedef struct board_layout_fs_t {
+  uint8_t present;      //!< Non-zero if the rig has this sensor
+  uint8_t mux_channel;  //!< Mux channel number, 0 to 7
+  board_layout_type_t type;  //!< Which flow sensor part
+  sfm3000_settings_t settings;
+} board_layout_fs_t;
+
+typedef struct board_layout_t {
+  board_layout_ps_t ps1;
+  board_layout_fs_t fs1;
+} board_layout_t;
+
+/**
+ * @brief Fill in the compiled default layout
+ *
+ * @param layout
+ */
+void board_layout_default(board_layout_t* layout);
+
+/**
+ * @brief Parse a layout blob
+ *
+ * Sensors without a record are marked not present.
+ *
+ * @param blob
+ * @param len Length of blob in bytes
+ * @param layout Only written if the whole blob is valid
+ * @return BOARD_DEV_READY if the blob was valid
+ */
+board_dev_status_t board_layout_parse(const uint8_t* blob, uint32_t len,
+                                      board_layout_t* layout);
+
+/**
+ * @brief Load the layout from NVS, or the default if that fails
+ *
+ * @param layout
+ * @param key NVS key of the blob, one per circuit
+ * @return BOARD_DEV_READY if the layout came from NVS
+ */
+board_dev_status_t board_layout_load(board_layout_t* layout, const char* key);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ESP32_MAIN_BOARD_LAYOUT_H_
@@ -21,115 +21,269 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #include <drv_i2c_ms5525dso.h>
 
 static void update_state(board_dev_ps_t* ps, ps_state_t new_state);
+static void fault(board_dev_ps_t* ps, hal_err_t res);
+static void sample(board_dev_ps_t* ps);
+static void compensate(board_dev_ps_t* ps);
+static hal_err_t start_conversion(board_dev_ps_t* ps, ms5525dso_ch_t ch);
+static board_dev_status_t read_conversion(board_dev_ps_t* ps,
+                                          ms5525dso_ch_t ch, uint32_t* adc,
+                                          hal_err_t* res);
+static hal_timestamp_t conversion_wait(const board_dev_ps_t* ps);
 
-void ps_init(board_dev_ps_t* ps, hal_i2c_dev_t i2c_dev, ms5525dso_osr_t osr,
-             const ms5525dso_qx_t* qx) {
+void ps_init(board_dev_ps_t* ps, const char* name, hal_i2c_dev_t i2c_dev,
+             ms5525dso_osr_t osr, const ms5525dso_qx_t* qx) {
   assert(ps);
+  assert(name);
   assert(qx);
 
-  if ((ps != NULL) && (qx != NULL)) {
+  if ((ps != NULL) && (name != NULL) && (qx != NULL)) {
+    ps->name = name;
     ps->status = BOARD_DEV_NOT_READY;
+    ps->prom_addr = 0;
     ps->i2c_dev = i2c_dev;
     ps->temp = 0.0f;
     ps->pressure = 0.0f;
+    ps->startup_time = 0;
     ps->osr = osr;
+    ps->conv_osr = osr;
+    ps->osr_min = osr;
+    ps->osr_max = BOARD_PS_OSR_MAX;
+    ps->steady = 0;
+    ps->p_mean = 0;
+    ps->rate_divisor = 1;
+    for (uint32_t n = 0; n <= (uint32_t)MS5525DSO_OSR4096; n++) {
+      ps->latency[n] = ms5525dso_get_conversion_time((ms5525dso_osr_t)n);
+    }
+    ps->retries = 0;
+    ps->early_reads = 0;
+    ps->conversion_time = conversion_wait(ps);
+    ps->temp_decimation = BOARD_PS_TEMP_DECIMATION;
+    ps->temp_countdown = 0;
+    ps->raw = 0;
     memcpy(&ps->qx, qx, sizeof(ms5525dso_qx_t));
+    board_dev_backoff_init(&ps->backoff);
+    board_dev_stats_not_ready(&ps->stats, hal_get_timestamp());
+    // The history outlives a reset, like the health counters
+    board_hist_break(&ps->hist);
     update_state(ps, PS_SENSOR_ST_RESET);
   }
 }
 
-board_dev_status_t ps_update(board_dev_ps_t* ps, ps_values_t* ps_values) {
+void ps_set_rate_divisor(board_dev_ps_t* ps, uint32_t divisor) {
+  assert(ps);
+
+  if ((ps != NULL) && (divisor > 0u)) {
+    ps->rate_divisor = divisor;
+    ps->conversion_time = conversion_wait(ps);
+  }
+}
+
+hal_timestamp_t ps_get_min_wait(ms5525dso_osr_t osr) {
+  return (ms5525dso_get_conversion_time(osr) >> BOARD_PS_CONV_FLOOR_SHIFT) +
+         BOARD_PS_CONV_MARGIN;
+}
+
+void ps_set_raw(board_dev_ps_t* ps, uint8_t raw) {
+  assert(ps);
+
+  if (ps != NULL) {
+    ps->raw = raw;
+  }
+}
+
+void ps_set_osr_max(board_dev_ps_t* ps, ms5525dso_osr_t osr) {
+  assert(ps);
+
+  if (ps != NULL) {
+    ps->osr_max = osr;
+  }
+}
+
+void ps_set_temp_decimation(board_dev_ps_t* ps, uint32_t decimation) {
+  assert(ps);
+
+  if ((ps != NULL) && (decimation > 0u)) {
+    ps->temp_decimation = decimation;
+  }
+}
+
+board_dev_status_t ps_update(board_dev_ps_t* ps, board_dev_budget_t* budget,
+                             ps_values_t* ps_values) {
   hal_err_t res;
   board_dev_status_t retval;
+  uint8_t done;
+  uint8_t count;
 
   assert(ps);
+  assert(budget);
   assert(ps_values);
 
   retval = BOARD_DEV_NOT_READY;
 
-  if ((ps != NULL) && (ps_values != NULL)) {
+  if ((ps != NULL) && (budget != NULL) && (ps_values != NULL)) {
+    done = 1u;
     switch (ps->state) {
       case PS_SENSOR_ST_RESET:
-        ps->ts_state = hal_get_timestamp();
         ps->status = BOARD_DEV_NOT_READY;
-        res = ms5525dso_soft_reset(hal_i2c_get_config(ps->i2c_dev));
-        if (res == HAL_OK) {
-          update_state(ps, PS_SENSOR_ST_CONFIG);
+        // Hold off retrying a faulted sensor, the others keep running
+        if ((board_dev_backoff_expired(&ps->backoff) == BOARD_DEV_READY) &&
+            (board_dev_budget_take(budget, BOARD_PS_COST_RESET) ==
+             BOARD_DEV_READY)) {
+          res = ms5525dso_soft_reset(hal_i2c_get_config(ps->i2c_dev));
+          if (res == HAL_OK) {
+            ps->ts_reset = hal_get_timestamp();
+            update_state(ps, PS_SENSOR_ST_CONFIG);
+          } else {
+            fault(ps, res);
+          }
         }
         break;
 
       case PS_SENSOR_ST_CONFIG:
-        if (hal_get_timestamp() >= (ps->ts_state + BOARD_PS_RESET_TIME)) {
-          res = ms5525dso_read_all_coeff(hal_i2c_get_config(ps->i2c_dev),
-                                         &ps->coeff);
+        // Poll until the sensor is out of reset, a cheap address ACK first
+        if ((hal_get_timestamp() >= (ps->ts_poll + BOARD_PS_POLL_TIME)) &&
+            (board_dev_budget_take(budget, BOARD_PS_COST_PROBE) ==
+             BOARD_DEV_READY)) {
+          ps->ts_poll = hal_get_timestamp();
+          res = hal_i2c_probe(hal_i2c_get_config(ps->i2c_dev));
           if (res == HAL_OK) {
-            hal_log(HAL_LOG_INFO, "PS1", "Coefficient table:");
-            hal_log(HAL_LOG_INFO, "PS1", "0 - 0x%.08X", ps->coeff.c[0]);
-            hal_log(HAL_LOG_INFO, "PS1", "1 - 0x%.08X", ps->coeff.c[1]);
-            hal_log(HAL_LOG_INFO, "PS1", "2 - 0x%.08X", ps->coeff.c[2]);
-            hal_log(HAL_LOG_INFO, "PS1", "3 - 0x%.08X", ps->coeff.c[3]);
-            hal_log(HAL_LOG_INFO, "PS1", "4 - 0x%.08X", ps->coeff.c[4]);
-            hal_log(HAL_LOG_INFO, "PS1", "5 - 0x%.08X", ps->coeff.c[5]);
-            hal_log(HAL_LOG_INFO, "PS1", "6 - 0x%.08X", ps->coeff.c[6]);
-            hal_log(HAL_LOG_INFO, "PS1", "7 - 0x%.08X", ps->coeff.c[7]);
-
-            res = ms5525dso_start_ch_convert(hal_i2c_get_config(ps->i2c_dev),
-                                             MS5525DSO_CH_D1_PRESSURE, ps->osr);
+            ps->prom_addr = 0;
+            ps->state = PS_SENSOR_ST_READ_COEFF;
+          } else if (hal_get_timestamp() >=
+                     (ps->ts_state + BOARD_PS_RESET_TIME)) {
+            // Never came out of reset
+            fault(ps, res);
           }
+        }
+        break;
+
+      case PS_SENSOR_ST_READ_COEFF:
+        // As many coefficients as fit in this update, in one batch, the rest
+        // next time. Normally that is all of them
+        res = HAL_OK;
+        count = 0;
+        while (((ps->prom_addr + count) < MS5525DSO_NUM_PROM_ADDR) &&
+               (board_dev_budget_take(budget, (count == 0u)
+                                                  ? BOARD_PS_COST_PROM
+                                                  : BOARD_PS_COST_PROM_NEXT) ==
+                BOARD_DEV_READY)) {
+          count++;
+        }
+        if (count > 0u) {
+          res = ms5525dso_read_prom_batch(hal_i2c_get_config(ps->i2c_dev),
+                                          ps->prom_addr, count, &ps->coeff);
           if (res == HAL_OK) {
+            ps->prom_addr += count;
+          }
+        }
+
+        if ((res == HAL_OK) && (ps->prom_addr >= MS5525DSO_NUM_PROM_ADDR)) {
+          if (ms5525dso_calculate_coeff_crc(&ps->coeff) ==
+              (ps->coeff.c[7] & 0x000Fu)) {
+            hal_log(HAL_LOG_INFO, ps->name,
+                    "Coeff %.04X %.04X %.04X %.04X %.04X %.04X %.04X %.04X",
+                    ps->coeff.c[0], ps->coeff.c[1], ps->coeff.c[2],
+                    ps->coeff.c[3], ps->coeff.c[4], ps->coeff.c[5],
+                    ps->coeff.c[6], ps->coeff.c[7]);
+            ms5525dso_prepare_comp(&ps->qx, &ps->coeff, &ps->comp);
+            ps->state = PS_SENSOR_ST_START;
+          } else {
+            res = HAL_ERR_CRC;
+          }
+        }
+
+        if (res != HAL_OK) {
+          // Not fully out of reset yet, poll again until the table passes
+          // its CRC
+          if (hal_get_timestamp() >= (ps->ts_state + BOARD_PS_RESET_TIME)) {
+            fault(ps, res);
+          } else {
+            ps->state = PS_SENSOR_ST_CONFIG;
+          }
+        }
+        break;
+
+      case PS_SENSOR_ST_START:
+        if (board_dev_budget_take(budget, BOARD_PS_COST_START) ==
+            BOARD_DEV_READY) {
+          // Fastest conversions until the pressure is known to be steady
+          ps->osr = ps->osr_min;
+          ps->steady = 0;
+          res = start_conversion(ps, MS5525DSO_CH_D1_PRESSURE);
+          if (res == HAL_OK) {
+            // A fresh temperature before the first sample
+            ps->temp_countdown = 0;
             update_state(ps, PS_SENSOR_ST_READ_CH1);
           } else {
-            update_state(ps, PS_SENSOR_ST_RESET);
+            fault(ps, res);
           }
         }
         break;
 
       case PS_SENSOR_ST_READ_CH1:
         // Has the previous conversion finished?
-        if (hal_get_timestamp() >=
-            (ps->ts_state + ms5525dso_get_conversion_time(ps->osr))) {
-          res = ms5525dso_read_adc(hal_i2c_get_config(ps->i2c_dev), &ps->d1);
-          if (res == HAL_OK) {
-            res = ms5525dso_start_ch_convert(hal_i2c_get_config(ps->i2c_dev),
-                                             MS5525DSO_CH_D2_TEMPERATURE,
-                                             ps->osr);
+        if ((hal_get_timestamp() >=
+             (ps->ts_state + ps->conversion_time)) &&
+            (board_dev_budget_take(budget, BOARD_PS_COST_READ) ==
+             BOARD_DEV_READY)) {
+          if (read_conversion(ps, MS5525DSO_CH_D1_PRESSURE, &ps->d1, &res) !=
+              BOARD_DEV_READY) {
+            // Started again, read it later
+            done = 0;
+          } else {
+            // Temperature changes slowly, so it is only converted once every
+            // temp_decimation pressures and the last D2 is used in between
+            if (ps->temp_countdown == 0u) {
+              res = start_conversion(ps, MS5525DSO_CH_D2_TEMPERATURE);
+            } else {
+              compensate(ps);
+              res = start_conversion(ps, MS5525DSO_CH_D1_PRESSURE);
+            }
           }
 
-          if (res == HAL_OK) {
+          if ((res == HAL_OK) && (done == 0u)) {
+            update_state(ps, PS_SENSOR_ST_READ_CH1);
+          } else if (res == HAL_OK) {
             // Store the time when we successfully started the pressure
             // conversion
             ps->ts_current_update = hal_get_timestamp();
-            update_state(ps, PS_SENSOR_ST_READ_CH2);
+            if (ps->temp_countdown == 0u) {
+              update_state(ps, PS_SENSOR_ST_READ_CH2);
+            } else {
+              ps->temp_countdown--;
+              sample(ps);
+            }
           } else {
-            update_state(ps, PS_SENSOR_ST_RESET);
+            fault(ps, res);
           }
         }
         break;
 
       case PS_SENSOR_ST_READ_CH2:
         // Has the previous conversion finished?
-        if (hal_get_timestamp() >=
-            (ps->ts_state + ms5525dso_get_conversion_time(ps->osr))) {
-          res = ms5525dso_read_adc(hal_i2c_get_config(ps->i2c_dev), &ps->d2);
-          if (res == HAL_OK) {
+        if ((hal_get_timestamp() >=
+             (ps->ts_state + ps->conversion_time)) &&
+            (board_dev_budget_take(budget, BOARD_PS_COST_READ) ==
+             BOARD_DEV_READY)) {
+          if (read_conversion(ps, MS5525DSO_CH_D2_TEMPERATURE, &ps->d2,
+                              &res) != BOARD_DEV_READY) {
+            done = 0;
+          } else {
             // Start the conversion again for channel 1
-            res = ms5525dso_start_ch_convert(hal_i2c_get_config(ps->i2c_dev),
-                                             MS5525DSO_CH_D1_PRESSURE,
-                                             MS5525DSO_OSR256);
-            // Calculate the new calibrated pressure and temp for the previously
-            // read out p+t
-            ms5525dso_calculate_pt(&ps->qx, &ps->coeff, ps->d1, ps->d2,
-                                   &ps->pressure, &ps->temp);
-
-            // Successfully updated pressure and temperature
-            // so updated timestamp of when the update occurred
-            ps->ts_last_update = ps->ts_current_update;
+            compensate(ps);
+            res = start_conversion(ps, MS5525DSO_CH_D1_PRESSURE);
           }
-          if (res == HAL_OK) {
-            ps->status = BOARD_DEV_READY;
-            update_state(ps, PS_SENSOR_ST_READ_CH1);
+          if ((res == HAL_OK) && (done == 0u)) {
+            update_state(ps, PS_SENSOR_ST_READ_CH2);
+          } else if (res == HAL_OK) {
+            // Goes ahead of the pressure it is used with, so a reader of the
+            // history always has the temperature of the pressures it reads
+            board_hist_push(&ps->hist, ps->ts_current_update, ps->d2,
+                            BOARD_HIST_FLAG_TEMP);
+            ps->temp_countdown = ps->temp_decimation - 1u;
+            sample(ps);
           } else {
-            update_state(ps, PS_SENSOR_ST_RESET);
+            fault(ps, res);
           }
         }
         break;
@@ -164,11 +318,165 @@ ps_info_t* ps_get_info(board_dev_ps_t* ps, ps_info_t* info) {
   return info;
 }
 
+static void fault(board_dev_ps_t* ps, hal_err_t res) {
+  assert(ps);
+
+  if (ps != NULL) {
+    ps->status = BOARD_DEV_NOT_READY;
+    board_dev_backoff_fault(&ps->backoff);
+    board_dev_stats_fault(&ps->stats, hal_get_timestamp(), res);
+    update_state(ps, PS_SENSOR_ST_RESET);
+  }
+}
+
+static void sample(board_dev_ps_t* ps) {
+  assert(ps);
+
+  if (ps != NULL) {
+    // Successfully updated pressure and temperature
+    // so updated timestamp of when the update occurred
+    ps->ts_last_update = ps->ts_current_update;
+
+    if (ps->status != BOARD_DEV_READY) {
+      ps->startup_time = hal_get_timestamp() - ps->ts_reset;
+      hal_log(HAL_LOG_INFO, ps->name, "First sample after %lld us",
+              ps->startup_time);
+    }
+    board_hist_push(&ps->hist, ps->ts_last_update, ps->d1,
+                    (ps->status != BOARD_DEV_READY) ? BOARD_HIST_FLAG_GAP
+                                                    : 0u);
+    ps->status = BOARD_DEV_READY;
+    board_dev_backoff_ready(&ps->backoff);
+    board_dev_stats_sample(&ps->stats, hal_get_timestamp());
+    update_state(ps, PS_SENSOR_ST_READ_CH1);
+  }
+}
+
+static void compensate(board_dev_ps_t* ps) {
+  int32_t p;
+  int32_t t;
+  int32_t delta;
+
+  assert(ps);
+
+  if ((ps != NULL) && (ps->raw == 0u)) {
+    // Calculate the new calibrated pressure and temp for the last read out
+    // D1 and D2
+    ms5525dso_compensate(&ps->comp, ps->d1, ps->d2, &p, &t);
+    ps->pressure = MS5525DSO_CONVERT_P_TO_FLOAT(p);
+    ps->temp = MS5525DSO_CONVERT_T_TO_FLOAT(t);
+
+    // Pick the oversampling of the next conversion. A sample that strays from
+    // the running mean means the pressure is moving, so get the next one out
+    // as soon as possible. Once it has held still for a while, step up to
+    // slower conversions with less noise
+    if (ps->status != BOARD_DEV_READY) {
+      ps->p_mean = p;
+    }
+    delta = p - ps->p_mean;
+    ps->p_mean += delta / (1 << BOARD_PS_OSR_MEAN_SHIFT);
+
+    if ((delta > BOARD_PS_OSR_FAST_DELTA) ||
+        (delta < -BOARD_PS_OSR_FAST_DELTA)) {
+      ps->osr = ps->osr_min;
+      ps->steady = 0;
+    } else if (ps->steady < BOARD_PS_OSR_STEADY_SAMPLES) {
+      ps->steady++;
+    } else if (ps->osr < ps->osr_max) {
+      ps->osr = (ms5525dso_osr_t)(ps->osr + 1);
+      ps->steady = 0;
+    }
+  }
+}
+
+static hal_err_t start_conversion(board_dev_ps_t* ps, ms5525dso_ch_t ch) {
+  hal_err_t res;
+
+  assert(ps);
+
+  res = HAL_ERR_FAIL;
+
+  if (ps != NULL) {
+    res = ms5525dso_start_ch_convert(hal_i2c_get_config(ps->i2c_dev), ch,
+                                     ps->osr);
+    // Wait for the oversampling this conversion was started with
+    ps->conv_osr = ps->osr;
+    ps->conversion_time = conversion_wait(ps);
+  }
+
+  return res;
+}
+
+static board_dev_status_t read_conversion(board_dev_ps_t* ps,
+                                          ms5525dso_ch_t ch, uint32_t* adc,
+                                          hal_err_t* res) {
+  board_dev_status_t retval;
+  hal_timestamp_t elapsed;
+  hal_timestamp_t worst;
+  hal_timestamp_t* latency;
+  uint32_t value;
+
+  assert(ps);
+  assert(adc);
+  assert(res);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((ps != NULL) && (adc != NULL) && (res != NULL)) {
+    *res = ms5525dso_read_adc(hal_i2c_get_config(ps->i2c_dev), &value);
+    elapsed = hal_get_timestamp() - ps->ts_state;
+    worst = ms5525dso_get_conversion_time(ps->conv_osr);
+    latency = &ps->latency[ps->conv_osr];
+
+    if ((*res == HAL_OK) && (value != 0u)) {
+      // Done, try a little earlier next time
+      *adc = value;
+      ps->retries = 0;
+      *latency -= *latency >> BOARD_PS_CONV_PROBE_SHIFT;
+      if (*latency < (worst >> BOARD_PS_CONV_FLOOR_SHIFT)) {
+        *latency = worst >> BOARD_PS_CONV_FLOOR_SHIFT;
+      }
+      retval = BOARD_DEV_READY;
+    } else if ((*res == HAL_OK) && (ps->retries < BOARD_PS_CONV_RETRIES)) {
+      // Not done yet. The read spoiled the result, so convert again and wait
+      // longer from now on, up to the worst case
+      ps->retries++;
+      ps->early_reads++;
+      if ((elapsed + (worst >> BOARD_PS_CONV_BACKOFF_SHIFT)) < worst) {
+        *latency = elapsed + (worst >> BOARD_PS_CONV_BACKOFF_SHIFT);
+      } else {
+        *latency = worst;
+      }
+      *res = start_conversion(ps, ch);
+    } else if (*res == HAL_OK) {
+      // Never finishes a conversion
+      *res = HAL_ERR_FAIL;
+    }
+  }
+
+  return retval;
+}
+
+static hal_timestamp_t conversion_wait(const board_dev_ps_t* ps) {
+  hal_timestamp_t wait;
+
+  // The bus is planned with the shortest wait, a divided rate keeps to the
+  // multiple of it planned, which is past the worst case from 2 up
+  if (ps->rate_divisor > 1u) {
+    wait = ps_get_min_wait(ps->osr) * ps->rate_divisor;
+  } else {
+    wait = ps->latency[ps->osr] + BOARD_PS_CONV_MARGIN;
+  }
+
+  return wait;
+}
+
 static void update_state(board_dev_ps_t* ps, ps_state_t new_state) {
   assert(ps);
 
   if (ps != NULL) {
     ps->state = new_state;
     ps->ts_state = hal_get_timestamp();
+    ps->ts_poll = ps->ts_state;
   }
 }
@@ -21,6 +21,7 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #include <stdint.h>
 #include <hal.h>
 #include <board_dev.h>
+#include <board_hist.h>
 #include <drv_i2c_ms5525dso.h>
 
 #ifdef __cplusplus
@@ -34,15 +35,77 @@ extern "C" {
  * @{
  */
 
-/** Wait for reset to clear for 100ms */
+/** Give up on the sensor if it has not come out of reset after 100ms */
 #define BOARD_PS_RESET_TIME 100000
 
+/** Poll for the sensor to come out of reset every 1ms */
+#define BOARD_PS_POLL_TIME 1000
+
 /** Wait 2ms for conversion to finish */
 #define BOARD_PS_CONVERSION_TIME 2000
 
+/** Read a conversion 10us after the time it has been learned to take */
+#ifndef BOARD_PS_CONV_MARGIN
+#define BOARD_PS_CONV_MARGIN 10
+#endif
+
+/** Each good read brings the learned conversion time in by 1/1024 */
+#define BOARD_PS_CONV_PROBE_SHIFT 10
+
+/** A read that was too early puts the learned conversion time 1/16 of the
+ * worst case past it */
+#define BOARD_PS_CONV_BACKOFF_SHIFT 4
+
+/** Never learn less than half the worst case conversion time */
+#define BOARD_PS_CONV_FLOOR_SHIFT 1
+
+/** Reset the sensor after 3 conversions in a row read back zero */
+#define BOARD_PS_CONV_RETRIES 3u
+
+/** Convert temperature once every 8 pressures, temperature changes slowly */
+#ifndef BOARD_PS_TEMP_DECIMATION
+#define BOARD_PS_TEMP_DECIMATION 8u
+#endif
+
+/** Slowest, least noisy, oversampling the sensor steps up to while the
+ * pressure is steady. Kept to OSR2048 so the sample rate stays above
+ * BOARD_PS_RATE_TARGET */
+#ifndef BOARD_PS_OSR_MAX
+#define BOARD_PS_OSR_MAX MS5525DSO_OSR2048
+#endif
+
+/** Step the oversampling up after 32 steady samples in a row */
+#ifndef BOARD_PS_OSR_STEADY_SAMPLES
+#define BOARD_PS_OSR_STEADY_SAMPLES 32u
+#endif
+
+/** Drop back to the configured oversampling when a sample is more than
+ * 0.005 PSI away from the running mean, in PSI x 10000 */
+#ifndef BOARD_PS_OSR_FAST_DELTA
+#define BOARD_PS_OSR_FAST_DELTA 50
+#endif
+
+/** The running mean moves 1/8 of the way to each sample */
+#define BOARD_PS_OSR_MEAN_SHIFT 3
+
+/** Estimated bus time of each step, taken from the board update budget */
+#define BOARD_PS_COST_RESET HAL_I2C_XFER_TIME_US(1u)
+#define BOARD_PS_COST_PROBE HAL_I2C_XFER_TIME_US(0u)
+#define BOARD_PS_COST_PROM \
+  (HAL_I2C_XFER_TIME_US(1u) + HAL_I2C_XFER_TIME_US(MS5525DSO_NUM_PROM_BYTES))
+/** Each coefficient after the first in a batch, without the driver setup */
+#define BOARD_PS_COST_PROM_NEXT \
+  (BOARD_PS_COST_PROM - (2u * HAL_I2C_XFER_OVERHEAD_US))
+#define BOARD_PS_COST_START HAL_I2C_XFER_TIME_US(1u)
+#define BOARD_PS_COST_READ                                                 \
+  (HAL_I2C_XFER_TIME_US(1u) + HAL_I2C_XFER_TIME_US(MS5525DSO_NUM_ADC_BYTES) + \
+   BOARD_PS_COST_START)
+
 typedef enum ps_state_t {
   PS_SENSOR_ST_RESET,
   PS_SENSOR_ST_CONFIG,
+  PS_SENSOR_ST_READ_COEFF,
+  PS_SENSOR_ST_START,
   PS_SENSOR_ST_READ_CH1,
   PS_SENSOR_ST_READ_CH2,
 } ps_state_t;
@@ -65,38 +128,137 @@ typedef struct board_dev_ps_t {
   hal_timestamp_t
       ts_last_update;  //!< Timestamp of when last completed update started
   hal_timestamp_t ts_state;  //!< Timestamp of when current state was entered
+  hal_timestamp_t ts_poll;   //!< Timestamp of the last readiness poll
+  hal_timestamp_t ts_reset;  //!< Timestamp of the last soft reset
+  hal_timestamp_t startup_time;  //!< Time from soft reset to first sample
+  const char* name;          //!< Log topic
   hal_i2c_dev_t i2c_dev;     //!< I2C device to use
   board_dev_status_t status;
   uint32_t d1;
   uint32_t d2;
-  ms5525dso_osr_t osr;
+  ms5525dso_osr_t osr;       //!< Oversampling of the next conversion
+  ms5525dso_osr_t conv_osr;  //!< Oversampling of the running conversion
+  ms5525dso_osr_t osr_min;   //!< Configured, fastest, oversampling
+  ms5525dso_osr_t osr_max;   //!< Slowest oversampling while steady
+  uint32_t steady;           //!< Steady samples in a row
+  int32_t p_mean;            //!< Running mean pressure, in PSI x 10000
+  uint32_t rate_divisor;     //!< Conversions are given this many times
+  hal_timestamp_t conversion_time;  //!< Wait for a conversion, in us
+  hal_timestamp_t latency[MS5525DSO_OSR4096 + 1];  //!< Learned conversion
+                                                   //!< time per OSR, in us
+  uint32_t retries;          //!< Conversions restarted in a row
+  uint32_t early_reads;      //!< Reads that came before their conversion
   ms5525dso_qx_t qx;
   ms5525dso_coeff_t coeff;  //!< Coefficient table to use for calculations
+  ms5525dso_comp_t comp;    //!< Compensation constants, from coeff and qx
+  uint8_t prom_addr;        //!< Next coefficient to read
   float pressure;           //!< Compensated pressure in PSI
   float temp;               //!< Compensated temperature in C
   ps_state_t state;         //!< Internal state
-  hal_timestamp_t temp_update_rate;
+  uint32_t temp_decimation;  //!< Pressure conversions per temperature one
+  uint32_t temp_countdown;   //!< Pressures left before the next temperature
+  uint8_t raw;               //!< Leave compensation to the host if set
+  board_dev_backoff_t backoff;  //!< Fault recovery state
+  board_dev_stats_t stats;      //!< Health counters, survive re-init
+  board_hist_t hist;  //!< Recent raw pressure (D1) samples, and each
+                      //!< temperature (D2) flagged BOARD_HIST_FLAG_TEMP
+  board_hist_sample_t hist_buffer[BOARD_HIST_PS_LEN];
 } board_dev_ps_t;
 
 /**
  * @brief Initialize pressure sensor
  *
+ * The oversampling is adapted per conversion. While the pressure is steady it
+ * steps up towards BOARD_PS_OSR_MAX for less noise, and as soon as it moves it
+ * drops back to osr for the lowest latency.
+ *
+ * Conversions are read as soon as this sensor has been seen to finish them,
+ * rather than after the datasheet worst case. The time is learned per
+ * oversampling: each good read tries a little earlier next time, and a read
+ * that comes back zero, as it does before the conversion is done, moves it
+ * later. Reading early spoils the conversion, so it is started again.
+ *
  * @param ps Pressure sensor struct
+ * @param name Log topic, e.g. "PS1"
  * @param i2c_dev
- * @param osr Over Sample rate (OSR) to use
+ * @param osr Over Sample rate (OSR) to use while the pressure changes, the
+ * bus load is planned for it
  * @param qx Qx Coefficient values to use, should chosen by part number
  */
-void ps_init(board_dev_ps_t* ps, hal_i2c_dev_t i2c_dev, ms5525dso_osr_t osr,
-             const ms5525dso_qx_t* qx);
+void ps_init(board_dev_ps_t* ps, const char* name, hal_i2c_dev_t i2c_dev,
+             ms5525dso_osr_t osr, const ms5525dso_qx_t* qx);
 
 /**
  * @brief
  *
  * @param ps
+ * @param budget Bus time left in this board update, steps that do not fit
+ * are deferred to a later update
  * @param values
  * @return board_dev_status_t
  */
-board_dev_status_t ps_update(board_dev_ps_t* ps, ps_values_t* values);
+board_dev_status_t ps_update(board_dev_ps_t* ps, board_dev_budget_t* budget,
+                             ps_values_t* values);
+
+/**
+ * @brief Shortest wait from starting a conversion to reading it
+ *
+ * The learned conversion time never goes below half the worst case, this is
+ * that plus BOARD_PS_CONV_MARGIN. The bus load is planned with it, so the
+ * sensor never reads more often than planned.
+ *
+ * @param osr
+ * @return hal_timestamp_t Wait in us
+ */
+hal_timestamp_t ps_get_min_wait(ms5525dso_osr_t osr);
+
+/**
+ * @brief Slow the sample rate down, to keep the bus load in bounds
+ *
+ * Each conversion is given divisor times ps_get_min_wait(), as the bus load
+ * was planned with, rather than the time it has been learned to take. From
+ * a divisor of 2 that is past the worst case. Cleared by ps_init().
+ *
+ * @param ps
+ * @param divisor 1 for the fastest rate
+ */
+void ps_set_rate_divisor(board_dev_ps_t* ps, uint32_t divisor);
+
+/**
+ * @brief Leave compensation to the host
+ *
+ * Raw readings are only kept in the history, for streaming. Pressure and
+ * temperature values are not updated, and the oversampling stays at the osr
+ * given to ps_init() as there is no pressure to adapt it to. Cleared by
+ * ps_init().
+ *
+ * @param ps
+ * @param raw Set to skip compensation
+ */
+void ps_set_raw(board_dev_ps_t* ps, uint8_t raw);
+
+/**
+ * @brief Set the slowest oversampling used while the pressure is steady
+ *
+ * Set to BOARD_PS_OSR_MAX by ps_init(). At or below the osr given to
+ * ps_init() the oversampling stays fixed.
+ *
+ * @param ps
+ * @param osr
+ */
+void ps_set_osr_max(board_dev_ps_t* ps, ms5525dso_osr_t osr);
+
+/**
+ * @brief Set how often temperature is converted
+ *
+ * One temperature (D2) conversion is done every decimation pressure (D1)
+ * conversions, the last temperature is used for the pressures in between.
+ * Set to BOARD_PS_TEMP_DECIMATION by ps_init().
+ *
+ * @param ps
+ * @param decimation 1 to convert temperature with every pressure
+ */
+void ps_set_temp_decimation(board_dev_ps_t* ps, uint32_t decimation);
 
 /**
  * @brief
@@ -0,0 +1,193 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <board_scan.h>
+#include <drv_i2c_ms5525dso.h>
+#include <drv_i2c_sfm3000.h>
+#include <drv_i2c_sfm3019.h>
+
+/** Addresses of every device the scan looks for */
+static const uint8_t known_addr[BOARD_SCAN_NUM_ADDR] = {
+    SFM3000_I2C_ADDR,
+    SFM3019_I2C_ADDR,
+    MS5525DSO_I2C_ADDR_HIGH,
+    MS5525DSO_I2C_ADDR_LOW,
+    // ADS1115 ADC, all four address options
+    0x48u,
+    0x49u,
+    0x4Au,
+    0x4Bu,
+};
+
+static void add_credit(board_scan_t* scan);
+static void advance(board_scan_t* scan);
+
+void board_scan_init(board_scan_t* scan, uint32_t share) {
+  assert(scan);
+
+  if (scan != NULL) {
+    scan->share = share;
+    scan->credit = 0;
+    scan->ts_credit = hal_get_timestamp();
+    scan->channel = 0;
+    scan->addr_idx = 0;
+    memset(scan->found, 0, sizeof(scan->found));
+    scan->probes = 0;
+    scan->passes = 0;
+  }
+}
+
+board_dev_status_t board_scan_next(board_scan_t* scan,
+                                   board_dev_budget_t* budget,
+                                   const uint8_t* busy, uint8_t* channel,
+                                   uint8_t* addr) {
+  board_dev_status_t retval;
+  uint32_t n;
+
+  assert(scan);
+  assert(budget);
+  assert(channel);
+  assert(addr);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((scan != NULL) && (budget != NULL) && (channel != NULL) &&
+      (addr != NULL)) {
+    add_credit(scan);
+
+    if (scan->credit >= ((int64_t)BOARD_SCAN_COST * 100)) {
+      // Pass over pairs in use, at most once around
+      for (n = 0; (n < (BOARD_SCAN_CHANNELS * BOARD_SCAN_NUM_ADDR)) &&
+                  (busy != NULL) &&
+                  ((busy[scan->channel] & (1u << scan->addr_idx)) != 0u);
+           n++) {
+        advance(scan);
+      }
+
+      // The cursor stays put if there is no spare bus time, so the pair is
+      // probed next time
+      if ((n < (BOARD_SCAN_CHANNELS * BOARD_SCAN_NUM_ADDR)) &&
+          (board_dev_budget_spare(budget, BOARD_SCAN_COST) ==
+           BOARD_DEV_READY)) {
+        *channel = scan->channel;
+        *addr = known_addr[scan->addr_idx];
+        scan->credit -= (int64_t)BOARD_SCAN_COST * 100;
+        scan->probes++;
+        advance(scan);
+        retval = BOARD_DEV_READY;
+      }
+    }
+  }
+
+  return retval;
+}
+
+void board_scan_result(board_scan_t* scan, uint8_t channel, uint8_t addr,
+                       hal_err_t res) {
+  assert(scan);
+
+  if ((scan != NULL) && (channel < BOARD_SCAN_CHANNELS)) {
+    if (res == HAL_OK) {
+      scan->found[channel] |= board_scan_addr_bit(addr);
+    } else {
+      scan->found[channel] &= ~board_scan_addr_bit(addr);
+    }
+  }
+}
+
+void board_scan_forget(board_scan_t* scan, uint8_t channel, uint8_t addr) {
+  board_scan_result(scan, channel, addr, HAL_ERR_NACK);
+}
+
+board_dev_status_t board_scan_find(const board_scan_t* scan, uint8_t addr,
+                                   uint8_t preferred, uint8_t* channel) {
+  board_dev_status_t retval;
+  uint8_t bit;
+
+  assert(scan);
+  assert(channel);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((scan != NULL) && (channel != NULL)) {
+    bit = board_scan_addr_bit(addr);
+
+    if ((preferred < BOARD_SCAN_CHANNELS) &&
+        ((scan->found[preferred] & bit) != 0u)) {
+      *channel = preferred;
+      retval = BOARD_DEV_READY;
+    }
+
+    for (uint8_t ch = 0;
+         (ch < BOARD_SCAN_CHANNELS) && (retval != BOARD_DEV_READY); ch++) {
+      if ((scan->found[ch] & bit) != 0u) {
+        *channel = ch;
+        retval = BOARD_DEV_READY;
+      }
+    }
+  }
+
+  return retval;
+}
+
+uint8_t board_scan_addr_bit(uint8_t addr) {
+  uint8_t bit;
+
+  bit = 0;
+
+  for (uint32_t n = 0; n < BOARD_SCAN_NUM_ADDR; n++) {
+    if (known_addr[n] == addr) {
+      bit = 1u << n;
+    }
+  }
+
+  return bit;
+}
+
+uint8_t board_scan_addr(uint32_t idx) {
+  return (idx < BOARD_SCAN_NUM_ADDR) ? known_addr[idx] : 0u;
+}
+
+static void add_credit(board_scan_t* scan) {
+  hal_timestamp_t ts;
+
+  // Credit is kept in us x percent, so no fraction of a us is lost each update
+  ts = hal_get_timestamp();
+  if (ts > scan->ts_credit) {
+    scan->credit += (ts - scan->ts_credit) * (int64_t)scan->share;
+  }
+  scan->ts_credit = ts;
+
+  if (scan->credit > ((int64_t)BOARD_SCAN_COST * 100 * BOARD_SCAN_BURST)) {
+    scan->credit = (int64_t)BOARD_SCAN_COST * 100 * BOARD_SCAN_BURST;
+  }
+}
+
+static void advance(board_scan_t* scan) {
+  scan->addr_idx++;
+  if (scan->addr_idx >= BOARD_SCAN_NUM_ADDR) {
+    scan->addr_idx = 0;
+    scan->channel++;
+    if (scan->channel >= BOARD_SCAN_CHANNELS) {
+      scan->channel = 0;
+      scan->passes++;
+    }
+  }
+}
@@ -0,0 +1,156 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#ifndef ESP32_MAIN_BOARD_SCAN_H_
+#define ESP32_MAIN_BOARD_SCAN_H_
+
+#include <stdint.h>
+#include <hal.h>
+#include <board_dev.h>
+#include <board_sw.h>
+#include <board_layout.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup board_scan Board Bus Scan
+ * @ingroup board
+ * @brief Background search of the mux channels for known sensors
+ *
+ * Walks every (channel, address) pair one probe at a time, so sensors that
+ * are plugged in or pulled out are noticed without a board reset. Pairs in
+ * use by a running sensor are skipped, its own traffic already shows whether
+ * it is there.
+ *
+ * Probes are paid for twice. From a token bucket that fills at a fixed share
+ * of wall time, which caps the bus time the scan can ever take, and from
+ * whatever is left of the board update budget, so the scan never delays a
+ * sensor.
+ * @{
+ */
+
+/** Share of bus time the scan may use, in percent */
+#ifndef BOARD_SCAN_SHARE
+#define BOARD_SCAN_SHARE 5u
+#endif
+
+/** Number of mux channels scanned */
+#define BOARD_SCAN_CHANNELS BOARD_LAYOUT_MUX_CHANNELS
+
+/** Number of known device addresses, one bit each in a channel mask */
+#define BOARD_SCAN_NUM_ADDR 8u
+
+/** Estimated bus time of one probe, including selecting its channel */
+#define BOARD_SCAN_COST (BOARD_SW_COST + HAL_I2C_XFER_TIME_US(0u))
+
+/** Probes the scan may save up while it has nothing to do */
+#define BOARD_SCAN_BURST 2
+
+typedef struct board_scan_t {
+  uint32_t share;              //!< Share of bus time, in percent
+  int64_t credit;              //!< Saved up bus time, in us x percent
+  hal_timestamp_t ts_credit;   //!< Time credit was last added
+  uint8_t channel;             //!< Channel of the next probe
+  uint8_t addr_idx;            //!< Known address of the next probe
+  uint8_t found[BOARD_SCAN_CHANNELS];  //!< Known addresses that answered
+  uint32_t probes;             //!< Probes made, since init
+  uint32_t passes;             //!< Passes over every pair, since init
+} board_scan_t;
+
+/**
+ * @brief Initialize scan, nothing is found until probed
+ *
+ * @param scan
+ * @param share Share of bus time the scan may use, in percent
+ */
+void board_scan_init(board_scan_t* scan, uint32_t share);
+
+/**
+ * @brief Pick the next pair to probe, if the scan may probe now
+ *
+ * The caller makes the probe and hands the result to board_scan_result().
+ *
+ * @param scan
+ * @param budget Board update budget, the probe is taken from what is spare
+ * @param busy Mask of known addresses in use for each channel, these are
+ * skipped. May be NULL
+ * @param channel Filled in with the channel to probe
+ * @param addr Filled in with the address to probe
+ * @return BOARD_DEV_READY if a probe should be made
+ */
+board_dev_status_t board_scan_next(board_scan_t* scan,
+                                   board_dev_budget_t* budget,
+                                   const uint8_t* busy, uint8_t* channel,
+                                   uint8_t* addr);
+
+/**
+ * @brief Record the result of a probe
+ *
+ * @param scan
+ * @param channel
+ * @param addr
+ * @param res Result of the probe, HAL_OK if the device answered
+ */
+void board_scan_result(board_scan_t* scan, uint8_t channel, uint8_t addr,
+                       hal_err_t res);
+
+/**
+ * @brief Forget a device, it is only found again once it answers a probe
+ *
+ * @param scan
+ * @param channel
+ * @param addr
+ */
+void board_scan_forget(board_scan_t* scan, uint8_t channel, uint8_t addr);
+
+/**
+ * @brief Find a channel where a device answered
+ *
+ * @param scan
+ * @param addr Device address
+ * @param preferred Channel returned if the device is found there
+ * @param channel Filled in with the channel
+ * @return BOARD_DEV_READY if the device was found
+ */
+board_dev_status_t board_scan_find(const board_scan_t* scan, uint8_t addr,
+                                   uint8_t preferred, uint8_t* channel);
+
+/**
+ * @brief Channel mask bit of a known address
+ *
+ * @param addr
+ * @return uint8_t Bit for the address, 0 if it is not a known address
+ */
+uint8_t board_scan_addr_bit(uint8_t addr);
+
+/**
+ * @brief Known address by index
+ *
+ * @param idx Index below BOARD_SCAN_NUM_ADDR
+ * @return uint8_t Address, 0 if idx is out of range
+ */
+uint8_t board_scan_addr(uint32_t idx);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ESP32_MAIN_BOARD_SCAN_H_
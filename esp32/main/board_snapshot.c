@@ -0,0 +1,90 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <board_snapshot.h>
+
+void board_snapshot_init(board_snapshot_t* snapshot) {
+  assert(snapshot);
+
+  if (snapshot != NULL) {
+    memset(&snapshot->sample, 0, sizeof(snapshot->sample));
+    __atomic_store_n(&snapshot->seq, 0u, __ATOMIC_RELEASE);
+  }
+}
+
+void board_snapshot_publish(board_snapshot_t* snapshot,
+                            const board_sample_t* sample) {
+  uint32_t seq;
+
+  assert(snapshot);
+  assert(sample);
+
+  if ((snapshot != NULL) && (sample != NULL)) {
+    seq = __atomic_load_n(&snapshot->seq, __ATOMIC_RELAXED);
+
+    // Mark the write as in progress, the fence keeps the sample stores from
+    // being seen before the odd sequence
+    __atomic_store_n(&snapshot->seq, seq + 1u, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(&snapshot->sample, sample, sizeof(snapshot->sample));
+    snapshot->sample.count = (seq / 2u) + 1u;
+
+    // Even again, publishes the sample stores
+    __atomic_store_n(&snapshot->seq, seq + 2u, __ATOMIC_RELEASE);
+  }
+}
+
+board_dev_status_t board_snapshot_read(const board_snapshot_t* snapshot,
+                                       board_sample_t* sample) {
+  board_dev_status_t retval;
+  uint32_t seq_start;
+  uint32_t seq_end;
+
+  assert(snapshot);
+  assert(sample);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((snapshot != NULL) && (sample != NULL)) {
+    for (uint32_t n = 0; (n < BOARD_SNAPSHOT_READ_RETRIES) &&
+                         (retval != BOARD_DEV_READY);
+         n++) {
+      seq_start = __atomic_load_n(&snapshot->seq, __ATOMIC_ACQUIRE);
+
+      // Nothing published yet, or the writer is part way through
+      if ((seq_start == 0u) || ((seq_start & 1u) != 0u)) {
+        continue;
+      }
+
+      memcpy(sample, &snapshot->sample, sizeof(*sample));
+
+      // Keep the sample loads from drifting past the second sequence load
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      seq_end = __atomic_load_n(&snapshot->seq, __ATOMIC_RELAXED);
+
+      if (seq_start == seq_end) {
+        retval = BOARD_DEV_READY;
+      }
+    }
+  }
+
+  return retval;
+}
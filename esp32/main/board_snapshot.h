@@ -0,0 +1,118 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#ifndef ESP32_MAIN_BOARD_SNAPSHOT_H_
+#define ESP32_MAIN_BOARD_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <board_dev.h>
+#include <board_ps.h>
+#include <board_fs.h>
+#include <board_volume.h>
+#include <board_scan.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup board_snapshot Board Sample Snapshot
+ * @ingroup board
+ * @brief Lock-free publication of the latest board samples to other cores
+ *
+ * A sequence lock, the board task is the only writer and never waits. Readers
+ * copy the sample out and retry if the writer touched it during the copy. The
+ * sequence is odd while a write is in progress.
+ * @{
+ */
+
+/** Number of attempts a reader makes before giving up on a consistent copy */
+#define BOARD_SNAPSHOT_READ_RETRIES 4u
+
+/** @brief Latest set of samples published by the board
+ */
+typedef struct board_sample_t {
+  uint32_t count;                   //!< Number of sample sets published
+  board_dev_status_t ps1_status;    //!< Status of the pressure sensor
+  board_dev_status_t fs1_status;    //!< Status of the flow sensor
+  ps_values_t ps1;                  //!< Latest pressure sensor values
+  fs_values_t fs1;                  //!< Latest flow sensor values
+  board_dev_stats_t sw_stats;       //!< I2C switch health
+  board_dev_stats_t ps1_stats;      //!< Pressure sensor health
+  board_dev_stats_t fs1_stats;      //!< Flow sensor health
+  board_dev_period_t period;        //!< Board update interval
+  board_dev_budget_t budget;        //!< Board update bus time allowance
+  hal_timestamp_t run_time_max;     //!< Longest board update since init
+  board_scan_t scan;                //!< Devices found on the mux channels
+  uint32_t bus_busy;                //!< Updates skipped waiting for the bus
+  uint32_t bus_load;                //!< Predicted bus time in use, in percent
+  uint32_t bus_divisor;             //!< Sample rates are divided by this
+  ps_info_t ps1_info;               //!< Pressure sensor calibration
+  fs_info_t fs1_info;               //!< Flow sensor identity
+  sfm3000_settings_t fs1_settings;  //!< Flow sensor calibration
+  board_volume_breath_t fs1_breath;  //!< Last breath completed
+  float fs1_volume;                  //!< Volume so far this breath, in ml
+  //! Raw pressure samples, read in place, see board_hist
+  const board_hist_t* ps1_hist;
+  //! Raw flow samples, read in place, see board_hist
+  const board_hist_t* fs1_hist;
+} board_sample_t;
+
+typedef struct board_snapshot_t {
+  uint32_t seq;           //!< Sequence counter, odd while being written
+  board_sample_t sample;  //!< Published sample set
+} board_snapshot_t;
+
+/**
+ * @brief Initialize snapshot, nothing is readable until first publish
+ *
+ * @param snapshot
+ */
+void board_snapshot_init(board_snapshot_t* snapshot);
+
+/**
+ * @brief Publish a new sample set
+ *
+ * Must only be called from a single writer. Never blocks.
+ *
+ * @param snapshot
+ * @param sample Sample set to publish, count is filled in
+ */
+void board_snapshot_publish(board_snapshot_t* snapshot,
+                            const board_sample_t* sample);
+
+/**
+ * @brief Read a consistent copy of the latest sample set
+ *
+ * Never blocks, makes at most BOARD_SNAPSHOT_READ_RETRIES attempts to get a
+ * copy the writer did not touch.
+ *
+ * @param snapshot
+ * @param sample Filled in with the latest sample set, contents are undefined
+ * unless BOARD_DEV_READY is returned
+ * @return BOARD_DEV_READY if sample holds a consistent copy
+ */
+board_dev_status_t board_snapshot_read(const board_snapshot_t* snapshot,
+                                       board_sample_t* sample);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ESP32_MAIN_BOARD_SNAPSHOT_H_
@@ -23,6 +23,8 @@ void sw_init(board_dev_sw_t* sw, hal_i2c_dev_t i2c_dev) {
   if (sw != NULL) {
     sw->i2c_dev = i2c_dev;
     sw->status = BOARD_DEV_NOT_READY;
+    sw->faults = 0;
+    board_dev_stats_not_ready(&sw->stats, hal_get_timestamp());
   }
 }
 
@@ -36,9 +38,15 @@ board_dev_status_t sw_set_channel(board_dev_sw_t* sw, uint8_t ch) {
 
   if (sw != NULL) {
     // Select the channel on the I2C switch that has the desired sensor on it
-    res = tca9548a_write_channel(hal_i2c_get_config(HAL_I2C_DEV_SWITCH), ch);
+    res = tca9548a_write_channel(hal_i2c_get_config(sw->i2c_dev), ch);
     if (res == HAL_OK) {
       sw->status = BOARD_DEV_READY;
+      sw->faults = 0;
+      board_dev_stats_sample(&sw->stats, hal_get_timestamp());
+    } else {
+      sw->status = BOARD_DEV_NOT_READY;
+      sw->faults++;
+      board_dev_stats_fault(&sw->stats, hal_get_timestamp(), res);
     }
     retval = sw->status;
   }
@@ -57,9 +65,14 @@ board_dev_status_t sw_get_channel(board_dev_sw_t* sw, uint8_t* ch) {
 
   if ((sw != NULL) && (ch != NULL)) {
     // Get the current channel from the switch
-    res = tca9548a_read_channel(hal_i2c_get_config(HAL_I2C_DEV_SWITCH), ch);
+    res = tca9548a_read_channel(hal_i2c_get_config(sw->i2c_dev), ch);
     if (res == HAL_OK) {
       sw->status = BOARD_DEV_READY;
+      board_dev_stats_sample(&sw->stats, hal_get_timestamp());
+    } else {
+      // Only used to poll the switch out of reset, where failures are
+      // expected, so not counted as faults
+      sw->status = BOARD_DEV_NOT_READY;
     }
     retval = sw->status;
   }
@@ -34,10 +34,15 @@ extern "C" {
  * @{
  */
 
+/** Estimated bus time of a channel selection */
+#define BOARD_SW_COST HAL_I2C_XFER_TIME_US(1u)
+
 typedef struct board_dev_sw_t {
   hal_i2c_dev_t i2c_dev;  //!< I2C device to use
   board_dev_status_t status;
   uint8_t last_channel;
+  uint32_t faults;  //!< Consecutive failed channel selections
+  board_dev_stats_t stats;  //!< Health counters, survive re-init
 } board_dev_sw_t;
 
 /**
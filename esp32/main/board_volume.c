@@ -0,0 +1,247 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <board_volume.h>
+
+/** ml per slm us, half of it for the trapezoids */
+#define HALF_ML_PER_SLM_US (0.5f / 60000.0f)
+
+/** slm per ml us */
+#define SLM_PER_ML_US 60000.0f
+
+static void integrate(board_volume_t* volume, hal_timestamp_t ts, float flow);
+static void add_area(board_volume_t* volume, float area);
+static void finish_breath(board_volume_t* volume);
+
+void board_volume_init(board_volume_t* volume) {
+  assert(volume);
+
+  if (volume != NULL) {
+    memset(volume, 0, sizeof(board_volume_t));
+    volume->phase = BOARD_VOLUME_PHASE_NONE;
+  }
+}
+
+board_dev_status_t board_volume_update(board_volume_t* volume,
+                                       const fs_values_t* values) {
+  board_dev_status_t retval;
+  hal_timestamp_t dt;
+  float flow;
+
+  assert(volume);
+  assert(values);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((volume != NULL) && (values != NULL) &&
+      ((volume->started == 0u) || (values->ts != volume->ts_last))) {
+    flow = values->flow - volume->offset;
+    dt = values->ts - volume->ts_last;
+
+    if ((volume->started != 0u) &&
+        ((dt < 0) || (dt > BOARD_VOLUME_GAP_MAX))) {
+      // Nothing is known about the flow in between
+      if (volume->in_breath != 0u) {
+        volume->gaps++;
+      }
+      volume->phase = BOARD_VOLUME_PHASE_NONE;
+      volume->in_breath = 0;
+      volume->pending = 0;
+    } else if (volume->started != 0u) {
+      integrate(volume, values->ts, flow);
+    }
+    volume->started = 1u;
+    volume->ts_last = values->ts;
+    volume->flow_last = flow;
+
+    switch (volume->phase) {
+      case BOARD_VOLUME_PHASE_INSPIRE:
+        if (flow < -BOARD_VOLUME_TRIGGER) {
+          volume->phase = BOARD_VOLUME_PHASE_EXPIRE;
+        }
+        break;
+
+      case BOARD_VOLUME_PHASE_EXPIRE:
+        // Past the trigger, so the flow crossed zero going up since
+        if (flow > BOARD_VOLUME_TRIGGER) {
+          if (volume->in_breath != 0u) {
+            finish_breath(volume);
+            retval = BOARD_DEV_READY;
+          }
+          volume->in_breath = 1u;
+          volume->ts_breath = volume->ts_zero;
+          volume->inspired = volume->pending_in;
+          volume->expired = 0.0f;
+          volume->peak = volume->pending_peak;
+          volume->pending = 0;
+          volume->phase = BOARD_VOLUME_PHASE_INSPIRE;
+        }
+        break;
+
+      default:
+        // Part way into a breath, wait for the next one
+        if (flow < -BOARD_VOLUME_TRIGGER) {
+          volume->phase = BOARD_VOLUME_PHASE_EXPIRE;
+        }
+        break;
+    }
+  }
+
+  return retval;
+}
+
+void board_volume_get_breath(const board_volume_t* volume,
+                             board_volume_breath_t* breath) {
+  assert(volume);
+  assert(breath);
+
+  if ((volume != NULL) && (breath != NULL)) {
+    *breath = volume->breath;
+  }
+}
+
+float board_volume_get_volume(const board_volume_t* volume) {
+  float retval;
+
+  assert(volume);
+
+  retval = 0.0f;
+
+  if ((volume != NULL) && (volume->in_breath != 0u)) {
+    retval = volume->inspired - volume->expired;
+  }
+
+  return retval;
+}
+
+static void integrate(board_volume_t* volume, hal_timestamp_t ts, float flow) {
+  float f0;
+  float dt;
+  float dt_cross;
+  hal_timestamp_t ts_rise;
+
+  assert(volume);
+
+  if (volume != NULL) {
+    f0 = volume->flow_last;
+    dt = (float)(ts - volume->ts_last);
+
+    if ((f0 > 0.0f) == (flow > 0.0f)) {
+      add_area(volume, (f0 + flow) * dt * HALF_ML_PER_SLM_US);
+    } else {
+      // Split where the line between the samples crosses zero
+      dt_cross = dt * (f0 / (f0 - flow));
+      add_area(volume, f0 * dt_cross * HALF_ML_PER_SLM_US);
+      if (flow > 0.0f) {
+        // Going up, this may be the start of the next breath. Only while
+        // expiring, inspiration dipping to zero does not end a breath
+        if (volume->phase != BOARD_VOLUME_PHASE_INSPIRE) {
+          volume->pending = 1u;
+          volume->pending_in = 0.0f;
+          volume->pending_peak = 0.0f;
+          volume->ts_zero = volume->ts_last + (hal_timestamp_t)dt_cross;
+        }
+      } else if (volume->pending != 0u) {
+        // Back down before the trigger, it was part of this breath after all
+        volume->pending = 0;
+        if (volume->pending_peak > volume->peak) {
+          volume->peak = volume->pending_peak;
+        }
+      }
+      add_area(volume, flow * (dt - dt_cross) * HALF_ML_PER_SLM_US);
+    }
+
+    // Rising out of the noise, where the line through the samples meets
+    // zero. Later than the crossing if the flow hovered about zero first
+    if ((volume->pending != 0u) && (f0 <= BOARD_VOLUME_NOISE) &&
+        (flow > BOARD_VOLUME_NOISE)) {
+      ts_rise = volume->ts_last + (hal_timestamp_t)(dt * (f0 / (f0 - flow)));
+      if (ts_rise > volume->ts_zero) {
+        volume->ts_zero = ts_rise;
+      }
+    }
+
+    if (volume->pending != 0u) {
+      if (flow > volume->pending_peak) {
+        volume->pending_peak = flow;
+      }
+    } else if (flow > volume->peak) {
+      volume->peak = flow;
+    }
+  }
+}
+
+static void add_area(board_volume_t* volume, float area) {
+  assert(volume);
+
+  if (volume != NULL) {
+    if (area >= 0.0f) {
+      volume->inspired += area;
+      if (volume->pending != 0u) {
+        volume->pending_in += area;
+      }
+    } else {
+      volume->expired -= area;
+    }
+  }
+}
+
+static void finish_breath(board_volume_t* volume) {
+  board_volume_breath_t* breath;
+  float duration;
+  float drift;
+
+  assert(volume);
+
+  if (volume != NULL) {
+    breath = &volume->breath;
+    breath->count++;
+    breath->ts = volume->ts_breath;
+    breath->duration = volume->ts_zero - volume->ts_breath;
+    breath->inspired = volume->inspired - volume->pending_in;
+    breath->expired = volume->expired;
+    breath->peak_flow = volume->peak;
+    duration = (float)breath->duration;
+
+    if (duration > 0.0f) {
+      if (breath->count == 1u) {
+        volume->avg_expired = breath->expired;
+        volume->avg_duration = duration;
+      } else {
+        volume->avg_expired +=
+            (breath->expired - volume->avg_expired) * BOARD_VOLUME_MINUTE_GAIN;
+        volume->avg_duration +=
+            (duration - volume->avg_duration) * BOARD_VOLUME_MINUTE_GAIN;
+      }
+      breath->minute_volume =
+          (volume->avg_expired / volume->avg_duration) * SLM_PER_ML_US;
+
+      // Whatever did not come back out is put down to offset drift, up to a
+      // limit so a real leak still shows
+      drift = ((breath->inspired - breath->expired) / duration) * SLM_PER_ML_US;
+      volume->offset += drift * BOARD_VOLUME_DRIFT_GAIN;
+      if (volume->offset > BOARD_VOLUME_DRIFT_MAX) {
+        volume->offset = BOARD_VOLUME_DRIFT_MAX;
+      } else if (volume->offset < -BOARD_VOLUME_DRIFT_MAX) {
+        volume->offset = -BOARD_VOLUME_DRIFT_MAX;
+      }
+    }
+  }
+}
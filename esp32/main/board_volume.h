@@ -0,0 +1,163 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#ifndef ESP32_MAIN_BOARD_VOLUME_H_
+#define ESP32_MAIN_BOARD_VOLUME_H_
+
+#include <stdint.h>
+#include <hal.h>
+#include <board_dev.h>
+#include <board_fs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup board_volume Board Volume Integration
+ * @ingroup board
+ * @brief Inspired and expired volume of each breath, from the flow samples
+ *
+ * Each flow sample adds the trapezoid between it and the previous one, at
+ * their own timestamps, so it takes constant time and keeps no samples. A
+ * trapezoid that crosses zero is split where the line between the samples
+ * does, so each part lands on the right side of the breath.
+ *
+ * A breath starts where the flow last rose from zero, once the flow has gone
+ * past BOARD_VOLUME_TRIGGER, after having gone below -BOARD_VOLUME_TRIGGER.
+ * Flow sitting within BOARD_VOLUME_NOISE of zero, in a pause, has not risen
+ * yet. The net volume of a breath is taken as sensor
+ * drift and fed back into a flow offset.
+ * @{
+ */
+
+/** Flow past which inspiration or expiration is taken to have started, in
+ * slm */
+#ifndef BOARD_VOLUME_TRIGGER
+#define BOARD_VOLUME_TRIGGER 2.0f
+#endif
+
+/** Flow within this of zero is taken as no flow when finding the start of a
+ * breath, in slm */
+#ifndef BOARD_VOLUME_NOISE
+#define BOARD_VOLUME_NOISE 0.2f
+#endif
+
+/** Time between samples past which the breath in progress is dropped, in us
+ */
+#ifndef BOARD_VOLUME_GAP_MAX
+#define BOARD_VOLUME_GAP_MAX 100000
+#endif
+
+/** Fraction of each breath's net flow added to the drift estimate, 0 to
+ * turn drift correction off */
+#ifndef BOARD_VOLUME_DRIFT_GAIN
+#define BOARD_VOLUME_DRIFT_GAIN 0.25f
+#endif
+
+/** Largest drift estimate, in slm. A leak bigger than this is not hidden */
+#ifndef BOARD_VOLUME_DRIFT_MAX
+#define BOARD_VOLUME_DRIFT_MAX 1.0f
+#endif
+
+/** Weight of each new breath in the minute volume */
+#define BOARD_VOLUME_MINUTE_GAIN 0.25f
+
+typedef enum board_volume_phase_t {
+  BOARD_VOLUME_PHASE_NONE,     //!< No trigger since init or a gap
+  BOARD_VOLUME_PHASE_INSPIRE,  //!< Flow went past BOARD_VOLUME_TRIGGER
+  BOARD_VOLUME_PHASE_EXPIRE,   //!< Flow went below -BOARD_VOLUME_TRIGGER
+} board_volume_phase_t;
+
+/** @brief A completed breath
+ */
+typedef struct board_volume_breath_t {
+  uint32_t count;            //!< Breaths completed since init
+  hal_timestamp_t ts;        //!< Start of the breath
+  hal_timestamp_t duration;  //!< Length of the breath, in us
+  float inspired;            //!< Volume in, in ml
+  float expired;             //!< Volume out, in ml
+  float peak_flow;           //!< Highest inspiratory flow, in slm
+  float minute_volume;       //!< Expired volume per minute, in l/min
+} board_volume_breath_t;
+
+typedef struct board_volume_t {
+  board_volume_phase_t phase;
+  uint8_t started;           //!< ts_last and flow_last hold a sample
+  uint8_t in_breath;         //!< Start of the breath in progress was seen
+  uint8_t pending;           //!< Flow crossed zero going up, not triggered
+  hal_timestamp_t ts_last;   //!< Timestamp of the previous sample
+  float flow_last;           //!< Previous sample, drift corrected, in slm
+  hal_timestamp_t ts_breath;  //!< Start of the breath in progress
+  hal_timestamp_t ts_zero;    //!< Last time the flow rose from zero
+  float inspired;      //!< Volume in during the breath in progress, in ml
+  float expired;       //!< Volume out during the breath in progress, in ml
+  float peak;          //!< Highest flow of the breath in progress, in slm
+  float pending_in;    //!< Part of inspired since ts_zero, in ml
+  float pending_peak;  //!< Highest flow since ts_zero, in slm
+  float offset;        //!< Drift estimate taken off each sample, in slm
+  float avg_expired;   //!< Running average of expired volume, in ml
+  float avg_duration;  //!< Running average of breath length, in us
+  uint32_t gaps;       //!< Breaths dropped for missing samples
+  board_volume_breath_t breath;  //!< Last breath completed
+} board_volume_t;
+
+/**
+ * @brief Start integrating, with no drift estimate
+ *
+ * @param volume
+ */
+void board_volume_init(board_volume_t* volume);
+
+/**
+ * @brief Take in a flow sample
+ *
+ * Samples with the timestamp of the previous one are ignored, so the latest
+ * values can be passed in on every board update.
+ *
+ * @param volume
+ * @param values
+ * @return BOARD_DEV_READY if the sample completed a breath, see
+ * board_volume_get_breath()
+ */
+board_dev_status_t board_volume_update(board_volume_t* volume,
+                                       const fs_values_t* values);
+
+/**
+ * @brief Get the last breath completed
+ *
+ * @param volume
+ * @param breath Filled in with the breath, count is 0 until there is one
+ */
+void board_volume_get_breath(const board_volume_t* volume,
+                             board_volume_breath_t* breath);
+
+/**
+ * @brief Get the net volume since the start of the breath in progress
+ *
+ * @param volume
+ * @return float Volume in, less volume out, in ml
+ */
+float board_volume_get_volume(const board_volume_t* volume);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ESP32_MAIN_BOARD_VOLUME_H_
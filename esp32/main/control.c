@@ -17,21 +17,53 @@ along with this program.  If not, see www.gnu.org/licenses/.
 
 #include <control.h>
 #include <board.h>
+#include <hal.h>
 #include <stdlib.h>
+#include <string.h>
 
-void control_init(control_t* control) {
+static const control_config_t control_config[BOARD_CIRCUITS] = {
+    {.name = "CONTROL1",
+     .valve_pins = {HAL_GPIO_DRV_CH1_PIN, HAL_GPIO_DRV_CH2_PIN}},
+#if (BOARD_CIRCUITS > 1u)
+    {.name = "CONTROL2",
+     .valve_pins = {HAL_GPIO_DRV_CH3_PIN, HAL_GPIO_DRV_CH4_PIN}},
+#endif
+};
+
+const control_config_t* control_get_config(uint32_t circuit) {
+  return (circuit < BOARD_CIRCUITS) ? &control_config[circuit] : NULL;
+}
+
+void control_init(control_t* control, const control_config_t* config,
+                  const board_snapshot_t* snapshot) {
   assert(control);
+  assert(config);
+  assert(snapshot);
 
-  if (control != NULL) {
+  if ((control != NULL) && (config != NULL) && (snapshot != NULL)) {
+    control->config = config;
+    for (uint32_t n = 0; n < CONTROL_NUM_VALVES; n++) {
+      hal_gpio_write(config->valve_pins[n], 0);
+    }
     control->state = CONTROL_STATE_RESET;
     control->settings.mode = CONTROL_MODE_OFF;
+    control->snapshot = snapshot;
+    memset(&control->sample, 0, sizeof(control->sample));
   }
 }
 
 void control_update(control_t* control) {
+  board_sample_t sample;
+
   assert(control);
 
   if (control != NULL) {
+    // Pick up the latest board samples, keep the previous ones if the board
+    // was part way through publishing
+    if (board_snapshot_read(control->snapshot, &sample) == BOARD_DEV_READY) {
+      control->sample = sample;
+    }
+
     switch (control->state) {
       case CONTROL_STATE_RESET:
         break;
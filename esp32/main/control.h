@@ -19,6 +19,7 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #define ESP32_MAIN_CONTROL_H_
 
 #include <stdint.h>
+#include <board_snapshot.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,6 +31,9 @@ extern "C" {
  * @{
  */
 
+/** Valves driven by each circuit */
+#define CONTROL_NUM_VALVES 2u
+
 typedef enum control_mode_t {
   CONTROL_MODE_OFF,
   CONTROL_MODE_MANUAL,
@@ -48,12 +52,39 @@ typedef struct control_settings_t {
   control_mode_t mode;
 } control_settings_t;
 
+/** @brief Outputs of one patient circuit
+ */
+typedef struct control_config_t {
+  const char* name;                         //!< Log topic of the circuit
+  uint32_t valve_pins[CONTROL_NUM_VALVES];  //!< HAL_GPIO_DRV_CH* of its valves
+} control_config_t;
+
 typedef struct control_t {
+  const control_config_t* config;  //!< Which circuit this is
   control_state_t state;
   control_settings_t settings;
+  const board_snapshot_t* snapshot;  //!< Where the board publishes samples
+  board_sample_t sample;             //!< Latest consistent board samples
 } control_t;
 
-void control_init(control_t* control);
+/**
+ * @brief Get the configuration of a patient circuit
+ *
+ * @param circuit Index of the circuit, below BOARD_CIRCUITS
+ * @return const control_config_t* NULL if there is no such circuit
+ */
+const control_config_t* control_get_config(uint32_t circuit);
+
+/**
+ * @brief Initialize controller, its valves start closed
+ *
+ * @param control
+ * @param config Circuit the controller drives, see control_get_config()
+ * @param snapshot Board sample snapshot of the same circuit to read sensor
+ * values from
+ */
+void control_init(control_t* control, const control_config_t* config,
+                  const board_snapshot_t* snapshot);
 
 void control_update(control_t* control);
 
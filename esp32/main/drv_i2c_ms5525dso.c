@@ -21,6 +21,8 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #include <stdint.h>
 #include <stdlib.h>
 
+static int64_t div_pow2(int64_t x, int64_t q);
+
 hal_err_t ms5525dso_soft_reset(const hal_i2c_config_t* cfg) {
   hal_err_t res;
 
@@ -156,8 +158,8 @@ hal_err_t ms5525dso_start_ch_convert(const hal_i2c_config_t* cfg,
   return res;
 }
 
-hal_err_t ms5525dso_read_all_coeff(const hal_i2c_config_t* cfg,
-                                   ms5525dso_coeff_t* coeff) {
+hal_err_t ms5525dso_read_prom_batch(const hal_i2c_config_t* cfg, uint8_t first,
+                                    uint8_t count, ms5525dso_coeff_t* coeff) {
   hal_err_t res;
 
   assert(cfg);
@@ -165,23 +167,53 @@ hal_err_t ms5525dso_read_all_coeff(const hal_i2c_config_t* cfg,
 
   res = HAL_ERR_FAIL;
 
-  if ((cfg != NULL) && (coeff != NULL)) {
-    uint16_t value;
+  if ((cfg != NULL) && (coeff != NULL) && (count > 0u) &&
+      (((uint32_t)first + count) <= MS5525DSO_NUM_PROM_ADDR)) {
+    uint8_t cmd[MS5525DSO_NUM_PROM_ADDR];
+    uint8_t prom_data[MS5525DSO_NUM_PROM_ADDR][MS5525DSO_NUM_PROM_BYTES];
+    hal_i2c_xfer_t xfers[MS5525DSO_NUM_PROM_ADDR];
+
+    // Select each PROM address then read it, as ms5525dso_read_prom() does
+    for (uint8_t n = 0; n < count; n++) {
+      cmd[n] = MS5525DSO_REG_PROM_READ_BASE |
+               (((first + n) & MS5525DSO_REG_PROM_ADDR_MASK)
+                << MS5525DSO_REG_PROM_ADDR_OFST);
+      xfers[n].tx = &cmd[n];
+      xfers[n].tx_len = sizeof(cmd[n]);
+      xfers[n].rx = prom_data[n];
+      xfers[n].rx_len = MS5525DSO_NUM_PROM_BYTES;
+    }
+    res = hal_i2c_batch(cfg, xfers, count);
 
-    // Loop through the addresses and gather up the PROM values + the 4-bit CRC
-    res = HAL_OK;
-    for (uint8_t n = 0; (n < MS5525DSO_NUM_PROM_ADDR) && (res == HAL_OK); n++) {
-      res = ms5525dso_read_prom(cfg, n, &value);
-      if (res == HAL_OK) {
-        coeff->c[n] = value;
+    if (res == HAL_OK) {
+      // MSB is in the first byte
+      for (uint8_t n = 0; n < count; n++) {
+        coeff->c[first + n] = (prom_data[n][0] << 8u) | prom_data[n][1];
       }
     }
+  }
+
+  return res;
+}
 
-    // Check the CRC4 only if the read appears to have worked
-    // No need to check if res is OK before attempting, as we only set res to
-    // HAL_ERR_FAIL, not HAL_OK
-    if (ms5525dso_calculate_coeff_crc(coeff) != (coeff->c[7] & 0x000Fu)) {
-      res = HAL_ERR_FAIL;
+hal_err_t ms5525dso_read_all_coeff(const hal_i2c_config_t* cfg,
+                                   ms5525dso_coeff_t* coeff) {
+  hal_err_t res;
+
+  assert(cfg);
+  assert(coeff);
+
+  res = HAL_ERR_FAIL;
+
+  if ((cfg != NULL) && (coeff != NULL)) {
+    // Gather up the PROM values + the 4-bit CRC in one go
+    res = ms5525dso_read_prom_batch(cfg, 0, MS5525DSO_NUM_PROM_ADDR, coeff);
+
+    // Check the CRC4 only if the read appears to have worked, a failed read
+    // keeps its own error
+    if ((res == HAL_OK) &&
+        (ms5525dso_calculate_coeff_crc(coeff) != (coeff->c[7] & 0x000Fu))) {
+      res = HAL_ERR_CRC;
     }
   }
 
@@ -231,6 +263,9 @@ void ms5525dso_calculate_pt(const ms5525dso_qx_t* qx,
                             const ms5525dso_coeff_t* coeff, uint32_t d1,
                             uint32_t d2, float* p_compensated,
                             float* t_compensated) {
+  int32_t p;
+  int32_t t;
+
   assert(qx);
   assert(coeff);
   assert(p_compensated);
@@ -238,35 +273,126 @@ void ms5525dso_calculate_pt(const ms5525dso_qx_t* qx,
 
   if ((qx != NULL) && (coeff != NULL) && (p_compensated != NULL) &&
       (t_compensated != NULL)) {
+    ms5525dso_calculate_pt_fixed(qx, coeff, d1, d2, &p, &t);
+    *p_compensated = MS5525DSO_CONVERT_P_TO_FLOAT(p);
+    *t_compensated = MS5525DSO_CONVERT_T_TO_FLOAT(t);
+  }
+}
+
+void ms5525dso_calculate_pt_fixed(const ms5525dso_qx_t* qx,
+                                  const ms5525dso_coeff_t* coeff, uint32_t d1,
+                                  uint32_t d2, int32_t* p_compensated,
+                                  int32_t* t_compensated) {
+  ms5525dso_comp_t comp;
+
+  assert(qx);
+  assert(coeff);
+  assert(p_compensated);
+  assert(t_compensated);
+
+  if ((qx != NULL) && (coeff != NULL) && (p_compensated != NULL) &&
+      (t_compensated != NULL)) {
+    ms5525dso_prepare_comp(qx, coeff, &comp);
+    ms5525dso_compensate(&comp, d1, d2, p_compensated, t_compensated);
+  }
+}
+
+void ms5525dso_prepare_comp(const ms5525dso_qx_t* qx,
+                            const ms5525dso_coeff_t* coeff,
+                            ms5525dso_comp_t* comp) {
+  assert(qx);
+  assert(coeff);
+  assert(comp);
+
+  if ((qx != NULL) && (coeff != NULL) && (comp != NULL)) {
+    // TREF = C5 * 2^Q5
+    comp->t_ref = (int64_t)coeff->c[5] << qx->Q5;
+    // OFFT1 = C2 * 2^Q2
+    comp->off_t1 = (int64_t)coeff->c[2] << qx->Q2;
+    // SENST1 = C1 * 2^Q1
+    comp->sens_t1 = (int64_t)coeff->c[1] << qx->Q1;
+    comp->tcs = coeff->c[3];
+    comp->tco = coeff->c[4];
+    comp->tempsens = coeff->c[6];
+    comp->q3 = (uint8_t)qx->Q3;
+    comp->q4 = (uint8_t)qx->Q4;
+    comp->q6 = (uint8_t)qx->Q6;
+  }
+}
+
+void ms5525dso_compensate(const ms5525dso_comp_t* comp, uint32_t d1,
+                          uint32_t d2, int32_t* p_compensated,
+                          int32_t* t_compensated) {
+  assert(comp);
+  assert(p_compensated);
+  assert(t_compensated);
+
+  if ((comp != NULL) && (p_compensated != NULL) && (t_compensated != NULL)) {
     int64_t dT;
-    int64_t TEMP;
     int64_t OFF;
     int64_t SENS;
 
     // Difference between actual and reference temperature
-    // dT = D2 - TRE F = D2 - C5 * 2^Q5
-    dT = (int64_t)d2 - (coeff->c[5] * ((int64_t)1 << (int64_t)qx->Q5));
+    // dT = D2 - TREF
+    dT = (int64_t)d2 - comp->t_ref;
 
     // Measured temperature
     // TEMP=20°C+dT*TEMPSENS=2000+dT*C6/2^Q6
-    TEMP = 2000 + ((dT * coeff->c[6]) / (1 << qx->Q6));
+    *t_compensated = (int32_t)(2000 + div_pow2(dT * comp->tempsens, comp->q6));
 
     // Offset at actual temperature
-    // OFF=OFFT1+TCO * dT
-    // = C2*2^Q2+(C4*dT)/2^Q4
-    OFF = (coeff->c[2] * (1 << qx->Q2)) +
-          ((coeff->c[4] * dT) / (1 << qx->Q4));
+    // OFF=OFFT1+TCO*dT=C2*2^Q2+(C4*dT)/2^Q4
+    OFF = comp->off_t1 + div_pow2(comp->tco * dT, comp->q4);
 
     // Sensitivity at actual temperature
     // SENS=SENST1+TCS*dT=C1*2^Q1+(C3*dT)/2^Q3
-    SENS = (coeff->c[1] * (1 << qx->Q1)) +
-           ((coeff->c[3] * dT) / (1 << qx->Q3));
+    SENS = comp->sens_t1 + div_pow2(comp->tcs * dT, comp->q3);
 
     // Temperature Compensated Pressure
     // P=D1*SENS-OFF=(D1*SENS/2^21-OFF)/2^15
-    *p_compensated =
-        MS5525DSO_CONVERT_P_TO_FLOAT(((d1 * SENS) / (1 << 21) - OFF) / (1 << 15));
-    *t_compensated = MS5525DSO_CONVERT_T_TO_FLOAT(TEMP);
+    *p_compensated = (int32_t)div_pow2(div_pow2(d1 * SENS, 21) - OFF, 15);
+  }
+}
+
+void ms5525dso_calculate_pt_batch(const ms5525dso_comp_t* comp,
+                                  const uint32_t* restrict d1,
+                                  const uint32_t* restrict d2,
+                                  int32_t* restrict p_compensated,
+                                  int32_t* restrict t_compensated,
+                                  uint32_t count) {
+  assert(comp);
+  assert(d1);
+  assert(d2);
+  assert(p_compensated);
+  assert(t_compensated);
+
+  if ((comp != NULL) && (d1 != NULL) && (d2 != NULL) &&
+      (p_compensated != NULL) && (t_compensated != NULL)) {
+    // Constants in locals, so the compiler knows the stores below cannot
+    // change them and keeps them in registers across the loop
+    const int64_t t_ref = comp->t_ref;
+    const int64_t off_t1 = comp->off_t1;
+    const int64_t sens_t1 = comp->sens_t1;
+    const int64_t tcs = comp->tcs;
+    const int64_t tco = comp->tco;
+    const int64_t tempsens = comp->tempsens;
+    const int64_t q3 = comp->q3;
+    const int64_t q4 = comp->q4;
+    const int64_t q6 = comp->q6;
+
+    // Same steps as ms5525dso_compensate(), without a branch in the loop
+    for (uint32_t n = 0; n < count; n++) {
+      int64_t dT;
+      int64_t OFF;
+      int64_t SENS;
+
+      dT = (int64_t)d2[n] - t_ref;
+      t_compensated[n] = (int32_t)(2000 + div_pow2(dT * tempsens, q6));
+      OFF = off_t1 + div_pow2(tco * dT, q4);
+      SENS = sens_t1 + div_pow2(tcs * dT, q3);
+      p_compensated[n] =
+          (int32_t)div_pow2(div_pow2((int64_t)d1[n] * SENS, 21) - OFF, 15);
+    }
   }
 }
 
@@ -280,3 +406,10 @@ hal_timestamp_t ms5525dso_get_conversion_time(ms5525dso_osr_t osr) {
     default: return 10000;
   }
 }
+
+static int64_t div_pow2(int64_t x, int64_t q) {
+  // Rounds toward zero as the datasheet's divide does, a shift on its own
+  // would round negative values down. Negative values are biased up by
+  // 2^q - 1 first, without a branch, GCC shifts signed values arithmetically
+  return (x + ((x >> 63) & (((int64_t)1 << q) - 1))) >> q;
+}
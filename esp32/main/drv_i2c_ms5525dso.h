@@ -117,6 +117,23 @@ typedef struct ms5525dso_qx_t {
   int64_t Q6;  //!< Amount to bitshift when performing calculations
 } ms5525dso_qx_t;
 
+/** @brief Compensation constants of one sensor
+ *
+ * The terms of the compensation that only depend on the PROM and Qx table,
+ * worked out once by ms5525dso_prepare_comp() rather than on every sample.
+ */
+typedef struct ms5525dso_comp_t {
+  int64_t t_ref;     //!< Reference temperature reading, C5 * 2^Q5
+  int64_t off_t1;    //!< Offset at reference temperature, C2 * 2^Q2
+  int64_t sens_t1;   //!< Sensitivity at reference temperature, C1 * 2^Q1
+  int64_t tcs;       //!< Temperature coefficient of sensitivity, C3
+  int64_t tco;       //!< Temperature coefficient of offset, C4
+  int64_t tempsens;  //!< Temperature coefficient of temperature, C6
+  uint8_t q3;        //!< Shift applied to the sensitivity term
+  uint8_t q4;        //!< Shift applied to the offset term
+  uint8_t q6;        //!< Shift applied to the temperature term
+} ms5525dso_comp_t;
+
 /** @brief Perform soft reset of device
  *
  * Performs a soft reset of the device, this required on power-on-reset. Per
@@ -148,6 +165,23 @@ hal_err_t ms5525dso_soft_reset(const hal_i2c_config_t* cfg);
 hal_err_t ms5525dso_read_prom(const hal_i2c_config_t* cfg, uint8_t prom_addr,
                               uint16_t* prom_value);
 
+/** @brief Read a run of PROM values in one batch
+ *
+ * The same as calling ms5525dso_read_prom() for each address, but the reads
+ * are all queued up as one hal_i2c_batch(). No CRC4 check, the run may only
+ * be part of the table.
+ *
+ * @param cfg I2C configuration for this device
+ * @param first First PROM address to read
+ * @param count Number of addresses to read, first + count must not be more
+ * than MS5525DSO_NUM_PROM_ADDR
+ * @param coeff Table to fill in, only c[first] to c[first + count - 1] are
+ * changed
+ * @return HAL_OK if no error, hal_err_t value otherwise
+ */
+hal_err_t ms5525dso_read_prom_batch(const hal_i2c_config_t* cfg, uint8_t first,
+                                    uint8_t count, ms5525dso_coeff_t* coeff);
+
 /** @brief Read ADC channel conversion result
  *
  * This will get the results of the last conversion of last requested channel.
@@ -166,9 +200,10 @@ hal_err_t ms5525dso_read_adc(const hal_i2c_config_t* cfg, uint32_t* adc_value);
 
 /** @brief Read all PROM values
  *
- * Reads all 8 PROM addresses and fills in the full coefficient table. This
- * function performs the CRC4 check for you, and will return ESP_FAIL if the
- * CRC4 is not a match to the calculated value
+ * Reads all 8 PROM addresses, in one batch, and fills in the full coefficient
+ * table. This function performs the CRC4 check for you, once all of them are
+ * in, and will return HAL_ERR_CRC if the CRC4 is not a match to the
+ * calculated value
  *
  * @param cfg I2C configuration for this device
  * @param coeff Pointer to structure where the PROM values will be stored
@@ -224,6 +259,73 @@ void ms5525dso_calculate_pt(const ms5525dso_qx_t* qx,
                                  uint32_t d2, float* p_compensated,
                                  float* t_compensated);
 
+/** @brief Calculate the compensated pressure and temperature, integers only
+ *
+ * The same calculation as ms5525dso_calculate_pt(), which converts these
+ * results to float. Every division by 2^Qx is a shift, rounded toward zero
+ * as the datasheet's divide is, so the results are bit-exact.
+ *
+ * @param qx Pointer to QX table to use, determined by manufacturer model
+ * @param coeff Pointer to coefficient table to use
+ * @param d1 Pressure ADC channel value to use
+ * @param d2 Temperature ADC channel value to use
+ * @param p_compensated Filled in with the compensated pressure, in PSI x 10000
+ * @param t_compensated Filled in with the compensated temperature, in C x 100
+ */
+void ms5525dso_calculate_pt_fixed(const ms5525dso_qx_t* qx,
+                                  const ms5525dso_coeff_t* coeff, uint32_t d1,
+                                  uint32_t d2, int32_t* p_compensated,
+                                  int32_t* t_compensated);
+
+/** @brief Work out the compensation constants of a sensor
+ *
+ * Done once the coefficient table has been read and passed its CRC, then
+ * every sample goes through ms5525dso_compensate().
+ *
+ * @param qx Pointer to QX table to use, determined by manufacturer model
+ * @param coeff Pointer to coefficient table to use
+ * @param comp Filled in with the constants
+ */
+void ms5525dso_prepare_comp(const ms5525dso_qx_t* qx,
+                            const ms5525dso_coeff_t* coeff,
+                            ms5525dso_comp_t* comp);
+
+/** @brief Calculate the compensated pressure and temperature from prepared
+ * constants
+ *
+ * Bit-exact with ms5525dso_calculate_pt_fixed() for the same PROM and Qx
+ * table, without the per sample work of building the constants.
+ *
+ * @param comp Constants from ms5525dso_prepare_comp()
+ * @param d1 Pressure ADC channel value to use
+ * @param d2 Temperature ADC channel value to use
+ * @param p_compensated Filled in with the compensated pressure, in PSI x 10000
+ * @param t_compensated Filled in with the compensated temperature, in C x 100
+ */
+void ms5525dso_compensate(const ms5525dso_comp_t* comp, uint32_t d1,
+                          uint32_t d2, int32_t* p_compensated,
+                          int32_t* t_compensated);
+
+/** @brief Calculate the compensated pressure and temperature of many samples
+ *
+ * For reprocessing recorded raw samples. Takes and fills in separate arrays,
+ * one value per sample, so the loop has no calls or pointer chasing and
+ * compilers vectorise it where the target has the instructions for it.
+ * Bit-exact with ms5525dso_compensate() sample by sample. The arrays must not
+ * overlap.
+ *
+ * @param comp Constants from ms5525dso_prepare_comp()
+ * @param d1 Pressure ADC channel values
+ * @param d2 Temperature ADC channel values
+ * @param p_compensated Filled in with the compensated pressures, in PSI x 10000
+ * @param t_compensated Filled in with the compensated temperatures, in C x 100
+ * @param count Number of samples
+ */
+void ms5525dso_calculate_pt_batch(const ms5525dso_comp_t* comp,
+                                  const uint32_t* d1, const uint32_t* d2,
+                                  int32_t* p_compensated,
+                                  int32_t* t_compensated, uint32_t count);
+
 hal_timestamp_t ms5525dso_get_conversion_time(ms5525dso_osr_t osr);
 
 /** @} */
@@ -77,6 +77,9 @@ extern "C" {
 /** Given by datasheet, used to adjust conversion calculation for O2 */
 #define SFM3000_GIVEN_SCALE_FACTOR_O2 142.8f
 
+/** Fraction bits of the offset in sfm3000_conv_t */
+#define SFM3000_CONV_OFFSET_BITS 8u
+
 /** @brief Parameter settings for SFM3000
  *
  * Contains settings for calculations
@@ -88,6 +91,19 @@ typedef struct sfm3000_settings_t {
                        //!< changed if not using Air/N2
 } sfm3000_settings_t;
 
+/** @brief Conversion constants of one set of settings
+ *
+ * Worked out once by sfm3000_prepare_conv() when the settings change, so
+ * each sample takes a subtract and a multiply rather than a divide.
+ */
+typedef struct sfm3000_conv_t {
+  float offset;      //!< Offset, as in the settings
+  float inv_scale;   //!< 1 / scale factor
+  int32_t offset_q;  //!< Offset x 2^SFM3000_CONV_OFFSET_BITS
+  int32_t recip;     //!< 1000 / scale factor, x 2^(shift - offset bits)
+  uint8_t shift;     //!< Shift taking the product to milli-slm, 0 if unset
+} sfm3000_conv_t;
+
 /** @brief Soft reset of SFM3000
  *
  * Perform a software reset of the SFM3000 device, afterwards it will be
@@ -191,6 +207,45 @@ hal_err_t sfm3000_read_product(const hal_i2c_config_t* cfg, uint32_t* product);
  */
 hal_err_t sfm3000_convert_to_slm(uint16_t flow_raw, const sfm3000_settings_t* settings, float* flow);
 
+/**
+ * @brief Work out the conversion constants of settings
+ *
+ * Fails, leaving conv unusable, for the same scale factors
+ * sfm3000_convert_to_slm() refuses and for offsets outside the raw range.
+ *
+ * @param settings Offset and scale factor to use for conversion
+ * @param conv Filled in with the constants
+ * @return hal_err_t
+ */
+hal_err_t sfm3000_prepare_conv(const sfm3000_settings_t* settings,
+                               sfm3000_conv_t* conv);
+
+/**
+ * @brief Convert raw flow rate to slm with prepared constants
+ *
+ * Within 2 ulp of sfm3000_convert_to_slm() for the same settings.
+ *
+ * @param flow_raw Raw flow rate to perform conversion on
+ * @param conv Constants from sfm3000_prepare_conv()
+ * @param flow
+ * @return hal_err_t
+ */
+hal_err_t sfm3000_convert(uint16_t flow_raw, const sfm3000_conv_t* conv,
+                          float* flow);
+
+/**
+ * @brief Convert raw flow rate to milli-slm with prepared constants
+ *
+ * Integer only, rounded to the nearest milli-slm.
+ *
+ * @param flow_raw Raw flow rate to perform conversion on
+ * @param conv Constants from sfm3000_prepare_conv()
+ * @param flow Flow in slm x 1000
+ * @return hal_err_t
+ */
+hal_err_t sfm3000_convert_mslm(uint16_t flow_raw, const sfm3000_conv_t* conv,
+                               int32_t* flow);
+
 /** @} */
 
 #ifdef __cplusplus
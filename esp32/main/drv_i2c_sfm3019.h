@@ -73,6 +73,16 @@ extern "C" {
 /** Read product number and serial number command code */
 #define SFM3019_REG_READ_PRODUCT 0xE102u
 
+/** Added to the signed flow reading by sfm3019_read_flow() */
+#define SFM3019_FLOW_BIAS 32768
+
+/** Given by datasheet, -24576 for the signed reading, biased as
+ * sfm3019_read_flow() returns it */
+#define SFM3019_GIVEN_OFFSET 8192u
+
+/** Given by datasheet, the same for every gas */
+#define SFM3019_GIVEN_SCALE_FACTOR 170.0f
+
 typedef enum sfm3019_gas_t {
   SFM3019_GAS_O2 = 0,  //!< Pure O2 gas mix
   SFM3019_GAS_AIR,     //!< Air gas mix (20% Oxygen?)
@@ -106,6 +116,19 @@ hal_err_t sfm3019_start_cont_meas(const hal_i2c_config_t* cfg,
 hal_err_t sfm3019_read_meas(const hal_i2c_config_t* cfg, int16_t* flow,
                             int16_t* temp, int16_t* status);
 
+/**
+ * @brief Read just the flow word of a conversion
+ *
+ * The temperature and status words are left unread. The signed reading is
+ * returned plus SFM3019_FLOW_BIAS, so it orders like an SFM3000 reading and
+ * converts the same way.
+ *
+ * @param cfg I2C configuration for this device
+ * @param flow_raw Raw flow rate, biased
+ * @return hal_err_t
+ */
+hal_err_t sfm3019_read_flow(const hal_i2c_config_t* cfg, uint16_t* flow_raw);
+
 /**
  * @brief Update concentration
  *
@@ -21,17 +21,25 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #include <hal.h>
 #include <driver/gpio.h>
 #include <driver/i2c.h>
+#include <nvs.h>
+#include <xtensa/hal.h>
 #include <drv_i2c_ms5525dso.h>
 #include <drv_i2c_sfm3000.h>
 #include <drv_i2c_tca9548a.h>
 
 static hal_log_level_t current_log_level = HAL_LOG_NONE;
 
+static StaticSemaphore_t i2c_lock_buffer[HAL_I2C_NUM_PORTS];
+static SemaphoreHandle_t i2c_lock[HAL_I2C_NUM_PORTS];
+
 static const char* get_log_color(hal_log_level_t log_level);
 static const char* get_log_level_string(hal_log_level_t log_level);
+static hal_err_t to_hal_err(esp_err_t res);
 
 hal_timestamp_t hal_get_timestamp(void) { return esp_timer_get_time(); }
 
+uint32_t hal_get_cycles(void) { return xthal_get_ccount(); }
+
 void hal_set_log_level(hal_log_level_t new_log_level) {
   current_log_level = new_log_level;
 }
@@ -68,6 +76,28 @@ void hal_init(void) {
       i2c_driver_install(I2C_NUM_0, I2C_MODE_MASTER, 0, 0, ESP_INTR_FLAG_IRAM));
 
   ESP_ERROR_CHECK(i2c_set_timeout(I2C_NUM_0, HAL_I2C_DEFAULT_TIMEOUT_PERIOD));
+
+#if (HAL_I2C_CIRCUIT2_PORT != I2C_NUM_0)
+  const i2c_config_t i2c2_cfg = {
+      .mode = I2C_MODE_MASTER,
+      .sda_io_num = HAL_I2C2_MASTER_SDA_IO_PIN,
+      .sda_pullup_en = false,
+      .scl_io_num = HAL_I2C2_MASTER_SCL_IO_PIN,
+      .scl_pullup_en = false,
+      .master.clk_speed = HAL_I2C_MASTER_FREQ,
+  };
+
+  ESP_ERROR_CHECK(i2c_param_config(HAL_I2C_CIRCUIT2_PORT, &i2c2_cfg));
+  ESP_ERROR_CHECK(i2c_driver_install(HAL_I2C_CIRCUIT2_PORT, I2C_MODE_MASTER,
+                                     0, 0, ESP_INTR_FLAG_IRAM));
+  ESP_ERROR_CHECK(
+      i2c_set_timeout(HAL_I2C_CIRCUIT2_PORT, HAL_I2C_DEFAULT_TIMEOUT_PERIOD));
+#endif
+
+  // Before any task that uses the buses is started
+  for (uint32_t n = 0; n < HAL_I2C_NUM_PORTS; n++) {
+    i2c_lock[n] = xSemaphoreCreateMutexStatic(&i2c_lock_buffer[n]);
+  }
 }
 
 
@@ -139,6 +169,23 @@ static const hal_i2c_config_t i2c_fs_cfg = {
     .i2c_port_num = I2C_NUM_0,
     .i2c_timeout = HAL_I2C_DEFAULT_TIMEOUT_PERIOD};
 
+static const hal_i2c_config_t i2c_switch2_cfg = {
+    .i2c_addr = HAL_I2C_SWITCH2_ADDR,
+    .i2c_port_num = HAL_I2C_CIRCUIT2_PORT,
+    .i2c_timeout = HAL_I2C_DEFAULT_TIMEOUT_PERIOD};
+
+static const hal_i2c_config_t i2c_ps2_cfg = {
+    // PS2 Config
+    .i2c_addr = HAL_I2C_PS2_ADDR,
+    .i2c_port_num = HAL_I2C_CIRCUIT2_PORT,
+    .i2c_timeout = HAL_I2C_DEFAULT_TIMEOUT_PERIOD};
+
+static const hal_i2c_config_t i2c_fs2_cfg = {
+    // FS2 Config
+    .i2c_addr = HAL_I2C_FS2_ADDR,
+    .i2c_port_num = HAL_I2C_CIRCUIT2_PORT,
+    .i2c_timeout = HAL_I2C_DEFAULT_TIMEOUT_PERIOD};
+
 const hal_i2c_config_t* hal_i2c_get_config(hal_i2c_dev_t dev) {
   switch (dev) {
     case HAL_I2C_DEV_SWITCH:
@@ -147,6 +194,12 @@ const hal_i2c_config_t* hal_i2c_get_config(hal_i2c_dev_t dev) {
       return &i2c_ps_cfg;
     case HAL_I2C_DEV_FS1:
       return &i2c_fs_cfg;
+    case HAL_I2C_DEV_SWITCH2:
+      return &i2c_switch2_cfg;
+    case HAL_I2C_DEV_PS2:
+      return &i2c_ps2_cfg;
+    case HAL_I2C_DEV_FS2:
+      return &i2c_fs2_cfg;
     default:
       return 0;
   }
@@ -154,6 +207,57 @@ const hal_i2c_config_t* hal_i2c_get_config(hal_i2c_dev_t dev) {
   return 0;
 }
 
+hal_err_t hal_i2c_lock(const hal_i2c_config_t* cfg) {
+  assert(cfg);
+  if ((!cfg) || (cfg->i2c_port_num >= HAL_I2C_NUM_PORTS)) {
+    return HAL_ERR_FAIL;
+  }
+
+  if (xSemaphoreTake(i2c_lock[cfg->i2c_port_num],
+                     pdMS_TO_TICKS(HAL_I2C_LOCK_TIMEOUT_MS)) != pdTRUE) {
+    return HAL_ERR_FAIL;
+  }
+
+  return HAL_OK;
+}
+
+void hal_i2c_unlock(const hal_i2c_config_t* cfg) {
+  assert(cfg);
+  if ((cfg) && (cfg->i2c_port_num < HAL_I2C_NUM_PORTS)) {
+    xSemaphoreGive(i2c_lock[cfg->i2c_port_num]);
+  }
+}
+
+hal_err_t hal_i2c_probe(const hal_i2c_config_t* cfg) {
+  i2c_cmd_handle_t cmd;
+  esp_err_t res;
+
+  assert(cfg);
+  if (!cfg) {
+    return HAL_ERR_FAIL;
+  }
+
+  // Create link to queue i2c messages up into
+  cmd = i2c_cmd_link_create();
+  if (!cmd) {
+    return HAL_ERR_FAIL;
+  }
+
+  // Address only, a missing or busy device will not ACK
+  ESP_ERROR_CHECK(i2c_master_start(cmd));
+  ESP_ERROR_CHECK(
+      i2c_master_write_byte(cmd, (cfg->i2c_addr << 1) | I2C_MASTER_WRITE, 1));
+  ESP_ERROR_CHECK(i2c_master_stop(cmd));
+
+  // Execute queued i2c commands
+  res = i2c_master_cmd_begin(cfg->i2c_port_num, cmd, cfg->i2c_timeout);
+
+  // Cleanup the link
+  i2c_cmd_link_delete(cmd);
+
+  return to_hal_err(res);
+}
+
 hal_err_t hal_i2c_write(const hal_i2c_config_t* cfg, const uint8_t* buffer,
                         uint8_t len) {
   i2c_cmd_handle_t cmd;
@@ -181,7 +285,7 @@ hal_err_t hal_i2c_write(const hal_i2c_config_t* cfg, const uint8_t* buffer,
   // Cleanup the link
   i2c_cmd_link_delete(cmd);
 
-  return (res == ESP_OK) ? HAL_OK : HAL_ERR_FAIL;
+  return to_hal_err(res);
 }
 
 hal_err_t hal_i2c_read(const hal_i2c_config_t* cfg, uint8_t* buffer,
@@ -219,5 +323,119 @@ hal_err_t hal_i2c_read(const hal_i2c_config_t* cfg, uint8_t* buffer,
   // Cleanup the link
   i2c_cmd_link_delete(cmd);
 
+  return to_hal_err(res);
+}
+
+hal_err_t hal_i2c_batch(const hal_i2c_config_t* cfg,
+                        const hal_i2c_xfer_t* xfers, uint8_t count) {
+  i2c_cmd_handle_t cmd;
+  esp_err_t res;
+  uint8_t n;
+  uint8_t k;
+
+  assert(cfg);
+  assert(xfers);
+  if ((!cfg) || (!xfers)) {
+    return HAL_ERR_FAIL;
+  }
+
+  // Create link to queue i2c messages up into
+  cmd = i2c_cmd_link_create();
+  if (!cmd) {
+    return HAL_ERR_FAIL;
+  }
+
+  // Queue up every transfer, each write and read as if it was on its own
+  for (n = 0; n < count; n++) {
+    if (xfers[n].tx_len > 0u) {
+      ESP_ERROR_CHECK(i2c_master_start(cmd));
+      ESP_ERROR_CHECK(i2c_master_write_byte(
+          cmd, (cfg->i2c_addr << 1) | I2C_MASTER_WRITE, 1));
+      for (k = 0; k < xfers[n].tx_len; k++) {
+        ESP_ERROR_CHECK(i2c_master_write_byte(cmd, xfers[n].tx[k], 1));
+      }
+      ESP_ERROR_CHECK(i2c_master_stop(cmd));
+    }
+    if (xfers[n].rx_len > 0u) {
+      ESP_ERROR_CHECK(i2c_master_start(cmd));
+      ESP_ERROR_CHECK(i2c_master_write_byte(
+          cmd, (cfg->i2c_addr << 1) | I2C_MASTER_READ, 1));
+      for (k = 0; k < xfers[n].rx_len; k++) {
+        ESP_ERROR_CHECK(i2c_master_read_byte(
+            cmd, &xfers[n].rx[k],
+            (k < (xfers[n].rx_len - 1)) ? I2C_MASTER_ACK : I2C_MASTER_NACK));
+      }
+      ESP_ERROR_CHECK(i2c_master_stop(cmd));
+    }
+  }
+
+  // Execute queued i2c commands, all of them in one go
+  res = i2c_master_cmd_begin(cfg->i2c_port_num, cmd, cfg->i2c_timeout);
+
+  // Cleanup the link
+  i2c_cmd_link_delete(cmd);
+
+  return to_hal_err(res);
+}
+
+hal_err_t hal_nvs_read_blob(const char* name_space, const char* key,
+                            void* buffer, size_t* len) {
+  nvs_handle handle;
+  esp_err_t res;
+
+  assert(name_space);
+  assert(key);
+  assert(buffer);
+  assert(len);
+  if ((!name_space) || (!key) || (!buffer) || (!len)) {
+    return HAL_ERR_FAIL;
+  }
+
+  res = nvs_open(name_space, NVS_READONLY, &handle);
+  if (res != ESP_OK) {
+    return HAL_ERR_FAIL;
+  }
+
+  res = nvs_get_blob(handle, key, buffer, len);
+  nvs_close(handle);
+
+  return (res == ESP_OK) ? HAL_OK : HAL_ERR_FAIL;
+}
+
+hal_err_t hal_nvs_write_blob(const char* name_space, const char* key,
+                             const void* buffer, size_t len) {
+  nvs_handle handle;
+  esp_err_t res;
+
+  assert(name_space);
+  assert(key);
+  assert(buffer);
+  if ((!name_space) || (!key) || (!buffer)) {
+    return HAL_ERR_FAIL;
+  }
+
+  res = nvs_open(name_space, NVS_READWRITE, &handle);
+  if (res != ESP_OK) {
+    return HAL_ERR_FAIL;
+  }
+
+  res = nvs_set_blob(handle, key, buffer, len);
+  if (res == ESP_OK) {
+    res = nvs_commit(handle);
+  }
+  nvs_close(handle);
+
   return (res == ESP_OK) ? HAL_OK : HAL_ERR_FAIL;
 }
+
+static hal_err_t to_hal_err(esp_err_t res) {
+  switch (res) {
+    case ESP_OK:
+      return HAL_OK;
+    case ESP_FAIL:
+      // The IDF I2C driver reports a missing ACK as a plain ESP_FAIL
+      return HAL_ERR_NACK;
+    default:
+      return HAL_ERR_FAIL;
+  }
+}
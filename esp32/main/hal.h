@@ -20,6 +20,9 @@ along with this program.  If not, see www.gnu.org/licenses/.
 
 #include <driver/gpio.h>
 #include <driver/i2c.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -40,9 +43,37 @@ extern "C" {
 /** SDA I2C pin */
 #define HAL_I2C_MASTER_SDA_IO_PIN 23
 
+/** Port of the I2C bus circuit 2 sensors are on. On port 0 they share the
+ * bus and mux with circuit 1, on mux channels of their own. Override at build
+ * time to give circuit 2 a bus of its own */
+#ifndef HAL_I2C_CIRCUIT2_PORT
+#define HAL_I2C_CIRCUIT2_PORT I2C_NUM_0
+#endif
+
+/** SCL pin of the second I2C bus, only used if circuit 2 is on port 1 */
+#define HAL_I2C2_MASTER_SCL_IO_PIN 25
+
+/** SDA pin of the second I2C bus, only used if circuit 2 is on port 1 */
+#define HAL_I2C2_MASTER_SDA_IO_PIN 26
+
+/** Number of I2C master ports on the ESP32 */
+#define HAL_I2C_NUM_PORTS 2u
+
+/** Longest wait for another task to finish with a bus */
+#define HAL_I2C_LOCK_TIMEOUT_MS 10u
+
 /** 400kHz I2C bus master */
 #define HAL_I2C_MASTER_FREQ 400000u
 
+/** Start, stop and driver setup per transfer, in us */
+#define HAL_I2C_XFER_OVERHEAD_US 50u
+
+/** Estimated time of one transfer of n data bytes plus the address byte, 9
+ * clocks a byte, in us */
+#define HAL_I2C_XFER_TIME_US(n) \
+  (((((n) + 1u) * 9u * 1000000u) / HAL_I2C_MASTER_FREQ) + \
+   HAL_I2C_XFER_OVERHEAD_US)
+
 /** I2C is in APB 80MHz clock period */
 #define HAL_I2C_TIMEOUT_PERIOD_IN_US(x) ((x) * (I2C_APB_CLK_FREQ / 1000000u))
 
@@ -52,6 +83,9 @@ extern "C" {
 #define HAL_I2C_PS1_ADDR MS5525DSO_I2C_ADDR_HIGH
 #define HAL_I2C_FS1_ADDR SFM3000_I2C_ADDR
 #define HAL_I2C_SWITCH_ADDR TCA9548A_ADDR_LLL
+#define HAL_I2C_PS2_ADDR MS5525DSO_I2C_ADDR_HIGH
+#define HAL_I2C_FS2_ADDR SFM3000_I2C_ADDR
+#define HAL_I2C_SWITCH2_ADDR TCA9548A_ADDR_LLL
 
 #define HAL_GPIO_DRV_RSTn_PIN 14u
 #define HAL_GPIO_LED1_PIN 13u
@@ -61,15 +95,15 @@ extern "C" {
 #define HAL_GPIO_DRV_CH2_PIN 33u
 #define HAL_GPIO_DRV_CH1_PIN 27u
 
-#define HAL_I2C_SWITCH_CH_PS1 (1u << 7)
-#define HAL_I2C_SWITCH_CH_FS1 (1u << 0)
-
 typedef int64_t hal_timestamp_t;
 
 typedef enum hal_i2c_dev_t {
     HAL_I2C_DEV_SWITCH,
     HAL_I2C_DEV_PS1,
     HAL_I2C_DEV_FS1,
+    HAL_I2C_DEV_SWITCH2,
+    HAL_I2C_DEV_PS2,
+    HAL_I2C_DEV_FS2,
 } hal_i2c_dev_t;
 
 typedef enum hal_log_level_t {
@@ -84,7 +118,12 @@ typedef enum hal_log_level_t {
  * @brief HAL errors
  *
  */
-typedef enum hal_err_t { HAL_OK, HAL_ERR_FAIL } hal_err_t;
+typedef enum hal_err_t {
+  HAL_OK,
+  HAL_ERR_FAIL,  //!< Any other failure, bad arguments, bus timeout
+  HAL_ERR_NACK,  //!< Device did not acknowledge the transfer
+  HAL_ERR_CRC    //!< Data was transferred but failed its CRC check
+} hal_err_t;
 
 
 typedef gpio_num_t hal_gpio_t;
@@ -99,6 +138,17 @@ typedef struct hal_i2c_config_t {
   TickType_t i2c_timeout;   //!< I2C timeout in ticks
 } hal_i2c_config_t;
 
+/**
+ * @brief One transfer of a batch, a write then a read, either may be empty
+ *
+ */
+typedef struct hal_i2c_xfer_t {
+  const uint8_t* tx;  //!< Bytes to write
+  uint8_t tx_len;     //!< Number of bytes to write, 0 for none
+  uint8_t* rx;        //!< Buffer for the bytes read
+  uint8_t rx_len;     //!< Number of bytes to read, 0 for none
+} hal_i2c_xfer_t;
+
 
 void hal_init(void);
 
@@ -146,6 +196,14 @@ void hal_log(hal_log_level_t log_level, const char* topic, const char* fmt,
 
 hal_timestamp_t hal_get_timestamp(void);
 
+/**
+ * @brief CPU cycle counter of the calling core, for timing short stretches of
+ * code
+ *
+ * @return uint32_t Cycles, wraps around
+ */
+uint32_t hal_get_cycles(void);
+
 /**
  * @brief Get the I2C configuration of a given board device
  *
@@ -154,6 +212,37 @@ hal_timestamp_t hal_get_timestamp(void);
  */
 const hal_i2c_config_t* hal_i2c_get_config(hal_i2c_dev_t dev);
 
+/**
+ * @brief Take a bus for a run of transfers
+ *
+ * Tasks sharing a bus hold it from selecting a mux channel until they are
+ * done with the device behind it, so another task can not switch the channel
+ * in between.
+ *
+ * @param cfg I2C configuration of any device on the bus
+ * @return HAL_OK if the bus was taken, HAL_ERR_FAIL if it stayed busy for
+ * HAL_I2C_LOCK_TIMEOUT_MS
+ */
+hal_err_t hal_i2c_lock(const hal_i2c_config_t* cfg);
+
+/**
+ * @brief Release a bus taken with hal_i2c_lock()
+ *
+ * @param cfg I2C configuration of any device on the bus
+ */
+void hal_i2c_unlock(const hal_i2c_config_t* cfg);
+
+/**
+ * @brief Probe for a device on the I2C bus
+ *
+ * Sends the address byte only, the cheapest transaction that tells whether a
+ * device is present and responding.
+ *
+ * @param cfg I2C configuration of device
+ * @return HAL_OK if the device acknowledged its address
+ */
+hal_err_t hal_i2c_probe(const hal_i2c_config_t* cfg);
+
 /**
  * @brief Writes data to given I2C device
  *
@@ -176,6 +265,50 @@ hal_err_t hal_i2c_write(const hal_i2c_config_t* cfg, const uint8_t* buffer,
 hal_err_t hal_i2c_read(const hal_i2c_config_t* cfg, uint8_t* buffer,
                        uint8_t len);  //!< Function pointer to i2c_read
 
+/**
+ * @brief Run a batch of transfers with the given I2C device
+ *
+ * The transfers are queued up and run back to back, each write and read with
+ * its own start and stop, and the task is woken once when the last one is
+ * done. Cheaper than one hal_i2c_write() or hal_i2c_read() per transfer,
+ * which each pay for setting up the driver and waiting on it.
+ *
+ * @param cfg I2C configuration of device
+ * @param xfers Transfers, in bus order
+ * @param count Number of transfers
+ * @return hal_err_t HAL_OK if every transfer went through, the first error
+ * otherwise, with the contents of the read buffers undefined
+ */
+hal_err_t hal_i2c_batch(const hal_i2c_config_t* cfg,
+                        const hal_i2c_xfer_t* xfers, uint8_t count);
+
+/**
+ * @brief Reads a binary blob from non-volatile storage
+ *
+ * @param name_space NVS namespace the blob is stored under
+ * @param key Key of the blob
+ * @param buffer Buffer to store the blob in
+ * @param len In: size of buffer, out: size of the blob read
+ * @return HAL_OK if the blob exists and fit in buffer
+ */
+hal_err_t hal_nvs_read_blob(const char* name_space, const char* key,
+                            void* buffer, size_t* len);
+
+/**
+ * @brief Writes a binary blob to non-volatile storage, and commits it
+ *
+ * Blocks while the flash is written, which can take tens of ms, so only for
+ * data that rarely changes.
+ *
+ * @param name_space NVS namespace to store the blob under
+ * @param key Key of the blob
+ * @param buffer Blob to store
+ * @param len Size of the blob
+ * @return HAL_OK if the blob was stored
+ */
+hal_err_t hal_nvs_write_blob(const char* name_space, const char* key,
+                             const void* buffer, size_t len);
+
 /** @} */
 
 #ifdef __cplusplus
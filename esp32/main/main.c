@@ -22,18 +22,44 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #include <board.h>
 #include <control.h>
 #include <esp_system.h>
+#include <esp_timer.h>
 #include <esp_task_wdt.h>
 #include <serial_link.h>
 #include <nvs_flash.h>
 #include "main.h"
 
-static StackType_t stackbuffer_control[TASK_CONTROL_STACK_SIZE];
-static StaticTask_t taskbuffer_control;
-static TaskHandle_t task_control_handle;
+#if (BOARD_DEV_BUDGET > TASK_BOARD_PERIOD_US)
+#error "BOARD_DEV_BUDGET does not fit in TASK_BOARD_PERIOD_US"
+#endif
 
-static StackType_t stackbuffer_board[TASK_BOARD_STACK_SIZE];
-static StaticTask_t taskbuffer_board;
-static TaskHandle_t task_board_handle;
+#if (BOARD_BUS_PERIOD != TASK_BOARD_PERIOD_US)
+#error "BOARD_BUS_PERIOD does not match TASK_BOARD_PERIOD_US"
+#endif
+
+/**
+ * @brief One patient circuit, its board and control loop run in tasks of
+ * their own
+ */
+typedef struct circuit_t {
+  uint32_t index;  //!< Circuit number, from 0
+  board_t board;
+  control_t control;
+  StackType_t stackbuffer_control[TASK_CONTROL_STACK_SIZE];
+  StaticTask_t taskbuffer_control;
+  TaskHandle_t task_control_handle;
+  StackType_t stackbuffer_board[TASK_BOARD_STACK_SIZE];
+  StaticTask_t taskbuffer_board;
+  TaskHandle_t task_board_handle;
+} circuit_t;
+
+static circuit_t circuits[BOARD_CIRCUITS];
+
+static const char* const task_control_name[] = {TASK_CONTROL_NAME,
+                                                 TASK_CONTROL2_NAME};
+static const char* const task_board_name[] = {TASK_BOARD_NAME,
+                                              TASK_BOARD2_NAME};
+static const BaseType_t task_board_core[] = {TASK_BOARD_PINNED_CORE,
+                                             TASK_BOARD2_PINNED_CORE};
 
 static StackType_t stackbuffer_serial_link[TASK_SERIAL_LINK_STACK_SIZE];
 static StaticTask_t taskbuffer_serial_link;
@@ -42,6 +68,7 @@ static TaskHandle_t task_serial_link_handle;
 static void task_control(void* param);
 static void task_board(void* param);
 static void task_serial_link(void* param);
+static void board_timer_callback(void* arg);
 
 /**
  * @brief Entry function
@@ -61,17 +88,21 @@ void app_main(void) {
 
   hal_init();
 
-  // Create the Controller task
-  task_control_handle = xTaskCreateStaticPinnedToCore(
-      &task_control, TASK_CONTROL_NAME, TASK_CONTROL_STACK_SIZE, NULL,
-      TASK_CONTROL_PRIORITY, stackbuffer_control, &taskbuffer_control,
-      TASK_CONTROL_PINNED_CORE);
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    circuits[n].index = n;
 
-  // Create the Board task
-  task_board_handle = xTaskCreateStaticPinnedToCore(
-      &task_board, TASK_BOARD_NAME, TASK_BOARD_STACK_SIZE, NULL,
-      TASK_BOARD_PRIORITY, stackbuffer_board, &taskbuffer_board,
-      TASK_BOARD_PINNED_CORE);
+    // Create the Controller task
+    circuits[n].task_control_handle = xTaskCreateStaticPinnedToCore(
+        &task_control, task_control_name[n], TASK_CONTROL_STACK_SIZE,
+        &circuits[n], TASK_CONTROL_PRIORITY, circuits[n].stackbuffer_control,
+        &circuits[n].taskbuffer_control, TASK_CONTROL_PINNED_CORE);
+
+    // Create the Board task
+    circuits[n].task_board_handle = xTaskCreateStaticPinnedToCore(
+        &task_board, task_board_name[n], TASK_BOARD_STACK_SIZE, &circuits[n],
+        TASK_BOARD_PRIORITY, circuits[n].stackbuffer_board,
+        &circuits[n].taskbuffer_board, task_board_core[n]);
+  }
 
   // Create the Serial Link task
   task_serial_link_handle = xTaskCreateStaticPinnedToCore(
@@ -84,42 +115,72 @@ void app_main(void) {
 
 static void task_control(void* param) {
   TickType_t xLastWakeTime;
-  control_t control;
+  circuit_t* circuit = (circuit_t*)param;
+  control_t* control = &circuit->control;
 
-  esp_task_wdt_add(task_control_handle);
-  control_init(&control);
+  esp_task_wdt_add(NULL);
+  // Board lives in static storage, its snapshot reads as empty until the
+  // board task publishes the first samples
+  control_init(control, control_get_config(circuit->index),
+               &circuit->board.snapshot);
 
   xLastWakeTime = xTaskGetTickCount();
   for (;;) {
     esp_task_wdt_reset();
-    control_update(&control);
+    control_update(control);
     vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(TASK_CONTROL_INTERVAL_MS));
   }
-  esp_task_wdt_delete(task_control_handle);
+  esp_task_wdt_delete(NULL);
 }
 
 static void task_board(void* param) {
-  TickType_t xLastWakeTime;
-  board_t board;
+  esp_timer_handle_t timer;
+  circuit_t* circuit = (circuit_t*)param;
+  board_t* board = &circuit->board;
+  const esp_timer_create_args_t timer_args = {
+      .callback = &board_timer_callback,
+      .arg = xTaskGetCurrentTaskHandle(),
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = task_board_name[circuit->index]};
 
-  esp_task_wdt_add(task_board_handle);
-  board_init(&board);
+  esp_task_wdt_add(NULL);
+
+  // A circuit whose sensors do not fit on the bus is never run, its snapshot
+  // stays empty so the control loop sees no samples
+  if (board_init(board, board_get_config(circuit->index)) != BOARD_DEV_READY) {
+    hal_log(HAL_LOG_ERROR, task_board_name[circuit->index],
+            "Sensors do not fit on the bus, board not started");
+    esp_task_wdt_delete(NULL);
+    vTaskDelete(NULL);
+  }
+
+  // The tick based vTaskDelayUntil() can not go below one tick, wake from a
+  // microsecond timer instead
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
+  ESP_ERROR_CHECK(esp_timer_start_periodic(timer, TASK_BOARD_PERIOD_US));
 
-  xLastWakeTime = xTaskGetTickCount();
   for (;;) {
+    // Periods missed while busy collapse into one wake up, rather than a
+    // burst of back to back updates
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     esp_task_wdt_reset();
-    board_update(&board);
-    vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(TASK_BOARD_INTERVAL_MS));
+    board_update(board);
+    board_store_cal(board);
   }
-  esp_task_wdt_delete(task_board_handle);
+  esp_timer_delete(timer);
+  esp_task_wdt_delete(NULL);
 }
 
 static void task_serial_link(void* param) {
   TickType_t xLastWakeTime;
   serial_link_t serial_link;
+  const board_snapshot_t* snapshots[BOARD_CIRCUITS];
 
   esp_task_wdt_add(task_serial_link_handle);
-  serial_link_init(&serial_link);
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    snapshots[n] = &circuits[n].board.snapshot;
+  }
+  serial_link_init(&serial_link, snapshots, BOARD_CIRCUITS);
 
   xLastWakeTime = xTaskGetTickCount();
   for (;;) {
@@ -129,3 +190,8 @@ static void task_serial_link(void* param) {
   }
   esp_task_wdt_delete(task_serial_link_handle);
 }
+
+static void board_timer_callback(void* arg) {
+  // Runs in the esp_timer task, not an ISR
+  xTaskNotifyGive((TaskHandle_t)arg);
+}
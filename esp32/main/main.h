@@ -29,12 +29,27 @@ extern "C" {
 #define TASK_CONTROL_INTERVAL_MS 10
 #define TASK_CONTROL_PINNED_CORE 1
 #define TASK_CONTROL_NAME "control"
+#define TASK_CONTROL2_NAME "control2"
 
 #define TASK_BOARD_STACK_SIZE 8192
 #define TASK_BOARD_PRIORITY 7
-#define TASK_BOARD_INTERVAL_MS 5
+/** Board task is woken by a periodic timer, override at build time. How much
+ * the wake ups jitter at a given period has not been measured here, it is
+ * only known on target, from the serial "stats" command */
+#ifndef TASK_BOARD_PERIOD_US
+#define TASK_BOARD_PERIOD_US 1000
+#endif
+/** Shortest period a build accepts, not a period known to run with low
+ * jitter. A pressure read behind its mux select, 425us, has to fit in
+ * BOARD_DEV_BUDGET, which fits in the period, so both are overridden with it.
+ * Two circuits sharing a bus need twice that, board.c refuses less */
+#define TASK_BOARD_PERIOD_MIN_US 500
 #define TASK_BOARD_PINNED_CORE 0
 #define TASK_BOARD_NAME "board"
+/** Second circuit's board task runs on the other core, in parallel when it
+ * has a bus of its own */
+#define TASK_BOARD2_PINNED_CORE 1
+#define TASK_BOARD2_NAME "board2"
 
 #define TASK_SERIAL_LINK_STACK_SIZE 8192
 #define TASK_SERIAL_LINK_PRIORITY 6
@@ -42,6 +57,10 @@ extern "C" {
 #define TASK_SERIAL_LINK_PINNED_CORE 0
 #define TASK_SERIAL_LINK_NAME "serial_link"
 
+#if (TASK_BOARD_PERIOD_US < TASK_BOARD_PERIOD_MIN_US)
+#error "TASK_BOARD_PERIOD_US is below TASK_BOARD_PERIOD_MIN_US"
+#endif
+
 #ifdef __cplusplus
 }
 #endif
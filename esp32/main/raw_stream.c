@@ -0,0 +1,461 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <raw_stream.h>
+
+/** Payload of a pressure calibration, OSR, Q1 to Q6 and the PROM */
+#define CAL_PS_LEN (1u + 6u + (2u * MS5525DSO_NUM_PROM_ADDR))
+
+/** Payload of a flow calibration, serial number, offset and scale */
+#define CAL_FS_LEN 12u
+
+/** Payload of a breath, count, duration, then four floats */
+#define BREATH_LEN 24u
+
+static uint32_t finish(uint8_t* buffer, raw_stream_type_t type,
+                       uint8_t circuit, uint32_t len);
+static void put_u16(uint8_t* buffer, uint16_t value);
+static void put_u32(uint8_t* buffer, uint32_t value);
+static void put_float(uint8_t* buffer, float value);
+static uint16_t get_u16(const uint8_t* buffer);
+static uint32_t get_u32(const uint8_t* buffer);
+static float get_float(const uint8_t* buffer);
+static board_dev_status_t check_position(uint32_t start, uint32_t count,
+                                         uint32_t* next, uint32_t* dropped);
+
+uint32_t raw_stream_encode_cal_ps(uint8_t* buffer, uint8_t circuit,
+                                  ms5525dso_osr_t osr,
+                                  const ms5525dso_qx_t* qx,
+                                  const ms5525dso_coeff_t* coeff) {
+  uint8_t* payload;
+  uint32_t len;
+
+  assert(buffer);
+  assert(qx);
+  assert(coeff);
+
+  len = 0;
+
+  if ((buffer != NULL) && (qx != NULL) && (coeff != NULL)) {
+    payload = &buffer[RAW_STREAM_HEADER_LEN];
+    payload[0] = (uint8_t)osr;
+    payload[1] = (uint8_t)qx->Q1;
+    payload[2] = (uint8_t)qx->Q2;
+    payload[3] = (uint8_t)qx->Q3;
+    payload[4] = (uint8_t)qx->Q4;
+    payload[5] = (uint8_t)qx->Q5;
+    payload[6] = (uint8_t)qx->Q6;
+    for (uint32_t n = 0; n < MS5525DSO_NUM_PROM_ADDR; n++) {
+      put_u16(&payload[7u + (2u * n)], coeff->c[n]);
+    }
+    len = finish(buffer, RAW_STREAM_CAL_PS, circuit, CAL_PS_LEN);
+  }
+
+  return len;
+}
+
+uint32_t raw_stream_encode_cal_fs(uint8_t* buffer, uint8_t circuit,
+                                  uint32_t serial,
+                                  const sfm3000_settings_t* settings) {
+  uint8_t* payload;
+  uint32_t bits;
+  uint32_t len;
+
+  assert(buffer);
+  assert(settings);
+
+  len = 0;
+
+  if ((buffer != NULL) && (settings != NULL)) {
+    // The floats go as their bits, so the host divides by exactly the same
+    // values
+    payload = &buffer[RAW_STREAM_HEADER_LEN];
+    put_u32(&payload[0], serial);
+    memcpy(&bits, &settings->offset, sizeof(bits));
+    put_u32(&payload[4], bits);
+    memcpy(&bits, &settings->scale_factor, sizeof(bits));
+    put_u32(&payload[8], bits);
+    len = finish(buffer, RAW_STREAM_CAL_FS, circuit, CAL_FS_LEN);
+  }
+
+  return len;
+}
+
+uint32_t raw_stream_encode_samples(uint8_t* buffer, raw_stream_type_t type,
+                                   uint8_t circuit,
+                                   const board_hist_span_t* span,
+                                   uint32_t* count) {
+  const board_hist_sample_t* sample;
+  uint8_t* payload;
+  uint32_t n;
+  uint32_t len;
+
+  assert(buffer);
+  assert(span);
+  assert(count);
+
+  len = 0;
+
+  if ((buffer != NULL) && (span != NULL) && (count != NULL)) {
+    payload = &buffer[RAW_STREAM_HEADER_LEN];
+    put_u32(payload, span->start);
+
+    for (n = 0; (n < (span->first_len + span->second_len)) &&
+                (n < RAW_STREAM_MAX_SAMPLES);
+         n++) {
+      sample = (n < span->first_len) ? &span->first[n]
+                                     : &span->second[n - span->first_len];
+      payload = &buffer[RAW_STREAM_HEADER_LEN + 4u +
+                        (n * RAW_STREAM_SAMPLE_LEN)];
+      payload[0] = (uint8_t)sample->raw;
+      payload[1] = (uint8_t)(sample->raw >> 8);
+      payload[2] = (uint8_t)(sample->raw >> 16);
+      put_u16(&payload[3], sample->dt);
+      payload[5] = (uint8_t)sample->flags;
+    }
+
+    *count = n;
+    len = finish(buffer, type, circuit, 4u + (n * RAW_STREAM_SAMPLE_LEN));
+  }
+
+  return len;
+}
+
+uint32_t raw_stream_encode_breath(uint8_t* buffer, uint8_t circuit,
+                                  const board_volume_breath_t* breath) {
+  uint8_t* payload;
+  uint32_t len;
+
+  assert(buffer);
+  assert(breath);
+
+  len = 0;
+
+  if ((buffer != NULL) && (breath != NULL)) {
+    payload = &buffer[RAW_STREAM_HEADER_LEN];
+    put_u32(&payload[0], breath->count);
+    put_u32(&payload[4], (uint32_t)breath->duration);
+    put_float(&payload[8], breath->inspired);
+    put_float(&payload[12], breath->expired);
+    put_float(&payload[16], breath->peak_flow);
+    put_float(&payload[20], breath->minute_volume);
+    len = finish(buffer, RAW_STREAM_BREATH, circuit, BREATH_LEN);
+  }
+
+  return len;
+}
+
+board_dev_status_t raw_stream_parse(const uint8_t* buffer, uint32_t len,
+                                    raw_stream_frame_t* frame, uint32_t* used) {
+  board_dev_status_t retval;
+  uint32_t n;
+  uint32_t frame_len;
+  uint8_t sum;
+
+  assert(buffer);
+  assert(frame);
+  assert(used);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((buffer != NULL) && (frame != NULL) && (used != NULL)) {
+    *used = len;
+
+    // A frame cut short may still be completed by bytes yet to come, those
+    // are kept unless a whole frame follows. A sync byte in the data of a
+    // frame can look like the start of a long one
+    for (n = 0; (n < len) && (retval != BOARD_DEV_READY); n++) {
+      if (buffer[n] != RAW_STREAM_SYNC) {
+        continue;
+      }
+
+      if ((len - n) < RAW_STREAM_HEADER_LEN) {
+        *used = (*used < n) ? *used : n;
+        continue;
+      }
+      if (buffer[n + 3u] > RAW_STREAM_MAX_PAYLOAD) {
+        continue;
+      }
+      frame_len = RAW_STREAM_HEADER_LEN + buffer[n + 3u] + 1u;
+      if ((len - n) < frame_len) {
+        *used = (*used < n) ? *used : n;
+        continue;
+      }
+
+      sum = 0;
+      for (uint32_t k = 0; k < frame_len; k++) {
+        sum += buffer[n + k];
+      }
+      if ((sum == 0u) && (buffer[n + 1u] >= RAW_STREAM_CAL_PS) &&
+          (buffer[n + 1u] <= RAW_STREAM_BREATH)) {
+        frame->type = (raw_stream_type_t)buffer[n + 1u];
+        frame->circuit = buffer[n + 2u];
+        frame->len = buffer[n + 3u];
+        frame->payload = &buffer[n + RAW_STREAM_HEADER_LEN];
+        *used = n + frame_len;
+        retval = BOARD_DEV_READY;
+      }
+    }
+  }
+
+  return retval;
+}
+
+void raw_stream_decoder_init(raw_stream_decoder_t* decoder) {
+  assert(decoder);
+
+  if (decoder != NULL) {
+    memset(decoder, 0, sizeof(raw_stream_decoder_t));
+  }
+}
+
+board_dev_status_t raw_stream_decode_cal(raw_stream_decoder_t* decoder,
+                                         const raw_stream_frame_t* frame) {
+  board_dev_status_t retval;
+  ms5525dso_qx_t qx;
+  ms5525dso_coeff_t coeff;
+  uint32_t bits;
+
+  assert(decoder);
+  assert(frame);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((decoder != NULL) && (frame != NULL)) {
+    if ((frame->type == RAW_STREAM_CAL_PS) && (frame->len == CAL_PS_LEN)) {
+      qx.Q1 = frame->payload[1];
+      qx.Q2 = frame->payload[2];
+      qx.Q3 = frame->payload[3];
+      qx.Q4 = frame->payload[4];
+      qx.Q5 = frame->payload[5];
+      qx.Q6 = frame->payload[6];
+      for (uint32_t n = 0; n < MS5525DSO_NUM_PROM_ADDR; n++) {
+        coeff.c[n] = get_u16(&frame->payload[7u + (2u * n)]);
+      }
+      ms5525dso_prepare_comp(&qx, &coeff, &decoder->ps_comp);
+      decoder->ps_cal = 1u;
+      retval = BOARD_DEV_READY;
+    } else if ((frame->type == RAW_STREAM_CAL_FS) &&
+               (frame->len == CAL_FS_LEN)) {
+      bits = get_u32(&frame->payload[4]);
+      memcpy(&decoder->fs_settings.offset, &bits, sizeof(bits));
+      bits = get_u32(&frame->payload[8]);
+      memcpy(&decoder->fs_settings.scale_factor, &bits, sizeof(bits));
+      if (sfm3000_prepare_conv(&decoder->fs_settings, &decoder->fs_conv) ==
+          HAL_OK) {
+        decoder->fs_cal = 1u;
+        retval = BOARD_DEV_READY;
+      }
+    }
+  }
+
+  return retval;
+}
+
+uint32_t raw_stream_decode_ps(raw_stream_decoder_t* decoder,
+                              const raw_stream_frame_t* frame,
+                              raw_stream_ps_value_t* values) {
+  const uint8_t* sample;
+  uint32_t count;
+  uint32_t raw;
+  uint32_t dt;
+  uint16_t flags;
+  uint32_t n;
+
+  assert(decoder);
+  assert(frame);
+  assert(values);
+
+  n = 0;
+
+  if ((decoder != NULL) && (frame != NULL) && (values != NULL) &&
+      (frame->type == RAW_STREAM_PS) && (frame->len >= 4u) &&
+      (((frame->len - 4u) % RAW_STREAM_SAMPLE_LEN) == 0u)) {
+    count = (frame->len - 4u) / RAW_STREAM_SAMPLE_LEN;
+
+    // The temperature in use is unknown after missing samples
+    if (check_position(get_u32(frame->payload), count, &decoder->ps_next,
+                       &decoder->dropped) != BOARD_DEV_READY) {
+      decoder->d2_valid = 0;
+    }
+
+    for (uint32_t k = 0; k < count; k++) {
+      sample = &frame->payload[4u + (k * RAW_STREAM_SAMPLE_LEN)];
+      raw = sample[0] | ((uint32_t)sample[1] << 8) | ((uint32_t)sample[2] << 16);
+      dt = get_u16(&sample[3]);
+      flags = sample[5];
+
+      if ((flags & BOARD_HIST_FLAG_GAP) != 0u) {
+        decoder->ps_dt = 0;
+      }
+      decoder->ps_dt += dt;
+
+      if ((flags & BOARD_HIST_FLAG_TEMP) != 0u) {
+        // Used for every pressure after it, up to the next one
+        decoder->d2 = raw;
+        decoder->d2_valid = 1u;
+      } else {
+        if ((decoder->ps_cal != 0u) && (decoder->d2_valid != 0u)) {
+          values[n].dt = decoder->ps_dt;
+          values[n].d1 = raw;
+          values[n].d2 = decoder->d2;
+          values[n].flags = flags;
+          ms5525dso_compensate(&decoder->ps_comp, raw, decoder->d2,
+                               &values[n].p, &values[n].t);
+          n++;
+        }
+        decoder->ps_dt = 0;
+      }
+    }
+  }
+
+  return n;
+}
+
+uint32_t raw_stream_decode_fs(raw_stream_decoder_t* decoder,
+                              const raw_stream_frame_t* frame,
+                              raw_stream_fs_value_t* values) {
+  const uint8_t* sample;
+  uint32_t count;
+  uint32_t n;
+
+  assert(decoder);
+  assert(frame);
+  assert(values);
+
+  n = 0;
+
+  if ((decoder != NULL) && (frame != NULL) && (values != NULL) &&
+      (frame->type == RAW_STREAM_FS) && (frame->len >= 4u) &&
+      (((frame->len - 4u) % RAW_STREAM_SAMPLE_LEN) == 0u)) {
+    count = (frame->len - 4u) / RAW_STREAM_SAMPLE_LEN;
+    check_position(get_u32(frame->payload), count, &decoder->fs_next,
+                   &decoder->dropped);
+
+    for (uint32_t k = 0; k < count; k++) {
+      sample = &frame->payload[4u + (k * RAW_STREAM_SAMPLE_LEN)];
+      if ((decoder->fs_cal != 0u) &&
+          (sfm3000_convert(get_u16(sample), &decoder->fs_conv,
+                           &values[n].flow) == HAL_OK)) {
+        values[n].dt = get_u16(&sample[3]);
+        values[n].flow_raw = get_u16(sample);
+        values[n].flags = sample[5];
+        n++;
+      }
+    }
+  }
+
+  return n;
+}
+
+board_dev_status_t raw_stream_decode_breath(const raw_stream_frame_t* frame,
+                                            board_volume_breath_t* breath) {
+  board_dev_status_t retval;
+
+  assert(frame);
+  assert(breath);
+
+  retval = BOARD_DEV_NOT_READY;
+
+  if ((frame != NULL) && (breath != NULL) &&
+      (frame->type == RAW_STREAM_BREATH) && (frame->len == BREATH_LEN)) {
+    breath->count = get_u32(&frame->payload[0]);
+    breath->ts = 0;
+    breath->duration = get_u32(&frame->payload[4]);
+    breath->inspired = get_float(&frame->payload[8]);
+    breath->expired = get_float(&frame->payload[12]);
+    breath->peak_flow = get_float(&frame->payload[16]);
+    breath->minute_volume = get_float(&frame->payload[20]);
+    retval = BOARD_DEV_READY;
+  }
+
+  return retval;
+}
+
+static uint32_t finish(uint8_t* buffer, raw_stream_type_t type,
+                       uint8_t circuit, uint32_t len) {
+  uint8_t sum;
+
+  buffer[0] = RAW_STREAM_SYNC;
+  buffer[1] = (uint8_t)type;
+  buffer[2] = circuit;
+  buffer[3] = (uint8_t)len;
+
+  sum = 0;
+  for (uint32_t n = 0; n < (RAW_STREAM_HEADER_LEN + len); n++) {
+    sum += buffer[n];
+  }
+  buffer[RAW_STREAM_HEADER_LEN + len] = (uint8_t)(0u - sum);
+
+  return RAW_STREAM_HEADER_LEN + len + 1u;
+}
+
+static void put_u16(uint8_t* buffer, uint16_t value) {
+  buffer[0] = (uint8_t)value;
+  buffer[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t* buffer, uint32_t value) {
+  put_u16(&buffer[0], (uint16_t)value);
+  put_u16(&buffer[2], (uint16_t)(value >> 16));
+}
+
+static void put_float(uint8_t* buffer, float value) {
+  uint32_t bits;
+
+  memcpy(&bits, &value, sizeof(bits));
+  put_u32(buffer, bits);
+}
+
+static uint16_t get_u16(const uint8_t* buffer) {
+  return (uint16_t)(buffer[0] | ((uint16_t)buffer[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* buffer) {
+  return get_u16(&buffer[0]) | ((uint32_t)get_u16(&buffer[2]) << 16);
+}
+
+static float get_float(const uint8_t* buffer) {
+  uint32_t bits;
+  float value;
+
+  bits = get_u32(buffer);
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static board_dev_status_t check_position(uint32_t start, uint32_t count,
+                                         uint32_t* next, uint32_t* dropped) {
+  board_dev_status_t retval;
+
+  retval = BOARD_DEV_READY;
+
+  // Nothing is expected before the first frame. Positions only go back if
+  // the board reset the history
+  if ((*next != 0u) && (start != *next)) {
+    if ((int32_t)(start - *next) > 0) {
+      *dropped += start - *next;
+    }
+    retval = BOARD_DEV_NOT_READY;
+  }
+  *next = start + count;
+
+  return retval;
+}
@@ -0,0 +1,264 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#ifndef ESP32_MAIN_RAW_STREAM_H_
+#define ESP32_MAIN_RAW_STREAM_H_
+
+#include <stdint.h>
+#include <board_dev.h>
+#include <board_hist.h>
+#include <board_volume.h>
+#include <drv_i2c_ms5525dso.h>
+#include <drv_i2c_sfm3000.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup raw_stream Raw Sample Stream
+ * @brief Binary frames of raw sensor readings, and the host side decoder
+ *
+ * Raw readings go out as they are read from the sensors, with the
+ * calibration each sensor needs sent once ahead of them. The host
+ * compensates them with the same driver code the board uses, so it gets
+ * the same values bit for bit and a raw archive can be reprocessed later.
+ *
+ * Every frame is:
+ *  - RAW_STREAM_SYNC
+ *  - type, one of raw_stream_type_t
+ *  - circuit, from 0
+ *  - payload length in bytes
+ *  - payload, multi byte values little endian
+ *  - checksum, makes the bytes of the whole frame add up to 0 modulo 256
+ *
+ * Sample payloads are the position of the first sample in the sensor's
+ * history (see board_hist_head()), so the host can tell when samples were
+ * dropped, followed by RAW_STREAM_SAMPLE_LEN bytes per sample: raw value
+ * (24 bits), time since the previous sample in us (16 bits), and the
+ * BOARD_HIST_FLAG_* bits (8 bits). Pressure samples carry D1, except those
+ * flagged BOARD_HIST_FLAG_TEMP which carry the D2 used from then on.
+ *
+ * Breath frames follow the flow samples that completed each breath, with
+ * what the board worked out from them (see board_volume).
+ * @{
+ */
+
+#define RAW_STREAM_SYNC 0xA5u
+
+/** Sync, type, circuit and length */
+#define RAW_STREAM_HEADER_LEN 4u
+
+/** Bytes of each sample in a sample frame */
+#define RAW_STREAM_SAMPLE_LEN 6u
+
+/** Most samples in one frame */
+#define RAW_STREAM_MAX_SAMPLES 32u
+
+/** Longest payload of any frame */
+#define RAW_STREAM_MAX_PAYLOAD \
+  (4u + (RAW_STREAM_MAX_SAMPLES * RAW_STREAM_SAMPLE_LEN))
+
+/** Longest frame */
+#define RAW_STREAM_MAX_FRAME \
+  (RAW_STREAM_HEADER_LEN + RAW_STREAM_MAX_PAYLOAD + 1u)
+
+typedef enum raw_stream_type_t {
+  RAW_STREAM_CAL_PS = 1,  //!< Pressure sensor OSR, Qx table and PROM
+  RAW_STREAM_CAL_FS,      //!< Flow sensor serial number, offset and scale
+  RAW_STREAM_PS,          //!< Pressure sensor samples
+  RAW_STREAM_FS,          //!< Flow sensor samples
+  RAW_STREAM_BREATH,      //!< Volumes of a completed breath
+} raw_stream_type_t;
+
+/** @brief A frame found in received bytes
+ */
+typedef struct raw_stream_frame_t {
+  raw_stream_type_t type;
+  uint8_t circuit;
+  uint8_t len;             //!< Payload length in bytes
+  const uint8_t* payload;  //!< Points into the received bytes
+} raw_stream_frame_t;
+
+/** @brief Compensated pressure sample rebuilt by the host
+ */
+typedef struct raw_stream_ps_value_t {
+  uint32_t dt;     //!< Time since the previous pressure sample, in us
+  uint32_t d1;     //!< Raw pressure reading
+  uint32_t d2;     //!< Raw temperature reading it was compensated with
+  int32_t p;       //!< Pressure in PSI x 10000
+  int32_t t;       //!< Temperature in C x 100
+  uint16_t flags;  //!< BOARD_HIST_FLAG_* bits
+} raw_stream_ps_value_t;
+
+/** @brief Flow sample rebuilt by the host
+ */
+typedef struct raw_stream_fs_value_t {
+  uint32_t dt;        //!< Time since the previous flow sample, in us
+  uint16_t flow_raw;  //!< Raw flow reading
+  float flow;         //!< Flow in slm
+  uint16_t flags;     //!< BOARD_HIST_FLAG_* bits
+} raw_stream_fs_value_t;
+
+/** @brief Host side state of one circuit's stream
+ */
+typedef struct raw_stream_decoder_t {
+  ms5525dso_comp_t ps_comp;        //!< From the last pressure calibration
+  sfm3000_settings_t fs_settings;  //!< From the last flow calibration
+  sfm3000_conv_t fs_conv;          //!< Prepared from fs_settings
+  uint8_t ps_cal;                  //!< Pressure calibration received
+  uint8_t fs_cal;                  //!< Flow calibration received
+  uint8_t d2_valid;                //!< The temperature in use is known
+  uint32_t d2;                     //!< Last temperature reading
+  uint32_t ps_dt;    //!< Time carried over from temperature samples, in us
+  uint32_t ps_next;  //!< Position of the next pressure sample expected
+  uint32_t fs_next;  //!< Position of the next flow sample expected
+  uint32_t dropped;  //!< Samples missing from the stream
+} raw_stream_decoder_t;
+
+/**
+ * @brief Build a pressure sensor calibration frame
+ *
+ * @param buffer At least RAW_STREAM_MAX_FRAME bytes
+ * @param circuit
+ * @param osr
+ * @param qx
+ * @param coeff
+ * @return uint32_t Frame length in bytes
+ */
+uint32_t raw_stream_encode_cal_ps(uint8_t* buffer, uint8_t circuit,
+                                  ms5525dso_osr_t osr,
+                                  const ms5525dso_qx_t* qx,
+                                  const ms5525dso_coeff_t* coeff);
+
+/**
+ * @brief Build a flow sensor calibration frame
+ *
+ * @param buffer At least RAW_STREAM_MAX_FRAME bytes
+ * @param circuit
+ * @param serial Sensor serial number
+ * @param settings
+ * @return uint32_t Frame length in bytes
+ */
+uint32_t raw_stream_encode_cal_fs(uint8_t* buffer, uint8_t circuit,
+                                  uint32_t serial,
+                                  const sfm3000_settings_t* settings);
+
+/**
+ * @brief Build a sample frame from a run of history
+ *
+ * @param buffer At least RAW_STREAM_MAX_FRAME bytes
+ * @param type RAW_STREAM_PS or RAW_STREAM_FS
+ * @param circuit
+ * @param span History view, the first RAW_STREAM_MAX_SAMPLES of it are sent
+ * @param count Filled in with the number of samples sent
+ * @return uint32_t Frame length in bytes
+ */
+uint32_t raw_stream_encode_samples(uint8_t* buffer, raw_stream_type_t type,
+                                   uint8_t circuit,
+                                   const board_hist_span_t* span,
+                                   uint32_t* count);
+
+/**
+ * @brief Build a breath frame
+ *
+ * @param buffer At least RAW_STREAM_MAX_FRAME bytes
+ * @param circuit
+ * @param breath
+ * @return uint32_t Frame length in bytes
+ */
+uint32_t raw_stream_encode_breath(uint8_t* buffer, uint8_t circuit,
+                                  const board_volume_breath_t* breath);
+
+/**
+ * @brief Find the next frame in received bytes
+ *
+ * Skips anything before a frame with a good checksum.
+ *
+ * @param buffer Received bytes
+ * @param len Number of received bytes
+ * @param frame Filled in with the frame found
+ * @param used Filled in with the bytes consumed, up to the end of the frame
+ * if one was found, or the bytes that can never start one if not
+ * @return BOARD_DEV_READY if a frame was found
+ */
+board_dev_status_t raw_stream_parse(const uint8_t* buffer, uint32_t len,
+                                    raw_stream_frame_t* frame, uint32_t* used);
+
+/**
+ * @brief Start decoding a circuit's stream
+ *
+ * @param decoder
+ */
+void raw_stream_decoder_init(raw_stream_decoder_t* decoder);
+
+/**
+ * @brief Take in a calibration frame
+ *
+ * @param decoder
+ * @param frame
+ * @return BOARD_DEV_READY if the frame was a well formed calibration
+ */
+board_dev_status_t raw_stream_decode_cal(raw_stream_decoder_t* decoder,
+                                         const raw_stream_frame_t* frame);
+
+/**
+ * @brief Compensate the pressure samples of a frame
+ *
+ * Samples before the first calibration and temperature reading are skipped.
+ *
+ * @param decoder
+ * @param frame
+ * @param values At least RAW_STREAM_MAX_SAMPLES of them
+ * @return uint32_t Number of values filled in
+ */
+uint32_t raw_stream_decode_ps(raw_stream_decoder_t* decoder,
+                              const raw_stream_frame_t* frame,
+                              raw_stream_ps_value_t* values);
+
+/**
+ * @brief Convert the flow samples of a frame
+ *
+ * Samples before the first calibration are skipped.
+ *
+ * @param decoder
+ * @param frame
+ * @param values At least RAW_STREAM_MAX_SAMPLES of them
+ * @return uint32_t Number of values filled in
+ */
+uint32_t raw_stream_decode_fs(raw_stream_decoder_t* decoder,
+                              const raw_stream_frame_t* frame,
+                              raw_stream_fs_value_t* values);
+
+/**
+ * @brief Take apart a breath frame
+ *
+ * @param frame
+ * @param breath Filled in with the breath, the start time is not sent and is
+ * left at 0
+ * @return BOARD_DEV_READY if the frame was a well formed breath
+ */
+board_dev_status_t raw_stream_decode_breath(const raw_stream_frame_t* frame,
+                                            board_volume_breath_t* breath);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ESP32_MAIN_RAW_STREAM_H_
@@ -0,0 +1,162 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <hal.h>
+#include <sensirion_codec.h>
+
+static const uint8_t crc8_table[] = {
+    0x00, 0x31, 0x62, 0x53, 0xC4, 0xF5, 0xA6, 0x97, 0xB9, 0x88, 0xDB, 0xEA,
+    0x7D, 0x4C, 0x1F, 0x2E, 0x43, 0x72, 0x21, 0x10, 0x87, 0xB6, 0xE5, 0xD4,
+    0xFA, 0xCB, 0x98, 0xA9, 0x3E, 0x0F, 0x5C, 0x6D, 0x86, 0xB7, 0xE4, 0xD5,
+    0x42, 0x73, 0x20, 0x11, 0x3F, 0x0E, 0x5D, 0x6C, 0xFB, 0xCA, 0x99, 0xA8,
+    0xC5, 0xF4, 0xA7, 0x96, 0x01, 0x30, 0x63, 0x52, 0x7C, 0x4D, 0x1E, 0x2F,
+    0xB8, 0x89, 0xDA, 0xEB, 0x3D, 0x0C, 0x5F, 0x6E, 0xF9, 0xC8, 0x9B, 0xAA,
+    0x84, 0xB5, 0xE6, 0xD7, 0x40, 0x71, 0x22, 0x13, 0x7E, 0x4F, 0x1C, 0x2D,
+    0xBA, 0x8B, 0xD8, 0xE9, 0xC7, 0xF6, 0xA5, 0x94, 0x03, 0x32, 0x61, 0x50,
+    0xBB, 0x8A, 0xD9, 0xE8, 0x7F, 0x4E, 0x1D, 0x2C, 0x02, 0x33, 0x60, 0x51,
+    0xC6, 0xF7, 0xA4, 0x95, 0xF8, 0xC9, 0x9A, 0xAB, 0x3C, 0x0D, 0x5E, 0x6F,
+    0x41, 0x70, 0x23, 0x12, 0x85, 0xB4, 0xE7, 0xD6, 0x7A, 0x4B, 0x18, 0x29,
+    0xBE, 0x8F, 0xDC, 0xED, 0xC3, 0xF2, 0xA1, 0x90, 0x07, 0x36, 0x65, 0x54,
+    0x39, 0x08, 0x5B, 0x6A, 0xFD, 0xCC, 0x9F, 0xAE, 0x80, 0xB1, 0xE2, 0xD3,
+    0x44, 0x75, 0x26, 0x17, 0xFC, 0xCD, 0x9E, 0xAF, 0x38, 0x09, 0x5A, 0x6B,
+    0x45, 0x74, 0x27, 0x16, 0x81, 0xB0, 0xE3, 0xD2, 0xBF, 0x8E, 0xDD, 0xEC,
+    0x7B, 0x4A, 0x19, 0x28, 0x06, 0x37, 0x64, 0x55, 0xC2, 0xF3, 0xA0, 0x91,
+    0x47, 0x76, 0x25, 0x14, 0x83, 0xB2, 0xE1, 0xD0, 0xFE, 0xCF, 0x9C, 0xAD,
+    0x3A, 0x0B, 0x58, 0x69, 0x04, 0x35, 0x66, 0x57, 0xC0, 0xF1, 0xA2, 0x93,
+    0xBD, 0x8C, 0xDF, 0xEE, 0x79, 0x48, 0x1B, 0x2A, 0xC1, 0xF0, 0xA3, 0x92,
+    0x05, 0x34, 0x67, 0x56, 0x78, 0x49, 0x1A, 0x2B, 0xBC, 0x8D, 0xDE, 0xEF,
+    0x82, 0xB3, 0xE0, 0xD1, 0x46, 0x77, 0x24, 0x15, 0x3B, 0x0A, 0x59, 0x68,
+    0xFF, 0xCE, 0x9D, 0xAC};
+
+#if SENSIRION_CRC_WORD_TABLE
+// crc8_table applied twice, the first byte's part of a word's CRC. The CRC is
+// linear, so a word takes two lookups that do not wait on each other
+static const uint8_t crc8_table2[] = {
+    0x00, 0xF4, 0xD9, 0x2D, 0x83, 0x77, 0x5A, 0xAE, 0x37, 0xC3, 0xEE, 0x1A,
+    0xB4, 0x40, 0x6D, 0x99, 0x6E, 0x9A, 0xB7, 0x43, 0xED, 0x19, 0x34, 0xC0,
+    0x59, 0xAD, 0x80, 0x74, 0xDA, 0x2E, 0x03, 0xF7, 0xDC, 0x28, 0x05, 0xF1,
+    0x5F, 0xAB, 0x86, 0x72, 0xEB, 0x1F, 0x32, 0xC6, 0x68, 0x9C, 0xB1, 0x45,
+    0xB2, 0x46, 0x6B, 0x9F, 0x31, 0xC5, 0xE8, 0x1C, 0x85, 0x71, 0x5C, 0xA8,
+    0x06, 0xF2, 0xDF, 0x2B, 0x89, 0x7D, 0x50, 0xA4, 0x0A, 0xFE, 0xD3, 0x27,
+    0xBE, 0x4A, 0x67, 0x93, 0x3D, 0xC9, 0xE4, 0x10, 0xE7, 0x13, 0x3E, 0xCA,
+    0x64, 0x90, 0xBD, 0x49, 0xD0, 0x24, 0x09, 0xFD, 0x53, 0xA7, 0x8A, 0x7E,
+    0x55, 0xA1, 0x8C, 0x78, 0xD6, 0x22, 0x0F, 0xFB, 0x62, 0x96, 0xBB, 0x4F,
+    0xE1, 0x15, 0x38, 0xCC, 0x3B, 0xCF, 0xE2, 0x16, 0xB8, 0x4C, 0x61, 0x95,
+    0x0C, 0xF8, 0xD5, 0x21, 0x8F, 0x7B, 0x56, 0xA2, 0x23, 0xD7, 0xFA, 0x0E,
+    0xA0, 0x54, 0x79, 0x8D, 0x14, 0xE0, 0xCD, 0x39, 0x97, 0x63, 0x4E, 0xBA,
+    0x4D, 0xB9, 0x94, 0x60, 0xCE, 0x3A, 0x17, 0xE3, 0x7A, 0x8E, 0xA3, 0x57,
+    0xF9, 0x0D, 0x20, 0xD4, 0xFF, 0x0B, 0x26, 0xD2, 0x7C, 0x88, 0xA5, 0x51,
+    0xC8, 0x3C, 0x11, 0xE5, 0x4B, 0xBF, 0x92, 0x66, 0x91, 0x65, 0x48, 0xBC,
+    0x12, 0xE6, 0xCB, 0x3F, 0xA6, 0x52, 0x7F, 0x8B, 0x25, 0xD1, 0xFC, 0x08,
+    0xAA, 0x5E, 0x73, 0x87, 0x29, 0xDD, 0xF0, 0x04, 0x9D, 0x69, 0x44, 0xB0,
+    0x1E, 0xEA, 0xC7, 0x33, 0xC4, 0x30, 0x1D, 0xE9, 0x47, 0xB3, 0x9E, 0x6A,
+    0xF3, 0x07, 0x2A, 0xDE, 0x70, 0x84, 0xA9, 0x5D, 0x76, 0x82, 0xAF, 0x5B,
+    0xF5, 0x01, 0x2C, 0xD8, 0x41, 0xB5, 0x98, 0x6C, 0xC2, 0x36, 0x1B, 0xEF,
+    0x18, 0xEC, 0xC1, 0x35, 0x9B, 0x6F, 0x42, 0xB6, 0x2F, 0xDB, 0xF6, 0x02,
+    0xAC, 0x58, 0x75, 0x81};
+#endif
+
+uint8_t sensirion_crc8(const uint8_t* buff, uint32_t len, uint8_t init) {
+  uint8_t crc;
+
+  assert(buff);
+
+  crc = init;
+
+  if (buff != NULL) {
+    for (uint32_t n = 0; n < len; n++) {
+      crc = crc8_table[crc ^ buff[n]];
+    }
+  }
+
+  return crc;
+}
+
+uint8_t sensirion_crc_word(uint16_t word, uint8_t init) {
+#if SENSIRION_CRC_WORD_TABLE
+  return crc8_table2[init ^ (word >> 8)] ^ crc8_table[word & 0xFFu];
+#else
+  return crc8_table[crc8_table[init ^ (word >> 8)] ^ (word & 0xFFu)];
+#endif
+}
+
+void sensirion_encode_word(uint16_t word, uint8_t init, uint8_t* buff) {
+  assert(buff);
+
+  if (buff != NULL) {
+    buff[0] = (uint8_t)(word >> 8);
+    buff[1] = (uint8_t)word;
+    buff[2] = sensirion_crc_word(word, init);
+  }
+}
+
+hal_err_t sensirion_decode_words(const uint8_t* buff, uint32_t num_words,
+                                 uint8_t init, uint16_t* words) {
+  hal_err_t res;
+  uint16_t word;
+  uint8_t bad;
+
+  assert(buff);
+  assert(words);
+
+  res = HAL_ERR_FAIL;
+
+  if ((buff != NULL) && (words != NULL)) {
+    // Every word is checked without stopping at the first bad one, then the
+    // words are only handed over if they all passed
+    bad = 0;
+    for (uint32_t n = 0; n < num_words; n++) {
+      word = ((uint16_t)buff[0] << 8) | buff[1];
+      bad |= sensirion_crc_word(word, init) ^ buff[2];
+      words[n] = word;
+      buff += SENSIRION_WORD_LEN;
+    }
+    res = (bad == 0u) ? HAL_OK : HAL_ERR_CRC;
+  }
+
+  return res;
+}
+
+hal_err_t sensirion_read_words(const hal_i2c_config_t* cfg, uint8_t init,
+                               uint16_t* words, uint32_t num_words) {
+  hal_err_t res;
+  uint8_t buff[SENSIRION_MAX_WORDS * SENSIRION_WORD_LEN];
+  uint16_t decoded[SENSIRION_MAX_WORDS];
+
+  assert(cfg);
+  assert(words);
+  assert(num_words <= SENSIRION_MAX_WORDS);
+
+  res = HAL_ERR_FAIL;
+
+  if ((cfg != NULL) && (words != NULL) && (num_words > 0u) &&
+      (num_words <= SENSIRION_MAX_WORDS)) {
+    res = hal_i2c_read(cfg, buff, (uint8_t)(num_words * SENSIRION_WORD_LEN));
+    if (res == HAL_OK) {
+      res = sensirion_decode_words(buff, num_words, init, decoded);
+    }
+    if (res == HAL_OK) {
+      for (uint32_t n = 0; n < num_words; n++) {
+        words[n] = decoded[n];
+      }
+    }
+  }
+
+  return res;
+}
@@ -0,0 +1,116 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#ifndef ESP32_MAIN_SENSIRION_CODEC_H_
+#define ESP32_MAIN_SENSIRION_CODEC_H_
+
+#include <hal.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup sensirion_codec Sensirion Word Codec
+ * @ingroup driver_i2c
+ * @brief Data words and CRCs shared by the Sensirion sensors
+ *
+ * Sensirion sensors send and take data as 16-bit words, MSB first, each
+ * followed by a CRC-8 (polynomial 0x31) of its two bytes. The CRC starts
+ * from a different value depending on the sensor.
+ * @{
+ */
+
+/** CRC start value of the SFM3000 */
+#define SENSIRION_CRC_INIT_SFM3000 0x00u
+
+/** CRC start value of the SFM3019, and most later sensors */
+#define SENSIRION_CRC_INIT_SFM3019 0xFFu
+
+/** Bytes of a word on the bus, two of data and the CRC */
+#define SENSIRION_WORD_LEN 3u
+
+/** Most words read at once */
+#define SENSIRION_MAX_WORDS 6u
+
+/** Look up the CRC of a whole word at a time, from a second 256 byte table,
+ * instead of a byte at a time. Set to 0 to save the flash.
+ */
+#ifndef SENSIRION_CRC_WORD_TABLE
+#define SENSIRION_CRC_WORD_TABLE 1
+#endif
+
+/**
+ * @brief CRC of bytes
+ *
+ * @param buff
+ * @param len
+ * @param init CRC start value of the sensor
+ * @return uint8_t
+ */
+uint8_t sensirion_crc8(const uint8_t* buff, uint32_t len, uint8_t init);
+
+/**
+ * @brief CRC of one word
+ *
+ * @param word
+ * @param init CRC start value of the sensor
+ * @return uint8_t
+ */
+uint8_t sensirion_crc_word(uint16_t word, uint8_t init);
+
+/**
+ * @brief Put a word and its CRC in bytes to send
+ *
+ * @param word
+ * @param init CRC start value of the sensor
+ * @param buff Filled in with SENSIRION_WORD_LEN bytes
+ */
+void sensirion_encode_word(uint16_t word, uint8_t init, uint8_t* buff);
+
+/**
+ * @brief Check and take apart received words, in one pass
+ *
+ * @param buff SENSIRION_WORD_LEN bytes per word
+ * @param num_words
+ * @param init CRC start value of the sensor
+ * @param words Filled in with the words, good only if every CRC is
+ * @return hal_err_t HAL_ERR_CRC on any bad CRC
+ */
+hal_err_t sensirion_decode_words(const uint8_t* buff, uint32_t num_words,
+                                 uint8_t init, uint16_t* words);
+
+/**
+ * @brief Read words from a sensor
+ *
+ * @param cfg I2C configuration for this device
+ * @param init CRC start value of the sensor
+ * @param words Filled in with the words
+ * @param num_words Up to SENSIRION_MAX_WORDS
+ * @return hal_err_t
+ */
+hal_err_t sensirion_read_words(const hal_i2c_config_t* cfg, uint8_t init,
+                               uint16_t* words, uint32_t num_words);
+
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ESP32_MAIN_SENSIRION_CODEC_H_
@@ -22,13 +22,25 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <string.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <esp_log.h>
+#include <drv_i2c_ms5525dso.h>
+#include <raw_stream.h>
 
 static const uint32_t EVENT_QUEUE_DEPTH = 8;
 static const uint32_t TX_BUFFER_SZ = 256;
 static const uint32_t RX_BUFFER_SZ = 256;
 
+/** Compensation runs timed by the bench */
+#define SERIAL_LINK_BENCH_RUNS 100u
+
+/** Sample PROM for timing compensation, which takes the same time whatever
+ * the values */
+static const ms5525dso_coeff_t bench_coeff = {
+    .c = {0x0001, 0x31DA, 0x1B42, 0x0C66, 0x06B9, 0x950C, 0x1F37, 0x0000}};
+
 static const uart_config_t uart_config = {
     .baud_rate = 115200,
     .data_bits = UART_DATA_8_BITS,
@@ -37,13 +49,43 @@ static const uart_config_t uart_config = {
     .flow_ctrl = UART_HW_FLOWCTRL_DISABLE};
 
 static void detect_text_command(serial_link_t* serial_link);
-static void parse_cmd(const uint8_t* cmd, uint32_t cmd_len);
+static void parse_cmd(serial_link_t* serial_link, const uint8_t* cmd,
+                      uint32_t cmd_len);
+static board_dev_status_t match_cmd(const serial_link_t* serial_link,
+                                    const char* cmd, const char* name,
+                                    uint32_t* circuit);
+static void cmd_stats(serial_link_t* serial_link, uint32_t circuit);
+static void cmd_scan(serial_link_t* serial_link, uint32_t circuit);
+static void cmd_bench(serial_link_t* serial_link);
+static void cmd_raw(serial_link_t* serial_link, uint32_t circuit);
+static void stream_raw(serial_link_t* serial_link);
+static void stream_hist(serial_link_t* serial_link, const board_hist_t* hist,
+                        raw_stream_type_t type, uint32_t* pos);
+static void write_stats(const char* name, uint32_t circuit,
+                        const board_dev_stats_t* stats, hal_timestamp_t ts);
+static void write_period(uint32_t circuit, const board_dev_period_t* period);
+static void write_budget(uint32_t circuit, const board_sample_t* sample);
+static board_dev_status_t write_bench(const char* name, uint32_t circuit,
+                                      const board_dev_stats_t* stats,
+                                      float target, hal_timestamp_t ts);
+static void write_comp_cycles(void);
+static void write_line(const char* fmt, ...);
 
-void serial_link_init(serial_link_t* serial_link) {
+void serial_link_init(serial_link_t* serial_link,
+                      const board_snapshot_t* const* snapshot,
+                      uint32_t circuits) {
   assert(serial_link);
+  assert(snapshot);
+  assert(circuits <= BOARD_CIRCUITS);
 
-  if (serial_link != NULL) {
+  if ((serial_link != NULL) && (snapshot != NULL) &&
+      (circuits <= BOARD_CIRCUITS)) {
     serial_link->rx_len = 0;
+    for (uint32_t n = 0; n < circuits; n++) {
+      serial_link->snapshot[n] = snapshot[n];
+    }
+    serial_link->circuits = circuits;
+    serial_link->raw = 0;
     serial_link->event_queue =
         xQueueCreate(EVENT_QUEUE_DEPTH, sizeof(uart_event_t));
     uart_param_config(UART_NUM_0, &uart_config);
@@ -60,6 +102,9 @@ void serial_link_update(serial_link_t* serial_link) {
 
   if (serial_link != NULL) {
     detect_text_command(serial_link);
+    if (serial_link->raw != 0u) {
+      stream_raw(serial_link);
+    }
   }
 }
 
@@ -95,7 +140,7 @@ static void detect_text_command(serial_link_t* serial_link) {
 
       // Found a command, and not just an empty string
       if (n > 0) {
-        parse_cmd(&serial_link->rx_buffer[0], n);
+        parse_cmd(serial_link, &serial_link->rx_buffer[0], n);
       }
 
       // Shift everything after the command back down to start from pos 0.
@@ -114,18 +159,333 @@ static void detect_text_command(serial_link_t* serial_link) {
   }
 }
 
-static void parse_cmd(const uint8_t* cmd, uint32_t cmd_len) {
-  char* pos;
+static void parse_cmd(serial_link_t* serial_link, const uint8_t* cmd,
+                      uint32_t cmd_len) {
+  uint32_t circuit;
 
+  assert(serial_link);
   assert(cmd);
 
-  if (cmd != NULL) {
+  if ((serial_link != NULL) && (cmd != NULL)) {
     // Guaranteed to have passed in a null terminated string from
     // serial_link_update()
+    if (match_cmd(serial_link, (const char*)cmd, "stats", &circuit) ==
+        BOARD_DEV_READY) {
+      cmd_stats(serial_link, circuit);
+    } else if (match_cmd(serial_link, (const char*)cmd, "scan", &circuit) ==
+               BOARD_DEV_READY) {
+      cmd_scan(serial_link, circuit);
+    } else if (strcmp((const char*)cmd, "bench") == 0) {
+      cmd_bench(serial_link);
+    } else if (match_cmd(serial_link, (const char*)cmd, "raw", &circuit) ==
+               BOARD_DEV_READY) {
+      cmd_raw(serial_link, circuit);
+    } else if (strcmp((const char*)cmd, "stop") == 0) {
+      serial_link->raw = 0;
+      write_line("OK\r\n");
+    } else {
+      write_line("ERR\r\n");
+    }
+  }
+}
+
+static board_dev_status_t match_cmd(const serial_link_t* serial_link,
+                                    const char* cmd, const char* name,
+                                    uint32_t* circuit) {
+  board_dev_status_t retval;
+  size_t len;
+
+  retval = BOARD_DEV_NOT_READY;
+  len = strlen(name);
+
+  // Either the bare name, or the name and a single digit circuit number
+  if (strncmp(cmd, name, len) == 0) {
+    if (cmd[len] == '\0') {
+      *circuit = 0;
+      retval = BOARD_DEV_READY;
+    } else if ((cmd[len] == ' ') && (cmd[len + 1u] >= '1') &&
+               ((uint32_t)(cmd[len + 1u] - '1') < serial_link->circuits) &&
+               (cmd[len + 2u] == '\0')) {
+      *circuit = cmd[len + 1u] - '1';
+      retval = BOARD_DEV_READY;
+    }
+  }
+
+  return retval;
+}
+
+static void cmd_stats(serial_link_t* serial_link, uint32_t circuit) {
+  board_sample_t sample;
+  hal_timestamp_t ts;
+
+  // Counters come from the board snapshot, the board task on the other core
+  // owns the devices
+  if (board_snapshot_read(serial_link->snapshot[circuit], &sample) ==
+      BOARD_DEV_READY) {
+    ts = hal_get_timestamp();
+    write_stats("SW", circuit, &sample.sw_stats, ts);
+    write_stats("PS", circuit, &sample.ps1_stats, ts);
+    write_stats("FS", circuit, &sample.fs1_stats, ts);
+    write_period(circuit, &sample.period);
+    write_budget(circuit, &sample);
+  } else {
+    write_line("ERR busy\r\n");
+  }
+}
+
+static void cmd_scan(serial_link_t* serial_link, uint32_t circuit) {
+  board_sample_t sample;
+
+  // One line per channel with anything on it
+  if (board_snapshot_read(serial_link->snapshot[circuit], &sample) ==
+      BOARD_DEV_READY) {
+    for (uint32_t ch = 0; ch < BOARD_SCAN_CHANNELS; ch++) {
+      for (uint32_t n = 0; n < BOARD_SCAN_NUM_ADDR; n++) {
+        if ((sample.scan.found[ch] & (1u << n)) != 0u) {
+          write_line("SCAN ch%u 0x%.02X\r\n", ch, board_scan_addr(n));
+        }
+      }
+    }
+    write_line("SCAN probes=%u passes=%u\r\n", sample.scan.probes,
+               sample.scan.passes);
+  } else {
+    write_line("ERR busy\r\n");
+  }
+}
+
+static void cmd_bench(serial_link_t* serial_link) {
+  board_sample_t sample[BOARD_CIRCUITS];
+  board_dev_status_t res;
+  hal_timestamp_t ts;
+
+  // Every circuit is read back to back, so their rates cover the same window
+  res = BOARD_DEV_READY;
+  for (uint32_t n = 0; n < serial_link->circuits; n++) {
+    if (board_snapshot_read(serial_link->snapshot[n], &sample[n]) !=
+        BOARD_DEV_READY) {
+      res = BOARD_DEV_NOT_READY;
+    }
+  }
+
+  if (res == BOARD_DEV_READY) {
+    ts = hal_get_timestamp();
+    for (uint32_t n = 0; n < serial_link->circuits; n++) {
+      if (write_bench("PS", n, &sample[n].ps1_stats, BOARD_PS_RATE_TARGET,
+                      ts) != BOARD_DEV_READY) {
+        res = BOARD_DEV_NOT_READY;
+      }
+      if (write_bench("FS", n, &sample[n].fs1_stats, BOARD_FS_RATE_TARGET,
+                      ts) != BOARD_DEV_READY) {
+        res = BOARD_DEV_NOT_READY;
+      }
+      write_budget(n, &sample[n]);
+    }
+    write_comp_cycles();
+    write_line("BENCH %s\r\n", (res == BOARD_DEV_READY) ? "pass" : "fail");
+  } else {
+    write_line("ERR busy\r\n");
+  }
+}
+
+static void cmd_raw(serial_link_t* serial_link, uint32_t circuit) {
+  board_sample_t sample;
+
+  // Samples from now on, with the calibrations sent first
+  if (board_snapshot_read(serial_link->snapshot[circuit], &sample) ==
+      BOARD_DEV_READY) {
+    write_line("OK\r\n");
+    serial_link->raw = 1u;
+    serial_link->raw_circuit = circuit;
+    serial_link->raw_ps_pos = board_hist_head(sample.ps1_hist);
+    serial_link->raw_fs_pos = board_hist_head(sample.fs1_hist);
+    serial_link->raw_breath = sample.fs1_breath.count;
+    serial_link->raw_ps_cal = 0;
+    serial_link->raw_fs_cal = 0;
+  } else {
+    write_line("ERR busy\r\n");
+  }
+}
+
+static void stream_raw(serial_link_t* serial_link) {
+  board_sample_t sample;
+  uint8_t frame[RAW_STREAM_MAX_FRAME];
+  uint32_t len;
+
+  if (board_snapshot_read(serial_link->snapshot[serial_link->raw_circuit],
+                          &sample) == BOARD_DEV_READY) {
+    // A sensor that came back, or was swapped, may have another calibration.
+    // It is only known once the sensor is running
+    if ((sample.ps1_status == BOARD_DEV_READY) &&
+        ((serial_link->raw_ps_cal == 0u) ||
+         (memcmp(&sample.ps1_info.coeff, &serial_link->raw_ps_info.coeff,
+                 sizeof(sample.ps1_info.coeff)) != 0) ||
+         (memcmp(&sample.ps1_info.qx, &serial_link->raw_ps_info.qx,
+                 sizeof(sample.ps1_info.qx)) != 0))) {
+      len = raw_stream_encode_cal_ps(frame, (uint8_t)serial_link->raw_circuit,
+                                     sample.ps1_info.osr, &sample.ps1_info.qx,
+                                     &sample.ps1_info.coeff);
+      uart_write_bytes(UART_NUM_0, (const char*)frame, len);
+      serial_link->raw_ps_info = sample.ps1_info;
+      serial_link->raw_ps_cal = 1u;
+    }
+    if ((sample.fs1_status == BOARD_DEV_READY) &&
+        ((serial_link->raw_fs_cal == 0u) ||
+         (sample.fs1_info.serial != serial_link->raw_fs_info.serial) ||
+         (memcmp(&sample.fs1_settings, &serial_link->raw_fs_settings,
+                 sizeof(sample.fs1_settings)) != 0))) {
+      len = raw_stream_encode_cal_fs(frame, (uint8_t)serial_link->raw_circuit,
+                                     sample.fs1_info.serial,
+                                     &sample.fs1_settings);
+      uart_write_bytes(UART_NUM_0, (const char*)frame, len);
+      serial_link->raw_fs_info = sample.fs1_info;
+      serial_link->raw_fs_settings = sample.fs1_settings;
+      serial_link->raw_fs_cal = 1u;
+    }
+
+    if (serial_link->raw_ps_cal != 0u) {
+      stream_hist(serial_link, sample.ps1_hist, RAW_STREAM_PS,
+                  &serial_link->raw_ps_pos);
+    }
+    if (serial_link->raw_fs_cal != 0u) {
+      stream_hist(serial_link, sample.fs1_hist, RAW_STREAM_FS,
+                  &serial_link->raw_fs_pos);
+    }
+    // After the samples that completed it
+    if (sample.fs1_breath.count != serial_link->raw_breath) {
+      len = raw_stream_encode_breath(frame, (uint8_t)serial_link->raw_circuit,
+                                     &sample.fs1_breath);
+      uart_write_bytes(UART_NUM_0, (const char*)frame, len);
+      serial_link->raw_breath = sample.fs1_breath.count;
+    }
+  }
+}
+
+static void stream_hist(serial_link_t* serial_link, const board_hist_t* hist,
+                        raw_stream_type_t type, uint32_t* pos) {
+  board_hist_span_t span;
+  uint8_t frame[RAW_STREAM_MAX_FRAME];
+  uint32_t count;
+  uint32_t len;
+
+  // Everything new, in frames copied straight out of the history. A frame is
+  // only sent if the board did not overwrite it while it was being built. If
+  // the link fell behind, it picks up from the newest samples and the host
+  // sees the jump in positions
+  while (board_hist_get_since(hist, *pos, &span) == BOARD_DEV_READY) {
+    if ((span.first_len + span.second_len) == 0u) {
+      break;
+    }
+    len = raw_stream_encode_samples(frame, type,
+                                    (uint8_t)serial_link->raw_circuit, &span,
+                                    &count);
+    if (board_hist_check(hist, &span) != BOARD_DEV_READY) {
+      break;
+    }
+    uart_write_bytes(UART_NUM_0, (const char*)frame, len);
+    *pos += count;
+  }
+
+  if (board_hist_get_since(hist, *pos, &span) != BOARD_DEV_READY) {
+    *pos = board_hist_head(hist);
+  }
+}
+
+static void write_stats(const char* name, uint32_t circuit,
+                        const board_dev_stats_t* stats, hal_timestamp_t ts) {
+  write_line("%s%u %s samples=%u rate=%.1fHz crc=%u nack=%u err=%u "
+             "resets=%u not_ready=%lldus\r\n",
+             name, circuit + 1u,
+             (stats->status == BOARD_DEV_READY) ? "ready" : "not_ready",
+             stats->samples, board_dev_stats_rate(stats, ts),
+             stats->crc_failures, stats->nacks, stats->errors,
+             stats->resets,
+             (long long)board_dev_stats_not_ready_time(stats, ts));
+}
+
+static void write_period(uint32_t circuit, const board_dev_period_t* period) {
+  write_line("BOARD%u period min=%lldus max=%lldus mean=%lldus "
+             "jitter=%lldus\r\n",
+             circuit + 1u, (long long)period->min, (long long)period->max,
+             (long long)period->mean,
+             (long long)(period->max - period->min));
+}
+
+static void write_budget(uint32_t circuit, const board_sample_t* sample) {
+  write_line("BOARD%u budget=%lldus run_max=%lldus deferred=%u "
+             "bus_busy=%u load=%u%% div=%u\r\n",
+             circuit + 1u, (long long)sample->budget.limit,
+             (long long)sample->run_time_max, sample->budget.deferred,
+             sample->bus_busy, sample->bus_load, sample->bus_divisor);
+}
+
+static board_dev_status_t write_bench(const char* name, uint32_t circuit,
+                                      const board_dev_stats_t* stats,
+                                      float target, hal_timestamp_t ts) {
+  board_dev_status_t retval;
+  float rate;
+
+  rate = board_dev_stats_rate(stats, ts);
+  retval = (rate >= target) ? BOARD_DEV_READY : BOARD_DEV_NOT_READY;
+  write_line("BENCH %s%u rate=%.1fHz target=%.1fHz %s\r\n", name,
+             circuit + 1u, rate, target,
+             (retval == BOARD_DEV_READY) ? "ok" : "low");
+
+  return retval;
+}
+
+static void write_comp_cycles(void) {
+  const ms5525dso_qx_t qx = MS5525DSO_QX_FOR_PP001DS();
+  ms5525dso_comp_t comp;
+  uint32_t cycles_fixed;
+  uint32_t cycles_prepared;
+  uint32_t cycles_float;
+  uint32_t start;
+  int32_t p;
+  int32_t t;
+  float pf;
+  float tf;
+
+  // Cycles per pressure compensation, on this core, integer and float results
+  start = hal_get_cycles();
+  for (uint32_t n = 0; n < SERIAL_LINK_BENCH_RUNS; n++) {
+    ms5525dso_calculate_pt_fixed(&qx, &bench_coeff, 4650976u + n, 4946912u, &p,
+                                 &t);
+  }
+  cycles_fixed = (hal_get_cycles() - start) / SERIAL_LINK_BENCH_RUNS;
+
+  // As the board runs it, with the constants prepared once per sensor
+  ms5525dso_prepare_comp(&qx, &bench_coeff, &comp);
+  start = hal_get_cycles();
+  for (uint32_t n = 0; n < SERIAL_LINK_BENCH_RUNS; n++) {
+    ms5525dso_compensate(&comp, 4650976u + n, 4946912u, &p, &t);
+  }
+  cycles_prepared = (hal_get_cycles() - start) / SERIAL_LINK_BENCH_RUNS;
+
+  start = hal_get_cycles();
+  for (uint32_t n = 0; n < SERIAL_LINK_BENCH_RUNS; n++) {
+    ms5525dso_calculate_pt(&qx, &bench_coeff, 4650976u + n, 4946912u, &pf,
+                           &tf);
+  }
+  cycles_float = (hal_get_cycles() - start) / SERIAL_LINK_BENCH_RUNS;
+
+  write_line("BENCH ps_comp fixed=%u prepared=%u float=%u cycles\r\n",
+             cycles_fixed, cycles_prepared, cycles_float);
+}
+
+static void write_line(const char* fmt, ...) {
+  char line[SERIAL_LINK_TX_LINE_LEN];
+  va_list args;
+  int len;
+
+  va_start(args, fmt);
+  len = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
 
-    pos = strchr((char*)cmd, ' ');
-    // Did we get to the end of the string
-    if (pos == '\0') {
+  if (len > 0) {
+    // Truncated lines still go out
+    if (len >= (int)sizeof(line)) {
+      len = sizeof(line) - 1;
     }
+    uart_write_bytes(UART_NUM_0, line, len);
   }
 }
@@ -22,6 +22,9 @@ along with this program.  If not, see www.gnu.org/licenses/.
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <hal.h>
+#include <board.h>
+#include <board_snapshot.h>
+#include <board_hist.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,14 +32,50 @@ extern "C" {
 
 #define SERIAL_LINK_RX_BUFF_LEN 512u
 #define SERIAL_LINK_MAX_CMD_LEN 32u
+#define SERIAL_LINK_TX_LINE_LEN 128u
 
 typedef struct serial_link_t {
   uint8_t rx_buffer[SERIAL_LINK_RX_BUFF_LEN];
   uint32_t rx_len;
   QueueHandle_t event_queue;
+  //! Board samples and health counters, one per circuit
+  const board_snapshot_t* snapshot[BOARD_CIRCUITS];
+  uint32_t circuits;  //!< Number of circuits with a snapshot
+  uint8_t raw;           //!< Streaming raw samples if set
+  uint32_t raw_circuit;  //!< Circuit being streamed
+  uint32_t raw_ps_pos;   //!< Next pressure history position to send
+  uint32_t raw_fs_pos;   //!< Next flow history position to send
+  uint8_t raw_ps_cal;    //!< Pressure calibration sent
+  uint8_t raw_fs_cal;    //!< Flow calibration sent
+  ps_info_t raw_ps_info;  //!< Pressure calibration last sent
+  fs_info_t raw_fs_info;  //!< Flow sensor identity last sent
+  sfm3000_settings_t raw_fs_settings;  //!< Flow calibration last sent
+  uint32_t raw_breath;                 //!< Count of the last breath sent
 } serial_link_t;
 
-void serial_link_init(serial_link_t* link);
+/**
+ * @brief Initialize the UART and command parser
+ *
+ * Text commands, terminated by '\r'. Those that take a circuit number, from
+ * 1, default to circuit 1:
+ *  - stats [n]: health counters of every board device, and board update
+ *    timing. The period jitter it prints is the way to measure it on target
+ *  - scan [n]: devices found on the mux channels
+ *  - bench: sample rate of every sensor of every circuit against its target,
+ *    all measured over the same window
+ *  - raw [n]: stream raw samples as binary frames, see raw_stream, until
+ *    stop. Each sensor's calibration goes out ahead of its first samples,
+ *    and again whenever it changes. Each breath completed goes out too.
+ *    Text replies carry on in between, a host skips them looking for frames
+ *  - stop: end a raw stream
+ *
+ * @param link
+ * @param snapshot Board snapshots to answer queries from, one per circuit
+ * @param circuits Number of snapshots, at most BOARD_CIRCUITS
+ */
+void serial_link_init(serial_link_t* link,
+                      const board_snapshot_t* const* snapshot,
+                      uint32_t circuits);
 
 void serial_link_update(serial_link_t* link);
 
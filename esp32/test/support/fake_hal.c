@@ -0,0 +1,419 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+
+#include <string.h>
+#include "fake_hal.h"
+#include "drv_i2c_ms5525dso.h"
+#include "drv_i2c_sfm3000.h"
+#include "drv_i2c_sfm3019.h"
+#include "sensirion_codec.h"
+
+/** Fake switch address, and the address of every other switch config */
+#define FAKE_HAL_SWITCH_ADDR 0x70u
+
+/** A valid MS5525DSO PROM, the CRC is filled in when added */
+static const ms5525dso_coeff_t fake_prom = {
+    .c = {0x0001, 0x31DA, 0x1B42, 0x0C66, 0x06B9, 0x950C, 0x1F37, 0x0000}};
+
+static const hal_i2c_config_t i2c_config[] = {
+    [HAL_I2C_DEV_SWITCH] = {.i2c_addr = FAKE_HAL_SWITCH_ADDR},
+    [HAL_I2C_DEV_PS1] = {.i2c_addr = MS5525DSO_I2C_ADDR_HIGH},
+    [HAL_I2C_DEV_FS1] = {.i2c_addr = SFM3000_I2C_ADDR},
+    [HAL_I2C_DEV_SWITCH2] = {.i2c_addr = FAKE_HAL_SWITCH_ADDR},
+    [HAL_I2C_DEV_PS2] = {.i2c_addr = MS5525DSO_I2C_ADDR_HIGH},
+    [HAL_I2C_DEV_FS2] = {.i2c_addr = SFM3000_I2C_ADDR},
+};
+
+fake_hal_t fake_hal;
+
+static fake_dev_t* find_dev(uint8_t addr);
+static fake_nvs_blob_t* find_blob(const char* name_space, const char* key);
+static void take_time(hal_timestamp_t time);
+static void write_dev(fake_dev_t* dev, const uint8_t* buffer, uint8_t len);
+static void read_ms5525dso(fake_dev_t* dev, uint8_t* buffer, uint8_t len);
+static void read_sfm3000(fake_dev_t* dev, uint8_t* buffer, uint8_t len);
+static void read_sfm3019(fake_dev_t* dev, uint8_t* buffer, uint8_t len);
+static void encode_words(const uint16_t* words, uint8_t init, uint8_t* buffer,
+                         uint8_t len);
+
+void fake_hal_init(void) {
+  memset(&fake_hal, 0, sizeof(fake_hal));
+  fake_hal.now = 1000;
+  fake_hal.reset_pin = 1u;
+}
+
+fake_dev_t* fake_hal_add(fake_dev_type_t type, uint8_t channel, uint8_t addr) {
+  fake_dev_t* dev;
+
+  if (fake_hal.dev_count >= FAKE_HAL_DEVS) {
+    return NULL;
+  }
+
+  dev = &fake_hal.devs[fake_hal.dev_count];
+  fake_hal.dev_count++;
+  memset(dev, 0, sizeof(*dev));
+  dev->type = type;
+  dev->channel = channel;
+  dev->addr = addr;
+  dev->fault = HAL_OK;
+
+  switch (type) {
+    case FAKE_DEV_MS5525DSO:
+      dev->prom = fake_prom;
+      dev->prom.c[7] = ms5525dso_calculate_coeff_crc(&dev->prom);
+      dev->d1 = 4650976u;
+      dev->d2 = 4946912u;
+      dev->conv_percent = 100u;
+      break;
+    case FAKE_DEV_SFM3000:
+      dev->serial = 0x12345678u;
+      dev->product = 0x04020105u;
+      dev->offset = SFM3000_GIVEN_OFFSET;
+      dev->scale_factor = 140u;
+      dev->flow_raw = SFM3000_GIVEN_OFFSET;
+      break;
+    case FAKE_DEV_SFM3019:
+      dev->serial = 0x12345678u;
+      dev->product = 0x04020611u;
+      dev->offset = (uint16_t)SFM3019_GIVEN_OFFSET;
+      dev->scale_factor = 170u;
+      dev->flow_raw = (uint16_t)SFM3019_GIVEN_OFFSET;
+      break;
+    default:
+      break;
+  }
+
+  return dev;
+}
+
+uint8_t* fake_hal_nvs_get(const char* name_space, const char* key,
+                          size_t* len) {
+  fake_nvs_blob_t* blob;
+
+  blob = find_blob(name_space, key);
+  *len = (blob != NULL) ? blob->len : 0u;
+  return (blob != NULL) ? blob->data : NULL;
+}
+
+hal_timestamp_t hal_get_timestamp(void) {
+  return fake_hal.now;
+}
+
+void hal_log(hal_log_level_t log_level, const char* topic, const char* fmt,
+             ...) {}
+
+const hal_i2c_config_t* hal_i2c_get_config(hal_i2c_dev_t dev) {
+  return &i2c_config[dev];
+}
+
+hal_err_t hal_i2c_lock(const hal_i2c_config_t* cfg) {
+  fake_hal.locks++;
+  return HAL_OK;
+}
+
+void hal_i2c_unlock(const hal_i2c_config_t* cfg) {}
+
+void hal_gpio_write(uint32_t pin, int value) {
+  fake_hal.reset_pin = (uint32_t)value;
+}
+
+hal_err_t hal_i2c_probe(const hal_i2c_config_t* cfg) {
+  take_time(HAL_I2C_XFER_TIME_US(0u));
+  return (find_dev(cfg->i2c_addr) != NULL) ? HAL_OK : HAL_ERR_NACK;
+}
+
+hal_err_t hal_i2c_write(const hal_i2c_config_t* cfg, const uint8_t* buffer,
+                        uint8_t len) {
+  fake_dev_t* dev;
+
+  take_time(HAL_I2C_XFER_TIME_US(len));
+  fake_hal.last_addr = cfg->i2c_addr;
+  dev = find_dev(cfg->i2c_addr);
+  if (dev == NULL) {
+    return HAL_ERR_NACK;
+  }
+  if (dev->fault != HAL_OK) {
+    return dev->fault;
+  }
+  write_dev(dev, buffer, len);
+  return HAL_OK;
+}
+
+hal_err_t hal_i2c_read(const hal_i2c_config_t* cfg, uint8_t* buffer,
+                       uint8_t len) {
+  fake_dev_t* dev;
+
+  take_time(HAL_I2C_XFER_TIME_US(len));
+  fake_hal.last_addr = cfg->i2c_addr;
+  dev = find_dev(cfg->i2c_addr);
+  if (dev == NULL) {
+    return HAL_ERR_NACK;
+  }
+  if (dev->fault != HAL_OK) {
+    return dev->fault;
+  }
+
+  memset(buffer, 0, len);
+  switch (dev->type) {
+    case FAKE_DEV_SWITCH:
+      buffer[0] = fake_hal.channels;
+      break;
+    case FAKE_DEV_MS5525DSO:
+      read_ms5525dso(dev, buffer, len);
+      break;
+    case FAKE_DEV_SFM3000:
+      read_sfm3000(dev, buffer, len);
+      break;
+    case FAKE_DEV_SFM3019:
+      read_sfm3019(dev, buffer, len);
+      break;
+    default:
+      break;
+  }
+  return HAL_OK;
+}
+
+// Back to back, the driver is only set up once
+hal_err_t hal_i2c_batch(const hal_i2c_config_t* cfg,
+                        const hal_i2c_xfer_t* xfers, uint8_t count) {
+  fake_dev_t* dev;
+  hal_err_t res;
+
+  dev = find_dev(cfg->i2c_addr);
+  if (dev != NULL) {
+    dev->batches++;
+  }
+
+  res = HAL_OK;
+  for (uint8_t n = 0; (n < count) && (res == HAL_OK); n++) {
+    if (xfers[n].tx_len > 0u) {
+      res = hal_i2c_write(cfg, xfers[n].tx, xfers[n].tx_len);
+      take_time(-(hal_timestamp_t)HAL_I2C_XFER_OVERHEAD_US);
+    }
+    if ((res == HAL_OK) && (xfers[n].rx_len > 0u)) {
+      res = hal_i2c_read(cfg, xfers[n].rx, xfers[n].rx_len);
+      take_time(-(hal_timestamp_t)HAL_I2C_XFER_OVERHEAD_US);
+    }
+  }
+  take_time(HAL_I2C_XFER_OVERHEAD_US);
+  return res;
+}
+
+hal_err_t hal_nvs_read_blob(const char* name_space, const char* key,
+                            void* buffer, size_t* len) {
+  fake_nvs_blob_t* blob;
+
+  blob = find_blob(name_space, key);
+  if ((blob == NULL) || (*len < blob->len)) {
+    return HAL_ERR_FAIL;
+  }
+  memcpy(buffer, blob->data, blob->len);
+  *len = blob->len;
+  return HAL_OK;
+}
+
+hal_err_t hal_nvs_write_blob(const char* name_space, const char* key,
+                             const void* buffer, size_t len) {
+  fake_nvs_blob_t* blob;
+
+  if ((len == 0u) || (len > FAKE_HAL_NVS_LEN) ||
+      (strlen(name_space) >= sizeof(blob->name_space)) ||
+      (strlen(key) >= sizeof(blob->key))) {
+    return HAL_ERR_FAIL;
+  }
+
+  // Overwrites the blob with the same key, or takes a free one
+  blob = find_blob(name_space, key);
+  for (uint32_t n = 0; (blob == NULL) && (n < FAKE_HAL_NVS_BLOBS); n++) {
+    if (fake_hal.nvs[n].len == 0u) {
+      blob = &fake_hal.nvs[n];
+    }
+  }
+  if (blob == NULL) {
+    return HAL_ERR_FAIL;
+  }
+
+  strcpy(blob->name_space, name_space);
+  strcpy(blob->key, key);
+  memcpy(blob->data, buffer, len);
+  blob->len = len;
+  fake_hal.nvs_writes++;
+  return HAL_OK;
+}
+
+// Only the devices on the selected channel answer, the switch always does
+static fake_dev_t* find_dev(uint8_t addr) {
+  fake_dev_t* dev;
+
+  for (uint32_t n = 0; n < fake_hal.dev_count; n++) {
+    dev = &fake_hal.devs[n];
+    if ((dev->addr == addr) &&
+        ((dev->channel == FAKE_HAL_CHANNEL_ANY) ||
+         ((fake_hal.channels & (1u << dev->channel)) != 0u))) {
+      return dev;
+    }
+  }
+  return NULL;
+}
+
+static fake_nvs_blob_t* find_blob(const char* name_space, const char* key) {
+  for (uint32_t n = 0; n < FAKE_HAL_NVS_BLOBS; n++) {
+    if ((fake_hal.nvs[n].len > 0u) &&
+        (strcmp(fake_hal.nvs[n].name_space, name_space) == 0) &&
+        (strcmp(fake_hal.nvs[n].key, key) == 0)) {
+      return &fake_hal.nvs[n];
+    }
+  }
+  return NULL;
+}
+
+static void take_time(hal_timestamp_t time) {
+  if (fake_hal.timed != 0u) {
+    fake_hal.now += time;
+    fake_hal.bus_time += time;
+  }
+}
+
+static void write_dev(fake_dev_t* dev, const uint8_t* buffer, uint8_t len) {
+  switch (dev->type) {
+    case FAKE_DEV_SWITCH:
+      fake_hal.channels = buffer[0];
+      break;
+    case FAKE_DEV_MS5525DSO:
+      dev->cmd = buffer[0];
+      if ((dev->cmd & 0xE0u) == 0x40u) {
+        dev->conv_cmd = buffer[0];
+        dev->ts_conv = fake_hal.now;
+        dev->spoiled = 0;
+        if ((dev->cmd & 0xF0u) == 0x40u) {
+          dev->d1_starts++;
+        } else {
+          dev->d2_starts++;
+        }
+      }
+      break;
+    default:
+      // Sensirion commands are a word, bar the SFM3019 soft reset
+      dev->cmd = (len > 1u) ? (((uint16_t)buffer[0] << 8) | buffer[1])
+                            : buffer[0];
+      if ((dev->type == FAKE_DEV_SFM3019) && (dev->cmd == SFM3019_REG_CONF_AVG)) {
+        dev->avg_writes++;
+      }
+      break;
+  }
+}
+
+static void read_ms5525dso(fake_dev_t* dev, uint8_t* buffer, uint8_t len) {
+  ms5525dso_osr_t osr;
+  uint32_t adc;
+  uint16_t c;
+
+  if ((dev->cmd & ~0x0Eu) == MS5525DSO_REG_PROM_READ_BASE) {
+    c = dev->prom.c[(dev->cmd >> MS5525DSO_REG_PROM_ADDR_OFST) &
+                    MS5525DSO_REG_PROM_ADDR_MASK];
+    buffer[0] = (uint8_t)(c >> 8);
+    buffer[1] = (uint8_t)c;
+    dev->prom_reads++;
+  } else if ((dev->cmd == MS5525DSO_REG_ADC_READ) &&
+             (len >= MS5525DSO_NUM_ADC_BYTES)) {
+    osr = (ms5525dso_osr_t)((dev->conv_cmd & 0x0Eu) >> 1);
+    if (fake_hal.now <
+        (dev->ts_conv +
+         ((ms5525dso_get_conversion_time(osr) * dev->conv_percent) / 100u))) {
+      dev->early_reads++;
+      dev->spoiled = 1u;
+      adc = 0;
+    } else if (dev->spoiled != 0u) {
+      dev->spoiled_reads++;
+      adc = 1u;
+    } else {
+      adc = ((dev->conv_cmd & 0xF0u) == 0x40u) ? dev->d1 : dev->d2;
+    }
+    buffer[0] = (uint8_t)(adc >> 16);
+    buffer[1] = (uint8_t)(adc >> 8);
+    buffer[2] = (uint8_t)adc;
+  }
+}
+
+// Answers the last register written, flow once it has been started
+static void read_sfm3000(fake_dev_t* dev, uint8_t* buffer, uint8_t len) {
+  uint16_t words[SENSIRION_MAX_WORDS];
+
+  memset(words, 0, sizeof(words));
+  switch (dev->cmd) {
+    case SFM3000_REG_SERIAL_HI:
+      words[0] = (uint16_t)(dev->serial >> 16);
+      words[1] = (uint16_t)dev->serial;
+      dev->serial_reads++;
+      break;
+    case SFM3000_REG_PRODUCT_HI:
+      words[0] = (uint16_t)(dev->product >> 16);
+      words[1] = (uint16_t)dev->product;
+      dev->product_reads++;
+      break;
+    case SFM3000_REG_OFFSET:
+      words[0] = dev->offset;
+      dev->cal_reads++;
+      break;
+    case SFM3000_REG_SCALE_FACTOR:
+      words[0] = dev->scale_factor;
+      dev->cal_reads++;
+      break;
+    case SFM3000_REG_START_FLOW:
+      words[0] = dev->flow_raw;
+      break;
+    default:
+      break;
+  }
+  encode_words(words, SENSIRION_CRC_INIT_SFM3000, buffer, len);
+}
+
+// The SFM3019 has its own commands, and CRC
+static void read_sfm3019(fake_dev_t* dev, uint8_t* buffer, uint8_t len) {
+  uint16_t words[SENSIRION_MAX_WORDS];
+
+  memset(words, 0, sizeof(words));
+  switch (dev->cmd) {
+    case SFM3019_REG_READ_PRODUCT:
+      words[0] = (uint16_t)(dev->product >> 16);
+      words[1] = (uint16_t)dev->product;
+      words[4] = (uint16_t)(dev->serial >> 16);
+      words[5] = (uint16_t)dev->serial;
+      dev->product_reads++;
+      break;
+    case SFM3019_REG_READ_SETTINGS:
+      words[0] = dev->scale_factor;
+      words[1] = dev->offset;
+      dev->cal_reads++;
+      break;
+    case SFM3019_REG_GAS_AIR:
+      words[0] = dev->flow_raw;
+      break;
+    default:
+      break;
+  }
+  encode_words(words, SENSIRION_CRC_INIT_SFM3019, buffer, len);
+}
+
+static void encode_words(const uint16_t* words, uint8_t init, uint8_t* buffer,
+                         uint8_t len) {
+  for (uint8_t n = 0;
+       (n < (len / SENSIRION_WORD_LEN)) && (n < SENSIRION_MAX_WORDS); n++) {
+    sensirion_encode_word(words[n], init, &buffer[n * SENSIRION_WORD_LEN]);
+  }
+}
@@ -0,0 +1,141 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+
+#ifndef FAKE_HAL_H_
+#define FAKE_HAL_H_
+
+#include <stdint.h>
+#include <hal.h>
+#include <drv_i2c_ms5525dso.h>
+
+/**
+ * @brief A bus of fake sensors behind the HAL, shared by the board tests
+ *
+ * Implements the HAL the board modules call. Devices are added on a mux
+ * channel and address, and answer only while the switch has their channel
+ * selected. Tests set up a device and read back what it saw through the
+ * fake_dev_t returned by fake_hal_add()
+ */
+
+/** Maximum devices on the fake bus */
+#define FAKE_HAL_DEVS 8u
+
+/** Maximum blobs in the fake NVS */
+#define FAKE_HAL_NVS_BLOBS 4u
+
+/** Largest blob the fake NVS holds */
+#define FAKE_HAL_NVS_LEN 64u
+
+/** Device answers whichever channel is selected, or when there is no switch */
+#define FAKE_HAL_CHANNEL_ANY 0xFFu
+
+typedef enum fake_dev_type_t {
+  FAKE_DEV_SWITCH,
+  FAKE_DEV_MS5525DSO,
+  FAKE_DEV_SFM3000,
+  FAKE_DEV_SFM3019,
+} fake_dev_type_t;
+
+typedef struct fake_dev_t {
+  fake_dev_type_t type;
+  uint8_t channel;  //!< Mux channel, or FAKE_HAL_CHANNEL_ANY
+  uint8_t addr;
+  hal_err_t fault;  //!< Returned by every transfer if not HAL_OK
+  uint16_t cmd;     //!< Last command written
+  uint32_t batches;
+
+  // MS5525DSO, a reading started too early reads zero, as the part does, and
+  // gets the conversion wrong after that. It converts in conv_percent of the
+  // worst case time
+  ms5525dso_coeff_t prom;
+  uint32_t d1;
+  uint32_t d2;
+  uint32_t conv_percent;
+  uint8_t conv_cmd;
+  uint8_t spoiled;
+  hal_timestamp_t ts_conv;
+  uint32_t d1_starts;
+  uint32_t d2_starts;
+  uint32_t early_reads;
+  uint32_t spoiled_reads;
+  uint32_t prom_reads;
+
+  // SFM3000 and SFM3019
+  uint32_t serial;
+  uint32_t product;
+  uint16_t offset;
+  uint16_t scale_factor;
+  uint16_t flow_raw;
+  uint32_t serial_reads;
+  uint32_t product_reads;
+  uint32_t cal_reads;
+  uint32_t avg_writes;
+} fake_dev_t;
+
+typedef struct fake_nvs_blob_t {
+  char name_space[16];
+  char key[16];
+  uint8_t data[FAKE_HAL_NVS_LEN];
+  size_t len;
+} fake_nvs_blob_t;
+
+typedef struct fake_hal_t {
+  hal_timestamp_t now;       //!< What hal_get_timestamp() returns
+  uint8_t timed;             //!< Transfers move the clock by their bus time
+  hal_timestamp_t bus_time;  //!< Bus time of all transfers since cleared
+  uint8_t channels;          //!< Mux channels selected on the switch
+  uint8_t last_addr;         //!< Address of the last transfer
+  uint32_t reset_pin;        //!< Level of the switch reset line
+  uint32_t locks;            //!< Times the bus was locked
+  uint32_t nvs_writes;
+  fake_nvs_blob_t nvs[FAKE_HAL_NVS_BLOBS];
+  fake_dev_t devs[FAKE_HAL_DEVS];
+  uint32_t dev_count;
+} fake_hal_t;
+
+extern fake_hal_t fake_hal;
+
+/**
+ * @brief Empty the bus and the NVS, and start the clock at 1ms
+ */
+void fake_hal_init(void);
+
+/**
+ * @brief Put a device on the bus
+ *
+ * Each type starts out with readings that pass its checks
+ *
+ * @param type
+ * @param channel Mux channel, or FAKE_HAL_CHANNEL_ANY
+ * @param addr I2C address
+ * @return fake_dev_t* The device, to set up and inspect
+ */
+fake_dev_t* fake_hal_add(fake_dev_type_t type, uint8_t channel, uint8_t addr);
+
+/**
+ * @brief Get a blob from the fake NVS
+ *
+ * @param name_space
+ * @param key
+ * @param len Returns the length of the blob
+ * @return uint8_t* NULL if there is no such blob
+ */
+uint8_t* fake_hal_nvs_get(const char* name_space, const char* key,
+                          size_t* len);
+
+#endif  // FAKE_HAL_H_
@@ -1,18 +1,86 @@
 #ifndef HAL_H_
 #define HAL_H_
 
+#include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 
-typedef enum hal_err_t { HAL_OK, HAL_ERR_FAIL } hal_err_t;
+typedef int64_t hal_timestamp_t;
+
+#define HAL_I2C_MASTER_FREQ 400000u
+#define HAL_I2C_XFER_OVERHEAD_US 50u
+#define HAL_I2C_XFER_TIME_US(n) \
+  (((((n) + 1u) * 9u * 1000000u) / HAL_I2C_MASTER_FREQ) + \
+   HAL_I2C_XFER_OVERHEAD_US)
+
+typedef enum hal_i2c_dev_t {
+  HAL_I2C_DEV_SWITCH,
+  HAL_I2C_DEV_PS1,
+  HAL_I2C_DEV_FS1,
+  HAL_I2C_DEV_SWITCH2,
+  HAL_I2C_DEV_PS2,
+  HAL_I2C_DEV_FS2,
+} hal_i2c_dev_t;
+
+typedef enum hal_err_t {
+  HAL_OK,
+  HAL_ERR_FAIL,
+  HAL_ERR_NACK,
+  HAL_ERR_CRC
+} hal_err_t;
+
+typedef enum hal_log_level_t {
+  HAL_LOG_NONE,
+  HAL_LOG_ERROR,
+  HAL_LOG_WARN,
+  HAL_LOG_INFO,
+  HAL_LOG_DEBUG
+} hal_log_level_t;
 
 typedef struct hal_i2c_config_t {
   uint8_t i2c_addr;
 } hal_i2c_config_t;
 
+typedef struct hal_i2c_xfer_t {
+  const uint8_t* tx;
+  uint8_t tx_len;
+  uint8_t* rx;
+  uint8_t rx_len;
+} hal_i2c_xfer_t;
+
+#define HAL_GPIO_DRV_RSTn_PIN 14u
+
+#define I2C_NUM_0 0
+#define HAL_I2C_CIRCUIT2_PORT I2C_NUM_0
+
+hal_timestamp_t hal_get_timestamp(void);
+
+void hal_log(hal_log_level_t log_level, const char* topic, const char* fmt,
+             ...);
+
+const hal_i2c_config_t* hal_i2c_get_config(hal_i2c_dev_t dev);
+
+hal_err_t hal_i2c_lock(const hal_i2c_config_t* cfg);
+
+void hal_i2c_unlock(const hal_i2c_config_t* cfg);
+
+void hal_gpio_write(uint32_t pin, int value);
+
+hal_err_t hal_i2c_probe(const hal_i2c_config_t* cfg);
+
 hal_err_t hal_i2c_write(const hal_i2c_config_t* cfg, const uint8_t* buffer,
                         uint8_t len);
 
 hal_err_t hal_i2c_read(const hal_i2c_config_t* cfg, uint8_t* buffer,
                        uint8_t len);
 
+hal_err_t hal_i2c_batch(const hal_i2c_config_t* cfg,
+                        const hal_i2c_xfer_t* xfers, uint8_t count);
+
+hal_err_t hal_nvs_read_blob(const char* name_space, const char* key,
+                            void* buffer, size_t* len);
+
+hal_err_t hal_nvs_write_blob(const char* name_space, const char* key,
+                             const void* buffer, size_t len);
+
 #endif
@@ -0,0 +1,35 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+
+#include "ms5525dso_reference.h"
+
+__attribute__((noinline)) void ms5525dso_reference_pt(
+    const ms5525dso_qx_t* qx, const ms5525dso_coeff_t* coeff, uint32_t d1,
+    uint32_t d2, int64_t* p, int64_t* t) {
+  int64_t dT;
+  int64_t OFF;
+  int64_t SENS;
+
+  dT = (int64_t)d2 - ((int64_t)coeff->c[5] * ((int64_t)1 << qx->Q5));
+  *t = 2000 + ((dT * coeff->c[6]) / ((int64_t)1 << qx->Q6));
+  OFF = ((int64_t)coeff->c[2] * ((int64_t)1 << qx->Q2)) +
+        ((coeff->c[4] * dT) / ((int64_t)1 << qx->Q4));
+  SENS = ((int64_t)coeff->c[1] * ((int64_t)1 << qx->Q1)) +
+         ((coeff->c[3] * dT) / ((int64_t)1 << qx->Q3));
+  *p = (((d1 * SENS) / ((int64_t)1 << 21)) - OFF) / ((int64_t)1 << 15);
+}
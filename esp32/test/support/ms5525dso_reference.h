@@ -0,0 +1,43 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+
+#ifndef MS5525DSO_REFERENCE_H_
+#define MS5525DSO_REFERENCE_H_
+
+#include <stdint.h>
+#include <drv_i2c_ms5525dso.h>
+
+/**
+ * @brief The datasheet compensation with its divides, in 64 bits throughout
+ *
+ * What the driver's shift and prepared paths are checked and timed against.
+ * Built as a translation unit of its own, so the test's constant Qx tables
+ * are not folded into it and each sample is a call, as in the driver.
+ *
+ * @param qx Pointer to QX table to use
+ * @param coeff Pointer to coefficient table to use
+ * @param d1 Pressure ADC channel value
+ * @param d2 Temperature ADC channel value
+ * @param p Filled in with the compensated pressure, in PSI x 10000
+ * @param t Filled in with the compensated temperature, in C x 100
+ */
+void ms5525dso_reference_pt(const ms5525dso_qx_t* qx,
+                            const ms5525dso_coeff_t* coeff, uint32_t d1,
+                            uint32_t d2, int64_t* p, int64_t* t);
+
+#endif  // MS5525DSO_REFERENCE_H_
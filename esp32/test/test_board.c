@@ -0,0 +1,225 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include "board.h"
+#include "board_dev.h"
+#include "board_hist.h"
+#include "board_sw.h"
+#include "board_ps.h"
+#include "board_fs.h"
+#include "board_fs_backend.h"
+#include "board_bus.h"
+#include "board_scan.h"
+#include "board_layout.h"
+#include "board_snapshot.h"
+#include "board_volume.h"
+#include "drv_i2c_ms5525dso.h"
+#include "drv_i2c_sfm3000.h"
+#include "drv_i2c_sfm3019.h"
+#include "sensirion_codec.h"
+#include "drv_i2c_tca9548a.h"
+#include "fake_hal.h"
+
+/** Updates long enough for both circuits to bring up their sensors */
+#define STARTUP_UPDATES 2000u
+
+static fake_dev_t* ps[BOARD_CIRCUITS];
+static fake_dev_t* fs[BOARD_CIRCUITS];
+
+static board_t board[BOARD_CIRCUITS];
+
+static void run(uint32_t updates);
+
+void setUp(void) {
+  fake_hal_init();
+  fake_hal.timed = 1u;
+
+  // Both circuits on one bus, behind one switch, on the default channels
+  fake_hal_add(FAKE_DEV_SWITCH, FAKE_HAL_CHANNEL_ANY, TCA9548A_ADDR_LLL);
+  ps[0] = fake_hal_add(FAKE_DEV_MS5525DSO, BOARD_LAYOUT_DEFAULT_PS1_CHANNEL,
+                       MS5525DSO_I2C_ADDR_HIGH);
+  fs[0] = fake_hal_add(FAKE_DEV_SFM3000, BOARD_LAYOUT_DEFAULT_FS1_CHANNEL,
+                       SFM3000_I2C_ADDR);
+  ps[1] = fake_hal_add(FAKE_DEV_MS5525DSO, board_get_config(1)->ps1_channel,
+                       MS5525DSO_I2C_ADDR_HIGH);
+  fs[1] = fake_hal_add(FAKE_DEV_SFM3000, board_get_config(1)->fs1_channel,
+                       SFM3000_I2C_ADDR);
+
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_init(&board[n], board_get_config(n)));
+  }
+}
+
+void tearDown(void) {}
+
+void test_board_shared_config(void) {
+  const board_config_t* config1 = board_get_config(0);
+  const board_config_t* config2 = board_get_config(1);
+
+  // Each circuit's sensors are on channels it owns, and no channel is owned
+  // twice
+  TEST_ASSERT_EQUAL_HEX8(0, config1->channels & config2->channels);
+  TEST_ASSERT_NOT_EQUAL(0, config1->channels & (1u << config1->ps1_channel));
+  TEST_ASSERT_NOT_EQUAL(0, config1->channels & (1u << config1->fs1_channel));
+  TEST_ASSERT_NOT_EQUAL(0, config2->channels & (1u << config2->ps1_channel));
+  TEST_ASSERT_NOT_EQUAL(0, config2->channels & (1u << config2->fs1_channel));
+
+  // Either circuit's budget fits a read behind its mux select, and together
+  // they fit in one update period
+  TEST_ASSERT_EQUAL(BOARD_SHARED_BUDGET, config1->budget);
+  TEST_ASSERT_EQUAL(BOARD_SHARED_BUDGET, config2->budget);
+  TEST_ASSERT_LESS_OR_EQUAL(BOARD_SHARED_BUDGET,
+                            BOARD_SW_COST + BOARD_PS_COST_READ);
+  TEST_ASSERT_LESS_OR_EQUAL(BOARD_SHARED_BUDGET,
+                            BOARD_SW_COST + BOARD_FS_COST_READ_WORD);
+  TEST_ASSERT_LESS_OR_EQUAL(BOARD_BUS_PERIOD, 2 * BOARD_SHARED_BUDGET);
+
+  // Both default layouts fit
+  TEST_ASSERT_EQUAL(1, board[0].layout.ps1.present);
+  TEST_ASSERT_EQUAL(1, board[0].layout.fs1.present);
+  TEST_ASSERT_EQUAL(1, board[1].layout.ps1.present);
+  TEST_ASSERT_EQUAL(1, board[1].layout.fs1.present);
+}
+
+void test_board_shared_update(void) {
+  uint32_t ps_samples[BOARD_CIRCUITS];
+  uint32_t fs_samples[BOARD_CIRCUITS];
+  hal_timestamp_t bus_time;
+
+  // Both circuits come up, each on its own sensors
+  run(STARTUP_UPDATES);
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    TEST_ASSERT_EQUAL(BOARD_ST_RUNNING, board[n].state);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[n].ps1.status);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[n].fs1.status);
+    TEST_ASSERT_EQUAL(1, board[n].bus_divisor);
+    TEST_ASSERT_NOT_EQUAL(0, ps[n]->d1_starts);
+    ps_samples[n] = board[n].ps1.stats.samples;
+    fs_samples[n] = board[n].fs1.stats.samples;
+  }
+
+  // And keep streaming, together within one update period of bus time
+  fake_hal.bus_time = 0;
+  run(1000u);
+  bus_time = fake_hal.bus_time;
+  TEST_ASSERT_LESS_OR_EQUAL(1000 * BOARD_BUS_PERIOD, bus_time);
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    TEST_ASSERT_EQUAL(BOARD_ST_RUNNING, board[n].state);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[n].ps1.status);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[n].fs1.status);
+    TEST_ASSERT_GREATER_THAN(ps_samples[n], board[n].ps1.stats.samples);
+    TEST_ASSERT_GREATER_THAN(fs_samples[n], board[n].fs1.stats.samples);
+  }
+}
+
+void test_board_escalate(void) {
+  hal_timestamp_t ts_fault;
+  hal_timestamp_t backoff;
+  hal_timestamp_t delay;
+
+  run(STARTUP_UPDATES);
+  TEST_ASSERT_EQUAL(BOARD_ST_RUNNING, board[0].state);
+
+  // A sensor that answers but keeps failing recovers on its own, backing off
+  // further every time, and the board carries on
+  ps[0]->fault = HAL_ERR_CRC;
+  ts_fault = fake_hal.now;
+  for (uint32_t n = 0; (n < 10000u) && (board[0].state == BOARD_ST_RUNNING) &&
+                       (board[0].ps1.backoff.faults < 2u);
+       n++) {
+    run(1);
+  }
+  TEST_ASSERT_EQUAL(BOARD_ST_RUNNING, board[0].state);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[0].fs1.status);
+  TEST_ASSERT_EQUAL(4 * BOARD_DEV_BACKOFF_MIN, board[0].ps1.backoff.delay);
+
+  // Until it has faulted escalate_faults times in a row, not before all the
+  // backoff delays in between have passed
+  for (uint32_t n = 0; (n < 10000u) && (board[0].state == BOARD_ST_RUNNING);
+       n++) {
+    run(1);
+  }
+  TEST_ASSERT_EQUAL(BOARD_ST_HARD_RESET, board[0].state);
+  TEST_ASSERT_EQUAL(BOARD_ESCALATE_FAULTS, board[0].ps1.backoff.faults);
+  TEST_ASSERT_EQUAL(HAL_ERR_CRC, board[0].ps1.stats.last_fault);
+  TEST_ASSERT_EQUAL(1, board[0].ps1_attached);
+
+  backoff = 0;
+  delay = BOARD_DEV_BACKOFF_MIN;
+  for (uint32_t n = 1; n < BOARD_ESCALATE_FAULTS; n++) {
+    backoff += delay;
+    delay = (delay < (BOARD_DEV_BACKOFF_MAX / 2)) ? (2 * delay)
+                                                   : BOARD_DEV_BACKOFF_MAX;
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(backoff, fake_hal.now - ts_fault);
+
+  // The other circuit is not held up by it
+  TEST_ASSERT_EQUAL(BOARD_ST_RUNNING, board[1].state);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[1].ps1.status);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[1].fs1.status);
+
+  // Once it reads again the board comes back up
+  ps[0]->fault = HAL_OK;
+  run(STARTUP_UPDATES);
+  TEST_ASSERT_EQUAL(BOARD_ST_RUNNING, board[0].state);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[0].ps1.status);
+  TEST_ASSERT_EQUAL(0, board[0].ps1.backoff.faults);
+}
+
+void test_board_store_cal(void) {
+  size_t len;
+
+  // Sensors not in the cache are read during updates, but not stored then
+  run(STARTUP_UPDATES);
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[n].fs1.status);
+    TEST_ASSERT_EQUAL(1, board[n].fs1.cal_valid);
+  }
+  TEST_ASSERT_EQUAL(0, fake_hal.nvs_writes);
+
+  // Only by the board task once the update is done, and only once
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    board_store_cal(&board[n]);
+    board_store_cal(&board[n]);
+    TEST_ASSERT_EQUAL(n + 1u, fake_hal.nvs_writes);
+    TEST_ASSERT_NOT_NULL(fake_hal_nvs_get(BOARD_DEV_CAL_NVS_NAMESPACE,
+                                          board_get_config(n)->fs1_name,
+                                          &len));
+  }
+  run(STARTUP_UPDATES);
+  TEST_ASSERT_EQUAL(BOARD_CIRCUITS, fake_hal.nvs_writes);
+}
+
+static void run(uint32_t updates) {
+  hal_timestamp_t ts;
+
+  // Both board tasks wake on the same period, and take turns on the bus
+  ts = fake_hal.now;
+  for (uint32_t i = 0; i < updates; i++) {
+    for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+      board_update(&board[n]);
+    }
+    ts += BOARD_BUS_PERIOD;
+    TEST_ASSERT_LESS_OR_EQUAL(ts, fake_hal.now);
+    fake_hal.now = ts;
+  }
+}
@@ -0,0 +1,357 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include "board.h"
+#include "board_dev.h"
+#include "board_hist.h"
+#include "board_sw.h"
+#include "board_ps.h"
+#include "board_fs.h"
+#include "board_fs_backend.h"
+#include "board_bus.h"
+#include "board_scan.h"
+#include "board_layout.h"
+#include "board_snapshot.h"
+#include "board_volume.h"
+#include "drv_i2c_ms5525dso.h"
+#include "drv_i2c_sfm3000.h"
+#include "drv_i2c_sfm3019.h"
+#include "sensirion_codec.h"
+#include "drv_i2c_tca9548a.h"
+#include "fake_hal.h"
+
+#define PERIOD 1000
+
+/** Updates run before measuring, long enough for both sensors to come up */
+#define SETTLE_UPDATES 2000u
+
+/** Updates measured */
+#define MEASURE_UPDATES 4000u
+
+/** Most updates for a conversion time to be learned down to its floor */
+#define LEARN_UPDATES 20000u
+
+/** Pressure readings far enough apart to keep the oversampling down */
+#define D1_LOW 0x700000u
+#define D1_HIGH 0x900000u
+
+static fake_dev_t* ps_sensor[BOARD_CIRCUITS];
+
+static board_t board[BOARD_CIRCUITS];
+
+static void predict(const board_t* board, board_bus_load_t* load,
+                    float* used);
+static void write_layout(const char* key, uint8_t ps_channel,
+                         ms5525dso_osr_t osr, uint8_t fs_channel);
+static void run(uint32_t circuits, uint32_t updates);
+
+// Every transaction moves the clock on by its time on the bus. Both
+// circuits have their sensors on their default channels. Pressure
+// conversions take the worst case time until a test makes them faster
+void setUp(void) {
+  const board_config_t* config;
+
+  fake_hal_init();
+  fake_hal.timed = 1u;
+  fake_hal_add(FAKE_DEV_SWITCH, FAKE_HAL_CHANNEL_ANY, TCA9548A_ADDR_LLL);
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    config = board_get_config(n);
+    ps_sensor[n] = fake_hal_add(FAKE_DEV_MS5525DSO, config->ps1_channel,
+                                MS5525DSO_I2C_ADDR_HIGH);
+    ps_sensor[n]->d1 = D1_LOW;
+    ps_sensor[n]->d2 = 0x800000u;
+    fake_hal_add(FAKE_DEV_SFM3000, config->fs1_channel, SFM3000_I2C_ADDR);
+  }
+}
+
+void tearDown(void) {}
+
+void test_board_bus_loads(void) {
+  board_bus_load_t load;
+
+  board_bus_ps_load(&load, MS5525DSO_OSR1024, 1);
+  TEST_ASSERT_EQUAL(BOARD_PS_COST_READ, load.cost);
+  TEST_ASSERT_EQUAL(ps_get_min_wait(MS5525DSO_OSR1024), load.wait);
+  TEST_ASSERT_EQUAL(2, load.reads);
+  TEST_ASSERT_EQUAL(1, load.samples);
+
+  // A temperature every 8 pressures
+  board_bus_ps_load(&load, MS5525DSO_OSR1024, 8);
+  TEST_ASSERT_EQUAL(9, load.reads);
+  TEST_ASSERT_EQUAL(8, load.samples);
+
+  board_bus_fs_load(&load);
+  TEST_ASSERT_EQUAL(BOARD_FS_COST_READ_WORD, load.cost);
+  TEST_ASSERT_EQUAL(BOARD_FS_CONVERSION_TIME, load.wait);
+  TEST_ASSERT_EQUAL(1, load.reads);
+  TEST_ASSERT_EQUAL(1, load.samples);
+}
+
+void test_board_bus_predict(void) {
+  board_bus_load_t load[2];
+  float used;
+
+  // The pressure sensor reads every update, the flow sensor's 1ms
+  // measurement is not over by the next one, so it reads every other
+  board_bus_ps_load(&load[0], MS5525DSO_OSR256, 1);
+  board_bus_fs_load(&load[1]);
+  used = board_bus_predict(load, 2, PERIOD, BOARD_DEV_BUDGET, 1, 0);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 500.0f, load[0].rate);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 500.0f, load[1].rate);
+  TEST_ASSERT_FLOAT_WITHIN(
+      0.001f,
+      (2 * BOARD_SW_COST + BOARD_PS_COST_READ + BOARD_FS_COST_READ_WORD / 2) /
+          (float)PERIOD,
+      used);
+
+  // Background work adds on top
+  TEST_ASSERT_FLOAT_WITHIN(
+      0.001f, used + 0.05f,
+      board_bus_predict(load, 2, PERIOD, BOARD_DEV_BUDGET, 1, 5));
+
+  // Slower conversions, fewer reads, once the wait is past an update
+  TEST_ASSERT_LESS_THAN(
+      (int)(used * 1000.0f),
+      (int)(board_bus_predict(load, 2, PERIOD, BOARD_DEV_BUDGET, 4, 0) *
+            1000.0f));
+  TEST_ASSERT_LESS_THAN(500, (int)load[0].rate);
+
+  // Fewer temperatures, more pressures for the same bus time
+  board_bus_ps_load(&load[0], MS5525DSO_OSR256, 8);
+  TEST_ASSERT_FLOAT_WITHIN(
+      0.001f, used, board_bus_predict(load, 2, PERIOD, BOARD_DEV_BUDGET, 1, 0));
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 1000.0f * 8 / 9, load[0].rate);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 500.0f, load[1].rate);
+
+  // A sensor behind one that takes the whole budget still gets its turn
+  board_bus_predict(load, 2, PERIOD, BOARD_SW_COST + BOARD_PS_COST_READ, 1, 0);
+  TEST_ASSERT_GREATER_THAN(0, (int)load[0].rate);
+  TEST_ASSERT_GREATER_THAN(0, (int)load[1].rate);
+
+  // A read that only fits without the select in front of it still runs
+  board_bus_predict(load, 2, PERIOD, BOARD_PS_COST_READ, 1, 0);
+  TEST_ASSERT_GREATER_THAN(0, (int)load[0].rate);
+  TEST_ASSERT_GREATER_THAN(0, (int)load[1].rate);
+}
+
+void test_board_bus_admit(void) {
+  board_bus_load_t load[2];
+  hal_timestamp_t budget;
+  uint32_t divisor;
+
+  board_bus_ps_load(&load[0], MS5525DSO_OSR256, 1);
+  board_bus_fs_load(&load[1]);
+
+  // The default configuration runs flat out on its own bus
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                    board_bus_admit(load, 2, BOARD_DEV_BUDGET,
+                                    BOARD_SCAN_SHARE, &divisor));
+  TEST_ASSERT_EQUAL(1, divisor);
+  TEST_ASSERT_EQUAL(500, (int)load[0].rate);
+  TEST_ASSERT_EQUAL(500, (int)load[1].rate);
+
+  // Sharing the bus with another circuit the reads no longer all fit in
+  // one update, but both still make their sample rate targets
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                    board_bus_admit(load, 2, BOARD_SHARED_BUDGET,
+                                    BOARD_SCAN_SHARE, &divisor));
+  TEST_ASSERT_EQUAL(1, divisor);
+  TEST_ASSERT_GREATER_OR_EQUAL((int)BOARD_PS_RATE_TARGET, (int)load[0].rate);
+  TEST_ASSERT_GREATER_OR_EQUAL((int)BOARD_FS_RATE_TARGET, (int)load[1].rate);
+
+  // With no more than a pressure read per update it has to slow down
+  budget = BOARD_SW_COST + BOARD_PS_COST_READ;
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                    board_bus_admit(load, 2, budget, BOARD_SCAN_SHARE,
+                                    &divisor));
+  TEST_ASSERT_GREATER_THAN(1, divisor);
+  TEST_ASSERT_LESS_OR_EQUAL(
+      budget * BOARD_BUS_HEADROOM / 100,
+      (int)(board_bus_predict(load, 2, BOARD_BUS_PERIOD, budget, divisor,
+                              BOARD_SCAN_SHARE) *
+            BOARD_BUS_PERIOD));
+
+  // Background work leaves too little for even the slowest rates
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    board_bus_admit(load, 2, budget, 40, &divisor));
+  TEST_ASSERT_EQUAL(BOARD_BUS_MAX_DIVISOR, divisor);
+
+  // A read that never fits in an update is refused outright
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    board_bus_admit(load, 1, BOARD_PS_COST_READ, 0, &divisor));
+}
+
+void test_board_bus_measured_default(void) {
+  board_bus_load_t load[2];
+  float predicted;
+  float measured;
+  uint32_t ps_samples;
+  uint32_t fs_samples;
+
+  // One circuit on the default layout, with the bus to itself
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_init(&board[0], board_get_config(0)));
+  run(1, SETTLE_UPDATES);
+  TEST_ASSERT_EQUAL(BOARD_ST_RUNNING, board[0].state);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[0].ps1.status);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[0].fs1.status);
+  TEST_ASSERT_EQUAL(MS5525DSO_OSR256, board[0].ps1.osr);
+  predict(&board[0], load, &predicted);
+
+  fake_hal.bus_time = 0;
+  ps_sensor[0]->d1_starts = 0;
+  ps_sensor[0]->d2_starts = 0;
+  ps_samples = board[0].ps1.stats.samples;
+  fs_samples = board[0].fs1.stats.samples;
+  run(1, MEASURE_UPDATES);
+  measured = (float)fake_hal.bus_time / (float)(MEASURE_UPDATES * PERIOD);
+
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, predicted, measured);
+  TEST_ASSERT_FLOAT_WITHIN(load[0].rate * 0.01f, load[0].rate,
+                           (board[0].ps1.stats.samples - ps_samples) * 1e6f /
+                               (MEASURE_UPDATES * PERIOD));
+  TEST_ASSERT_FLOAT_WITHIN(load[1].rate * 0.01f, load[1].rate,
+                           (board[0].fs1.stats.samples - fs_samples) * 1e6f /
+                               (MEASURE_UPDATES * PERIOD));
+
+  // One temperature conversion for every BOARD_PS_TEMP_DECIMATION pressures
+  TEST_ASSERT_UINT_WITHIN(1, ps_sensor[0]->d1_starts / BOARD_PS_TEMP_DECIMATION,
+                          ps_sensor[0]->d2_starts);
+}
+
+void test_board_bus_measured_shared(void) {
+  board_bus_load_t load[BOARD_CIRCUITS][2];
+  float predicted[BOARD_CIRCUITS];
+  float measured;
+  uint32_t ps_samples[BOARD_CIRCUITS];
+  uint32_t fs_samples[BOARD_CIRCUITS];
+  hal_timestamp_t floor;
+  uint32_t updates;
+
+  // Both circuits on one bus, with conversion times that do not line up
+  // with the updates
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    write_layout(board_get_config(n)->layout_key,
+                 board_get_config(n)->ps1_channel, MS5525DSO_OSR1024,
+                 board_get_config(n)->fs1_channel);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                      board_init(&board[n], board_get_config(n)));
+  }
+  run(BOARD_CIRCUITS, SETTLE_UPDATES);
+
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    TEST_ASSERT_EQUAL(BOARD_ST_RUNNING, board[n].state);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[n].ps1.status);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[n].fs1.status);
+    TEST_ASSERT_EQUAL(MS5525DSO_OSR1024, board[n].ps1.osr);
+    predict(&board[n], load[n], &predicted[n]);
+  }
+
+  // Sensors as slow as the worst case use less than planned
+  fake_hal.bus_time = 0;
+  run(BOARD_CIRCUITS, MEASURE_UPDATES);
+  measured = (float)fake_hal.bus_time / (float)(MEASURE_UPDATES * PERIOD);
+  TEST_ASSERT_LESS_OR_EQUAL((int)((predicted[0] + predicted[1]) * 1000.0f),
+                            (int)(measured * 1000.0f));
+
+  // Sensors faster than the board ever assumes are read at the floor, once
+  // it has been learned, and then use what was planned
+  floor = ms5525dso_get_conversion_time(MS5525DSO_OSR1024) >>
+          BOARD_PS_CONV_FLOOR_SHIFT;
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    ps_sensor[n]->conv_percent = 40u;
+  }
+  for (updates = 0;
+       (updates < LEARN_UPDATES) &&
+       ((board[0].ps1.latency[MS5525DSO_OSR1024] > floor) ||
+        (board[1].ps1.latency[MS5525DSO_OSR1024] > floor));
+       updates++) {
+    run(BOARD_CIRCUITS, 1);
+  }
+  TEST_ASSERT_LESS_THAN(LEARN_UPDATES, updates);
+
+  fake_hal.bus_time = 0;
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY, board[n].ps1.status);
+    TEST_ASSERT_EQUAL(0, ps_sensor[n]->spoiled_reads);
+    ps_samples[n] = board[n].ps1.stats.samples;
+    fs_samples[n] = board[n].fs1.stats.samples;
+  }
+  run(BOARD_CIRCUITS, MEASURE_UPDATES);
+  measured = (float)fake_hal.bus_time / (float)(MEASURE_UPDATES * PERIOD);
+
+  // Together they use what each is predicted to on its own
+  TEST_ASSERT_FLOAT_WITHIN(0.02f, predicted[0] + predicted[1], measured);
+  TEST_ASSERT_LESS_OR_EQUAL(PERIOD, board[0].run_time_max +
+                                        board[1].run_time_max);
+  for (uint32_t n = 0; n < BOARD_CIRCUITS; n++) {
+    TEST_ASSERT_FLOAT_WITHIN(load[n][0].rate * 0.02f, load[n][0].rate,
+                             (board[n].ps1.stats.samples - ps_samples[n]) *
+                                 1e6f / (MEASURE_UPDATES * PERIOD));
+    TEST_ASSERT_FLOAT_WITHIN(load[n][1].rate * 0.02f, load[n][1].rate,
+                             (board[n].fs1.stats.samples - fs_samples[n]) *
+                                 1e6f / (MEASURE_UPDATES * PERIOD));
+  }
+}
+
+// The model of the board's layout, on its budget and rates
+static void predict(const board_t* board, board_bus_load_t* load,
+                    float* used) {
+  board_bus_ps_load(&load[0], board->layout.ps1.osr, BOARD_PS_TEMP_DECIMATION);
+  board_bus_fs_load(&load[1]);
+  *used = board_bus_predict(load, 2, PERIOD, board->config->budget,
+                            board->bus_divisor, BOARD_SCAN_SHARE);
+}
+
+static void write_layout(const char* key, uint8_t ps_channel,
+                         ms5525dso_osr_t osr, uint8_t fs_channel) {
+  uint8_t blob[] = {'B', 'L', BOARD_LAYOUT_VERSION, 2,
+                    BOARD_LAYOUT_TYPE_MS5525DSO, 0, ps_channel,
+                    BOARD_LAYOUT_MS5525DSO_LEN, (uint8_t)osr, 15, 17, 7, 5, 7,
+                    21,
+                    BOARD_LAYOUT_TYPE_SFM3000, 0, fs_channel,
+                    BOARD_LAYOUT_SFM3000_LEN, 0x00, 0x7D, 0x05, 0x78,
+                    0};
+
+  blob[sizeof(blob) - 1] =
+      sensirion_crc8(blob, sizeof(blob) - 1, BOARD_LAYOUT_CRC_INIT);
+  TEST_ASSERT_EQUAL(HAL_OK, hal_nvs_write_blob(BOARD_LAYOUT_NVS_NAMESPACE, key,
+                                               blob, sizeof(blob)));
+}
+
+// Board tasks wake on the same period and take turns on the bus. The
+// pressure moves between every two conversions, however often they are
+// read, so the oversampling stays at the layout's, the one the bus is
+// planned for
+static void run(uint32_t circuits, uint32_t updates) {
+  hal_timestamp_t ts;
+
+  ts = fake_hal.now;
+  for (uint32_t i = 0; i < updates; i++) {
+    for (uint32_t n = 0; n < circuits; n++) {
+      ps_sensor[n]->d1 =
+          ((ps_sensor[n]->d1_starts % 2u) == 0u) ? D1_LOW : D1_HIGH;
+      board_update(&board[n]);
+    }
+    ts += PERIOD;
+    TEST_ASSERT_LESS_OR_EQUAL(ts, fake_hal.now);
+    fake_hal.now = ts;
+  }
+}
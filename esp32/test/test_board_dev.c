@@ -0,0 +1,232 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unity.h>
+#include "board_dev.h"
+
+static hal_timestamp_t now;
+
+void setUp(void) { now = 1000; }
+
+void tearDown(void) {}
+
+void test_board_dev_backoff(void) {
+  board_dev_backoff_t backoff;
+  hal_timestamp_t delay;
+
+  board_dev_backoff_init(&backoff);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_backoff_expired(&backoff));
+
+  board_dev_backoff_fault(&backoff);
+  TEST_ASSERT_EQUAL(1, backoff.faults);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_dev_backoff_expired(&backoff));
+  now += BOARD_DEV_BACKOFF_MIN - 1;
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_dev_backoff_expired(&backoff));
+  now += 1;
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_backoff_expired(&backoff));
+
+  // Each fault retries after twice the delay of the one before
+  delay = 2 * BOARD_DEV_BACKOFF_MIN;
+  while (delay < BOARD_DEV_BACKOFF_MAX) {
+    TEST_ASSERT_EQUAL(delay, backoff.delay);
+    board_dev_backoff_fault(&backoff);
+    TEST_ASSERT_EQUAL(now + delay, backoff.ts_retry);
+    now = backoff.ts_retry;
+    delay *= 2;
+  }
+
+  // Until it saturates at the maximum, however many faults follow
+  for (uint32_t n = 0; n < 20; n++) {
+    TEST_ASSERT_EQUAL(BOARD_DEV_BACKOFF_MAX, backoff.delay);
+    board_dev_backoff_fault(&backoff);
+    TEST_ASSERT_EQUAL(now + BOARD_DEV_BACKOFF_MAX, backoff.ts_retry);
+    now = backoff.ts_retry;
+  }
+  TEST_ASSERT_EQUAL(BOARD_DEV_BACKOFF_MAX, backoff.delay);
+
+  board_dev_backoff_ready(&backoff);
+  TEST_ASSERT_EQUAL(0, backoff.faults);
+  TEST_ASSERT_EQUAL(BOARD_DEV_BACKOFF_MIN, backoff.delay);
+}
+
+void test_board_dev_stats_faults(void) {
+  board_dev_stats_t stats;
+
+  board_dev_stats_init(&stats, now);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, stats.status);
+
+  board_dev_stats_fault(&stats, now, HAL_ERR_CRC);
+  board_dev_stats_fault(&stats, now, HAL_ERR_CRC);
+  board_dev_stats_fault(&stats, now, HAL_ERR_NACK);
+  board_dev_stats_fault(&stats, now, HAL_ERR_FAIL);
+
+  TEST_ASSERT_EQUAL(2, stats.crc_failures);
+  TEST_ASSERT_EQUAL(1, stats.nacks);
+  TEST_ASSERT_EQUAL(1, stats.errors);
+  TEST_ASSERT_EQUAL(4, stats.resets);
+  TEST_ASSERT_EQUAL(0, stats.samples);
+  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, stats.last_fault);
+}
+
+void test_board_dev_stats_not_ready_time(void) {
+  board_dev_stats_t stats;
+
+  board_dev_stats_init(&stats, now);
+
+  // Starts out not ready, the open period counts too
+  TEST_ASSERT_EQUAL(500, board_dev_stats_not_ready_time(&stats, now + 500));
+
+  board_dev_stats_sample(&stats, now + 700);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, stats.status);
+  TEST_ASSERT_EQUAL(700, board_dev_stats_not_ready_time(&stats, now + 5000));
+
+  // A second fault while already not ready does not restart the period
+  board_dev_stats_fault(&stats, now + 1000, HAL_ERR_NACK);
+  board_dev_stats_fault(&stats, now + 1500, HAL_ERR_NACK);
+  TEST_ASSERT_EQUAL(1700, board_dev_stats_not_ready_time(&stats, now + 2000));
+
+  board_dev_stats_sample(&stats, now + 3000);
+  TEST_ASSERT_EQUAL(2700, board_dev_stats_not_ready_time(&stats, now + 9000));
+
+  // Re-init of the device, not a fault
+  board_dev_stats_not_ready(&stats, now + 4000);
+  TEST_ASSERT_EQUAL(2, stats.resets);
+  TEST_ASSERT_EQUAL(2800, board_dev_stats_not_ready_time(&stats, now + 4100));
+}
+
+void test_board_dev_stats_rate(void) {
+  board_dev_stats_t stats;
+  hal_timestamp_t ts;
+
+  board_dev_stats_init(&stats, now);
+
+  // 1kHz for two windows
+  ts = now;
+  for (uint32_t n = 0; n < 2000; n++) {
+    ts += 1000;
+    board_dev_stats_sample(&stats, ts);
+  }
+  TEST_ASSERT_EQUAL(2000, stats.samples);
+  TEST_ASSERT_FLOAT_WITHIN(1.0f, 1000.0f, board_dev_stats_rate(&stats, ts));
+
+  // Slows to 100Hz, rate follows after a full window
+  for (uint32_t n = 0; n < 100; n++) {
+    ts += 10000;
+    board_dev_stats_sample(&stats, ts);
+  }
+  TEST_ASSERT_FLOAT_WITHIN(1.0f, 100.0f, board_dev_stats_rate(&stats, ts));
+
+  // Goes quiet, rate decays without any updates
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 0.0f,
+                           board_dev_stats_rate(&stats, ts + 10000000));
+}
+
+void test_board_dev_period(void) {
+  board_dev_period_t period;
+  hal_timestamp_t ts;
+
+  board_dev_period_init(&period);
+
+  // Alternate 900us and 1100us intervals for exactly one window
+  ts = now;
+  board_dev_period_update(&period, ts);
+  for (uint32_t n = 0; n < 1000; n++) {
+    ts += (n & 1u) ? 1100 : 900;
+    board_dev_period_update(&period, ts);
+  }
+  TEST_ASSERT_EQUAL(900, period.min);
+  TEST_ASSERT_EQUAL(1100, period.max);
+  TEST_ASSERT_EQUAL(1000, period.mean);
+
+  // A late wake up shows in the next window only
+  ts += 3000;
+  board_dev_period_update(&period, ts);
+  TEST_ASSERT_EQUAL(1100, period.max);
+  for (uint32_t n = 0; n < 1000; n++) {
+    ts += 1000;
+    board_dev_period_update(&period, ts);
+  }
+  TEST_ASSERT_EQUAL(1000, period.min);
+  TEST_ASSERT_EQUAL(3000, period.max);
+}
+
+void test_board_dev_budget(void) {
+  board_dev_budget_t budget;
+
+  board_dev_budget_init(&budget, 500);
+  board_dev_budget_start(&budget);
+
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_take(&budget, 200));
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_take(&budget, 300));
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_dev_budget_take(&budget, 1));
+  TEST_ASSERT_EQUAL(1, budget.deferred);
+
+  // Next update starts with the full allowance
+  board_dev_budget_start(&budget);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_take(&budget, 400));
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_dev_budget_take(&budget, 200));
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_take(&budget, 100));
+
+  // A step larger than the allowance still runs, but only on its own
+  board_dev_budget_start(&budget);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_take(&budget, 900));
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_dev_budget_take(&budget, 1));
+  TEST_ASSERT_EQUAL(3, budget.deferred);
+
+  // Selecting the device first does not use up that first step
+  board_dev_budget_start(&budget);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_select(&budget, 100));
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_take(&budget, 450));
+  TEST_ASSERT_EQUAL(550, budget.used);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_dev_budget_select(&budget, 1));
+  TEST_ASSERT_EQUAL(4, budget.deferred);
+
+  // After a step, a select is charged like any other transaction
+  board_dev_budget_start(&budget);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_take(&budget, 400));
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_select(&budget, 100));
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_dev_budget_take(&budget, 1));
+  TEST_ASSERT_EQUAL(5, budget.deferred);
+
+  // Only the first device selected gets that step, even if it did not step
+  board_dev_budget_start(&budget);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_select(&budget, 100));
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_select(&budget, 100));
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_dev_budget_take(&budget, 400));
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_take(&budget, 300));
+  TEST_ASSERT_EQUAL(500, budget.used);
+  TEST_ASSERT_EQUAL(6, budget.deferred);
+}
+
+void test_board_dev_budget_spare(void) {
+  board_dev_budget_t budget;
+
+  board_dev_budget_init(&budget, 500);
+  board_dev_budget_start(&budget);
+
+  // Background work never overruns, even as the first transaction
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_dev_budget_spare(&budget, 600));
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_take(&budget, 400));
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_dev_budget_spare(&budget, 200));
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_dev_budget_spare(&budget, 100));
+  TEST_ASSERT_EQUAL(500, budget.used);
+  TEST_ASSERT_EQUAL(0, budget.deferred);
+}
+
+hal_timestamp_t hal_get_timestamp(void) { return now; }
@@ -0,0 +1,199 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include "board_dev.h"
+#include "board_hist.h"
+#include "board_fs.h"
+#include "board_fs_backend.h"
+#include "drv_i2c_sfm3000.h"
+#include "drv_i2c_sfm3019.h"
+#include "sensirion_codec.h"
+#include "drv_i2c_ms5525dso.h"
+#include "fake_hal.h"
+
+#define PERIOD 1000
+
+/** Offset of the fake sensor, not the SFM3000 one */
+#define OFFSET 32768u
+
+/** Flow reading of the fake sensor */
+#define FLOW_RAW (OFFSET + 1200u)
+
+/** Offset of the fake SFM3019, and its signed flow reading */
+#define OFFSET_3019 (-24000)
+#define FLOW_3019 (OFFSET_3019 + 1700)
+
+static const sfm3000_settings_t air = {
+    .offset = SFM3000_GIVEN_OFFSET,
+    .scale_factor = SFM3000_GIVEN_SCALE_FACTOR_AIR_N2};
+
+static fake_dev_t* sensor;
+static fake_dev_t* sensor3019;
+
+static board_dev_fs_t fs;
+static board_dev_budget_t budget;
+static fs_values_t values;
+
+static void run(uint32_t updates);
+
+void setUp(void) {
+  fake_hal_init();
+  sensor = fake_hal_add(FAKE_DEV_SFM3000, FAKE_HAL_CHANNEL_ANY,
+                        SFM3000_I2C_ADDR);
+  sensor->offset = OFFSET;
+  sensor->scale_factor = 120u;
+  sensor->flow_raw = FLOW_RAW;
+  sensor3019 = fake_hal_add(FAKE_DEV_SFM3019, FAKE_HAL_CHANNEL_ANY,
+                            SFM3019_I2C_ADDR);
+  sensor3019->offset = (uint16_t)OFFSET_3019;
+  sensor3019->flow_raw = (uint16_t)FLOW_3019;
+  memset(&values, 0, sizeof(values));
+
+  board_dev_stats_init(&fs.stats, fake_hal.now);
+  board_hist_init(&fs.hist, fs.hist_buffer, BOARD_HIST_FS_LEN);
+  fs_load_cal(&fs, "FS1");
+  fs_init(&fs, "FS1", HAL_I2C_DEV_FS1, &board_fs_sfm3000, &air);
+  board_dev_budget_init(&budget, BOARD_DEV_BUDGET);
+}
+
+void tearDown(void) {}
+
+void test_board_fs_cal(void) {
+  size_t len;
+
+  // The datasheet values until the sensor has been read
+  TEST_ASSERT_EQUAL_FLOAT(SFM3000_GIVEN_OFFSET, fs.settings.offset);
+
+  // The sensor's own calibration, read once
+  run(300);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, fs.status);
+  TEST_ASSERT_EQUAL(1, sensor->product_reads);
+  TEST_ASSERT_EQUAL(2, sensor->cal_reads);
+
+  // And stored between updates, never from within one
+  TEST_ASSERT_EQUAL(0, fake_hal.nvs_writes);
+  TEST_ASSERT_EQUAL(1, fs.cal_dirty);
+  fs_store_cal(&fs);
+  fs_store_cal(&fs);
+  TEST_ASSERT_EQUAL(1, fake_hal.nvs_writes);
+  TEST_ASSERT_NOT_NULL(
+      fake_hal_nvs_get(BOARD_DEV_CAL_NVS_NAMESPACE, "FS1", &len));
+  TEST_ASSERT_EQUAL_HEX32(0x04020105u, fs.product);
+  TEST_ASSERT_EQUAL_FLOAT(OFFSET, fs.settings.offset);
+  TEST_ASSERT_EQUAL_FLOAT(120.0f, fs.settings.scale_factor);
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, 10.0f, values.flow);
+
+  // Not again after a reset
+  fs.state = FS_SENSOR_ST_RESET;
+  values.flow = 0.0f;
+  run(300);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, fs.status);
+  TEST_ASSERT_EQUAL(2, sensor->serial_reads);
+  TEST_ASSERT_EQUAL(1, sensor->product_reads);
+  TEST_ASSERT_EQUAL(2, sensor->cal_reads);
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, 10.0f, values.flow);
+
+  // Nor after a power cycle, from NVS, and for another gas
+  memset(&fs.cal, 0, sizeof(fs.cal));
+  fs_load_cal(&fs, "FS1");
+  TEST_ASSERT_EQUAL(1, fs.cal_valid);
+  fs_init(&fs, "FS1", HAL_I2C_DEV_FS1, &board_fs_sfm3000, &air);
+  fs_set_settings(&fs, &(sfm3000_settings_t){
+                           .offset = SFM3000_GIVEN_OFFSET,
+                           .scale_factor = SFM3000_GIVEN_SCALE_FACTOR_O2});
+  run(300);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, fs.status);
+  TEST_ASSERT_EQUAL(2, sensor->cal_reads);
+  TEST_ASSERT_EQUAL(1, fake_hal.nvs_writes);
+  TEST_ASSERT_EQUAL_FLOAT(
+      120.0f * SFM3000_GIVEN_SCALE_FACTOR_O2 / SFM3000_GIVEN_SCALE_FACTOR_AIR_N2,
+      fs.settings.scale_factor);
+
+  // Another sensor is read again
+  sensor->serial++;
+  sensor->scale_factor = 140u;
+  fs_set_settings(&fs, &air);
+  fs.state = FS_SENSOR_ST_RESET;
+  run(300);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, fs.status);
+  TEST_ASSERT_EQUAL(2, sensor->product_reads);
+  TEST_ASSERT_EQUAL(4, sensor->cal_reads);
+  TEST_ASSERT_EQUAL(1, fake_hal.nvs_writes);
+  fs_store_cal(&fs);
+  TEST_ASSERT_EQUAL(2, fake_hal.nvs_writes);
+  TEST_ASSERT_EQUAL(sensor->serial, fs.cal.serial);
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, 1200.0f / 140.0f, values.flow);
+}
+
+void test_board_fs_cal_unusable(void) {
+  // A scale factor that cannot be divided by leaves the datasheet values
+  sensor->scale_factor = 0;
+  run(300);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, fs.status);
+  TEST_ASSERT_EQUAL(2, sensor->cal_reads);
+  TEST_ASSERT_EQUAL_FLOAT(SFM3000_GIVEN_OFFSET, fs.settings.offset);
+  TEST_ASSERT_FLOAT_WITHIN(
+      0.0001f, (FLOW_RAW - SFM3000_GIVEN_OFFSET) / SFM3000_GIVEN_SCALE_FACTOR_AIR_N2,
+      values.flow);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    fs_set_settings(&fs, &(sfm3000_settings_t){
+                                             .offset = SFM3000_GIVEN_OFFSET,
+                                             .scale_factor = 0.0f}));
+}
+
+void test_board_fs_sfm3019(void) {
+  fs_init(&fs, "FS1", HAL_I2C_DEV_FS1, &board_fs_sfm3019,
+          &(sfm3000_settings_t){.offset = SFM3019_GIVEN_OFFSET,
+                                .scale_factor = SFM3019_GIVEN_SCALE_FACTOR});
+  run(300);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, fs.status);
+  TEST_ASSERT_EQUAL_HEX8(SFM3019_I2C_ADDR, fake_hal.last_addr);
+  TEST_ASSERT_EQUAL(1, sensor3019->avg_writes);
+  TEST_ASSERT_EQUAL_HEX32(0x04020611u, fs.product);
+  TEST_ASSERT_EQUAL_HEX32(sensor3019->serial, fs.serial);
+
+  // Its own offset, biased like the readings, and Air scale factor
+  TEST_ASSERT_EQUAL_FLOAT(OFFSET_3019 + SFM3019_FLOW_BIAS, fs.settings.offset);
+  TEST_ASSERT_EQUAL_FLOAT(170.0f, fs.settings.scale_factor);
+  TEST_ASSERT_EQUAL(FLOW_3019 + SFM3019_FLOW_BIAS, fs.flow_raw);
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, 10.0f, values.flow);
+}
+
+void test_board_fs_start_settle(void) {
+  // Flow is not read before the part has had its start-up time
+  while (fs.state != FS_SENSOR_ST_DISCARD_FIRST_FLOW) {
+    run(1);
+  }
+  run((BOARD_FS_START_SETTLE / PERIOD) - 1u);
+  TEST_ASSERT_EQUAL(FS_SENSOR_ST_DISCARD_FIRST_FLOW, fs.state);
+  run(2);
+  TEST_ASSERT_EQUAL(FS_SENSOR_ST_READ_FLOW, fs.state);
+  run(2);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, fs.status);
+}
+
+static void run(uint32_t updates) {
+  for (uint32_t n = 0; n < updates; n++) {
+    board_dev_budget_start(&budget);
+    fs_update(&fs, &budget, &values);
+    fake_hal.now += PERIOD;
+  }
+}
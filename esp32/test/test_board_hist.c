@@ -0,0 +1,203 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unity.h>
+#include "board_hist.h"
+
+#define HIST_LEN 8u
+
+static board_hist_t hist;
+static board_hist_sample_t buffer[HIST_LEN];
+
+static const board_hist_sample_t* span_at(const board_hist_span_t* span,
+                                          uint32_t n);
+
+void setUp(void) {
+  board_hist_init(&hist, buffer, HIST_LEN);
+}
+
+void tearDown(void) {}
+
+void test_board_hist_init(void) {
+  board_hist_t h;
+  board_dev_status_t res;
+
+  res = board_hist_init(0, buffer, HIST_LEN);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+
+  res = board_hist_init(&h, 0, HIST_LEN);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+
+  // Not a power of two
+  res = board_hist_init(&h, buffer, 6);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+
+  res = board_hist_init(&h, buffer, 1);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+
+  res = board_hist_init(&h, buffer, HIST_LEN);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+  TEST_ASSERT_EQUAL(0, board_hist_head(&h));
+}
+
+void test_board_hist_push_dt(void) {
+  board_hist_span_t span;
+  board_dev_status_t res;
+
+  board_hist_push(&hist, 1000, 10, 0);
+  board_hist_push(&hist, 1500, 11, 0);
+  board_hist_push(&hist, 1500 + BOARD_HIST_DT_MAX + 1, 12, 0);
+  board_hist_push(&hist, 1500 + BOARD_HIST_DT_MAX + 2, 13, 0);
+
+  res = board_hist_get_latest(&hist, 4, &span);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+  TEST_ASSERT_EQUAL(4, span.first_len + span.second_len);
+
+  // First sample has nothing to be relative to
+  TEST_ASSERT_EQUAL(10, span_at(&span, 0)->raw);
+  TEST_ASSERT_EQUAL(BOARD_HIST_FLAG_GAP, span_at(&span, 0)->flags);
+
+  TEST_ASSERT_EQUAL(11, span_at(&span, 1)->raw);
+  TEST_ASSERT_EQUAL(500, span_at(&span, 1)->dt);
+  TEST_ASSERT_EQUAL(0, span_at(&span, 1)->flags);
+
+  // Time step too large to record
+  TEST_ASSERT_EQUAL(12, span_at(&span, 2)->raw);
+  TEST_ASSERT_EQUAL(BOARD_HIST_FLAG_GAP, span_at(&span, 2)->flags);
+
+  TEST_ASSERT_EQUAL(13, span_at(&span, 3)->raw);
+  TEST_ASSERT_EQUAL(1, span_at(&span, 3)->dt);
+}
+
+void test_board_hist_break(void) {
+  board_hist_span_t span;
+  board_dev_status_t res;
+  uint32_t cursor;
+
+  board_hist_push(&hist, 1000, 10, 0);
+  board_hist_push(&hist, 1100, 11, 0);
+  cursor = board_hist_head(&hist);
+
+  // A sensor reset keeps positions going, a reader carries on where it was
+  // and sees the gap in the next sample
+  board_hist_break(&hist);
+  TEST_ASSERT_EQUAL(cursor, board_hist_head(&hist));
+  board_hist_push(&hist, 1200, 12, 0);
+  board_hist_push(&hist, 1300, 13, 0);
+
+  res = board_hist_get_since(&hist, cursor, &span);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+  TEST_ASSERT_EQUAL(2, span.first_len + span.second_len);
+  TEST_ASSERT_EQUAL(12, span_at(&span, 0)->raw);
+  TEST_ASSERT_EQUAL(0, span_at(&span, 0)->dt);
+  TEST_ASSERT_EQUAL(BOARD_HIST_FLAG_GAP, span_at(&span, 0)->flags);
+  TEST_ASSERT_EQUAL(13, span_at(&span, 1)->raw);
+  TEST_ASSERT_EQUAL(100, span_at(&span, 1)->dt);
+  TEST_ASSERT_EQUAL(0, span_at(&span, 1)->flags);
+}
+
+void test_board_hist_latest_wraps(void) {
+  board_hist_span_t span;
+  board_dev_status_t res;
+
+  res = board_hist_get_latest(&hist, 4, &span);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+  TEST_ASSERT_EQUAL(0, span.first_len + span.second_len);
+
+  for (uint32_t n = 0; n < 13; n++) {
+    board_hist_push(&hist, n * 10, n, 0);
+  }
+  TEST_ASSERT_EQUAL(13, board_hist_head(&hist));
+
+  // One slot is kept for the writer
+  res = board_hist_get_latest(&hist, 100, &span);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+  TEST_ASSERT_EQUAL(HIST_LEN - 1, span.first_len + span.second_len);
+  TEST_ASSERT_EQUAL(6, span.start);
+
+  // Views point straight into the ring and split where it wraps
+  TEST_ASSERT_EQUAL_PTR(&buffer[6], span.first);
+  TEST_ASSERT_EQUAL(2, span.first_len);
+  TEST_ASSERT_EQUAL_PTR(&buffer[0], span.second);
+  TEST_ASSERT_EQUAL(5, span.second_len);
+
+  for (uint32_t n = 0; n < (HIST_LEN - 1); n++) {
+    TEST_ASSERT_EQUAL(6 + n, span_at(&span, n)->raw);
+  }
+
+  res = board_hist_get_latest(&hist, 3, &span);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+  TEST_ASSERT_EQUAL(3, span.first_len);
+  TEST_ASSERT_EQUAL(0, span.second_len);
+  TEST_ASSERT_EQUAL(10, span_at(&span, 0)->raw);
+}
+
+void test_board_hist_since(void) {
+  board_hist_span_t span;
+  board_dev_status_t res;
+  uint32_t cursor;
+
+  cursor = board_hist_head(&hist);
+  for (uint32_t n = 0; n < 40; n++) {
+    board_hist_push(&hist, n * 10, n, 0);
+
+    // Consume whatever is new every third sample
+    if ((n % 3) == 2) {
+      res = board_hist_get_since(&hist, cursor, &span);
+      TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+      TEST_ASSERT_EQUAL(3, span.first_len + span.second_len);
+      for (uint32_t k = 0; k < 3; k++) {
+        TEST_ASSERT_EQUAL(cursor + k, span_at(&span, k)->raw);
+      }
+      TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_hist_check(&hist, &span));
+      cursor += span.first_len + span.second_len;
+    }
+  }
+
+  // Reader fell too far behind, must resync
+  res = board_hist_get_since(&hist, board_hist_head(&hist) - HIST_LEN, &span);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+
+  // Reader is ahead of the history
+  res = board_hist_get_since(&hist, board_hist_head(&hist) + 1, &span);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+}
+
+void test_board_hist_check_overrun(void) {
+  board_hist_span_t span;
+  board_dev_status_t res;
+
+  for (uint32_t n = 0; n < HIST_LEN; n++) {
+    board_hist_push(&hist, n, n, 0);
+  }
+
+  res = board_hist_get_latest(&hist, HIST_LEN, &span);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_hist_check(&hist, &span));
+
+  // Writer reuses the oldest slot of the view
+  board_hist_push(&hist, HIST_LEN, HIST_LEN, 0);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_hist_check(&hist, &span));
+}
+
+static const board_hist_sample_t* span_at(const board_hist_span_t* span,
+                                          uint32_t n) {
+  return (n < span->first_len) ? &span->first[n]
+                               : &span->second[n - span->first_len];
+}
@@ -0,0 +1,236 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include "board_layout.h"
+#include "sensirion_codec.h"
+
+static uint8_t nvs_blob[BOARD_LAYOUT_MAX_LEN];
+static size_t nvs_len;
+
+static uint8_t crc8(const uint8_t* buff, uint32_t len);
+static uint32_t make_blob(uint8_t* blob);
+
+void setUp(void) { nvs_len = 0; }
+
+void tearDown(void) {}
+
+void test_board_layout_default(void) {
+  board_layout_t layout;
+
+  board_layout_default(&layout);
+  TEST_ASSERT_EQUAL(1, layout.ps1.present);
+  TEST_ASSERT_EQUAL(BOARD_LAYOUT_DEFAULT_PS1_CHANNEL, layout.ps1.mux_channel);
+  TEST_ASSERT_EQUAL(MS5525DSO_OSR256, layout.ps1.osr);
+  TEST_ASSERT_EQUAL(15, layout.ps1.qx.Q1);
+  TEST_ASSERT_EQUAL(21, layout.ps1.qx.Q6);
+  TEST_ASSERT_EQUAL(1, layout.fs1.present);
+  TEST_ASSERT_EQUAL(BOARD_LAYOUT_DEFAULT_FS1_CHANNEL, layout.fs1.mux_channel);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, SFM3000_GIVEN_SCALE_FACTOR_O2,
+                           layout.fs1.settings.scale_factor);
+}
+
+void test_board_layout_parse(void) {
+  board_layout_t layout;
+  uint8_t blob[BOARD_LAYOUT_MAX_LEN];
+  uint32_t len;
+  board_dev_status_t res;
+
+  len = make_blob(blob);
+  res = board_layout_parse(blob, len, &layout);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+
+  TEST_ASSERT_EQUAL(1, layout.ps1.present);
+  TEST_ASSERT_EQUAL(3, layout.ps1.mux_channel);
+  TEST_ASSERT_EQUAL(MS5525DSO_OSR1024, layout.ps1.osr);
+  TEST_ASSERT_EQUAL(16, layout.ps1.qx.Q1);
+  TEST_ASSERT_EQUAL(18, layout.ps1.qx.Q2);
+  TEST_ASSERT_EQUAL(6, layout.ps1.qx.Q3);
+  TEST_ASSERT_EQUAL(4, layout.ps1.qx.Q4);
+  TEST_ASSERT_EQUAL(7, layout.ps1.qx.Q5);
+  TEST_ASSERT_EQUAL(22, layout.ps1.qx.Q6);
+
+  TEST_ASSERT_EQUAL(1, layout.fs1.present);
+  TEST_ASSERT_EQUAL(5, layout.fs1.mux_channel);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 32000.0f, layout.fs1.settings.offset);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 140.0f, layout.fs1.settings.scale_factor);
+}
+
+void test_board_layout_parse_subset(void) {
+  board_layout_t layout;
+  uint8_t blob[] = {'B', 'L', BOARD_LAYOUT_VERSION, 2,
+                    // Unknown sensor type, skipped
+                    9, 0, 1, 2, 0xAA, 0xBB,
+                    // Flow sensor only
+                    BOARD_LAYOUT_TYPE_SFM3000, 0, 2, 4, 0x00, 0x7D, 0x94, 0x05,
+                    0};
+  board_dev_status_t res;
+
+  blob[sizeof(blob) - 1] = crc8(blob, sizeof(blob) - 1);
+  res = board_layout_parse(blob, sizeof(blob), &layout);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+  TEST_ASSERT_EQUAL(0, layout.ps1.present);
+  TEST_ASSERT_EQUAL(1, layout.fs1.present);
+  TEST_ASSERT_EQUAL(2, layout.fs1.mux_channel);
+  TEST_ASSERT_EQUAL(BOARD_LAYOUT_TYPE_SFM3000, layout.fs1.type);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 142.8f, layout.fs1.settings.scale_factor);
+}
+
+void test_board_layout_parse_sfm3019(void) {
+  board_layout_t layout;
+  uint8_t blob[] = {'B', 'L', BOARD_LAYOUT_VERSION, 1,
+                    BOARD_LAYOUT_TYPE_SFM3019, 0, 3, BOARD_LAYOUT_SFM3019_LEN,
+                    0};
+  board_dev_status_t res;
+
+  blob[sizeof(blob) - 1] = crc8(blob, sizeof(blob) - 1);
+  res = board_layout_parse(blob, sizeof(blob), &layout);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+  TEST_ASSERT_EQUAL(1, layout.fs1.present);
+  TEST_ASSERT_EQUAL(3, layout.fs1.mux_channel);
+  TEST_ASSERT_EQUAL(BOARD_LAYOUT_TYPE_SFM3019, layout.fs1.type);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, SFM3019_GIVEN_OFFSET,
+                           layout.fs1.settings.offset);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, SFM3019_GIVEN_SCALE_FACTOR,
+                           layout.fs1.settings.scale_factor);
+}
+
+void test_board_layout_parse_invalid(void) {
+  board_layout_t layout;
+  board_layout_t expected;
+  uint8_t blob[BOARD_LAYOUT_MAX_LEN];
+  uint32_t len;
+
+  board_layout_default(&layout);
+  memcpy(&expected, &layout, sizeof(layout));
+  len = make_blob(blob);
+
+  // Bad CRC
+  blob[5] ^= 1;
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_layout_parse(blob, len, &layout));
+  blob[5] ^= 1;
+
+  // Truncated
+  blob[len - 2] = crc8(blob, len - 2);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    board_layout_parse(blob, len - 1, &layout));
+  len = make_blob(blob);
+
+  // Wrong version
+  blob[2]++;
+  blob[len - 1] = crc8(blob, len - 1);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_layout_parse(blob, len, &layout));
+  len = make_blob(blob);
+
+  // Mux channel out of range
+  blob[6] = BOARD_LAYOUT_MUX_CHANNELS;
+  blob[len - 1] = crc8(blob, len - 1);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_layout_parse(blob, len, &layout));
+  len = make_blob(blob);
+
+  // Qx outside the datasheet range, too small or large enough to overflow
+  blob[9] = 13;
+  blob[len - 1] = crc8(blob, len - 1);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_layout_parse(blob, len, &layout));
+  len = make_blob(blob);
+  blob[14] = 32;
+  blob[len - 1] = crc8(blob, len - 1);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_layout_parse(blob, len, &layout));
+  len = make_blob(blob);
+
+  // Count does not cover every record
+  blob[3] = 1;
+  blob[len - 1] = crc8(blob, len - 1);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_layout_parse(blob, len, &layout));
+
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_layout_parse(blob, 2, &layout));
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_layout_parse(0, len, &layout));
+
+  // Layout is untouched by a bad blob
+  TEST_ASSERT_EQUAL_MEMORY(&expected, &layout, sizeof(layout));
+}
+
+void test_board_layout_load(void) {
+  board_layout_t layout;
+
+  // Nothing in NVS
+  memset(&layout, 0, sizeof(layout));
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_layout_load(&layout, BOARD_LAYOUT_NVS_KEY));
+  TEST_ASSERT_EQUAL(BOARD_LAYOUT_DEFAULT_PS1_CHANNEL, layout.ps1.mux_channel);
+
+  nvs_len = make_blob(nvs_blob);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_layout_load(&layout, BOARD_LAYOUT_NVS_KEY));
+  TEST_ASSERT_EQUAL(3, layout.ps1.mux_channel);
+
+  // Corrupt blob falls back to the default
+  nvs_blob[4] ^= 0xFF;
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_layout_load(&layout, BOARD_LAYOUT_NVS_KEY));
+  TEST_ASSERT_EQUAL(BOARD_LAYOUT_DEFAULT_PS1_CHANNEL, layout.ps1.mux_channel);
+}
+
+static uint32_t make_blob(uint8_t* blob) {
+  const uint8_t records[] = {
+      'B', 'L', BOARD_LAYOUT_VERSION, 2,
+      // PP002DS at OSR1024 on mux channel 3
+      BOARD_LAYOUT_TYPE_MS5525DSO, 0, 3, BOARD_LAYOUT_MS5525DSO_LEN,
+      MS5525DSO_OSR1024, 16, 18, 6, 4, 7, 22,
+      // Air/N2 on mux channel 5, offset 32000, scale 140.0
+      BOARD_LAYOUT_TYPE_SFM3000, 0, 5, BOARD_LAYOUT_SFM3000_LEN, 0x00, 0x7D,
+      0x78, 0x05};
+
+  memcpy(blob, records, sizeof(records));
+  blob[sizeof(records)] = crc8(records, sizeof(records));
+  return sizeof(records) + 1;
+}
+
+// Bit by bit, to check the table driven CRC the firmware uses
+static uint8_t crc8(const uint8_t* buff, uint32_t len) {
+  uint8_t crc;
+
+  crc = 0xFFu;
+  for (uint32_t n = 0; n < len; n++) {
+    crc ^= buff[n];
+    for (uint8_t bit = 0; bit < 8u; bit++) {
+      crc = (crc & 0x80u) ? (uint8_t)((crc << 1) ^ 0x31u) : (uint8_t)(crc << 1);
+    }
+  }
+
+  return crc;
+}
+
+hal_err_t hal_nvs_read_blob(const char* name_space, const char* key,
+                            void* buffer, size_t* len) {
+  TEST_ASSERT_EQUAL_STRING(BOARD_LAYOUT_NVS_NAMESPACE, name_space);
+  TEST_ASSERT_EQUAL_STRING(BOARD_LAYOUT_NVS_KEY, key);
+
+  if ((nvs_len == 0) || (nvs_len > *len)) {
+    return HAL_ERR_FAIL;
+  }
+
+  memcpy(buffer, nvs_blob, nvs_len);
+  *len = nvs_len;
+  return HAL_OK;
+}
+
+// The layout only shares the CRC with the Sensirion codec, never the bus
+hal_err_t hal_i2c_read(const hal_i2c_config_t* cfg, uint8_t* buffer,
+                       uint8_t len) {
+  return HAL_ERR_FAIL;
+}
@@ -0,0 +1,219 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include "board_dev.h"
+#include "board_hist.h"
+#include "board_ps.h"
+#include "drv_i2c_ms5525dso.h"
+#include "sensirion_codec.h"
+#include "fake_hal.h"
+
+#define PERIOD 1000
+
+/** Pressure reading of the fake sensor, near 0.5 PSI */
+#define D1_STEADY 4650976u
+
+static const ms5525dso_qx_t qx = MS5525DSO_QX_FOR_PP001DS();
+
+static fake_dev_t* sensor;
+static hal_timestamp_t period;
+
+static board_dev_ps_t ps;
+static board_dev_budget_t budget;
+
+static void run(uint32_t updates);
+static ms5525dso_osr_t conv_osr(void);
+
+void setUp(void) {
+  fake_hal_init();
+  sensor = fake_hal_add(FAKE_DEV_MS5525DSO, FAKE_HAL_CHANNEL_ANY,
+                        MS5525DSO_I2C_ADDR_HIGH);
+  sensor->d1 = D1_STEADY;
+  period = PERIOD;
+
+  board_dev_stats_init(&ps.stats, fake_hal.now);
+  board_hist_init(&ps.hist, ps.hist_buffer, BOARD_HIST_PS_LEN);
+  ps_init(&ps, "PS1", HAL_I2C_DEV_PS1, MS5525DSO_OSR256, &qx);
+  board_dev_budget_init(&budget, period);
+}
+
+void tearDown(void) {}
+
+void test_board_ps_osr_steady(void) {
+  // A steady pressure steps up to the least noisy oversampling allowed
+  run(2000);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, ps.status);
+  TEST_ASSERT_EQUAL(BOARD_PS_OSR_MAX, ps.osr);
+  TEST_ASSERT_EQUAL(BOARD_PS_OSR_MAX, conv_osr());
+  TEST_ASSERT_EQUAL(0, sensor->spoiled_reads);
+}
+
+void test_board_ps_osr_transient(void) {
+  uint32_t samples;
+
+  run(2000);
+  TEST_ASSERT_EQUAL(BOARD_PS_OSR_MAX, conv_osr());
+
+  // Small changes are noise, the oversampling holds
+  sensor->d1 = D1_STEADY + 1000u;
+  run(100);
+  TEST_ASSERT_EQUAL(BOARD_PS_OSR_MAX, conv_osr());
+
+  // The first sample of a fast change starts the fastest conversion
+  sensor->d1 = D1_STEADY + 100000u;
+  samples = ps.stats.samples;
+  while (ps.stats.samples == samples) {
+    run(1);
+  }
+  TEST_ASSERT_EQUAL(MS5525DSO_OSR256, ps.osr);
+  TEST_ASSERT_EQUAL(MS5525DSO_OSR256, conv_osr());
+  TEST_ASSERT_EQUAL(0, sensor->spoiled_reads);
+
+  // Then steps back up once the pressure holds still
+  run(2000);
+  TEST_ASSERT_EQUAL(BOARD_PS_OSR_MAX, conv_osr());
+  TEST_ASSERT_EQUAL(0, sensor->spoiled_reads);
+}
+
+void test_board_ps_osr_fixed(void) {
+  ps_set_osr_max(&ps, MS5525DSO_OSR256);
+  run(2000);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, ps.status);
+  TEST_ASSERT_EQUAL(MS5525DSO_OSR256, conv_osr());
+
+  // The configured oversampling is also the slowest
+  setUp();
+  ps_init(&ps, "PS1", HAL_I2C_DEV_PS1, MS5525DSO_OSR4096, &qx);
+  run(2000);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, ps.status);
+  TEST_ASSERT_EQUAL(MS5525DSO_OSR4096, conv_osr());
+  TEST_ASSERT_EQUAL(0, sensor->spoiled_reads);
+}
+
+void test_board_ps_conversion_time(void) {
+  hal_timestamp_t worst;
+  uint32_t samples;
+  uint32_t early;
+
+  // A part 20% faster than the worst case, updated often enough to tell
+  sensor->conv_percent = 80u;
+  period = 50;
+  worst = ms5525dso_get_conversion_time(MS5525DSO_OSR1024);
+  ps_init(&ps, "PS1", HAL_I2C_DEV_PS1, MS5525DSO_OSR1024, &qx);
+  ps_set_osr_max(&ps, MS5525DSO_OSR1024);
+  run(40000);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, ps.status);
+
+  // Learned to within the backoff of the real time
+  TEST_ASSERT_UINT_WITHIN(worst >> BOARD_PS_CONV_BACKOFF_SHIFT,
+                          (worst * 8u) / 10u,
+                          ps.latency[MS5525DSO_OSR1024]);
+
+  // Faster than waiting for the worst case, a temperature every
+  // BOARD_PS_TEMP_DECIMATION pressures, with few conversions spoiled by
+  // reading them too soon and none of those read back
+  samples = ps.stats.samples;
+  early = sensor->early_reads;
+  run(20000);
+  samples = ps.stats.samples - samples;
+  TEST_ASSERT_GREATER_THAN(
+      (11u * 1000000u * BOARD_PS_TEMP_DECIMATION) /
+          (10u * (BOARD_PS_TEMP_DECIMATION + 1u) *
+           (uint32_t)(worst + BOARD_PS_CONV_MARGIN + period)),
+      samples);
+  TEST_ASSERT_LESS_THAN(samples / 32u, sensor->early_reads - early);
+  TEST_ASSERT_EQUAL(0, sensor->spoiled_reads);
+
+  // A divided rate waits as the bus was planned, past the worst case
+  ps_set_rate_divisor(&ps, 2);
+  TEST_ASSERT_EQUAL(2 * ps_get_min_wait(MS5525DSO_OSR1024), ps.conversion_time);
+  TEST_ASSERT_GREATER_THAN(worst, ps.conversion_time);
+}
+
+void test_board_ps_prom_batch(void) {
+  // The whole PROM in one batch, then straight on to converting
+  while (ps.state != PS_SENSOR_ST_READ_COEFF) {
+    run(1);
+  }
+  run(1);
+  TEST_ASSERT_EQUAL(PS_SENSOR_ST_START, ps.state);
+  TEST_ASSERT_EQUAL(1, sensor->batches);
+  TEST_ASSERT_EQUAL_MEMORY(&sensor->prom, &ps.coeff, sizeof(sensor->prom));
+
+  // A tight budget splits it over a few updates, checked once complete
+  setUp();
+  board_dev_budget_init(&budget,
+                        BOARD_PS_COST_PROM + (2u * BOARD_PS_COST_PROM_NEXT));
+  while (ps.state != PS_SENSOR_ST_READ_COEFF) {
+    run(1);
+  }
+  run(2);
+  TEST_ASSERT_EQUAL(PS_SENSOR_ST_READ_COEFF, ps.state);
+  run(1);
+  TEST_ASSERT_EQUAL(PS_SENSOR_ST_START, ps.state);
+  TEST_ASSERT_EQUAL(3, sensor->batches);
+  TEST_ASSERT_EQUAL_MEMORY(&sensor->prom, &ps.coeff, sizeof(sensor->prom));
+  run(2000);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, ps.status);
+}
+
+void test_board_ps_prom_reset(void) {
+  ms5525dso_coeff_t saved;
+
+  // Nothing tells one sensor from another, so every start reads the table
+  run(100);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, ps.status);
+  TEST_ASSERT_EQUAL(MS5525DSO_NUM_PROM_ADDR, sensor->prom_reads);
+
+  // So does every reset after a fault
+  sensor->prom_reads = 0;
+  ps.state = PS_SENSOR_ST_RESET;
+  run(100);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, ps.status);
+  TEST_ASSERT_EQUAL(MS5525DSO_NUM_PROM_ADDR, sensor->prom_reads);
+
+  // Which picks up a different sensor, its CRC checked, without any flash
+  sensor->prom_reads = 0;
+  saved = sensor->prom;
+  sensor->prom.c[6] ^= 0x0100u;
+  sensor->prom.c[7] = ms5525dso_calculate_coeff_crc(&sensor->prom);
+  ps_init(&ps, "PS1", HAL_I2C_DEV_PS1, MS5525DSO_OSR256, &qx);
+  run(100);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, ps.status);
+  TEST_ASSERT_EQUAL(MS5525DSO_NUM_PROM_ADDR, sensor->prom_reads);
+  TEST_ASSERT_EQUAL_MEMORY(&sensor->prom, &ps.coeff, sizeof(sensor->prom));
+  TEST_ASSERT_EQUAL(0, fake_hal.nvs_writes);
+  sensor->prom = saved;
+}
+
+static void run(uint32_t updates) {
+  ps_values_t values;
+
+  for (uint32_t n = 0; n < updates; n++) {
+    board_dev_budget_start(&budget);
+    ps_update(&ps, &budget, &values);
+    fake_hal.now += period;
+  }
+}
+
+static ms5525dso_osr_t conv_osr(void) {
+  return (ms5525dso_osr_t)((sensor->conv_cmd & 0x0Eu) >> 1);
+}
@@ -0,0 +1,179 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include "board_dev.h"
+#include "board_scan.h"
+
+/** Time for the bucket to fill enough for one probe at the default share */
+#define PROBE_INTERVAL (BOARD_SCAN_COST * 100 / BOARD_SCAN_SHARE)
+
+static hal_timestamp_t now;
+static board_scan_t scan;
+static board_dev_budget_t budget;
+
+void setUp(void) {
+  now = 1000;
+  board_scan_init(&scan, BOARD_SCAN_SHARE);
+  board_dev_budget_init(&budget, 10 * BOARD_SCAN_COST);
+  board_dev_budget_start(&budget);
+}
+
+void tearDown(void) {}
+
+void test_board_scan_addr(void) {
+  TEST_ASSERT_EQUAL(1u << 0, board_scan_addr_bit(0x40));
+  TEST_ASSERT_EQUAL(1u << 1, board_scan_addr_bit(0x2E));
+  TEST_ASSERT_EQUAL(1u << 7, board_scan_addr_bit(0x4B));
+  TEST_ASSERT_EQUAL(0, board_scan_addr_bit(0x70));
+
+  for (uint32_t n = 0; n < BOARD_SCAN_NUM_ADDR; n++) {
+    TEST_ASSERT_EQUAL(1u << n, board_scan_addr_bit(board_scan_addr(n)));
+  }
+  TEST_ASSERT_EQUAL(0, board_scan_addr(BOARD_SCAN_NUM_ADDR));
+}
+
+void test_board_scan_rate_limit(void) {
+  uint8_t channel;
+  uint8_t addr;
+  uint32_t probes;
+
+  // Nothing saved up yet
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    board_scan_next(&scan, &budget, NULL, &channel, &addr));
+
+  // Over 100 probe intervals, updating every 100us, the scan gets about 100
+  // probes no matter how much budget is spare
+  probes = 0;
+  for (uint32_t n = 0; n < (PROBE_INTERVAL + 1); n++) {
+    now += 100;
+    board_dev_budget_start(&budget);
+    if (board_scan_next(&scan, &budget, NULL, &channel, &addr) ==
+        BOARD_DEV_READY) {
+      probes++;
+    }
+  }
+  TEST_ASSERT_EQUAL(100, probes);
+  TEST_ASSERT_EQUAL(100, scan.probes);
+
+  // Credit saved up while idle is capped
+  now += 1000000;
+  probes = 0;
+  for (uint32_t n = 0; n < 10; n++) {
+    if (board_scan_next(&scan, &budget, NULL, &channel, &addr) ==
+        BOARD_DEV_READY) {
+      probes++;
+    }
+  }
+  TEST_ASSERT_EQUAL(BOARD_SCAN_BURST, probes);
+}
+
+void test_board_scan_spare_budget(void) {
+  uint8_t channel;
+  uint8_t addr;
+
+  now += 1000000;
+
+  // Sensors used up the update, the pair waits for the next one
+  budget.used = budget.limit - BOARD_SCAN_COST + 1;
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    board_scan_next(&scan, &budget, NULL, &channel, &addr));
+  TEST_ASSERT_EQUAL(0, budget.deferred);
+
+  board_dev_budget_start(&budget);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                    board_scan_next(&scan, &budget, NULL, &channel, &addr));
+  TEST_ASSERT_EQUAL(0, channel);
+  TEST_ASSERT_EQUAL(board_scan_addr(0), addr);
+  TEST_ASSERT_EQUAL(BOARD_SCAN_COST, budget.used);
+}
+
+void test_board_scan_order(void) {
+  uint8_t busy[BOARD_SCAN_CHANNELS];
+  uint8_t channel;
+  uint8_t addr;
+
+  // Everything but one address on channel 3 is in use
+  memset(busy, 0xFF, sizeof(busy));
+  busy[3] = (uint8_t)~board_scan_addr_bit(0x77);
+
+  for (uint32_t n = 0; n < 3; n++) {
+    now += 1000000;
+    board_dev_budget_start(&budget);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                      board_scan_next(&scan, &budget, busy, &channel, &addr));
+    TEST_ASSERT_EQUAL(3, channel);
+    TEST_ASSERT_EQUAL(0x77, addr);
+  }
+  TEST_ASSERT_EQUAL(2, scan.passes);
+
+  // Nothing left to probe costs nothing
+  memset(busy, 0xFF, sizeof(busy));
+  board_dev_budget_start(&budget);
+  now += 1000000;
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    board_scan_next(&scan, &budget, busy, &channel, &addr));
+  TEST_ASSERT_EQUAL(0, budget.used);
+
+  // A full pass with nothing busy visits every pair once
+  scan.channel = 0;
+  scan.addr_idx = 0;
+  for (uint32_t n = 0; n < (BOARD_SCAN_CHANNELS * BOARD_SCAN_NUM_ADDR); n++) {
+    now += 1000000;
+    board_dev_budget_start(&budget);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                      board_scan_next(&scan, &budget, NULL, &channel, &addr));
+    TEST_ASSERT_EQUAL(n / BOARD_SCAN_NUM_ADDR, channel);
+    TEST_ASSERT_EQUAL(board_scan_addr(n % BOARD_SCAN_NUM_ADDR), addr);
+  }
+  TEST_ASSERT_EQUAL(4, scan.passes);
+}
+
+void test_board_scan_find(void) {
+  uint8_t channel;
+
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    board_scan_find(&scan, 0x40, 0, &channel));
+
+  board_scan_result(&scan, 2, 0x40, HAL_OK);
+  board_scan_result(&scan, 5, 0x40, HAL_OK);
+  board_scan_result(&scan, 5, 0x77, HAL_ERR_NACK);
+
+  // The preferred channel wins, otherwise the lowest
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_scan_find(&scan, 0x40, 5, &channel));
+  TEST_ASSERT_EQUAL(5, channel);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, board_scan_find(&scan, 0x40, 7, &channel));
+  TEST_ASSERT_EQUAL(2, channel);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    board_scan_find(&scan, 0x77, 5, &channel));
+
+  // Unplugged
+  board_scan_result(&scan, 2, 0x40, HAL_ERR_NACK);
+  board_scan_forget(&scan, 5, 0x40);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    board_scan_find(&scan, 0x40, 2, &channel));
+
+  // Unknown addresses are never found
+  board_scan_result(&scan, 1, 0x70, HAL_OK);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    board_scan_find(&scan, 0x70, 1, &channel));
+}
+
+hal_timestamp_t hal_get_timestamp(void) { return now; }
@@ -0,0 +1,237 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unity.h>
+#include "board_snapshot.h"
+
+#define STRESS_READERS 3
+#define STRESS_DURATION_NS 500000000LL
+
+typedef struct reader_result_t {
+  uint64_t reads;
+  uint64_t not_ready;
+  uint64_t torn;
+  uint64_t backwards;
+  int64_t max_latency_ns;
+  int64_t total_latency_ns;
+} reader_result_t;
+
+static board_snapshot_t snapshot;
+static volatile int stop;
+
+static int64_t now_ns(void);
+static void fill_sample(board_sample_t* sample, uint32_t n);
+static int check_sample(const board_sample_t* sample);
+static void* writer_thread(void* arg);
+static void* reader_thread(void* arg);
+
+void setUp(void) {
+  board_snapshot_init(&snapshot);
+  stop = 0;
+}
+
+void tearDown(void) {}
+
+void test_board_snapshot_empty(void) {
+  board_sample_t sample;
+  board_dev_status_t res;
+
+  res = board_snapshot_read(&snapshot, &sample);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+
+  res = board_snapshot_read(0, &sample);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+
+  res = board_snapshot_read(&snapshot, 0);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+}
+
+void test_board_snapshot_publish_read(void) {
+  board_sample_t in;
+  board_sample_t out;
+  board_dev_status_t res;
+
+  board_snapshot_publish(0, &in);
+  board_snapshot_publish(&snapshot, 0);
+
+  for (uint32_t n = 1; n < 10; n++) {
+    fill_sample(&in, n);
+    board_snapshot_publish(&snapshot, &in);
+
+    res = board_snapshot_read(&snapshot, &out);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+    TEST_ASSERT_EQUAL(n, out.count);
+    TEST_ASSERT_EQUAL(in.ps1.ts, out.ps1.ts);
+    TEST_ASSERT_EQUAL(in.fs1.ts, out.fs1.ts);
+    TEST_ASSERT_FLOAT_WITHIN(0.0f, in.ps1.pressure, out.ps1.pressure);
+    TEST_ASSERT_FLOAT_WITHIN(0.0f, in.fs1.flow, out.fs1.flow);
+    TEST_ASSERT_EQUAL(1, check_sample(&out));
+  }
+}
+
+void test_board_snapshot_writer_busy(void) {
+  board_sample_t sample;
+  board_dev_status_t res;
+
+  fill_sample(&sample, 1);
+  board_snapshot_publish(&snapshot, &sample);
+
+  // Writer caught part way through, reader must give up rather than wait
+  snapshot.seq++;
+  res = board_snapshot_read(&snapshot, &sample);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+
+  snapshot.seq++;
+  res = board_snapshot_read(&snapshot, &sample);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+}
+
+void test_board_snapshot_stress(void) {
+  pthread_t writer;
+  pthread_t readers[STRESS_READERS];
+  reader_result_t results[STRESS_READERS];
+  uint64_t published;
+  uint64_t reads;
+  uint64_t not_ready;
+  int64_t max_latency_ns;
+  int64_t total_latency_ns;
+  int64_t ts_start;
+
+  memset(results, 0, sizeof(results));
+
+  pthread_create(&writer, NULL, writer_thread, &published);
+  for (int n = 0; n < STRESS_READERS; n++) {
+    pthread_create(&readers[n], NULL, reader_thread, &results[n]);
+  }
+
+  ts_start = now_ns();
+  while ((now_ns() - ts_start) < STRESS_DURATION_NS) {
+    sched_yield();
+  }
+  stop = 1;
+
+  pthread_join(writer, NULL);
+  reads = 0;
+  not_ready = 0;
+  max_latency_ns = 0;
+  total_latency_ns = 0;
+  for (int n = 0; n < STRESS_READERS; n++) {
+    pthread_join(readers[n], NULL);
+    TEST_ASSERT_EQUAL(0, results[n].torn);
+    TEST_ASSERT_EQUAL(0, results[n].backwards);
+    reads += results[n].reads;
+    not_ready += results[n].not_ready;
+    total_latency_ns += results[n].total_latency_ns;
+    if (results[n].max_latency_ns > max_latency_ns) {
+      max_latency_ns = results[n].max_latency_ns;
+    }
+  }
+
+  TEST_ASSERT_GREATER_THAN(0, reads);
+  printf("snapshot stress: %llu published, %llu reads, %llu not ready\n",
+         (unsigned long long)published, (unsigned long long)reads,
+         (unsigned long long)not_ready);
+  printf("snapshot stress: read latency mean %lld ns, max %lld ns\n",
+         (long long)(total_latency_ns / (int64_t)(reads + not_ready)),
+         (long long)max_latency_ns);
+}
+
+static int64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((int64_t)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+static void fill_sample(board_sample_t* sample, uint32_t n) {
+  // Every field is derived from n, so a mix of two writes is detectable
+  sample->ps1_status = (n & 1u) ? BOARD_DEV_READY : BOARD_DEV_NOT_READY;
+  sample->fs1_status = sample->ps1_status;
+  sample->ps1.ts = n;
+  sample->ps1.pressure = (float)(n & 0xFFFFu);
+  sample->ps1.temp = (float)((n & 0xFFFFu) * 2u);
+  sample->fs1.ts = (hal_timestamp_t)n * 3;
+  sample->fs1.flow = -(float)(n & 0xFFFFu);
+}
+
+static int check_sample(const board_sample_t* sample) {
+  uint32_t n;
+  board_dev_status_t status;
+
+  n = (uint32_t)sample->ps1.ts;
+  status = (n & 1u) ? BOARD_DEV_READY : BOARD_DEV_NOT_READY;
+
+  return (sample->ps1_status == status) && (sample->fs1_status == status) &&
+         (sample->ps1.pressure == (float)(n & 0xFFFFu)) &&
+         (sample->ps1.temp == (float)((n & 0xFFFFu) * 2u)) &&
+         (sample->fs1.ts == (hal_timestamp_t)n * 3) &&
+         (sample->fs1.flow == -(float)(n & 0xFFFFu)) && (sample->count == n);
+}
+
+static void* writer_thread(void* arg) {
+  board_sample_t sample;
+  uint64_t* published = (uint64_t*)arg;
+  uint32_t n;
+
+  for (n = 1; !__atomic_load_n(&stop, __ATOMIC_RELAXED); n++) {
+    fill_sample(&sample, n);
+    board_snapshot_publish(&snapshot, &sample);
+  }
+
+  *published = n - 1;
+  return NULL;
+}
+
+static void* reader_thread(void* arg) {
+  reader_result_t* result = (reader_result_t*)arg;
+  board_sample_t sample;
+  board_dev_status_t res;
+  uint32_t last_count;
+  int64_t ts_start;
+  int64_t latency;
+
+  last_count = 0;
+  while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+    ts_start = now_ns();
+    res = board_snapshot_read(&snapshot, &sample);
+    latency = now_ns() - ts_start;
+
+    result->total_latency_ns += latency;
+    if (latency > result->max_latency_ns) {
+      result->max_latency_ns = latency;
+    }
+
+    if (res == BOARD_DEV_READY) {
+      result->reads++;
+      if (!check_sample(&sample)) {
+        result->torn++;
+      }
+      if (sample.count < last_count) {
+        result->backwards++;
+      }
+      last_count = sample.count;
+    } else {
+      result->not_ready++;
+    }
+  }
+
+  return NULL;
+}
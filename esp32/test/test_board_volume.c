@@ -0,0 +1,217 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unity.h>
+#include "board_volume.h"
+
+/** Breath period of the synthetic waveforms, 12 breaths per minute */
+#define PERIOD 5000000
+
+/** Peak flow of the sine waveform, in slm */
+#define AMPLITUDE 30.0f
+
+/** Tidal volume of the sine waveform, in ml */
+#define SINE_TIDAL ((AMPLITUDE * PERIOD) / (M_PI * 60000.0))
+
+/** Tidal volume of the ventilator waveform, in ml */
+#define VENT_TIDAL 600.0
+
+static board_volume_t volume;
+static board_volume_breath_t breaths[64];
+static uint32_t completed;
+static uint32_t state;
+
+typedef float (*waveform_t)(hal_timestamp_t t);
+
+static void run(waveform_t waveform, float bias, hal_timestamp_t start,
+                hal_timestamp_t end);
+static float sine(hal_timestamp_t t);
+static float vent(hal_timestamp_t t);
+static uint32_t rand_next(void);
+
+void setUp(void) {
+  board_volume_init(&volume);
+  memset(breaths, 0, sizeof(breaths));
+  completed = 0;
+  state = 1;
+}
+
+void tearDown(void) {}
+
+void test_board_volume_sine(void) {
+  board_volume_breath_t breath;
+
+  board_volume_get_breath(&volume, &breath);
+  TEST_ASSERT_EQUAL(0, breath.count);
+
+  // Starts part way into inspiration, that breath is not counted
+  run(sine, 0.0f, 0, (10 * PERIOD) + (PERIOD / 8));
+  TEST_ASSERT_EQUAL(9, completed);
+
+  for (uint32_t n = 0; n < completed; n++) {
+    TEST_ASSERT_EQUAL(n + 1u, breaths[n].count);
+    TEST_ASSERT_FLOAT_WITHIN(SINE_TIDAL * 0.001, SINE_TIDAL,
+                             breaths[n].inspired);
+    TEST_ASSERT_FLOAT_WITHIN(SINE_TIDAL * 0.001, SINE_TIDAL,
+                             breaths[n].expired);
+    TEST_ASSERT_INT_WITHIN(PERIOD / 1000, (int32_t)(n + 1u) * PERIOD,
+                           (int32_t)breaths[n].ts);
+    TEST_ASSERT_INT_WITHIN(PERIOD / 1000, PERIOD, (int32_t)breaths[n].duration);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, AMPLITUDE, breaths[n].peak_flow);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, SINE_TIDAL * 12.0 / 1000.0,
+                             breaths[n].minute_volume);
+  }
+  TEST_ASSERT_EQUAL(0, volume.gaps);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, volume.offset);
+
+  // Live volume, 1/8 of the way into a breath
+  TEST_ASSERT_FLOAT_WITHIN(
+      SINE_TIDAL * 0.002, SINE_TIDAL * (1.0 - cos(M_PI / 4.0)) / 2.0,
+      board_volume_get_volume(&volume));
+}
+
+void test_board_volume_waveform(void) {
+  // Square inspiration, a pause at zero flow, then a long expiration
+  run(vent, 0.0f, PERIOD / 2, 10 * PERIOD);
+  TEST_ASSERT_EQUAL(8, completed);
+
+  for (uint32_t n = 0; n < completed; n++) {
+    TEST_ASSERT_FLOAT_WITHIN(VENT_TIDAL * 0.001, VENT_TIDAL,
+                             breaths[n].inspired);
+    TEST_ASSERT_FLOAT_WITHIN(VENT_TIDAL * 0.001, VENT_TIDAL,
+                             breaths[n].expired);
+    TEST_ASSERT_INT_WITHIN(PERIOD / 1000, PERIOD, (int32_t)breaths[n].duration);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 40.0f, breaths[n].peak_flow);
+  }
+}
+
+void test_board_volume_drift(void) {
+  // An offset on the sensor is learnt from the breaths and taken off
+  run(sine, 0.5f, 0, 30 * PERIOD);
+  TEST_ASSERT_EQUAL(28, completed);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 0.5f, volume.offset);
+  TEST_ASSERT_FLOAT_WITHIN(SINE_TIDAL * 0.002, SINE_TIDAL,
+                           breaths[completed - 1u].inspired);
+  TEST_ASSERT_FLOAT_WITHIN(SINE_TIDAL * 0.002, SINE_TIDAL,
+                           breaths[completed - 1u].expired);
+
+  // Up to a limit, a leak is left to show
+  setUp();
+  run(sine, 2.0f, 0, 30 * PERIOD);
+  TEST_ASSERT_EQUAL_FLOAT(BOARD_VOLUME_DRIFT_MAX, volume.offset);
+  TEST_ASSERT_GREATER_THAN(
+      (int32_t)breaths[completed - 1u].expired + 50,
+      (int32_t)breaths[completed - 1u].inspired);
+}
+
+void test_board_volume_gap(void) {
+  fs_values_t values;
+
+  run(sine, 0.0f, 0, (3 * PERIOD) + (PERIOD / 4));
+  TEST_ASSERT_EQUAL(2, completed);
+
+  // The same sample again is not a new one
+  values.ts = volume.ts_last;
+  values.flow = 100.0f;
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, board_volume_update(&volume, &values));
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, volume.flow_last - sine(values.ts));
+
+  // The breath cut by the gap is dropped, the next whole one counts
+  run(sine, 0.0f, (3 * PERIOD) + (PERIOD / 2), (6 * PERIOD) + (PERIOD / 4));
+  TEST_ASSERT_EQUAL(1, volume.gaps);
+  TEST_ASSERT_EQUAL(4, completed);
+  TEST_ASSERT_EQUAL(3, breaths[2].count);
+  TEST_ASSERT_INT_WITHIN(PERIOD / 1000, 4 * PERIOD, (int32_t)breaths[2].ts);
+  TEST_ASSERT_FLOAT_WITHIN(SINE_TIDAL * 0.001, SINE_TIDAL,
+                           breaths[2].inspired);
+}
+
+void test_board_volume_throughput(void) {
+  fs_values_t values;
+  clock_t ts;
+  double ns;
+  uint32_t samples;
+
+  // Host timing only, a flow sample every 2ms for an hour
+  samples = 1800000u;
+  values.ts = 0;
+  ts = clock();
+  for (uint32_t n = 0; n < samples; n++) {
+    values.ts += 2000;
+    values.flow = ((n % 2500u) < 1250u) ? 20.0f : -20.0f;
+    board_volume_update(&volume, &values);
+  }
+  ns = (double)(clock() - ts) * 1e9 / CLOCKS_PER_SEC / samples;
+
+  printf("board_volume: %.1f ns per sample\n", ns);
+  TEST_ASSERT_EQUAL((samples / 2500u) - 2u, volume.breath.count);
+  TEST_ASSERT_FLOAT_WITHIN(1.0f, 20.0f * 2.5f * 1000.0f / 60.0f,
+                           volume.breath.inspired);
+}
+
+static void run(waveform_t waveform, float bias, hal_timestamp_t start,
+                hal_timestamp_t end) {
+  fs_values_t values;
+
+  // Samples about every 2ms, never evenly spaced
+  values.ts = start;
+  while (values.ts < end) {
+    values.flow = waveform(values.ts) + bias;
+    if ((board_volume_update(&volume, &values) == BOARD_DEV_READY) &&
+        (completed < (sizeof(breaths) / sizeof(breaths[0])))) {
+      board_volume_get_breath(&volume, &breaths[completed]);
+      completed++;
+    }
+    values.ts += 1500 + (rand_next() % 1000u);
+  }
+}
+
+static float sine(hal_timestamp_t t) {
+  return AMPLITUDE * (float)sin(2.0 * M_PI * (double)t / PERIOD);
+}
+
+static float vent(hal_timestamp_t t) {
+  double s;
+
+  // Piecewise linear, so the trapezoids only cut the corners. 0.9s at 40 slm
+  // in, then out with the same volume, 28.8 slm falling off over 2.5s
+  s = (double)(t % PERIOD) / 1e6;
+  if (s < 0.1) {
+    return (float)(400.0 * s);
+  } else if (s < 0.9) {
+    return 40.0f;
+  } else if (s < 1.0) {
+    return (float)(400.0 * (1.0 - s));
+  } else if (s < 1.5) {
+    return 0.0f;
+  } else if (s < 1.6) {
+    return (float)(-288.0 * (s - 1.5));
+  } else if (s < 4.0) {
+    return (float)(-28.8 * (4.0 - s) / 2.4);
+  }
+  return 0.0f;
+}
+
+static uint32_t rand_next(void) {
+  state = (state * 1103515245u) + 12345u;
+  return state >> 8;
+}
@@ -17,14 +17,37 @@ along with this program.  If not, see www.gnu.org/licenses/.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unity.h>
 #include "drv_i2c_ms5525dso.h"
+#include "ms5525dso_reference.h"
 
 static uint32_t expected_response_len;
 static uint32_t last_requested_cmd;
 static uint32_t skip_count;
 static uint32_t fail_count;
 static uint32_t fail_crc;
+static uint32_t batch_calls;
+
+/** Qx tables of every part, the fixed point path is checked against each */
+static const ms5525dso_qx_t all_qx[] = {
+    MS5525DSO_QX_FOR_PP001DS(), MS5525DSO_QX_FOR_PP002GS(),
+    MS5525DSO_QX_FOR_PP002DS(), MS5525DSO_QX_FOR_PP005GS(),
+    MS5525DSO_QX_FOR_PP005DS(), MS5525DSO_QX_FOR_PP015GS(),
+    MS5525DSO_QX_FOR_PP015AS(), MS5525DSO_QX_FOR_PP015DS(),
+    MS5525DSO_QX_FOR_PP030AS(), MS5525DSO_QX_FOR_PP030GS(),
+    MS5525DSO_QX_FOR_PP030DS(),
+};
+
+/** Samples per batch, and batches timed, in the batch tests */
+#define BATCH_LEN 4096u
+#define BATCH_RUNS 256u
+
+/** Calls timed in the calculate_pt bench */
+#define BENCH_CALLS 1000000u
+
+static uint32_t rand_next(uint32_t* state);
 
 void setUp(void) {}
 
@@ -93,10 +116,63 @@ void test_drv_i2c_ms5525dso_read_all_coeff(void) {
 
   fail_crc = 1;
   res = ms5525dso_read_all_coeff(&cfg, &coeff);
+  TEST_ASSERT_EQUAL(HAL_ERR_CRC, res);
+
+  res = ms5525dso_read_all_coeff(&cfg, &coeff);
+  TEST_ASSERT_EQUAL(HAL_OK, res);
+}
+
+void test_drv_i2c_ms5525dso_read_prom_batch(void) {
+  hal_err_t res;
+  hal_i2c_config_t cfg;
+  ms5525dso_coeff_t coeff;
+  uint16_t prom_value;
+
+  res = ms5525dso_read_prom_batch(0, 0, MS5525DSO_NUM_PROM_ADDR, &coeff);
   TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
 
+  res = ms5525dso_read_prom_batch(&cfg, 0, MS5525DSO_NUM_PROM_ADDR, 0);
+  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
+
+  // Nothing to read, or past the end of the PROM
+  res = ms5525dso_read_prom_batch(&cfg, 0, 0, &coeff);
+  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
+
+  res = ms5525dso_read_prom_batch(&cfg, 5, 4, &coeff);
+  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
+
+  // A failure part way through fails the lot
+  skip_count = 5;
+  fail_count = 1;
+  res = ms5525dso_read_prom_batch(&cfg, 0, MS5525DSO_NUM_PROM_ADDR, &coeff);
+  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
+
+  // The same values as reading them one at a time, in a single batch
+  memset(&coeff, 0, sizeof(coeff));
+  batch_calls = 0;
+  res = ms5525dso_read_prom_batch(&cfg, 0, MS5525DSO_NUM_PROM_ADDR, &coeff);
+  TEST_ASSERT_EQUAL(HAL_OK, res);
+  TEST_ASSERT_EQUAL(1, batch_calls);
+  for (uint8_t n = 0; n < MS5525DSO_NUM_PROM_ADDR; n++) {
+    res = ms5525dso_read_prom(&cfg, n, &prom_value);
+    TEST_ASSERT_EQUAL(HAL_OK, res);
+    TEST_ASSERT_EQUAL_HEX16(prom_value, coeff.c[n]);
+  }
+
+  // Part of the table, the rest is left alone
+  memset(&coeff, 0, sizeof(coeff));
+  res = ms5525dso_read_prom_batch(&cfg, 3, 2, &coeff);
+  TEST_ASSERT_EQUAL(HAL_OK, res);
+  TEST_ASSERT_EQUAL_HEX16(0, coeff.c[2]);
+  TEST_ASSERT_EQUAL_HEX16(0x0C66, coeff.c[3]);
+  TEST_ASSERT_EQUAL_HEX16(0x06B9, coeff.c[4]);
+  TEST_ASSERT_EQUAL_HEX16(0, coeff.c[5]);
+
+  // The whole table comes in one batch too
+  batch_calls = 0;
   res = ms5525dso_read_all_coeff(&cfg, &coeff);
   TEST_ASSERT_EQUAL(HAL_OK, res);
+  TEST_ASSERT_EQUAL(1, batch_calls);
 }
 
 void test_drv_i2c_ms5525dso_start_ch_convert(void) {
@@ -208,13 +284,250 @@ void test_drv_i2c_ms5525dso_calculate_pt(void) {
   ms5525dso_calculate_pt(&qx, &coeff, d1, d2, 0, &t);
   ms5525dso_calculate_pt(&qx, &coeff, d1, d2, &t, 0);
 
+  // Worked by hand from the datasheet formula for this PROM
   ms5525dso_calculate_pt(&qx, &coeff, d1, d2, &p, &t);
-  TEST_ASSERT_FLOAT_WITHIN(0.001f, -706.911f, p);
-  TEST_ASSERT_FLOAT_WITHIN(0.1f, 163489.6f, t);
+  TEST_ASSERT_FLOAT_WITHIN(0.00001f, 0.0393f, p);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 22.39f, t);
 
   ms5525dso_calculate_pt(&qx, &coeff, d1, d2, &p, &t);
-  TEST_ASSERT_FLOAT_WITHIN(0.001f, -706.911f, p);
-  TEST_ASSERT_FLOAT_WITHIN(0.1f, 163489.6f, t);
+  TEST_ASSERT_FLOAT_WITHIN(0.00001f, 0.0393f, p);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 22.39f, t);
+}
+
+void test_drv_i2c_ms5525dso_calculate_pt_fixed(void) {
+  hal_err_t res;
+  hal_i2c_config_t cfg;
+  ms5525dso_coeff_t coeff;
+  ms5525dso_qx_t qx = MS5525DSO_QX_FOR_PP001DS();
+  int32_t p;
+  int32_t t;
+  float pf;
+  float tf;
+
+  res = ms5525dso_read_all_coeff(&cfg, &coeff);
+  TEST_ASSERT_EQUAL(HAL_OK, res);
+
+  ms5525dso_calculate_pt_fixed(0, &coeff, 0, 0, &p, &t);
+  ms5525dso_calculate_pt_fixed(&qx, 0, 0, 0, &p, &t);
+  ms5525dso_calculate_pt_fixed(&qx, &coeff, 0, 0, 0, &t);
+  ms5525dso_calculate_pt_fixed(&qx, &coeff, 0, 0, &p, 0);
+
+  ms5525dso_calculate_pt_fixed(&qx, &coeff, 4650976, 4946912, &p, &t);
+  TEST_ASSERT_EQUAL(393, p);
+  TEST_ASSERT_EQUAL(2239, t);
+
+  // The float results are these, scaled
+  ms5525dso_calculate_pt(&qx, &coeff, 4650976, 4946912, &pf, &tf);
+  TEST_ASSERT_EQUAL_FLOAT(MS5525DSO_CONVERT_P_TO_FLOAT(p), pf);
+  TEST_ASSERT_EQUAL_FLOAT(MS5525DSO_CONVERT_T_TO_FLOAT(t), tf);
+
+  // Below the reference temperature every term is negative, where a plain
+  // shift would round the other way
+  ms5525dso_calculate_pt_fixed(&qx, &coeff, 1000, 1000, &p, &t);
+  TEST_ASSERT_EQUAL(-16606, t);
+}
+
+void test_drv_i2c_ms5525dso_calculate_pt_fixed_exact(void) {
+  ms5525dso_coeff_t coeff;
+  uint32_t state;
+  uint32_t d1;
+  uint32_t d2;
+  int32_t p;
+  int32_t t;
+  int64_t p_ref;
+  int64_t t_ref;
+
+  // Random PROMs and readings across the whole 24 bit ADC range, and the
+  // largest PROM, which overflows 32 bits in every part's offset term
+  state = 1;
+  for (uint32_t q = 0; q < (sizeof(all_qx) / sizeof(all_qx[0])); q++) {
+    for (uint32_t n = 0; n < 20000u; n++) {
+      for (uint32_t k = 0; k < MS5525DSO_NUM_PROM_ADDR; k++) {
+        coeff.c[k] =
+            (n == 0u) ? 0xFFFFu : (uint16_t)(rand_next(&state) >> 16);
+      }
+      d1 = (n == 1u) ? 0xFFFFFFu : (rand_next(&state) & 0xFFFFFFu);
+      d2 = (n == 1u) ? 0u : (rand_next(&state) & 0xFFFFFFu);
+
+      ms5525dso_calculate_pt_fixed(&all_qx[q], &coeff, d1, d2, &p, &t);
+      ms5525dso_reference_pt(&all_qx[q], &coeff, d1, d2, &p_ref, &t_ref);
+      TEST_ASSERT_EQUAL_INT64(p_ref, p);
+      TEST_ASSERT_EQUAL_INT64(t_ref, t);
+    }
+  }
+}
+
+void test_drv_i2c_ms5525dso_compensate(void) {
+  ms5525dso_coeff_t coeff;
+  ms5525dso_comp_t comp;
+  uint32_t state;
+  uint32_t d1;
+  uint32_t d2;
+  int32_t p;
+  int32_t t;
+  int64_t p_ref;
+  int64_t t_ref;
+
+  // Constants prepared once per PROM must hold for every reading after
+  state = 3;
+  for (uint32_t q = 0; q < (sizeof(all_qx) / sizeof(all_qx[0])); q++) {
+    for (uint32_t n = 0; n < 200u; n++) {
+      for (uint32_t k = 0; k < MS5525DSO_NUM_PROM_ADDR; k++) {
+        coeff.c[k] =
+            (n == 0u) ? 0xFFFFu : (uint16_t)(rand_next(&state) >> 16);
+      }
+      ms5525dso_prepare_comp(&all_qx[q], &coeff, &comp);
+
+      for (uint32_t m = 0; m < 100u; m++) {
+        d1 = (m == 1u) ? 0xFFFFFFu : (rand_next(&state) & 0xFFFFFFu);
+        d2 = (m == 1u) ? 0u : (rand_next(&state) & 0xFFFFFFu);
+
+        ms5525dso_compensate(&comp, d1, d2, &p, &t);
+        ms5525dso_reference_pt(&all_qx[q], &coeff, d1, d2, &p_ref, &t_ref);
+        TEST_ASSERT_EQUAL_INT64(p_ref, p);
+        TEST_ASSERT_EQUAL_INT64(t_ref, t);
+      }
+    }
+  }
+}
+
+void test_drv_i2c_ms5525dso_calculate_pt_bench(void) {
+  ms5525dso_qx_t qx = MS5525DSO_QX_FOR_PP001DS();
+  ms5525dso_coeff_t coeff;
+  ms5525dso_comp_t comp;
+  uint32_t state;
+  int32_t p;
+  int32_t t;
+  int64_t sum;
+  clock_t ts;
+  double fixed_ns;
+  double comp_ns;
+
+  // Host timing, at the firmware's optimisation level, of building the
+  // constants for every sample against preparing them once. The divides are
+  // only timed on target by the serial bench command, a host with a 64 bit
+  // divide instruction says nothing about the library call the target makes
+  state = 7;
+  for (uint32_t k = 0; k < MS5525DSO_NUM_PROM_ADDR; k++) {
+    coeff.c[k] = (uint16_t)(rand_next(&state) >> 16);
+  }
+
+  sum = 0;
+  ts = clock();
+  for (uint32_t n = 0; n < BENCH_CALLS; n++) {
+    ms5525dso_calculate_pt_fixed(&qx, &coeff, n << 4, n, &p, &t);
+    sum += p + t;
+  }
+  fixed_ns = (double)(clock() - ts) * 1e9 / CLOCKS_PER_SEC / BENCH_CALLS;
+
+  ms5525dso_prepare_comp(&qx, &coeff, &comp);
+  ts = clock();
+  for (uint32_t n = 0; n < BENCH_CALLS; n++) {
+    ms5525dso_compensate(&comp, n << 4, n, &p, &t);
+    sum -= p + t;
+  }
+  comp_ns = (double)(clock() - ts) * 1e9 / CLOCKS_PER_SEC / BENCH_CALLS;
+
+  printf("calculate_pt: shifts %.1f ns, prepared %.1f ns\n", fixed_ns,
+         comp_ns);
+
+  // The same results. The times are only printed, host load and build
+  // options move them too much to assert on
+  TEST_ASSERT_EQUAL_INT64(0, sum);
+}
+
+void test_drv_i2c_ms5525dso_calculate_pt_batch(void) {
+  static uint32_t d1[BATCH_LEN];
+  static uint32_t d2[BATCH_LEN];
+  static int32_t p[BATCH_LEN];
+  static int32_t t[BATCH_LEN];
+  ms5525dso_coeff_t coeff;
+  ms5525dso_comp_t comp;
+  uint32_t state;
+  int32_t p_one;
+  int32_t t_one;
+
+  // Every sample as ms5525dso_compensate() gives it, extremes included
+  state = 5;
+  for (uint32_t q = 0; q < (sizeof(all_qx) / sizeof(all_qx[0])); q++) {
+    for (uint32_t k = 0; k < MS5525DSO_NUM_PROM_ADDR; k++) {
+      coeff.c[k] = (q == 0u) ? 0xFFFFu : (uint16_t)(rand_next(&state) >> 16);
+    }
+    ms5525dso_prepare_comp(&all_qx[q], &coeff, &comp);
+
+    for (uint32_t n = 0; n < BATCH_LEN; n++) {
+      d1[n] = (n == 0u) ? 0xFFFFFFu : (rand_next(&state) & 0xFFFFFFu);
+      d2[n] = (n == 0u) ? 0u : (rand_next(&state) & 0xFFFFFFu);
+    }
+    ms5525dso_calculate_pt_batch(&comp, d1, d2, p, t, BATCH_LEN);
+
+    for (uint32_t n = 0; n < BATCH_LEN; n++) {
+      ms5525dso_compensate(&comp, d1[n], d2[n], &p_one, &t_one);
+      TEST_ASSERT_EQUAL_INT32(p_one, p[n]);
+      TEST_ASSERT_EQUAL_INT32(t_one, t[n]);
+    }
+  }
+
+  // Nothing is written past the count
+  p[3] = 12345;
+  t[3] = 12345;
+  ms5525dso_calculate_pt_batch(&comp, d1, d2, p, t, 3);
+  TEST_ASSERT_EQUAL_INT32(12345, p[3]);
+  TEST_ASSERT_EQUAL_INT32(12345, t[3]);
+}
+
+void test_drv_i2c_ms5525dso_calculate_pt_batch_bench(void) {
+  static uint32_t d1[BATCH_LEN];
+  static uint32_t d2[BATCH_LEN];
+  static int32_t p[BATCH_LEN];
+  static int32_t t[BATCH_LEN];
+  ms5525dso_qx_t qx = MS5525DSO_QX_FOR_PP001DS();
+  ms5525dso_coeff_t coeff;
+  ms5525dso_comp_t comp;
+  uint32_t state;
+  float pf;
+  float tf;
+  double sum_scalar;
+  int64_t sum_batch;
+  clock_t ts;
+  double scalar_rate;
+  double batch_rate;
+
+  // Host timing only, of recorded samples reprocessed one call each against
+  // one call for all of them
+  state = 9;
+  for (uint32_t k = 0; k < MS5525DSO_NUM_PROM_ADDR; k++) {
+    coeff.c[k] = (uint16_t)(rand_next(&state) >> 16);
+  }
+  for (uint32_t n = 0; n < BATCH_LEN; n++) {
+    d1[n] = rand_next(&state) & 0xFFFFFFu;
+    d2[n] = rand_next(&state) & 0xFFFFFFu;
+  }
+  ms5525dso_prepare_comp(&qx, &coeff, &comp);
+
+  sum_scalar = 0.0;
+  ts = clock();
+  for (uint32_t r = 0; r < BATCH_RUNS; r++) {
+    for (uint32_t n = 0; n < BATCH_LEN; n++) {
+      ms5525dso_calculate_pt(&qx, &coeff, d1[n], d2[n], &pf, &tf);
+      sum_scalar += pf;
+    }
+  }
+  scalar_rate = (double)BATCH_LEN * BATCH_RUNS /
+                ((double)(clock() - ts) / CLOCKS_PER_SEC);
+
+  sum_batch = 0;
+  ts = clock();
+  for (uint32_t r = 0; r < BATCH_RUNS; r++) {
+    ms5525dso_calculate_pt_batch(&comp, d1, d2, p, t, BATCH_LEN);
+    sum_batch += p[r % BATCH_LEN];
+  }
+  batch_rate = (double)BATCH_LEN * BATCH_RUNS /
+               ((double)(clock() - ts) / CLOCKS_PER_SEC);
+
+  printf("calculate_pt: scalar %.1f Msamples/s, batch %.1f Msamples/s\n",
+         scalar_rate / 1e6, batch_rate / 1e6);
+  TEST_ASSERT_TRUE((sum_scalar != 0.0) || (sum_batch != 0));
 }
 
 hal_err_t hal_i2c_write(const hal_i2c_config_t* cfg, const uint8_t* buffer,
@@ -383,3 +696,28 @@ hal_err_t hal_i2c_read(const hal_i2c_config_t* cfg, uint8_t* buffer,
 
   return HAL_OK;
 }
+
+hal_err_t hal_i2c_batch(const hal_i2c_config_t* cfg,
+                        const hal_i2c_xfer_t* xfers, uint8_t count) {
+  hal_err_t res;
+
+  batch_calls++;
+
+  // The same as each transfer on its own
+  res = HAL_OK;
+  for (uint8_t n = 0; (n < count) && (res == HAL_OK); n++) {
+    if (xfers[n].tx_len > 0u) {
+      res = hal_i2c_write(cfg, xfers[n].tx, xfers[n].tx_len);
+    }
+    if ((res == HAL_OK) && (xfers[n].rx_len > 0u)) {
+      res = hal_i2c_read(cfg, xfers[n].rx, xfers[n].rx_len);
+    }
+  }
+
+  return res;
+}
+
+static uint32_t rand_next(uint32_t* state) {
+  *state = (*state * 1664525u) + 1013904223u;
+  return *state;
+}
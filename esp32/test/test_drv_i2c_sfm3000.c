@@ -15,10 +15,13 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see www.gnu.org/licenses/.
 */
 
+#include <float.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unity.h>
 #include "drv_i2c_sfm3000.h"
+#include "sensirion_codec.h"
 
 static uint8_t crc8(const uint8_t* buff, uint8_t len);
 
@@ -91,7 +94,7 @@ void test_drv_i2c_sfm3000_read_flow(void) {
 
   fail_crc = 1;
   res = sfm3000_read_flow(&cfg, &flow_raw);
-  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
+  TEST_ASSERT_EQUAL(HAL_ERR_CRC, res);
 
   res = sfm3000_read_flow(&cfg, &flow_raw);
   TEST_ASSERT_EQUAL(HAL_OK, res);
@@ -123,7 +126,7 @@ void test_drv_i2c_sfm3000_read_scale_factor(void) {
 
   fail_crc = 1;
   res = sfm3000_read_scale_factor(&cfg, &scale_factor);
-  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
+  TEST_ASSERT_EQUAL(HAL_ERR_CRC, res);
 
   res = sfm3000_read_scale_factor(&cfg, &scale_factor);
   TEST_ASSERT_EQUAL(HAL_OK, res);
@@ -157,7 +160,7 @@ void test_drv_i2c_sfm3000_read_offset(void) {
 
   fail_crc = 1;
   res = sfm3000_read_offset(&cfg, &offset);
-  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
+  TEST_ASSERT_EQUAL(HAL_ERR_CRC, res);
 
   res = sfm3000_read_offset(&cfg, &offset);
   TEST_ASSERT_EQUAL(HAL_OK, res);
@@ -191,12 +194,12 @@ void test_drv_i2c_sfm3000_read_serial(void) {
 
   fail_crc = 1;
   res = sfm3000_read_serial(&cfg, &serial);
-  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
+  TEST_ASSERT_EQUAL(HAL_ERR_CRC, res);
 
   skip_crc = 1;
   fail_crc = 1;
   res = sfm3000_read_serial(&cfg, &serial);
-  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
+  TEST_ASSERT_EQUAL(HAL_ERR_CRC, res);
 
   res = sfm3000_read_serial(&cfg, &serial);
   TEST_ASSERT_EQUAL(HAL_OK, res);
@@ -230,12 +233,12 @@ void test_drv_i2c_sfm3000_read_product(void) {
 
   fail_crc = 1;
   res = sfm3000_read_product(&cfg, &product);
-  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
+  TEST_ASSERT_EQUAL(HAL_ERR_CRC, res);
 
   skip_crc = 1;
   fail_crc = 1;
   res = sfm3000_read_product(&cfg, &product);
-  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, res);
+  TEST_ASSERT_EQUAL(HAL_ERR_CRC, res);
 
   res = sfm3000_read_product(&cfg, &product);
   TEST_ASSERT_EQUAL(HAL_OK, res);
@@ -279,6 +282,53 @@ void test_drv_i2c_sfm3000_convert_to_slm(void) {
   TEST_ASSERT_FLOAT_WITHIN(0.01f, 5.48f, slm);
 }
 
+void test_drv_i2c_sfm3000_convert(void) {
+  static const sfm3000_settings_t all_settings[] = {
+      {.offset = 32000.0f, .scale_factor = SFM3000_GIVEN_SCALE_FACTOR_AIR_N2},
+      {.offset = 32000.0f, .scale_factor = SFM3000_GIVEN_SCALE_FACTOR_O2},
+      {.offset = 32768.0f, .scale_factor = 120.0f},
+      {.offset = 32000.5f, .scale_factor = 1.5f},
+  };
+  sfm3000_settings_t settings;
+  sfm3000_conv_t conv;
+  float slm;
+  float fast;
+  double exact;
+  int32_t mslm;
+  double err_max;
+
+  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, sfm3000_prepare_conv(0, &conv));
+  settings.offset = 32000.0f;
+  settings.scale_factor = 1.0f;
+  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, sfm3000_prepare_conv(&settings, &conv));
+  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, sfm3000_convert(0, &conv, &slm));
+  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, sfm3000_convert_mslm(0, &conv, &mslm));
+  settings.offset = -1.0f;
+  settings.scale_factor = 140.0f;
+  TEST_ASSERT_EQUAL(HAL_ERR_FAIL, sfm3000_prepare_conv(&settings, &conv));
+
+  // Every raw reading, against the divide and against exact arithmetic
+  for (uint32_t s = 0; s < (sizeof(all_settings) / sizeof(all_settings[0]));
+       s++) {
+    TEST_ASSERT_EQUAL(HAL_OK, sfm3000_prepare_conv(&all_settings[s], &conv));
+    err_max = 0.0;
+    for (uint32_t raw = 0; raw <= UINT16_MAX; raw++) {
+      sfm3000_convert_to_slm(raw, &all_settings[s], &slm);
+      TEST_ASSERT_EQUAL(HAL_OK, sfm3000_convert(raw, &conv, &fast));
+      TEST_ASSERT_FLOAT_WITHIN(fabsf(slm) * 2.0f * FLT_EPSILON, slm, fast);
+
+      exact = ((double)raw - all_settings[s].offset) /
+              all_settings[s].scale_factor * 1000.0;
+      TEST_ASSERT_EQUAL(HAL_OK, sfm3000_convert_mslm(raw, &conv, &mslm));
+      if (fabs(mslm - exact) > err_max) {
+        err_max = fabs(mslm - exact);
+      }
+    }
+    // Rounding, plus what is left of the reciprocal
+    TEST_ASSERT_TRUE(err_max <= 0.5001);
+  }
+}
+
 static const uint8_t crc8_table[] = {
     0x00, 0x31, 0x62, 0x53, 0xC4, 0xF5, 0xA6, 0x97, 0xB9, 0x88, 0xDB, 0xEA,
     0x7D, 0x4C, 0x1F, 0x2E, 0x43, 0x72, 0x21, 0x10, 0x87, 0xB6, 0xE5, 0xD4,
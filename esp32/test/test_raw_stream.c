@@ -0,0 +1,308 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include "board_hist.h"
+#include "drv_i2c_ms5525dso.h"
+#include "drv_i2c_sfm3000.h"
+#include "sensirion_codec.h"
+#include "raw_stream.h"
+
+#define HIST_LEN 256u
+
+/** Enough for a few full frames */
+#define STREAM_LEN (8u * RAW_STREAM_MAX_FRAME)
+
+static const ms5525dso_coeff_t prom = {
+    .c = {0x0001, 0x31DA, 0x1B42, 0x0C66, 0x06B9, 0x950C, 0x1F37, 0x0000}};
+
+static const ms5525dso_qx_t qx = MS5525DSO_QX_FOR_PP001DS();
+
+static const sfm3000_settings_t fs_settings = {.offset = 32768.0f,
+                                               .scale_factor = 120.0f};
+
+static sfm3000_conv_t fs_conv;
+static board_hist_t hist;
+static board_hist_sample_t buffer[HIST_LEN];
+static raw_stream_decoder_t decoder;
+
+static uint32_t send(uint8_t* stream, raw_stream_type_t type, uint32_t* pos);
+
+void setUp(void) {
+  board_hist_init(&hist, buffer, HIST_LEN);
+  raw_stream_decoder_init(&decoder);
+}
+
+void tearDown(void) {}
+
+void test_raw_stream_ps(void) {
+  uint8_t stream[RAW_STREAM_MAX_FRAME];
+  raw_stream_frame_t frame;
+  raw_stream_ps_value_t values[RAW_STREAM_MAX_SAMPLES];
+  ms5525dso_comp_t comp;
+  uint32_t d1[100];
+  uint32_t d2[100];
+  uint32_t dt[100];
+  uint32_t samples;
+  uint32_t temp;
+  uint32_t len;
+  uint32_t used;
+  uint32_t pos;
+  uint32_t decoded;
+  uint32_t count;
+  int32_t p;
+  int32_t t;
+
+  // A temperature, then pressures compensated with it, as the board reads
+  // them. The time spent reading a temperature counts towards the pressure
+  // after it
+  samples = 0;
+  temp = 0;
+  dt[0] = 0;
+  for (uint32_t n = 0; n < 100u; n++) {
+    if ((n % 9u) == 0u) {
+      temp = 4946912u + (n * 7u);
+      board_hist_push(&hist, 1000u * (n + 1u), temp, BOARD_HIST_FLAG_TEMP);
+      dt[samples] = buffer[n].dt;
+    } else {
+      d1[samples] = 4650976u + (n * 1013u);
+      d2[samples] = temp;
+      board_hist_push(&hist, 1000u * (n + 1u), d1[samples], 0);
+      dt[samples] += buffer[n].dt;
+      samples++;
+      dt[samples] = 0;
+    }
+  }
+
+  // Pressures ahead of their calibration can not be compensated
+  pos = 0;
+  len = send(stream, RAW_STREAM_PS, &pos);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                    raw_stream_parse(stream, len, &frame, &used));
+  TEST_ASSERT_EQUAL(0, raw_stream_decode_ps(&decoder, &frame, values));
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    raw_stream_decode_cal(&decoder, &frame));
+
+  raw_stream_decoder_init(&decoder);
+  len = raw_stream_encode_cal_ps(stream, 0, MS5525DSO_OSR1024, &qx, &prom);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                    raw_stream_parse(stream, len, &frame, &used));
+  TEST_ASSERT_EQUAL(len, used);
+  TEST_ASSERT_EQUAL(RAW_STREAM_CAL_PS, frame.type);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, raw_stream_decode_cal(&decoder, &frame));
+
+  // Every pressure comes back bit for bit as the board computes it
+  ms5525dso_prepare_comp(&qx, &prom, &comp);
+  pos = 0;
+  decoded = 0;
+  while (pos < board_hist_head(&hist)) {
+    len = send(stream, RAW_STREAM_PS, &pos);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                      raw_stream_parse(stream, len, &frame, &used));
+    TEST_ASSERT_EQUAL(len, used);
+    TEST_ASSERT_EQUAL(RAW_STREAM_PS, frame.type);
+    count = raw_stream_decode_ps(&decoder, &frame, values);
+    for (uint32_t n = 0; n < count; n++, decoded++) {
+      ms5525dso_compensate(&comp, d1[decoded], d2[decoded], &p, &t);
+      TEST_ASSERT_EQUAL(d1[decoded], values[n].d1);
+      TEST_ASSERT_EQUAL(d2[decoded], values[n].d2);
+      TEST_ASSERT_EQUAL(p, values[n].p);
+      TEST_ASSERT_EQUAL(t, values[n].t);
+      TEST_ASSERT_EQUAL(dt[decoded], values[n].dt);
+    }
+  }
+  TEST_ASSERT_EQUAL(samples, decoded);
+  TEST_ASSERT_EQUAL(0, decoder.dropped);
+  TEST_ASSERT_EQUAL(2000, dt[8]);
+}
+
+void test_raw_stream_fs(void) {
+  uint8_t stream[RAW_STREAM_MAX_FRAME];
+  raw_stream_frame_t frame;
+  raw_stream_fs_value_t values[RAW_STREAM_MAX_SAMPLES];
+  uint32_t len;
+  uint32_t used;
+  uint32_t pos;
+  uint32_t decoded;
+  uint32_t count;
+  float flow;
+
+  for (uint32_t n = 0; n < 200u; n++) {
+    board_hist_push(&hist, 2000u * (n + 1u), 32000u + (n * 37u), 0);
+  }
+
+  sfm3000_prepare_conv(&fs_settings, &fs_conv);
+  len = raw_stream_encode_cal_fs(stream, 1, 0x12345678u, &fs_settings);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                    raw_stream_parse(stream, len, &frame, &used));
+  TEST_ASSERT_EQUAL(RAW_STREAM_CAL_FS, frame.type);
+  TEST_ASSERT_EQUAL(1, frame.circuit);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, raw_stream_decode_cal(&decoder, &frame));
+
+  // Same flow as the board, to the bit
+  pos = 0;
+  decoded = 0;
+  while (pos < board_hist_head(&hist)) {
+    len = send(stream, RAW_STREAM_FS, &pos);
+    TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                      raw_stream_parse(stream, len, &frame, &used));
+    count = raw_stream_decode_fs(&decoder, &frame, values);
+    for (uint32_t n = 0; n < count; n++, decoded++) {
+      sfm3000_convert(buffer[decoded].raw, &fs_conv, &flow);
+      TEST_ASSERT_EQUAL(buffer[decoded].raw, values[n].flow_raw);
+      TEST_ASSERT_EQUAL(0, memcmp(&flow, &values[n].flow, sizeof(flow)));
+      TEST_ASSERT_EQUAL(buffer[decoded].dt, values[n].dt);
+    }
+  }
+  TEST_ASSERT_EQUAL(200, decoded);
+  TEST_ASSERT_EQUAL(0, decoder.dropped);
+}
+
+void test_raw_stream_parse(void) {
+  uint8_t stream[3u * RAW_STREAM_MAX_FRAME];
+  raw_stream_frame_t frame;
+  board_dev_status_t res;
+  uint32_t len;
+  uint32_t used;
+  uint32_t pos;
+
+  for (uint32_t n = 0; n < 10u; n++) {
+    board_hist_push(&hist, 1000u * (n + 1u), n, 0);
+  }
+
+  // Text and stray sync bytes ahead of a frame are skipped
+  len = 0;
+  memcpy(stream, "OK\r\n\xA5\xA5\x01", 7);
+  len += 7u;
+  pos = 0;
+  len += send(&stream[len], RAW_STREAM_FS, &pos);
+  res = raw_stream_parse(stream, len, &frame, &used);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+  TEST_ASSERT_EQUAL(len, used);
+  TEST_ASSERT_EQUAL(RAW_STREAM_FS, frame.type);
+  TEST_ASSERT_EQUAL(4u + (10u * RAW_STREAM_SAMPLE_LEN), frame.len);
+
+  // A frame cut short is kept for when the rest arrives
+  res = raw_stream_parse(stream, len - 1u, &frame, &used);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+  TEST_ASSERT_EQUAL(4, used);
+  res = raw_stream_parse(&stream[used], len - used, &frame, &used);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY, res);
+
+  // Damaged frames are not
+  pos = 0;
+  len = send(stream, RAW_STREAM_FS, &pos);
+  stream[20] ^= 0x10u;
+  res = raw_stream_parse(stream, len, &frame, &used);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+  TEST_ASSERT_EQUAL(len, used);
+
+  res = raw_stream_parse(0, len, &frame, &used);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY, res);
+}
+
+void test_raw_stream_breath(void) {
+  board_volume_breath_t breath = {.count = 7,
+                                  .ts = 123456789,
+                                  .duration = 4998765,
+                                  .inspired = 512.25f,
+                                  .expired = 498.5f,
+                                  .peak_flow = 41.125f,
+                                  .minute_volume = 6.0625f};
+  board_volume_breath_t decoded;
+  uint8_t stream[RAW_STREAM_MAX_FRAME];
+  raw_stream_frame_t frame;
+  uint32_t len;
+  uint32_t used;
+
+  len = raw_stream_encode_breath(stream, 1, &breath);
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                    raw_stream_parse(stream, len, &frame, &used));
+  TEST_ASSERT_EQUAL(len, used);
+  TEST_ASSERT_EQUAL(RAW_STREAM_BREATH, frame.type);
+  TEST_ASSERT_EQUAL(BOARD_DEV_NOT_READY,
+                    raw_stream_decode_cal(&decoder, &frame));
+  TEST_ASSERT_EQUAL(BOARD_DEV_READY,
+                    raw_stream_decode_breath(&frame, &decoded));
+  breath.ts = 0;
+  TEST_ASSERT_EQUAL_MEMORY(&breath, &decoded, sizeof(breath));
+}
+
+void test_raw_stream_dropped(void) {
+  uint8_t stream[RAW_STREAM_MAX_FRAME];
+  raw_stream_frame_t frame;
+  raw_stream_ps_value_t values[RAW_STREAM_MAX_SAMPLES];
+  uint32_t len;
+  uint32_t used;
+  uint32_t pos;
+
+  len = raw_stream_encode_cal_ps(stream, 0, MS5525DSO_OSR1024, &qx, &prom);
+  raw_stream_parse(stream, len, &frame, &used);
+  raw_stream_decode_cal(&decoder, &frame);
+
+  board_hist_push(&hist, 1000u, 4946912u, BOARD_HIST_FLAG_TEMP);
+  for (uint32_t n = 0; n < 99u; n++) {
+    board_hist_push(&hist, 1000u * (n + 2u), 4650976u, 0);
+  }
+
+  pos = 0;
+  len = send(stream, RAW_STREAM_PS, &pos);
+  raw_stream_parse(stream, len, &frame, &used);
+  TEST_ASSERT_EQUAL(RAW_STREAM_MAX_SAMPLES - 1u,
+                    raw_stream_decode_ps(&decoder, &frame, values));
+
+  // A frame lost on the way is counted, and the temperature it may have
+  // changed is no longer trusted
+  pos += RAW_STREAM_MAX_SAMPLES;
+  len = send(stream, RAW_STREAM_PS, &pos);
+  raw_stream_parse(stream, len, &frame, &used);
+  TEST_ASSERT_EQUAL(0, raw_stream_decode_ps(&decoder, &frame, values));
+  TEST_ASSERT_EQUAL(RAW_STREAM_MAX_SAMPLES, decoder.dropped);
+}
+
+// The drivers only convert here, they never talk to a sensor
+hal_err_t hal_i2c_write(const hal_i2c_config_t* cfg, const uint8_t* buffer,
+                        uint8_t len) {
+  return HAL_ERR_FAIL;
+}
+
+hal_err_t hal_i2c_read(const hal_i2c_config_t* cfg, uint8_t* buffer,
+                       uint8_t len) {
+  return HAL_ERR_FAIL;
+}
+
+hal_err_t hal_i2c_batch(const hal_i2c_config_t* cfg,
+                        const hal_i2c_xfer_t* xfers, uint8_t count) {
+  return HAL_ERR_FAIL;
+}
+
+static uint32_t send(uint8_t* stream, raw_stream_type_t type, uint32_t* pos) {
+  board_hist_span_t span;
+  uint32_t count;
+  uint32_t len;
+
+  len = 0;
+  if (board_hist_get_since(&hist, *pos, &span) == BOARD_DEV_READY) {
+    len = raw_stream_encode_samples(stream, type, 0, &span, &count);
+    *pos += count;
+  }
+
+  return len;
+}
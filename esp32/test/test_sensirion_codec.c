@@ -0,0 +1,128 @@
+/*
+Copyright 2020 TRIUMF
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include "sensirion_codec.h"
+
+static uint8_t bus[SENSIRION_MAX_WORDS * SENSIRION_WORD_LEN];
+static uint8_t read_len;
+
+static uint8_t crc_bitwise(uint16_t word, uint8_t init);
+
+hal_err_t hal_i2c_read(const hal_i2c_config_t* cfg, uint8_t* buffer,
+                       uint8_t len) {
+  read_len = len;
+  memcpy(buffer, bus, len);
+  return HAL_OK;
+}
+
+void setUp(void) {
+  memset(bus, 0, sizeof(bus));
+  read_len = 0;
+}
+
+void tearDown(void) {}
+
+void test_sensirion_codec_crc(void) {
+  static const uint8_t beef[] = {0xBE, 0xEF};
+
+  // Example from the datasheets
+  TEST_ASSERT_EQUAL_HEX8(0x92, sensirion_crc8(beef, 2,
+                                              SENSIRION_CRC_INIT_SFM3019));
+  TEST_ASSERT_EQUAL_HEX8(0x92,
+                         sensirion_crc_word(0xBEEFu, SENSIRION_CRC_INIT_SFM3019));
+
+  // Every word, both sensors
+  for (uint32_t word = 0; word <= UINT16_MAX; word++) {
+    uint8_t buff[2] = {(uint8_t)(word >> 8), (uint8_t)word};
+
+    TEST_ASSERT_EQUAL_HEX8(
+        crc_bitwise(word, SENSIRION_CRC_INIT_SFM3000),
+        sensirion_crc_word(word, SENSIRION_CRC_INIT_SFM3000));
+    TEST_ASSERT_EQUAL_HEX8(
+        crc_bitwise(word, SENSIRION_CRC_INIT_SFM3019),
+        sensirion_crc_word(word, SENSIRION_CRC_INIT_SFM3019));
+    TEST_ASSERT_EQUAL_HEX8(crc_bitwise(word, SENSIRION_CRC_INIT_SFM3019),
+                           sensirion_crc8(buff, 2, SENSIRION_CRC_INIT_SFM3019));
+  }
+}
+
+void test_sensirion_codec_words(void) {
+  hal_i2c_config_t cfg;
+  uint16_t words[SENSIRION_MAX_WORDS];
+  uint16_t decoded[SENSIRION_MAX_WORDS];
+
+  for (uint32_t n = 0; n < SENSIRION_MAX_WORDS; n++) {
+    words[n] = (uint16_t)(0x1234u * (n + 1u));
+    sensirion_encode_word(words[n], SENSIRION_CRC_INIT_SFM3019,
+                          &bus[n * SENSIRION_WORD_LEN]);
+  }
+  TEST_ASSERT_EQUAL_HEX8(0x12, bus[0]);
+  TEST_ASSERT_EQUAL_HEX8(0x34, bus[1]);
+
+  TEST_ASSERT_EQUAL(HAL_OK,
+                    sensirion_read_words(&cfg, SENSIRION_CRC_INIT_SFM3019,
+                                         decoded, SENSIRION_MAX_WORDS));
+  TEST_ASSERT_EQUAL(SENSIRION_MAX_WORDS * SENSIRION_WORD_LEN, read_len);
+  TEST_ASSERT_EQUAL_MEMORY(words, decoded, sizeof(words));
+
+  // Odd counts too
+  memset(decoded, 0, sizeof(decoded));
+  TEST_ASSERT_EQUAL(HAL_OK,
+                    sensirion_read_words(&cfg, SENSIRION_CRC_INIT_SFM3019,
+                                         decoded, 3));
+  TEST_ASSERT_EQUAL(3 * SENSIRION_WORD_LEN, read_len);
+  TEST_ASSERT_EQUAL_MEMORY(words, decoded, 3 * sizeof(words[0]));
+  TEST_ASSERT_EQUAL(0, decoded[3]);
+
+  // The other sensor's CRCs do not pass
+  TEST_ASSERT_EQUAL(HAL_ERR_CRC,
+                    sensirion_read_words(&cfg, SENSIRION_CRC_INIT_SFM3000,
+                                         decoded, 1));
+
+  // Nor does a damaged word, anywhere, and nothing is handed over
+  bus[(4 * SENSIRION_WORD_LEN) + 1] ^= 0x01u;
+  memset(decoded, 0, sizeof(decoded));
+  TEST_ASSERT_EQUAL(HAL_ERR_CRC,
+                    sensirion_read_words(&cfg, SENSIRION_CRC_INIT_SFM3019,
+                                         decoded, SENSIRION_MAX_WORDS));
+  TEST_ASSERT_EQUAL(0, decoded[0]);
+  TEST_ASSERT_EQUAL(HAL_OK,
+                    sensirion_read_words(&cfg, SENSIRION_CRC_INIT_SFM3019,
+                                         decoded, 4));
+
+  TEST_ASSERT_EQUAL(HAL_ERR_FAIL,
+                    sensirion_read_words(&cfg, SENSIRION_CRC_INIT_SFM3019,
+                                         decoded, SENSIRION_MAX_WORDS + 1u));
+}
+
+static uint8_t crc_bitwise(uint16_t word, uint8_t init) {
+  uint8_t crc;
+
+  crc = init;
+  for (int32_t byte = 1; byte >= 0; byte--) {
+    crc ^= (uint8_t)(word >> (8 * byte));
+    for (uint32_t bit = 0; bit < 8u; bit++) {
+      crc = (crc & 0x80u) ? (uint8_t)((crc << 1) ^ 0x31u) : (uint8_t)(crc << 1);
+    }
+  }
+
+  return crc;
+}